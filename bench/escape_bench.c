@@ -0,0 +1,174 @@
+/*
+ * Microbenchmark of the json escaping and scanning kernels
+ *
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ *
+ * Prints the throughput of each kernel in bytes per nanosecond for
+ * a clean string and for a string with a special character every
+ * 64 bytes, and of formatting a message with the string as an argument.
+ * Build and run with `make bench`.
+ *
+ */
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "private/json_format.h"
+#include "private/message.h"
+#include "private/scan.h"
+
+#define STRING_LENGTH   4000
+#define ROUNDS          20000
+
+typedef size_t (*find_special_fn_t)(const char *str, size_t len);
+
+static char   input[STRING_LENGTH + 1];
+static char   output[2 * STRING_LENGTH + 1];
+static char   formatted[STRING_LENGTH + 64];
+static volatile size_t sink;
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void fill_input(unsigned special_interval)
+{
+    size_t i;
+
+    for (i = 0; i < STRING_LENGTH; i++)
+        input[i] = (char)('a' + i % 26);
+    if (special_interval)
+        for (i = special_interval - 1; i < STRING_LENGTH; i += special_interval)
+            input[i] = '"';
+    input[STRING_LENGTH] = '\0';
+}
+
+/*
+ * Scan the whole string, restarting after every special character
+ */
+static size_t scan_all(find_special_fn_t find_special)
+{
+    size_t i, count = 0;
+
+    for (i = 0; ; i++, count++)
+    {
+        i += find_special(&input[i], STRING_LENGTH - i);
+        if (i == STRING_LENGTH)
+            break;
+    }
+    return count;
+}
+
+static void bench_kernel(const char *name, find_special_fn_t find_special)
+{
+    double start = now_ns();
+    int    round;
+
+    for (round = 0; round < ROUNDS; round++)
+        sink = scan_all(find_special);
+    printf("  %-24s %8.2f bytes/ns\n", name, (double)STRING_LENGTH * ROUNDS / (now_ns() - start));
+}
+
+static void bench_escape(void)
+{
+    double start = now_ns();
+    int    round;
+
+    for (round = 0; round < ROUNDS; round++)
+        sink = mdclog_internal_escape(output, sizeof(output), input, NULL);
+    printf("  %-24s %8.2f bytes/ns\n", "mdclog_internal_escape", (double)STRING_LENGTH * ROUNDS / (now_ns() - start));
+}
+
+/*
+ * Format a message to a temporary buffer and escape it, as the messages
+ * were formatted before the fused formatter
+ */
+static size_t format_and_escape(const char *format, ...)
+{
+    va_list va;
+
+    va_start(va, format);
+    vsnprintf(formatted, sizeof(formatted), format, va);
+    va_end(va);
+    return mdclog_internal_escape(output, sizeof(output), formatted, NULL);
+}
+
+static size_t format_fused(const char *format, ...)
+{
+    va_list va;
+    int     truncated;
+    int     ret;
+
+    va_start(va, format);
+    ret = mdclog_internal_format_message(output, sizeof(output), format, va, &truncated);
+    va_end(va);
+    return ret;
+}
+
+static void bench_format(void)
+{
+    double start;
+    int    round;
+
+    // warm up, so that the variant measured first is not penalized
+    for (round = 0; round < ROUNDS / 4; round++)
+        sink = format_and_escape("entry %d from %s: %s", round, "bench", input) +
+               format_fused("entry %d from %s: %s", round, "bench", input);
+
+    start = now_ns();
+    for (round = 0; round < ROUNDS; round++)
+        sink = format_and_escape("entry %d from %s: %s", round, "bench", input);
+    printf("  %-24s %8.2f bytes/ns\n", "vsnprintf and escape", (double)STRING_LENGTH * ROUNDS / (now_ns() - start));
+
+    start = now_ns();
+    for (round = 0; round < ROUNDS; round++)
+        sink = format_fused("entry %d from %s: %s", round, "bench", input);
+    printf("  %-24s %8.2f bytes/ns\n", "fused format", (double)STRING_LENGTH * ROUNDS / (now_ns() - start));
+}
+
+int main(void)
+{
+    static const unsigned intervals[] = { 0, 64 };
+    size_t i;
+
+    for (i = 0; i < sizeof(intervals) / sizeof(intervals[0]); i++)
+    {
+        fill_input(intervals[i]);
+        if (intervals[i])
+            printf("%d byte string, special character every %u bytes:\n", STRING_LENGTH, intervals[i]);
+        else
+            printf("%d byte string without special characters:\n", STRING_LENGTH);
+        bench_kernel("scalar", mdclog_internal_find_special_scalar);
+#if defined(__x86_64__)
+        bench_kernel("sse2", mdclog_internal_find_special_sse2);
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            bench_kernel("avx2", mdclog_internal_find_special_avx2);
+#endif
+        bench_kernel("dispatched", mdclog_internal_find_special);
+        bench_escape();
+        bench_format();
+    }
+    return 0;
+}
@@ -0,0 +1,92 @@
+/*
+ * Benchmark of the C++ front end against mdclog_write()
+ *
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ *
+ * Prints the time per log call in nanoseconds for an entry that is written,
+ * and for an entry below the logging level. The entries are passed to a
+ * json sink that only counts them, so that the time is spent formatting
+ * instead of writing. Build and run with `make bench`.
+ *
+ */
+#include <stdio.h>
+#include <string>
+#include <time.h>
+
+#include "mdclog/mdclog.hpp"
+
+#define ROUNDS 500000
+
+static volatile size_t sink_bytes;
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void count_entry(void*, const char*, size_t len)
+{
+    sink_bytes = sink_bytes + len;
+}
+
+static void report(const char *name, double start)
+{
+    printf("  %-32s %8.1f ns/call\n", name, (now_ns() - start) / ROUNDS);
+}
+
+static void bench(mdclog_severity_t severity)
+{
+    const std::string user("subscriber \"17\"");
+    double            start;
+    int               round;
+
+    start = now_ns();
+    for (round = 0; round < ROUNDS; round++)
+        mdclog_write(severity, "cell %d throughput %f Mbps user %s", round, 12.5, user.c_str());
+    report("mdclog_write()", start);
+
+    start = now_ns();
+    for (round = 0; round < ROUNDS; round++)
+        mdclog::log(severity, "cell {} throughput {} Mbps user {}", round, 12.5, user);
+    report("mdclog::log()", start);
+}
+
+int main(void)
+{
+    mdclog_sink_t sink = {};
+
+    mdclog_level_set(MDCLOG_FATAL);
+    sink.format = MDCLOG_SINK_JSON;
+    sink.level = MDCLOG_INFO;
+    sink.write = count_entry;
+    if (mdclog_sink_add(&sink) < 0)
+    {
+        perror("mdclog_sink_add");
+        return 1;
+    }
+
+    printf("written entry:\n");
+    bench(MDCLOG_INFO);
+    printf("entry below the logging level:\n");
+    bench(MDCLOG_DEBUG);
+    return 0;
+}
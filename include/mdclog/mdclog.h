@@ -27,10 +27,11 @@
  *
  * Structured logging library with Mapped Diagnostic Context
  *
- * - Outputs the log entries to standard out in structured format, json currently
- * - Severity based filtering
+ * - Outputs the log entries to standard out or a rotated file in structured format, json currently
+ * - Severity based filtering, optionally inline at the call site with MDCLOG_WRITE()
  * - Supports Mapped Diagnostic Context (MDC)
  * - Thread safe
+ * - Optional asynchronous mode, where the log entries are written by a background thread
  *
  * Set MDC pairs are automatically added to log entries by the library.
  * MDC pairs are thread specific. A thread can see only MDCs it has set.
@@ -62,15 +63,20 @@ extern "C" {
 #endif
 
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/time.h>
 
 /**
  * Severity level enumerations
  */
 typedef enum {
+    MDCLOG_FATAL   = 0, //! Fatal error level log entry. Logging it does not terminate the process.
     MDCLOG_ERR     = 1, //! Error level log entry
     MDCLOG_WARN    = 2, //! Warning level log entry
     MDCLOG_INFO    = 3, //! Info level log entry
-    MDCLOG_DEBUG   = 4  //! Debug level log entry
+    MDCLOG_DEBUG   = 4, //! Debug level log entry
+    MDCLOG_TRACE   = 5  //! Trace level log entry, for detailed tracing of hot code paths
 } mdclog_severity_t;
 
 /**
@@ -83,9 +89,11 @@ typedef enum {
  *
  * Logs the message with the given severity if it is equal or higher than the current
  * logging level.
- * If the length of the log entry after formatting exceeds PIPE_BUF bytes, the log
+ * If the length of the log entry after formatting exceeds the maximum entry size,
+ * PIPE_BUF bytes by default (see mdclog_attr_set_max_entry_size()), the log
  * entry is truncated. All non-printable characters in the log message, as well as in
- * MDC values, are replaced with a space. In addition, backslash (\) and double
+ * MDC values, are replaced with a space. Bytes outside of the printable ASCII range
+ * are non-printable regardless of the locale. In addition, backslash (\) and double
  * quotation marks (") are escaped for JSON formatting.
  *
  *
@@ -95,6 +103,27 @@ typedef enum {
 MDCLOG_EXPORT void mdclog_write(mdclog_severity_t severity, const char *format, ...)
     __attribute__ ((format (printf, 2, 3)));
 
+/**
+ * Call site of a log message, used by the rate limiting. A zero initialized
+ * static object, as created by the MDCLOG_WRITE() macro, is ready for use.
+ * The content is private to the library.
+ */
+typedef struct {
+    unsigned long long state __attribute__ ((aligned (8)));
+} mdclog_site_t;
+
+/**
+ * Log a message like mdclog_write(), but with an explicit call site for the rate
+ * limiting instead of identifying the call site by the format string.
+ * Usually called by the MDCLOG_WRITE() macros.
+ *
+ * @param   site       call site of the message, a static object
+ * @param   severity   severity of the log message
+ * @param   format     log message
+ */
+MDCLOG_EXPORT void mdclog_write_site(mdclog_site_t *site, mdclog_severity_t severity, const char *format, ...)
+    __attribute__ ((format (printf, 3, 4)));
+
 /**
  * Set current logging level. Log messages with lower severity
  * will be filtered.
@@ -110,6 +139,291 @@ MDCLOG_EXPORT void mdclog_level_set(mdclog_severity_t level);
  */
 MDCLOG_EXPORT mdclog_severity_t mdclog_level_get(void);
 
+/**
+ * Lowest severity that is either logged, recorded by the flight recorder (see
+ * mdclog_attr_set_flight_recorder()) or passed to a sink (see mdclog_sink_add()).
+ * Exported only for mdclog_level_enabled(), which reads it without a function
+ * call. Use mdclog_level_set() and mdclog_level_get() instead of accessing the
+ * variable directly.
+ */
+MDCLOG_EXPORT extern int mdclog_current_level;
+
+/**
+ * Check if a log message with the given severity passes the current logging level,
+ * or is recorded by the flight recorder or passed to a sink
+ *
+ * @param   severity   severity of the log message
+ *
+ * @return  non-zero if mdclog_write() would log, record or pass the message to a sink, 0 if it would be filtered
+ */
+static inline int mdclog_level_enabled(mdclog_severity_t severity)
+{
+    return (int)severity <= __atomic_load_n(&mdclog_current_level, __ATOMIC_RELAXED);
+}
+
+/**
+ * The lowest severity compiled in by the MDCLOG_WRITE() macros. Call sites with
+ * a lower severity are removed by the compiler, for example with
+ * -DMDCLOG_COMPILE_LEVEL=MDCLOG_WARN in release builds. Defaults to MDCLOG_TRACE,
+ * all call sites are compiled in. Does not affect calling mdclog_write() directly.
+ */
+#ifndef MDCLOG_COMPILE_LEVEL
+#define MDCLOG_COMPILE_LEVEL MDCLOG_TRACE
+#endif
+
+/**
+ * Log a message like mdclog_write(), but check the severity before the call.
+ * The message arguments are not evaluated, and the library function is not
+ * called, if the message is filtered by the current logging level. If the
+ * severity is lower than MDCLOG_COMPILE_LEVEL, the call site is compiled out.
+ * Every call site has a token bucket of its own for the rate limiting.
+ * The severity argument is evaluated more than once.
+ *
+ * @param   severity   severity of the log message
+ * @param   ...        printf style format string and its arguments
+ */
+#define MDCLOG_WRITE(severity, ...) \
+    do { \
+        static mdclog_site_t mdclog_site_; \
+        if ((int)(severity) <= (int)(MDCLOG_COMPILE_LEVEL) && mdclog_level_enabled(severity)) \
+            mdclog_write_site(&mdclog_site_, (severity), __VA_ARGS__); \
+    } while (0)
+
+#define MDCLOG_FATAL_WRITE(...) MDCLOG_WRITE(MDCLOG_FATAL, __VA_ARGS__)  //! MDCLOG_WRITE() with fatal severity
+#define MDCLOG_ERR_WRITE(...)   MDCLOG_WRITE(MDCLOG_ERR, __VA_ARGS__)    //! MDCLOG_WRITE() with error severity
+#define MDCLOG_WARN_WRITE(...)  MDCLOG_WRITE(MDCLOG_WARN, __VA_ARGS__)   //! MDCLOG_WRITE() with warning severity
+#define MDCLOG_INFO_WRITE(...)  MDCLOG_WRITE(MDCLOG_INFO, __VA_ARGS__)   //! MDCLOG_WRITE() with info severity
+#define MDCLOG_DEBUG_WRITE(...) MDCLOG_WRITE(MDCLOG_DEBUG, __VA_ARGS__)  //! MDCLOG_WRITE() with debug severity
+#define MDCLOG_TRACE_WRITE(...) MDCLOG_WRITE(MDCLOG_TRACE, __VA_ARGS__)  //! MDCLOG_WRITE() with trace severity
+
+/**
+ * Type of a structured log entry field
+ */
+typedef enum {
+    MDCLOG_KV_INT64  = 0,
+    MDCLOG_KV_UINT64 = 1,
+    MDCLOG_KV_DOUBLE = 2,   //! written with the fewest digits that read back to the same value,
+                            //! null if not finite
+    MDCLOG_KV_BOOL   = 3,
+    MDCLOG_KV_STRING = 4    //! escaped like the log message, null if the string is NULL
+} mdclog_kv_type_t;
+
+/**
+ * Typed field of a structured log entry, usually created with mdclog_kv_int64() and
+ * the other functions below
+ */
+typedef struct {
+    const char       *key;  //! key of the field, escaped like the log message
+    mdclog_kv_type_t  type;
+    union {
+        int64_t  i64;
+        uint64_t u64;
+        double   d;
+        int      b;
+        struct {
+            const char *str;
+            size_t      len;
+        } s;
+    } value;
+} mdclog_kv_t;
+
+static inline mdclog_kv_t mdclog_kv_int64(const char *key, int64_t value)
+{
+    mdclog_kv_t kv;
+
+    kv.key = key;
+    kv.type = MDCLOG_KV_INT64;
+    kv.value.i64 = value;
+    return kv;
+}
+
+static inline mdclog_kv_t mdclog_kv_uint64(const char *key, uint64_t value)
+{
+    mdclog_kv_t kv;
+
+    kv.key = key;
+    kv.type = MDCLOG_KV_UINT64;
+    kv.value.u64 = value;
+    return kv;
+}
+
+static inline mdclog_kv_t mdclog_kv_double(const char *key, double value)
+{
+    mdclog_kv_t kv;
+
+    kv.key = key;
+    kv.type = MDCLOG_KV_DOUBLE;
+    kv.value.d = value;
+    return kv;
+}
+
+static inline mdclog_kv_t mdclog_kv_bool(const char *key, int value)
+{
+    mdclog_kv_t kv;
+
+    kv.key = key;
+    kv.type = MDCLOG_KV_BOOL;
+    kv.value.b = value;
+    return kv;
+}
+
+static inline mdclog_kv_t mdclog_kv_string(const char *key, const char *value, size_t len)
+{
+    mdclog_kv_t kv;
+
+    kv.key = key;
+    kv.type = MDCLOG_KV_STRING;
+    kv.value.s.str = value;
+    kv.value.s.len = len;
+    return kv;
+}
+
+/**
+ * Log a message with typed fields. The fields are written as json members of the
+ * log entry before the message field, numbers and booleans without quotes, e.g.
+ * {"ts":...,"cell":7,"throughput":12.5,"msg":"cell stats"}. The message is not a
+ * printf format string. The fields that do not fit to the maximum entry size are
+ * left out. With the binary output format, the fields are appended to the message
+ * as a json object.
+ *
+ * @param   severity      severity of the log message
+ * @param   message       log message
+ * @param   fields        the fields, can be NULL if the count is 0
+ * @param   field_count   number of the fields
+ */
+MDCLOG_EXPORT void mdclog_write_kv(mdclog_severity_t severity, const char *message,
+                                   const mdclog_kv_t *fields, size_t field_count);
+
+/**
+ * Log a message that is already formatted, e.g. by the C++ front end in
+ * mdclog/mdclog.hpp. The message is escaped like the message of mdclog_write(),
+ * but it is not a printf format string. The rate limiting identifies the call
+ * site by the format string that the message was formatted from.
+ *
+ * @param   severity   severity of the log message
+ * @param   format     format string of the message, NULL if the message identifies the call site
+ * @param   message    log message
+ */
+MDCLOG_EXPORT void mdclog_write_formatted(mdclog_severity_t severity, const char *format, const char *message);
+
+/**
+ * Maximum number of fields in a log entry built with mdclog_kv_begin()
+ */
+#define MDCLOG_KV_BUILDER_MAX_FIELDS 32
+
+/**
+ * Log entry with typed fields built one field at a time, typically on the stack.
+ * The content is private to the library.
+ */
+typedef struct {
+    mdclog_severity_t severity;
+    const char       *message;
+    size_t            field_count;
+    mdclog_kv_t       fields[MDCLOG_KV_BUILDER_MAX_FIELDS];
+} mdclog_kv_builder_t;
+
+/**
+ * Start building a log entry with typed fields. The fields are added with the
+ * mdclog_kv_add_*() functions, and the entry is written with mdclog_kv_end().
+ * The strings given to the builder must be valid until mdclog_kv_end() returns.
+ *
+ * @param   builder    the builder
+ * @param   severity   severity of the log message
+ * @param   message    log message, not a printf format string
+ *
+ * @return  non-zero if the log entry would be written, 0 if it is filtered by the
+ *          logging level, in which case the fields do not need to be added
+ */
+MDCLOG_EXPORT int mdclog_kv_begin(mdclog_kv_builder_t *builder, mdclog_severity_t severity, const char *message);
+
+/**
+ * Add a field to a log entry started with mdclog_kv_begin()
+ *
+ * @param   builder   the builder
+ * @param   field     the field
+ *
+ * @return   0 in case of success,
+ *          -1 in case of error. Errno ENOSPC is set if the entry has
+ *             MDCLOG_KV_BUILDER_MAX_FIELDS fields already.
+ */
+MDCLOG_EXPORT int mdclog_kv_add(mdclog_kv_builder_t *builder, mdclog_kv_t field);
+
+static inline int mdclog_kv_add_int64(mdclog_kv_builder_t *builder, const char *key, int64_t value)
+{
+    return mdclog_kv_add(builder, mdclog_kv_int64(key, value));
+}
+
+static inline int mdclog_kv_add_uint64(mdclog_kv_builder_t *builder, const char *key, uint64_t value)
+{
+    return mdclog_kv_add(builder, mdclog_kv_uint64(key, value));
+}
+
+static inline int mdclog_kv_add_double(mdclog_kv_builder_t *builder, const char *key, double value)
+{
+    return mdclog_kv_add(builder, mdclog_kv_double(key, value));
+}
+
+static inline int mdclog_kv_add_bool(mdclog_kv_builder_t *builder, const char *key, int value)
+{
+    return mdclog_kv_add(builder, mdclog_kv_bool(key, value));
+}
+
+static inline int mdclog_kv_add_string(mdclog_kv_builder_t *builder, const char *key, const char *value, size_t len)
+{
+    return mdclog_kv_add(builder, mdclog_kv_string(key, value, len));
+}
+
+/**
+ * Write a log entry built with mdclog_kv_begin() like mdclog_write_kv()
+ *
+ * @param   builder   the builder
+ */
+MDCLOG_EXPORT void mdclog_kv_end(mdclog_kv_builder_t *builder);
+
+/**
+ * Limit the rate of log entries written from one call site. Entries exceeding the
+ * limit are discarded, and reported in a summary log entry (see mdclog_summary_interval_set()).
+ * The call site of mdclog_write() is identified by the format string, and the call site
+ * of the MDCLOG_WRITE() macros by a static object created by the macro.
+ * Rate limiting is disabled by default. Can be changed at any time.
+ *
+ * @param   per_second   log entries per second a call site can write on average.
+ *                       0 disables rate limiting.
+ * @param   burst        log entries a call site can write at once before the rate
+ *                       limiting starts to discard entries. 0 for the same as per_second.
+ *
+ * @return   0 in case of success,
+ *          -1 in case of error. Errno EINVAL is set if per_second is over one billion.
+ */
+MDCLOG_EXPORT int mdclog_rate_limit_set(unsigned per_second, unsigned burst);
+
+/**
+ * Write only a random sample of the log entries with the given severity. The discarded
+ * entries are reported in a summary log entry (see mdclog_summary_interval_set()).
+ * All entries are written by default. Can be changed at any time.
+ *
+ * @param   severity      severity of the sampled log entries
+ * @param   probability   probability of writing an entry, between 0.0 and 1.0.
+ *                        1.0 disables the sampling of the severity.
+ *
+ * @return   0 in case of success,
+ *          -1 in case of error. Errno EINVAL is set if the severity is unknown or
+ *             the probability is not between 0.0 and 1.0.
+ */
+MDCLOG_EXPORT int mdclog_sampling_set(mdclog_severity_t severity, double probability);
+
+/**
+ * Set how often the log entries discarded by the rate limiting or the sampling are
+ * reported. The report is a log entry with the counts of the discarded entries and
+ * the severity of the most severe of them. It is written by the first logging call
+ * after the interval has elapsed since the first unreported entry was discarded,
+ * and when the library is unloaded.
+ *
+ * @param   interval_ms   summary interval in milliseconds, 0 to report every discarded
+ *                        entry right away. Defaults to 10 seconds.
+ */
+MDCLOG_EXPORT void mdclog_summary_interval_set(unsigned interval_ms);
+
 typedef struct mdclog_attr mdclog_attr_t;
 
 /**
@@ -149,6 +463,470 @@ MDCLOG_EXPORT void mdclog_attr_destroy(mdclog_attr_t *attr);
  */
 MDCLOG_EXPORT int mdclog_attr_set_ident(mdclog_attr_t *attr, const char *identity);
 
+/**
+ * What to do when a thread logs in asynchronous mode and its ring buffer is full
+ */
+typedef enum {
+    MDCLOG_OVERFLOW_BLOCK       = 0, //! Wait until the background thread has made room for the entry
+    MDCLOG_OVERFLOW_DROP_NEWEST = 1, //! Discard the new log entry
+    MDCLOG_OVERFLOW_DROP_OLDEST = 2  //! Discard the oldest buffered log entries
+} mdclog_overflow_policy_t;
+
+/**
+ * Enable or disable the asynchronous mode. Disabled by default.
+ *
+ * In asynchronous mode mdclog_write() does not write the log entry itself. Instead,
+ * the entry is queued to a ring buffer of the calling thread, and a background thread
+ * writes the queued entries to the standard out. Entries from the same thread are
+ * written in order. The entries of an exiting thread, as well as all entries at process
+ * exit, are written before the buffers are released.
+ *
+ * @param   attr     pointer to attributes, previously allocated with mdclog_attr_init()
+ * @param   enable   0 to disable, any other value to enable
+ *
+ * @return   0 in case of success,
+ *          -1 in case of error. Errno EINVAL is set if attr is NULL.
+ */
+MDCLOG_EXPORT int mdclog_attr_set_async(mdclog_attr_t *attr, int enable);
+
+/**
+ * Enable or disable deferred formatting of log entries. Disabled by default.
+ * Has effect only in asynchronous mode.
+ *
+ * With deferred formatting mdclog_write() does not format the log message. It copies
+ * the timestamp, severity, MDCs, the format string pointer and the message arguments
+ * to the ring buffer, and the background thread formats the log entry.
+ * The format string must therefore stay valid for the lifetime of the process,
+ * which is the case for string literals. Strings given as arguments are copied.
+ * Messages using positional arguments or the %n, %m, %lc or %ls conversions are
+ * formatted immediately as in the normal asynchronous mode.
+ *
+ * The MDCs are copied to every entry as serialized json, also when the thread
+ * has adopted an MDC snapshot (see mdclog_mdc_adopt()). At most PIPE_BUF - 256
+ * bytes of them are copied; the MDCs that do not fit are left out of the entry.
+ *
+ * @param   attr     pointer to attributes, previously allocated with mdclog_attr_init()
+ * @param   enable   0 to disable, any other value to enable
+ *
+ * @return   0 in case of success,
+ *          -1 in case of error. Errno EINVAL is set if attr is NULL.
+ */
+MDCLOG_EXPORT int mdclog_attr_set_deferred_format(mdclog_attr_t *attr, int enable);
+
+/**
+ * Set the size of the thread specific ring buffer used in asynchronous mode
+ *
+ * @param   attr       pointer to attributes, previously allocated with mdclog_attr_init()
+ * @param   capacity   size of the ring buffer in bytes. Rounded up to a power of two.
+ *                     Defaults to 64 KiB, minimum 16 KiB.
+ *
+ * @return   0 in case of success,
+ *          -1 in case of error. Errno EINVAL is set if attr is NULL or the capacity is too small.
+ */
+MDCLOG_EXPORT int mdclog_attr_set_async_capacity(mdclog_attr_t *attr, size_t capacity);
+
+/**
+ * Set the asynchronous mode overflow policy. Defaults to MDCLOG_OVERFLOW_BLOCK.
+ *
+ * @param   attr     pointer to attributes, previously allocated with mdclog_attr_init()
+ * @param   policy   overflow policy
+ *
+ * @return   0 in case of success,
+ *          -1 in case of error. Errno EINVAL is set if attr is NULL or the policy is unknown.
+ */
+MDCLOG_EXPORT int mdclog_attr_set_overflow_policy(mdclog_attr_t *attr, mdclog_overflow_policy_t policy);
+
+/**
+ * Set the maximum number of bytes the asynchronous mode background thread writes
+ * with one system call. The queued log entries are collected to batches of at most
+ * this size. If the standard out is a pipe, the batch size is limited to PIPE_BUF,
+ * so that a batch is written atomically.
+ *
+ * @param   attr         pointer to attributes, previously allocated with mdclog_attr_init()
+ * @param   batch_size   batch size in bytes. Defaults to 64 KiB, maximum 1 MiB.
+ *                       0 disables batching, every log entry is written with its own system call.
+ *
+ * @return   0 in case of success,
+ *          -1 in case of error. Errno EINVAL is set if attr is NULL or the batch size is too large.
+ */
+MDCLOG_EXPORT int mdclog_attr_set_batch_size(mdclog_attr_t *attr, size_t batch_size);
+
+/**
+ * Set how long the asynchronous mode background thread may hold a partially
+ * filled batch waiting for more log entries. A longer interval lowers the number
+ * of system calls per log entry when logging is infrequent, at the cost of latency.
+ *
+ * @param   attr          pointer to attributes, previously allocated with mdclog_attr_init()
+ * @param   interval_ms   flush interval in milliseconds. Defaults to 0, the batch is written
+ *                        as soon as there are no more queued log entries.
+ *
+ * @return   0 in case of success,
+ *          -1 in case of error. Errno EINVAL is set if attr is NULL.
+ */
+MDCLOG_EXPORT int mdclog_attr_set_flush_interval(mdclog_attr_t *attr, unsigned interval_ms);
+
+/**
+ * Enable or disable the suppression of repeated log entries. Disabled by default.
+ *
+ * When enabled, a log entry equal to the previous entry of the same thread, apart from
+ * the timestamp, is not written. The repetitions are counted instead, and the latest
+ * repetition is written with the count in the "repeated" field when the thread logs a
+ * different entry, when the timeout has elapsed since the first counted repetition, or
+ * when the thread exits. A background thread writes the counts of the threads that do
+ * not log any more entries after the timeout, and mdclog_lib_clean() writes the counts
+ * of all threads. The MDCs of an entry are part of the comparison.
+ * Deferred formatting is not used while the suppression is enabled.
+ *
+ * @param   attr         pointer to attributes, previously allocated with mdclog_attr_init()
+ * @param   timeout_ms   maximum time in milliseconds repetitions are counted before the
+ *                       count is written. 0 disables the suppression.
+ *
+ * @return   0 in case of success,
+ *          -1 in case of error. Errno EINVAL is set if attr is NULL.
+ */
+MDCLOG_EXPORT int mdclog_attr_set_repeat_suppression(mdclog_attr_t *attr, unsigned timeout_ms);
+
+/**
+ * Clock sources of the log entry timestamps
+ */
+typedef enum {
+    MDCLOG_CLOCK_REALTIME        = 0, //! CLOCK_REALTIME
+    MDCLOG_CLOCK_REALTIME_COARSE = 1, //! CLOCK_REALTIME_COARSE, faster but only as accurate as the kernel tick
+    MDCLOG_CLOCK_TSC             = 2  //! Time stamp counter of the CPU, calibrated against CLOCK_REALTIME
+} mdclog_clock_t;
+
+/**
+ * Set the clock source of the log entry timestamps. Defaults to MDCLOG_CLOCK_REALTIME.
+ *
+ * MDCLOG_CLOCK_TSC reads the time stamp counter without a system call. The counter is
+ * calibrated against CLOCK_REALTIME once per second, which also corrects any drift, so
+ * the timestamps can step by the drift at the calibration. Until the first calibration,
+ * and on CPUs without an invariant time stamp counter, CLOCK_REALTIME is used instead.
+ *
+ * @param   attr    pointer to attributes, previously allocated with mdclog_attr_init()
+ * @param   clock   clock source
+ *
+ * @return   0 in case of success,
+ *          -1 in case of error. Errno EINVAL is set if attr is NULL or the clock is unknown.
+ */
+MDCLOG_EXPORT int mdclog_attr_set_clock(mdclog_attr_t *attr, mdclog_clock_t clock);
+
+/**
+ * Formats of the timestamp field
+ */
+typedef enum {
+    MDCLOG_TIMESTAMP_EPOCH_MS = 0, //! Milliseconds since the epoch as a number, e.g. 1550667066123
+    MDCLOG_TIMESTAMP_RFC3339  = 1  //! RFC 3339 UTC time as a string, e.g. "2019-02-20T12:51:06.123Z"
+} mdclog_timestamp_format_t;
+
+/**
+ * Set the format of the timestamp field. Defaults to MDCLOG_TIMESTAMP_EPOCH_MS.
+ *
+ * @param   attr     pointer to attributes, previously allocated with mdclog_attr_init()
+ * @param   format   timestamp format
+ *
+ * @return   0 in case of success,
+ *          -1 in case of error. Errno EINVAL is set if attr is NULL or the format is unknown.
+ */
+MDCLOG_EXPORT int mdclog_attr_set_timestamp_format(mdclog_attr_t *attr, mdclog_timestamp_format_t format);
+
+/**
+ * Fields of a log entry
+ */
+typedef enum {
+    MDCLOG_FIELD_TIMESTAMP = 0, //! Timestamp, key "ts" by default
+    MDCLOG_FIELD_SEVERITY  = 1, //! Severity, key "crit" by default
+    MDCLOG_FIELD_IDENTITY  = 2, //! Logger identity, key "id" by default
+    MDCLOG_FIELD_MDC       = 3, //! MDC object, key "mdc" by default
+    MDCLOG_FIELD_MESSAGE   = 4  //! Log message, key "msg" by default
+} mdclog_field_t;
+
+/**
+ * Maximum length of a field key
+ */
+#define MDCLOG_FIELD_KEY_MAX_LENGTH 32
+
+/**
+ * Set the key of a log entry field
+ *
+ * @param   attr    pointer to attributes, previously allocated with mdclog_attr_init()
+ * @param   field   log entry field
+ * @param   key     key of the field. Must not be empty, longer than MDCLOG_FIELD_KEY_MAX_LENGTH
+ *                  or contain characters that need escaping in JSON.
+ *
+ * @return   0 in case of success,
+ *          -1 in case of error. Errno EINVAL is set if attr or key is NULL, the field is unknown
+ *             or the key is not valid.
+ */
+MDCLOG_EXPORT int mdclog_attr_set_field_key(mdclog_attr_t *attr, mdclog_field_t field, const char *key);
+
+/**
+ * Set the fields of a log entry and their order. Defaults to timestamp, severity,
+ * identity, MDC and message. The fields left out are not written.
+ *
+ * The message is always the last field, because it is truncated if the log entry
+ * does not fit to PIPE_BUF bytes.
+ *
+ * @param   attr     pointer to attributes, previously allocated with mdclog_attr_init()
+ * @param   fields   fields in the order they are written. Each field can occur once,
+ *                   and MDCLOG_FIELD_MESSAGE must be the last one.
+ * @param   count    number of fields
+ *
+ * @return   0 in case of success,
+ *          -1 in case of error. Errno EINVAL is set if attr or fields is NULL, or the
+ *             fields are not valid.
+ */
+MDCLOG_EXPORT int mdclog_attr_set_field_order(mdclog_attr_t *attr, const mdclog_field_t *fields, size_t count);
+
+/**
+ * Maximum value of mdclog_attr_set_max_entry_size()
+ */
+#define MDCLOG_MAX_ENTRY_SIZE (16 * 1024 * 1024)
+
+/**
+ * Set the maximum size of a log entry in bytes, including the ending newline.
+ * Defaults to PIPE_BUF. The message of a longer log entry is truncated.
+ *
+ * Log entries up to PIPE_BUF bytes are formatted on the stack and written with a
+ * single write, so they are never interleaved with the entries of other processes
+ * writing to the same pipe. A longer entry is formatted again to a thread specific
+ * buffer and written according to mdclog_attr_set_large_entry_policy().
+ * A longer entry is written directly also in asynchronous mode, so it can be written
+ * before the entries still queued by the same thread. Deferred formatting is not used
+ * when the maximum size exceeds PIPE_BUF.
+ *
+ * @param   attr   pointer to attributes, previously allocated with mdclog_attr_init()
+ * @param   size   maximum size of a log entry, from PIPE_BUF to MDCLOG_MAX_ENTRY_SIZE
+ *
+ * @return   0 in case of success,
+ *          -1 in case of error. Errno EINVAL is set if attr is NULL or the size is out of range.
+ */
+MDCLOG_EXPORT int mdclog_attr_set_max_entry_size(mdclog_attr_t *attr, size_t size);
+
+/**
+ * How log entries longer than PIPE_BUF bytes are written
+ */
+typedef enum {
+    MDCLOG_LARGE_ENTRY_FRAGMENT_PIPE = 0, //! Fragment if the standard output is a pipe, otherwise write at once
+    MDCLOG_LARGE_ENTRY_FRAGMENT      = 1, //! Always fragment
+    MDCLOG_LARGE_ENTRY_WRITE         = 2  //! Write at once, possibly interleaved with other writers
+} mdclog_large_entry_policy_t;
+
+/**
+ * Set how log entries longer than PIPE_BUF bytes are written.
+ * Defaults to MDCLOG_LARGE_ENTRY_FRAGMENT_PIPE.
+ *
+ * A fragmented log entry is written as JSON lines of at most PIPE_BUF bytes each:
+ *
+ *     {"fragment":{"pid":1234,"id":5,"seq":0,"last":false},"data":"{\"ts\":..."}
+ *
+ * The data strings of the fragments with the same pid and id, concatenated in the seq
+ * order, give the original log entry. Each fragment is written atomically, so the
+ * fragments can be reassembled even if other processes write to the same pipe.
+ *
+ * @param   attr     pointer to attributes, previously allocated with mdclog_attr_init()
+ * @param   policy   large entry policy
+ *
+ * @return   0 in case of success,
+ *          -1 in case of error. Errno EINVAL is set if attr is NULL or the policy is unknown.
+ */
+MDCLOG_EXPORT int mdclog_attr_set_large_entry_policy(mdclog_attr_t *attr, mdclog_large_entry_policy_t policy);
+
+/**
+ * Formats of the log output
+ */
+typedef enum {
+    MDCLOG_OUTPUT_JSON   = 0, //! A JSON object per line
+    MDCLOG_OUTPUT_BINARY = 1  //! Compact binary records, decoded to JSON with the mdclog-decode utility
+} mdclog_output_format_t;
+
+/**
+ * Set the format of the log output. Defaults to MDCLOG_OUTPUT_JSON.
+ *
+ * The binary format stores the timestamp as a difference to the previous entry, the
+ * severity as a byte, the format strings and MDC keys as ids defined once per stream,
+ * and the message arguments without formatting them. The mdclog-decode utility formats
+ * the entries to the same JSON the library would have written, with the field layout,
+ * identity, timestamp format and maximum entry size of the stream.
+ *
+ * The records of a stream refer to the earlier records, so the stream must be written
+ * by one process only, to the standard out or a log file. A new stream, starting with a
+ * header, is written after the library is initialized again and to every rotated log file.
+ * The binary entries are encoded and written by the logging thread under a lock, also in
+ * asynchronous mode, and repeated entries are not suppressed. The flight recorder still
+ * records JSON entries.
+ *
+ * @param   attr     pointer to attributes, previously allocated with mdclog_attr_init()
+ * @param   format   output format
+ *
+ * @return   0 in case of success,
+ *          -1 in case of error. Errno EINVAL is set if attr is NULL or the format is unknown.
+ */
+MDCLOG_EXPORT int mdclog_attr_set_output_format(mdclog_attr_t *attr, mdclog_output_format_t format);
+
+/**
+ * Default number of rotated log files kept
+ */
+#define MDCLOG_DEFAULT_FILE_RETENTION 5
+
+/**
+ * Maximum value of mdclog_attr_set_file_retention()
+ */
+#define MDCLOG_MAX_FILE_RETENTION 1000
+
+/**
+ * Write the log entries to a file instead of the standard out. The file is opened
+ * by mdclog_init() with O_APPEND, so other processes can append to it as well.
+ *
+ * @param   attr   pointer to attributes, previously allocated with mdclog_attr_init()
+ * @param   path   path of the log file, NULL to write to the standard out
+ *
+ * @return   0 in case of success,
+ *          -1 in case of error. Errno EINVAL is set if attr is NULL or the path is empty,
+ *             ENOMEM if memory cannot be allocated.
+ */
+MDCLOG_EXPORT int mdclog_attr_set_file(mdclog_attr_t *attr, const char *path);
+
+/**
+ * Set when the log file is rotated. By default the file is not rotated.
+ *
+ * A rotated file is renamed with the suffix .1, and the earlier rotated files
+ * are renamed from .1 to .2 and so on. The file is checked after every write,
+ * so it can exceed the maximum size by the last write. The thread that notices the
+ * rotation is due renames the files and opens the new one, which is the background
+ * thread in asynchronous mode. The other threads keep writing to the previous file
+ * meanwhile, so they are not blocked by the rotation.
+ *
+ * A new file is preallocated to the maximum size with fallocate(), so that appending
+ * to it does not need to allocate blocks for the file. The blocks left unused are
+ * released when the file is rotated.
+ *
+ * @param   attr         pointer to attributes, previously allocated with mdclog_attr_init()
+ * @param   max_size     size in bytes after which the file is rotated, 0 for no size based rotation
+ * @param   interval_s   seconds after which the file is rotated, 0 for no time based rotation
+ *
+ * @return   0 in case of success,
+ *          -1 in case of error. Errno EINVAL is set if attr is NULL.
+ */
+MDCLOG_EXPORT int mdclog_attr_set_file_rotation(mdclog_attr_t *attr, size_t max_size, unsigned interval_s);
+
+/**
+ * Set the number of rotated log files kept. Defaults to MDCLOG_DEFAULT_FILE_RETENTION.
+ * The oldest file is removed when the file is rotated once more.
+ *
+ * @param   attr    pointer to attributes, previously allocated with mdclog_attr_init()
+ * @param   count   number of rotated files, from 0 to MDCLOG_MAX_FILE_RETENTION
+ *
+ * @return   0 in case of success,
+ *          -1 in case of error. Errno EINVAL is set if attr is NULL or the count is too large.
+ */
+MDCLOG_EXPORT int mdclog_attr_set_file_retention(mdclog_attr_t *attr, unsigned count);
+
+/**
+ * Type of the unix domain socket the log entries are sent to
+ */
+typedef enum
+{
+    MDCLOG_SOCKET_STREAM = 0,   //! SOCK_STREAM
+    MDCLOG_SOCKET_SEQPACKET = 1 //! SOCK_SEQPACKET, every batch is one message
+} mdclog_socket_type_t;
+
+/**
+ * Default maximum number of bytes sent to the socket with one system call
+ */
+#define MDCLOG_DEFAULT_SOCKET_BATCH_SIZE (16 * 1024)
+
+/**
+ * Maximum value of the socket batch size
+ */
+#define MDCLOG_MAX_SOCKET_BATCH_SIZE (64 * 1024)
+
+/**
+ * Default time a partial batch waits for more log entries before it is sent
+ */
+#define MDCLOG_DEFAULT_SOCKET_FLUSH_INTERVAL_MS 10
+
+/**
+ * Send the log entries to a local log collector over a unix domain socket.
+ *
+ * Each log entry is a frame: the length of the entry as a 32-bit big-endian integer
+ * followed by the entry without the ending newline. In MDCLOG_OUTPUT_BINARY format
+ * the records of each log entry are one frame, and every connection starts a new stream.
+ * A background thread collects the frames to batches and sends several frames with one
+ * system call.
+ *
+ * mdclog_init() connects to the socket. If the collector is not listening or the
+ * connection breaks, the log entries are written to the log file set with
+ * mdclog_attr_set_file() or to the standard out, and the connection is tried again
+ * with an exponential backoff. The entries queued when the connection breaks are
+ * written to the fallback output, so they may be mixed with newer entries.
+ * A collector that does not read for a second is considered broken.
+ *
+ * @param   attr   pointer to attributes, previously allocated with mdclog_attr_init()
+ * @param   path   path of the socket, NULL to disable the socket
+ * @param   type   socket type
+ *
+ * @return   0 in case of success,
+ *          -1 in case of error. Errno EINVAL is set if attr is NULL, the path is empty
+ *             or too long or the type is unknown, ENOMEM if memory cannot be allocated.
+ */
+MDCLOG_EXPORT int mdclog_attr_set_socket(mdclog_attr_t *attr, const char *path, mdclog_socket_type_t type);
+
+/**
+ * Set the batching of the log entries sent to the socket
+ *
+ * @param   attr          pointer to attributes, previously allocated with mdclog_attr_init()
+ * @param   batch_size    maximum bytes sent with one system call, at most MDCLOG_MAX_SOCKET_BATCH_SIZE.
+ *                        Defaults to MDCLOG_DEFAULT_SOCKET_BATCH_SIZE. A longer entry is sent alone.
+ *                        0 disables batching.
+ * @param   interval_ms   how long a partial batch may wait for more entries.
+ *                        Defaults to MDCLOG_DEFAULT_SOCKET_FLUSH_INTERVAL_MS.
+ *
+ * @return   0 in case of success,
+ *          -1 in case of error. Errno EINVAL is set if attr is NULL or the batch size is too large.
+ */
+MDCLOG_EXPORT int mdclog_attr_set_socket_batching(mdclog_attr_t *attr, size_t batch_size, unsigned interval_ms);
+
+/**
+ * Minimum size of the flight recorder ring
+ */
+#define MDCLOG_MIN_RECORDER_SIZE (64 * 1024)
+
+/**
+ * Maximum size of the flight recorder ring
+ */
+#define MDCLOG_MAX_RECORDER_SIZE (1024 * 1024 * 1024)
+
+/**
+ * Record the log entries to a flight recorder file, for analysing a crash of the process.
+ *
+ * The file is a memory mapped ring, which keeps the latest log entries up to its size.
+ * A log entry is recorded by reserving space with an atomic add and copying the
+ * formatted entry to the mapping, without a system call. The kernel writes the pages
+ * to the file, also after the process has crashed. The entries can be read with the
+ * mdclog-recorder utility. A file with the same size is continued by a later process.
+ *
+ * The entries with the recorder level or higher severity are recorded, regardless of the
+ * logging level, which only filters the entries written to the output. Thus e.g. the
+ * debug entries can be recorded while only the errors are written to the output.
+ * The recorded entries are not deferred in asynchronous mode, and the repeat
+ * suppression does not apply to them.
+ *
+ * @param   attr    pointer to attributes, previously allocated with mdclog_attr_init()
+ * @param   path    path of the recorder file, NULL to disable the recorder
+ * @param   size    size of the ring in bytes. Rounded up to a power of two, and to at
+ *                  least MDCLOG_MIN_RECORDER_SIZE. An entry longer than half of the ring
+ *                  is not recorded.
+ * @param   level   lowest severity that is recorded
+ *
+ * @return   0 in case of success,
+ *          -1 in case of error. Errno EINVAL is set if attr is NULL, the path is empty,
+ *             the size is larger than MDCLOG_MAX_RECORDER_SIZE or the level is unknown,
+ *             ENOMEM if memory cannot be allocated.
+ */
+MDCLOG_EXPORT int mdclog_attr_set_flight_recorder(mdclog_attr_t *attr, const char *path, size_t size,
+                                                  mdclog_severity_t level);
+
 /**
  * Initialize mdclog library. Calling is optional.
  * If the mdclog_init() is not called or is called
@@ -160,7 +938,9 @@ MDCLOG_EXPORT int mdclog_attr_set_ident(mdclog_attr_t *attr, const char *identit
  *
  * @param   attr     pointer to attributes. Can be NULL
  *
- * @return   0 in case of success, -1 in case of error. Errno is set in case of error
+ * @return   0 in case of success, -1 in case of error. Errno is set in case of error,
+ *           e.g. as by open() if the log file cannot be opened. The earlier configuration
+ *           is kept in case of error.
  */
 MDCLOG_EXPORT int mdclog_init(mdclog_attr_t *attr);
 
@@ -182,7 +962,8 @@ MDCLOG_EXPORT int mdclog_init(mdclog_attr_t *attr);
 MDCLOG_EXPORT int mdclog_mdc_add(const char *key, const char *value);
 
 /**
- * Get the thread's MDC value with the given key
+ * Get the thread's MDC value with the given key. If the thread has no MDC
+ * with the key, the global MDC set by mdclog_format_initialize() is returned.
  *
  * @param   key    MDC key
  *
@@ -203,9 +984,81 @@ MDCLOG_EXPORT void mdclog_mdc_remove(const char *key);
  */
 MDCLOG_EXPORT void mdclog_mdc_clean(void);
 
+/**
+ * Start a thread specific MDC scope. The MDCs added in the scope are removed
+ * when the scope is ended with mdclog_mdc_scope_pop(). An MDC added in the
+ * scope with the key of an MDC added before the scope hides the older value
+ * until the scope is ended. Scopes can be nested.
+ *
+ * @return   number of the scope, passed to mdclog_mdc_scope_pop(),
+ *          -1 in case of error.
+ *             Errno ENOMEM is set if memory cannot be allocated.
+ */
+MDCLOG_EXPORT int mdclog_mdc_scope_push(void);
+
+/**
+ * End an MDC scope of the thread, and the scopes started in it that are
+ * still open. The MDCs added in the scopes are removed, and the values they
+ * hid are restored. The time is proportional to the number of the removed
+ * MDCs, and does not depend on the number of the other MDCs of the thread.
+ * An MDC removed in a scope with mdclog_mdc_remove() or mdclog_mdc_clean()
+ * is not restored.
+ *
+ * @param    scope    number of the scope returned by mdclog_mdc_scope_push()
+ *
+ * @return   0 in case of success,
+ *          -1 in case of error.
+ *             Errno EINVAL is set if the scope is not open.
+ *             Errno ENOMEM is set if the MDCs of an adopted snapshot cannot be copied.
+ */
+MDCLOG_EXPORT int mdclog_mdc_scope_pop(int scope);
+
+typedef struct mdclog_mdc_snapshot mdclog_mdc_snapshot_t;
+
+/**
+ * Take an immutable snapshot of the MDCs of the thread, for example to hand
+ * the context of a request over to another thread with mdclog_mdc_adopt().
+ * The snapshot holds the MDCs already escaped and serialized to json. Taking
+ * a snapshot again before the MDCs of the thread are modified returns the
+ * same snapshot, only incrementing its reference count.
+ *
+ * @return   snapshot, which must be released with mdclog_mdc_snapshot_release(),
+ *           null in case of error.
+ *             Errno ENOMEM is set if memory cannot be allocated.
+ */
+MDCLOG_EXPORT mdclog_mdc_snapshot_t *mdclog_mdc_snapshot(void);
+
+/**
+ * Replace the MDCs of the thread with the MDCs of a snapshot, like
+ * mdclog_mdc_clean() followed by adding each of them. The snapshot is not
+ * copied: the thread refers to it until it modifies its MDCs, and only then
+ * copies the escaped MDCs to its own store. The caller keeps its reference
+ * to the snapshot.
+ *
+ * @param    snapshot    snapshot returned by mdclog_mdc_snapshot(), possibly in another thread
+ *
+ * @return   0 in case of success,
+ *          -1 in case of error.
+ *             Errno EINVAL is set if snapshot is null.
+ *             Errno ENOMEM is set if memory cannot be allocated.
+ */
+MDCLOG_EXPORT int mdclog_mdc_adopt(mdclog_mdc_snapshot_t *snapshot);
+
+/**
+ * Release a snapshot returned by mdclog_mdc_snapshot(). The snapshot is
+ * freed when it has been released and no thread has it adopted.
+ *
+ * @param    snapshot    the snapshot, null is ignored
+ */
+MDCLOG_EXPORT void mdclog_mdc_snapshot_release(mdclog_mdc_snapshot_t *snapshot);
+
 /**
  * Adds in MDC log format with HostName, PodName, ContainerName, ServiceName,PID, CallbackNotifyforLogFieldChange
  *
+ * The fields are set as global MDCs, which are included in the log entries of all threads.
+ * A thread specific MDC with the same key overrides the global one.
+ * The global MDCs cannot be removed with mdclog_mdc_remove() or mdclog_mdc_clean().
+ *
  * @param  log_change_monitor values either 0 or 1.
  *
  *         Value: 0 signifies not to monitor to change in log severity
@@ -216,6 +1069,127 @@ MDCLOG_EXPORT void mdclog_mdc_clean(void);
  */
 MDCLOG_EXPORT int mdclog_format_initialize(const int log_change_monitor);
 
+/**
+ * Asynchronous mode and suppression statistics
+ */
+typedef struct {
+    unsigned long long written;   //! Log entries written by the background thread
+    unsigned long long dropped;   //! Log entries discarded because of a full ring buffer
+    unsigned long long syscalls;  //! Write system calls made by the background thread.
+                                  //! syscalls / written is the average number of system calls per entry.
+    unsigned long long rate_limited;  //! Log entries discarded by the rate limiting
+    unsigned long long sampled_out;   //! Log entries discarded by the sampling
+} mdclog_stats_t;
+
+/**
+ * Get the asynchronous mode and suppression statistics. The counters are cumulative
+ * over the lifetime of the process.
+ *
+ * @param   stats   output: statistics
+ *
+ * @return   0 in case of success,
+ *          -1 in case of error. Errno EINVAL is set if stats is NULL.
+ */
+MDCLOG_EXPORT int mdclog_stats_get(mdclog_stats_t *stats);
+
+/**
+ * Log entry passed to a sink as a structured record. The record and the strings
+ * it refers to are valid only during the call of the sink.
+ */
+typedef struct {
+    struct timeval     timestamp;    //! timestamp of the log entry, from the clock of the library
+    mdclog_severity_t  severity;
+    const char        *identity;     //! identity of the logger, as in the json entries
+    const char        *message;      //! formatted message, not escaped, zero terminated
+    size_t             message_len;  //! length of the message, truncated to the maximum entry size
+    const mdclog_kv_t *fields;       //! fields given to mdclog_write_kv(), NULL for mdclog_write()
+    size_t             field_count;
+    const void        *mdc;          //! private, read with mdclog_mdc_iter_init()
+} mdclog_record_t;
+
+/**
+ * Iterator of the MDCs of a record
+ */
+typedef struct {
+    const void *global;     //! private
+    const void *thread;     //! private
+} mdclog_mdc_iter_t;
+
+/**
+ * What a sink receives
+ */
+typedef enum {
+    MDCLOG_SINK_JSON = 0,   //! the json entry, which is formatted once for all outputs needing it
+    MDCLOG_SINK_RECORD = 1  //! structured record, built once for all sinks needing it
+} mdclog_sink_format_t;
+
+/**
+ * Sink receiving log entries in addition to the output of the library
+ */
+typedef struct {
+    mdclog_sink_format_t format;
+    mdclog_severity_t    level;     //! lowest severity passed to the sink, independent of mdclog_level_set()
+    /**
+     * Called with the json entry if the format is MDCLOG_SINK_JSON. The entry is
+     * borrowed from the library: it is zero terminated, without the ending newline,
+     * and valid only during the call.
+     */
+    void (*write)(void *arg, const char *entry, size_t len);
+    /**
+     * Called with the record if the format is MDCLOG_SINK_RECORD
+     */
+    void (*write_record)(void *arg, const mdclog_record_t *record);
+    void *arg;                      //! first argument of the functions
+} mdclog_sink_t;
+
+/**
+ * Add a sink. The sinks are called in the thread writing the log entry, in the order
+ * they were added, before the entry is written to the output. A sink must not call
+ * mdclog_sink_add(), mdclog_sink_remove(), mdclog_init(), mdclog_format_initialize() or
+ * mdclog_lib_clean(). The log entries written by a sink are discarded. The sinks are kept
+ * over mdclog_init(), and removed by mdclog_lib_clean().
+ *
+ * @param   sink   sink, copied by the library
+ *
+ * @return   identifier of the sink for mdclog_sink_remove() in case of success,
+ *          -1 in case of error. Errno EINVAL is set if the sink is NULL, the format or
+ *             the level is unknown or the function of the format is NULL, ENOMEM if
+ *             memory cannot be allocated.
+ */
+MDCLOG_EXPORT int mdclog_sink_add(const mdclog_sink_t *sink);
+
+/**
+ * Remove a sink. The sink is not called any more when the function returns.
+ *
+ * @param   id   identifier returned by mdclog_sink_add()
+ *
+ * @return   0 in case of success,
+ *          -1 in case of error. Errno ENOENT is set if there is no sink with the identifier,
+ *             ENOMEM if memory cannot be allocated.
+ */
+MDCLOG_EXPORT int mdclog_sink_remove(int id);
+
+/**
+ * Start iterating the MDCs of a record: the global MDCs that the thread has not
+ * overridden, followed by the MDCs of the thread, in the order of the json entries.
+ * Can be called only in the sink receiving the record.
+ *
+ * @param   iter     output: iterator
+ * @param   record   record passed to the sink
+ */
+MDCLOG_EXPORT void mdclog_mdc_iter_init(mdclog_mdc_iter_t *iter, const mdclog_record_t *record);
+
+/**
+ * Get the next MDC of a record
+ *
+ * @param   iter    iterator initialized with mdclog_mdc_iter_init()
+ * @param   key     output: key of the MDC
+ * @param   value   output: value of the MDC, escaped as in the json entries
+ *
+ * @return   1 if an MDC was got, 0 if there are no more MDCs
+ */
+MDCLOG_EXPORT int mdclog_mdc_iter_next(mdclog_mdc_iter_t *iter, const char **key, const char **value);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,637 @@
+/** @file include/mdclog/mdclog.hpp*/
+
+/*
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ */
+
+/**
+ * Optional header only C++ front end. The messages are formatted from {}
+ * placeholders and typed arguments instead of printf conversions and varargs:
+ *
+ * @code
+ * #include <mdclog/mdclog.hpp>
+ *
+ * mdclog::info("cell {} throughput {} Mbps", cell_id, throughput);
+ * @endcode
+ *
+ * The format string is checked by a constexpr constructor, which counts the
+ * placeholders. With C++20 the constructor is consteval, and a format string
+ * whose placeholders do not match the arguments does not compile. With older
+ * standards an extra placeholder is written as is, and an extra argument is
+ * left out. {{ and }} are written as literal braces.
+ *
+ * The level check is inline at the call site. The message is formatted
+ * without allocations to a thread specific buffer of MDCLOG_MESSAGE_BUFFER_SIZE
+ * bytes, and escaped by the library like the message of mdclog_write(). The
+ * rate limiting identifies the call site by the format string.
+ *
+ * Integers, floating point numbers, booleans, characters, C strings,
+ * std::string and pointers are supported. Other types can be supported by
+ * specializing mdclog::formatter.
+ *
+ * mdclog::mdc_scope removes the MDCs added in a block when the block is left.
+ */
+
+#ifndef INCLUDE_MDCLOG_HPP_
+#define INCLUDE_MDCLOG_HPP_
+
+#include <mdclog/mdclog.h>
+
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <utility>
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+
+#if defined(__cpp_consteval)
+#define MDCLOG_CONSTEVAL consteval
+#else
+#define MDCLOG_CONSTEVAL constexpr
+#endif
+
+/**
+ * Size of the thread specific buffer that the messages are formatted to,
+ * including the ending zero. A longer message is cut.
+ */
+#ifndef MDCLOG_MESSAGE_BUFFER_SIZE
+#define MDCLOG_MESSAGE_BUFFER_SIZE 4096
+#endif
+
+namespace mdclog {
+
+namespace detail {
+
+#if __cpp_constexpr >= 201304L
+/*
+ * Count the {} placeholders of a format string, -1 if it has a brace that is
+ * not a placeholder, {{ or }}
+ */
+constexpr int count_placeholders(const char* str, int count)
+{
+    for (; *str != '\0'; str++)
+    {
+        if ((str[0] == '{' && str[1] == '{') || (str[0] == '}' && str[1] == '}'))
+            str++;
+        else if (str[0] == '{' && str[1] == '}')
+        {
+            str++;
+            count++;
+        }
+        else if (str[0] == '{' || str[0] == '}')
+            return -1;
+    }
+    return count;
+}
+#else
+// C++11 constexpr functions cannot have loops
+constexpr int count_placeholders(const char* str, int count)
+{
+    return *str == '\0' ? count :
+           (str[0] == '{' && str[1] == '{') || (str[0] == '}' && str[1] == '}') ?
+               count_placeholders(str + 2, count) :
+           str[0] == '{' && str[1] == '}' ? count_placeholders(str + 2, count + 1) :
+           str[0] == '{' || str[0] == '}' ? -1 :
+           count_placeholders(str + 1, count);
+}
+#endif
+
+/*
+ * Not constexpr, so reaching it while the format string is checked at compile
+ * time fails the compilation
+ */
+inline int format_string_does_not_match_the_arguments(int placeholders)
+{
+    return placeholders;
+}
+
+constexpr int check_placeholders(int placeholders, std::size_t args)
+{
+    return placeholders >= 0 && static_cast<std::size_t>(placeholders) == args ?
+        placeholders : format_string_does_not_match_the_arguments(placeholders);
+}
+
+} // namespace detail
+
+/**
+ * Format string of the given argument types, constructed from a string literal
+ */
+template <typename... Args>
+class basic_format_string
+{
+public:
+    template <std::size_t N>
+    MDCLOG_CONSTEVAL basic_format_string(const char (&str)[N]):
+        str_(str),
+        placeholders_(detail::check_placeholders(detail::count_placeholders(str, 0), sizeof...(Args)))
+    {
+    }
+
+    constexpr const char* get() const
+    {
+        return str_;
+    }
+
+    /**
+     * Number of the {} placeholders, -1 if the format string has a lone brace
+     */
+    constexpr int placeholders() const
+    {
+        return placeholders_;
+    }
+
+private:
+    const char* str_;
+    int         placeholders_;
+};
+
+/**
+ * Format string of the arguments of a log function. The argument types are
+ * not deduced from the format string.
+ */
+template <typename... Args>
+using format_string = basic_format_string<typename std::decay<Args>::type...>;
+
+/**
+ * Output of the formatters. The output is cut at the end of the buffer.
+ */
+class writer
+{
+public:
+    writer(char* buffer, std::size_t len): pos_(buffer), end_(buffer + len) {}
+
+    void put(const char* str, std::size_t len)
+    {
+        std::size_t room = static_cast<std::size_t>(end_ - pos_);
+
+        if (len > room)
+            len = room;
+        std::memcpy(pos_, str, len);
+        pos_ += len;
+    }
+
+    void put(char c)
+    {
+        if (pos_ < end_)
+            *pos_++ = c;
+    }
+
+    char* pos() const
+    {
+        return pos_;
+    }
+
+private:
+    char* pos_;
+    char* end_;
+};
+
+/**
+ * Formatter of an argument type. A specialization has a static
+ * format(writer&, const T&) function.
+ */
+template <typename T, typename Enable = void>
+struct formatter
+{
+    static_assert(sizeof(T) == 0, "the argument type has no mdclog::formatter");
+};
+
+namespace detail {
+
+inline void put_unsigned(writer& out, unsigned long long value)
+{
+    char        digits[20];
+    std::size_t i = sizeof(digits);
+
+    do
+    {
+        digits[--i] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value);
+    out.put(&digits[i], sizeof(digits) - i);
+}
+
+inline void put_signed(writer& out, long long value)
+{
+    if (value < 0)
+    {
+        out.put('-');
+        put_unsigned(out, 0ULL - static_cast<unsigned long long>(value));
+    }
+    else
+        put_unsigned(out, static_cast<unsigned long long>(value));
+}
+
+/*
+ * Put the shortest of the precisions from digits10 to max_digits10 that reads
+ * back to the same value, like the double fields of mdclog_write_kv()
+ */
+template <typename T>
+inline void put_floating(writer& out, T value)
+{
+    char buffer[64];
+    int  precision = std::numeric_limits<T>::digits10;
+    int  len;
+
+    for (;;)
+    {
+        len = std::snprintf(buffer, sizeof(buffer), "%.*Lg", precision, static_cast<long double>(value));
+        if (len <= 0 || precision >= std::numeric_limits<T>::max_digits10 ||
+            static_cast<T>(std::strtold(buffer, nullptr)) == value)
+            break;
+        precision++;
+    }
+    if (len > 0)
+        out.put(buffer, static_cast<std::size_t>(len) < sizeof(buffer) ? len : sizeof(buffer) - 1);
+}
+
+inline void put_string(writer& out, const char* str)
+{
+    if (str)
+        out.put(str, std::strlen(str));
+    else
+        out.put("(null)", 6);
+}
+
+} // namespace detail
+
+template <>
+struct formatter<bool>
+{
+    static void format(writer& out, bool value)
+    {
+        if (value)
+            out.put("true", 4);
+        else
+            out.put("false", 5);
+    }
+};
+
+template <>
+struct formatter<char>
+{
+    static void format(writer& out, char value)
+    {
+        out.put(value);
+    }
+};
+
+template <typename T>
+struct formatter<T, typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value &&
+                                            !std::is_same<T, char>::value>::type>
+{
+    static void format(writer& out, T value)
+    {
+        detail::put_signed(out, value);
+    }
+};
+
+template <typename T>
+struct formatter<T, typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value &&
+                                            !std::is_same<T, char>::value && !std::is_same<T, bool>::value>::type>
+{
+    static void format(writer& out, T value)
+    {
+        detail::put_unsigned(out, value);
+    }
+};
+
+template <typename T>
+struct formatter<T, typename std::enable_if<std::is_floating_point<T>::value>::type>
+{
+    static void format(writer& out, T value)
+    {
+        detail::put_floating(out, value);
+    }
+};
+
+template <>
+struct formatter<const char*>
+{
+    static void format(writer& out, const char* value)
+    {
+        detail::put_string(out, value);
+    }
+};
+
+template <>
+struct formatter<char*>
+{
+    static void format(writer& out, const char* value)
+    {
+        detail::put_string(out, value);
+    }
+};
+
+template <>
+struct formatter<std::string>
+{
+    static void format(writer& out, const std::string& value)
+    {
+        out.put(value.data(), value.size());
+    }
+};
+
+#if __cplusplus >= 201703L
+template <>
+struct formatter<std::string_view>
+{
+    static void format(writer& out, std::string_view value)
+    {
+        out.put(value.data(), value.size());
+    }
+};
+#endif
+
+template <typename T>
+struct formatter<T, typename std::enable_if<std::is_pointer<T>::value &&
+                                            !std::is_same<T, const char*>::value &&
+                                            !std::is_same<T, char*>::value>::type>
+{
+    static void format(writer& out, T value)
+    {
+        char buffer[32];
+        int  len = std::snprintf(buffer, sizeof(buffer), "%p",
+                                 const_cast<void*>(reinterpret_cast<const volatile void*>(value)));
+
+        if (len > 0)
+            out.put(buffer, static_cast<std::size_t>(len));
+    }
+};
+
+template <>
+struct formatter<std::nullptr_t>
+{
+    static void format(writer& out, std::nullptr_t)
+    {
+        out.put("(nil)", 5);
+    }
+};
+
+namespace detail {
+
+/*
+ * Copy the literal text up to the next placeholder
+ *
+ * @return  the format string after the placeholder, NULL if there are no more placeholders
+ */
+inline const char* put_literal(writer& out, const char* format)
+{
+    for (;;)
+    {
+        const char* brace = std::strpbrk(format, "{}");
+
+        if (!brace)
+        {
+            out.put(format, std::strlen(format));
+            return nullptr;
+        }
+        out.put(format, static_cast<std::size_t>(brace - format));
+        if (brace[0] == '{' && brace[1] == '}')
+            return brace + 2;
+        out.put(brace[0]);
+        // {{ and }} are written as one brace, a lone brace of an unchecked format as is
+        format = brace + (brace[0] == brace[1] ? 2 : 1);
+    }
+}
+
+inline void format_args(writer& out, const char* format)
+{
+    while (format)
+    {
+        format = put_literal(out, format);
+        if (format)
+            out.put("{}", 2);   // a placeholder without an argument
+    }
+}
+
+template <typename T, typename... Rest>
+void format_args(writer& out, const char* format, const T& arg, const Rest&... rest)
+{
+    format = put_literal(out, format);
+    if (!format)
+        return;
+    formatter<typename std::decay<T>::type>::format(out, arg);
+    format_args(out, format, rest...);
+}
+
+struct message_buffer
+{
+    char data[MDCLOG_MESSAGE_BUFFER_SIZE];
+    bool busy;
+};
+
+inline message_buffer& get_message_buffer()
+{
+    static thread_local message_buffer buffer;
+
+    return buffer;
+}
+
+class busy_guard
+{
+public:
+    explicit busy_guard(message_buffer& buffer): buffer_(buffer) { buffer_.busy = true; }
+    ~busy_guard() { buffer_.busy = false; }
+
+private:
+    message_buffer& buffer_;
+};
+
+/*
+ * Format the message and write the log entry. Not inlined, so that a call
+ * site has only the level check.
+ */
+template <typename... Args>
+__attribute__((noinline)) void write(mdclog_severity_t severity, const char* format, const Args&... args)
+{
+    message_buffer& buffer = get_message_buffer();
+
+    // a message logged while formatting or from a sink would be discarded by the library anyway
+    if (buffer.busy)
+        return;
+    busy_guard guard(buffer);
+    writer     out(buffer.data, sizeof(buffer.data) - 1);
+
+    format_args(out, format, args...);
+    *out.pos() = '\0';
+    mdclog_write_formatted(severity, format, buffer.data);
+}
+
+} // namespace detail
+
+/**
+ * Log a message if the severity passes the compile time and current logging levels
+ *
+ * @param   severity   severity of the log message
+ * @param   format     format string with a {} placeholder for each argument
+ * @param   args       the arguments
+ */
+template <typename... Args>
+inline void log(mdclog_severity_t severity, format_string<Args...> format, const Args&... args)
+{
+    if (static_cast<int>(severity) <= static_cast<int>(MDCLOG_COMPILE_LEVEL) && mdclog_level_enabled(severity))
+        detail::write(severity, format.get(), args...);
+}
+
+/**
+ * Log a message with the fatal severity, see log()
+ */
+template <typename... Args>
+inline void fatal(format_string<Args...> format, const Args&... args)
+{
+    log(MDCLOG_FATAL, format, args...);
+}
+
+/**
+ * Log a message with the error severity, see log()
+ */
+template <typename... Args>
+inline void error(format_string<Args...> format, const Args&... args)
+{
+    log(MDCLOG_ERR, format, args...);
+}
+
+/**
+ * Log a message with the warning severity, see log()
+ */
+template <typename... Args>
+inline void warn(format_string<Args...> format, const Args&... args)
+{
+    log(MDCLOG_WARN, format, args...);
+}
+
+/**
+ * Log a message with the info severity, see log()
+ */
+template <typename... Args>
+inline void info(format_string<Args...> format, const Args&... args)
+{
+    log(MDCLOG_INFO, format, args...);
+}
+
+/**
+ * Log a message with the debug severity, see log()
+ */
+template <typename... Args>
+inline void debug(format_string<Args...> format, const Args&... args)
+{
+    log(MDCLOG_DEBUG, format, args...);
+}
+
+/**
+ * Log a message with the trace severity, see log()
+ */
+template <typename... Args>
+inline void trace(format_string<Args...> format, const Args&... args)
+{
+    log(MDCLOG_TRACE, format, args...);
+}
+
+/**
+ * Thread specific MDC scope, see mdclog_mdc_scope_push(). The MDCs added
+ * while the guard exists are removed when it is destroyed, and the values
+ * they hid are restored:
+ *
+ * @code
+ * {
+ *     mdclog::mdc_scope scope;
+ *
+ *     scope.add("request", request_id);
+ *     handle(request);
+ * }
+ * @endcode
+ *
+ * The guard can be moved but not copied. It must be destroyed by the thread
+ * that created it, after the guards created after it.
+ */
+class mdc_scope
+{
+public:
+    mdc_scope(): scope_(mdclog_mdc_scope_push()) {}
+
+    mdc_scope(mdc_scope&& other) noexcept: scope_(other.scope_)
+    {
+        other.scope_ = -1;
+    }
+
+    mdc_scope& operator=(mdc_scope&& other) noexcept
+    {
+        if (this != &other)
+        {
+            end();
+            scope_ = other.scope_;
+            other.scope_ = -1;
+        }
+        return *this;
+    }
+
+    mdc_scope(const mdc_scope&) = delete;
+    mdc_scope& operator=(const mdc_scope&) = delete;
+
+    ~mdc_scope()
+    {
+        end();
+    }
+
+    /**
+     * Add an MDC to the scope, see mdclog_mdc_add()
+     *
+     * @return  0 in case of success, -1 in case of error. Errno is set.
+     */
+    int add(const char* key, const char* value)
+    {
+        return mdclog_mdc_add(key, value);
+    }
+
+    int add(const char* key, const std::string& value)
+    {
+        return mdclog_mdc_add(key, value.c_str());
+    }
+
+    /**
+     * End the scope before the guard is destroyed
+     */
+    void end()
+    {
+        if (scope_ > 0)
+            mdclog_mdc_scope_pop(scope_);
+        scope_ = -1;
+    }
+
+    /**
+     * False if the scope could not be started or it has been ended
+     */
+    explicit operator bool() const
+    {
+        return scope_ > 0;
+    }
+
+private:
+    int scope_;
+};
+
+} // namespace mdclog
+
+#endif /* INCLUDE_MDCLOG_HPP_ */
@@ -0,0 +1,135 @@
+/*
+ * async.h
+ *
+ * Internal asynchronous logging functions
+ *
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ */
+
+
+#ifndef INCLUDE_PRIVATE_ASYNC_H_
+#define INCLUDE_PRIVATE_ASYNC_H_
+
+#include <stddef.h>
+
+#include "mdclog/mdclog.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Default size of the thread specific ring buffer in bytes
+ */
+#define ASYNC_DEFAULT_CAPACITY  (64 * 1024)
+
+/**
+ * Minimum size of the thread specific ring buffer in bytes
+ */
+#define ASYNC_MIN_CAPACITY      (16 * 1024)
+
+/**
+ * Default maximum number of bytes written with one system call
+ */
+#define ASYNC_DEFAULT_BATCH_SIZE  (64 * 1024)
+
+/**
+ * Upper limit of the batch size
+ */
+#define ASYNC_MAX_BATCH_SIZE      (1024 * 1024)
+
+/**
+ * Function formatting a deferred log entry, called by the background thread
+ *
+ * @param   buffer       output: formatted log entry, including the ending newline
+ * @param   len          size of the buffer
+ * @param   record       deferred log entry queued with mdclog_internal_async_push_deferred()
+ * @param   record_len   length of the deferred log entry
+ *
+ * @return  length of the formatted log entry, 0 if the entry cannot be formatted
+ */
+typedef size_t (*async_format_fn_t)(char *buffer, size_t len, const char *record, size_t record_len);
+
+/**
+ * Asynchronous mode configuration
+ */
+struct async_config
+{
+    size_t                   capacity;            //! size of a thread specific ring buffer in bytes,
+                                                  //! rounded up to a power of two, 0 for the default
+    mdclog_overflow_policy_t policy;              //! what to do when the ring buffer of a thread is full
+    size_t                   batch_size;          //! maximum bytes written with one system call, limited to
+                                                  //! PIPE_BUF if the standard out is a pipe. 0 disables batching.
+    unsigned                 flush_interval_ms;   //! how long a partial batch may wait for more entries
+    async_format_fn_t        format;              //! function formatting deferred log entries,
+                                                  //! can be NULL if none are queued
+};
+
+/**
+ * Start the asynchronous mode. If the mode is already running, the new
+ * configuration takes effect, except that the capacity applies only to ring
+ * buffers created after the call and the format function is not changed.
+ *
+ * @param   config   asynchronous mode configuration
+ *
+ * @return  0 in case of success, -1 in case of error. Errno is set
+ */
+int mdclog_internal_async_start(const struct async_config *config);
+
+/**
+ * Stop the asynchronous mode. All buffered log entries are written out
+ * before the function returns. Does nothing if the mode is not running.
+ */
+void mdclog_internal_async_stop(void);
+
+/**
+ * Queue a formatted log entry to the ring buffer of the calling thread
+ *
+ * @param   buffer   log entry, including the ending newline
+ * @param   len      length of the log entry
+ *
+ * @return  0 if the entry was queued or dropped according to the overflow policy
+ *          -1 if the asynchronous mode is not running and the caller must write the entry itself
+ */
+int mdclog_internal_async_push(const char *buffer, size_t len);
+
+/**
+ * Queue a deferred log entry to the ring buffer of the calling thread.
+ * The background thread formats the entry with the function given to mdclog_internal_async_start().
+ *
+ * @param   record   deferred log entry
+ * @param   len      length of the deferred log entry
+ *
+ * @return  0 if the entry was queued or dropped according to the overflow policy
+ *          -1 if the asynchronous mode is not running and the caller must format the entry itself
+ */
+int mdclog_internal_async_push_deferred(const char *record, size_t len);
+
+/**
+ * Get the asynchronous mode statistics
+ *
+ * @param   stats   output: statistics
+ */
+void mdclog_internal_async_stats(mdclog_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INCLUDE_PRIVATE_ASYNC_H_ */
@@ -0,0 +1,231 @@
+/*
+ * binary.h
+ *
+ * Compact binary encoding of log entries and its decoding to json
+ *
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ */
+
+
+#ifndef INCLUDE_PRIVATE_BINARY_H_
+#define INCLUDE_PRIVATE_BINARY_H_
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "mdclog/mdclog.h"
+#include "private/json_format.h"
+#include "private/mdc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * A binary stream is a sequence of records, each starting with a type byte.
+ * Integers are varints of 7 bits per byte, least significant group first, and
+ * signed integers are zigzag encoded. Strings are a varint length followed by
+ * the characters. Floating point numbers are in the byte order of the writing host.
+ *
+ * A stream starts with a header record:
+ *   'H', "MDCLOGB", version byte, max entry size, timestamp format byte,
+ *   field count byte, field order bytes, the keys of all fields as strings,
+ *   identity string, sizeof(long double) byte
+ *
+ * Format strings and MDC keys are interned. A definition record assigns the
+ * next id, starting from 1, of the stream:
+ *   'F', id, format string
+ *   'K', id, MDC key
+ *
+ * A log entry record:
+ *   'E', severity byte (0xff for unknown), signed microseconds since the previous
+ *   entry of the stream, format id, MDC count, for every MDC the key id and the
+ *   value string, length of the packed arguments, packed arguments.
+ *
+ * An id 0 is followed by the string itself instead of referring to a definition.
+ * A new header record starts a new stream, which discards the definitions.
+ */
+#define BINARY_MAGIC            "MDCLOGB"
+#define BINARY_MAGIC_LENGTH     7
+#define BINARY_VERSION          1
+
+#define BINARY_RECORD_HEADER    'H'
+#define BINARY_RECORD_FORMAT    'F'
+#define BINARY_RECORD_KEY       'K'
+#define BINARY_RECORD_ENTRY     'E'
+
+/**
+ * Maximum length of a varint
+ */
+#define VARINT_MAX_LENGTH       10
+
+/**
+ * Maximum number of interned format strings and MDC keys of a stream.
+ * The strings beyond it are written to the entries.
+ */
+#define BINARY_MAX_DEFINITIONS  4096
+
+/**
+ * Parameters of a stream, needed for decoding its entries to json
+ */
+struct binary_stream
+{
+    struct json_layout        layout;
+    char                      identity[IDENTITY_MAX_LENGTH + 1];  //! escaped
+    mdclog_timestamp_format_t timestamp_format;
+    size_t                    max_entry_size;     //! including the newline
+};
+
+struct binary_encoder;
+struct binary_decoder;
+
+/**
+ * Function receiving a decoded log entry
+ *
+ * @param   entry   json log entry, without a newline
+ * @param   len     length of the log entry
+ * @param   arg     argument given to mdclog_internal_binary_decode()
+ */
+typedef void (*binary_entry_fn_t)(const char *entry, size_t len, void *arg);
+
+/**
+ * Write a varint
+ *
+ * @param   buffer   output
+ * @param   len      size of the buffer
+ * @param   value    value
+ *
+ * @return  length of the varint, 0 if it does not fit to the buffer
+ */
+size_t mdclog_internal_put_varint(char *buffer, size_t len, uint64_t value);
+
+/**
+ * Write a zigzag encoded signed varint
+ *
+ * @return  as mdclog_internal_put_varint()
+ */
+size_t mdclog_internal_put_svarint(char *buffer, size_t len, int64_t value);
+
+/**
+ * Read a varint
+ *
+ * @param   buffer   input
+ * @param   len      length of the input
+ * @param   value    output: value
+ *
+ * @return  length of the varint, 0 if the input ends or the varint is too long
+ */
+size_t mdclog_internal_get_varint(const char *buffer, size_t len, uint64_t *value);
+
+/**
+ * Read a zigzag encoded signed varint
+ *
+ * @return  as mdclog_internal_get_varint()
+ */
+size_t mdclog_internal_get_svarint(const char *buffer, size_t len, int64_t *value);
+
+/**
+ * Create a stream encoder
+ *
+ * @return  the encoder, NULL if memory cannot be allocated
+ */
+struct binary_encoder *mdclog_internal_binary_encoder_create(void);
+
+/**
+ * Destroy a stream encoder
+ *
+ * @param   encoder   encoder, can be NULL
+ */
+void mdclog_internal_binary_encoder_destroy(struct binary_encoder *encoder);
+
+/**
+ * Start a new stream. The next encoded entry is preceded by a header record.
+ *
+ * @param   encoder   encoder
+ * @param   stream    parameters of the stream
+ */
+void mdclog_internal_binary_encoder_reset(struct binary_encoder *encoder, const struct binary_stream *stream);
+
+/**
+ * Encode a log entry, preceded by the records it needs: the stream header and
+ * the definitions of new format strings and MDC keys. The MDCs and the message
+ * that cannot be visible in a json entry of the maximum entry size are left out.
+ * The encoder is not thread safe, and the records must be written in the order
+ * they are encoded. Must be called in an epoch critical section for reading the
+ * global MDCs.
+ *
+ * @param   encoder    encoder
+ * @param   timestamp  timestamp
+ * @param   severity   severity of the log message
+ * @param   mdc        first MDC of the calling thread
+ * @param   msg        log message format
+ * @param   arglist    arguments of the format
+ * @param   records    output: encoded records, valid until the next call
+ *
+ * @return  length of the records,
+ *          -1 in case of error. Errno is set to ENOMEM.
+ */
+long mdclog_internal_binary_encode(struct binary_encoder *encoder,
+                       const struct timeval *timestamp,
+                       mdclog_severity_t severity,
+                       mdc_t *mdc,
+                       const char *msg,
+                       va_list arglist,
+                       const char **records);
+
+/**
+ * Create a stream decoder
+ *
+ * @return  the decoder, NULL if memory cannot be allocated
+ */
+struct binary_decoder *mdclog_internal_binary_decoder_create(void);
+
+/**
+ * Destroy a stream decoder
+ *
+ * @param   decoder   decoder, can be NULL
+ */
+void mdclog_internal_binary_decoder_destroy(struct binary_decoder *decoder);
+
+/**
+ * Decode the complete records of a binary stream. The log entries are formatted
+ * to the json that mdclog_internal_format_to_json_str() formats from the original
+ * arguments with the layout, identity and maximum entry size of the stream.
+ *
+ * @param   decoder   decoder, keeping the state of the stream between the calls
+ * @param   data      stream data
+ * @param   len       length of the data
+ * @param   entry     function receiving the log entries
+ * @param   arg       argument of the function
+ *
+ * @return  number of bytes decoded. An incomplete record at the end of the data
+ *          is not decoded, and must be given again with the rest of the stream.
+ *          -1 in case of error. Errno EINVAL is set if the data is not a valid
+ *          stream, ENOMEM if memory cannot be allocated.
+ */
+long mdclog_internal_binary_decode(struct binary_decoder *decoder, const char *data, size_t len,
+                                   binary_entry_fn_t entry, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INCLUDE_PRIVATE_BINARY_H_ */
@@ -0,0 +1,149 @@
+/*
+ * deferred.h
+ *
+ * Capturing printf style arguments for formatting them later
+ *
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ */
+
+
+#ifndef INCLUDE_PRIVATE_DEFERRED_H_
+#define INCLUDE_PRIVATE_DEFERRED_H_
+
+#include <stddef.h>
+#include <stdarg.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Maximum length of a supported conversion specification, including the ending zero
+ */
+#define CONVERSION_MAX_LENGTH   32
+
+/**
+ * Type of the argument of a conversion specification
+ */
+enum arg_type
+{
+    ARG_NONE,       //! %%
+    ARG_INT,
+    ARG_LONG,
+    ARG_LLONG,
+    ARG_INTMAX,
+    ARG_SIZE,
+    ARG_PTRDIFF,
+    ARG_DOUBLE,
+    ARG_LDOUBLE,
+    ARG_STRING,
+    ARG_POINTER
+};
+
+/**
+ * Parsed conversion specification
+ */
+struct conversion
+{
+    size_t        len;              //! length of the specification, starting from %
+    int           width_arg;        //! width given as an argument (*)
+    int           precision_arg;    //! precision given as an argument (.*)
+    int           precision;        //! precision given in the format, -1 if none
+    enum arg_type type;
+};
+
+/**
+ * Parse a conversion specification starting with the % character.
+ * Positional arguments and the %n, %m, %lc and %ls conversions are not supported.
+ *
+ * @param   spec   the specification
+ * @param   conv   output: the parsed specification
+ *
+ * @return  0 in case of success, -1 if the conversion is not supported
+ */
+int mdclog_internal_parse_conversion(const char* spec, struct conversion* conv);
+
+/**
+ * Copy the arguments of a printf style format string to a binary payload.
+ * Scalars are copied by value and strings by content, so the payload stays valid
+ * after the caller returns.
+ * Positional arguments and the %n, %m, %lc and %ls conversions are not supported.
+ *
+ * @param   buffer    output: argument payload
+ * @param   len       size of the buffer
+ * @param   format    printf style format string
+ * @param   arglist   arguments of the format string
+ *
+ * @return  in case of success: length of the payload
+ *          in case of error: -1, if the format string is not supported or the payload does not fit
+ */
+int mdclog_internal_capture_args(char* buffer, size_t len, const char* format, va_list arglist);
+
+/**
+ * Format a captured argument payload like vsnprintf() would have formatted
+ * the original arguments.
+ *
+ * @param   buffer    output: formatted string with the ending zero
+ * @param   len       size of the buffer, including the ending zero
+ * @param   format    the format string given to mdclog_internal_capture_args()
+ * @param   args      argument payload
+ * @param   args_len  length of the argument payload
+ *
+ * @return  in case of success: length of the whole formatted string, excluding the ending zero,
+ *          even if it was truncated to fit to the buffer
+ *          in case of error: -1
+ */
+int mdclog_internal_render_args(char* buffer, size_t len, const char* format, const char* args, size_t args_len);
+
+/**
+ * Copy the arguments of a printf style format string to a packed payload, which
+ * does not depend on the sizes of the types of the host. Integers are zigzag
+ * encoded varints, strings a varint of the length plus one, 0 for NULL, followed
+ * by the characters. The same conversions are supported as by mdclog_internal_capture_args().
+ *
+ * @param   buffer    output: packed payload
+ * @param   len       size of the buffer
+ * @param   format    printf style format string
+ * @param   arglist   arguments of the format string
+ *
+ * @return  in case of success: length of the payload
+ *          in case of error: -1, if the format string is not supported or the payload does not fit
+ */
+int mdclog_internal_pack_args(char* buffer, size_t len, const char* format, va_list arglist);
+
+/**
+ * Convert a packed payload to the payload of mdclog_internal_capture_args(),
+ * which can be formatted with mdclog_internal_render_args()
+ *
+ * @param   buffer       output: argument payload
+ * @param   len          size of the buffer
+ * @param   format       the format string given to mdclog_internal_pack_args()
+ * @param   packed       packed payload
+ * @param   packed_len   length of the packed payload
+ *
+ * @return  in case of success: length of the argument payload
+ *          in case of error: -1, if the packed payload is not valid or the argument payload does not fit
+ */
+int mdclog_internal_unpack_args(char* buffer, size_t len, const char* format, const char* packed, size_t packed_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INCLUDE_PRIVATE_DEFERRED_H_ */
@@ -0,0 +1,58 @@
+/*
+ * epoch.h
+ *
+ * Epoch based reclamation of shared immutable data
+ *
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ */
+
+
+
+#ifndef INCLUDE_PRIVATE_EPOCH_H_
+#define INCLUDE_PRIVATE_EPOCH_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Enter a read side critical section. Data published with an atomic pointer
+ * and read in the critical section is not freed before the section is left.
+ * The critical sections can be nested. A critical section must not wait for
+ * a thread which may be calling mdclog_internal_epoch_synchronize().
+ */
+void mdclog_internal_epoch_enter(void);
+
+/**
+ * Leave a read side critical section
+ */
+void mdclog_internal_epoch_leave(void);
+
+/**
+ * Wait until all threads have left the read side critical sections they were
+ * in when the function was called. Data unpublished before the call can be
+ * freed after it. Must not be called in a read side critical section.
+ */
+void mdclog_internal_epoch_synchronize(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INCLUDE_PRIVATE_EPOCH_H_ */
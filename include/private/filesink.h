@@ -0,0 +1,131 @@
+/*
+ * filesink.h
+ *
+ * Internal output of the log entries, either to the standard out or to a rotated file
+ *
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ */
+
+
+#ifndef INCLUDE_PRIVATE_FILESINK_H_
+#define INCLUDE_PRIVATE_FILESINK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * How long a failed rotation is not retried
+ */
+#define FILE_SINK_ROTATION_RETRY_NS  1000000000ULL
+
+struct file_sink;
+
+/**
+ * Rotation of a log file
+ */
+struct file_sink_config
+{
+    size_t   max_size;      //! size after which the file is rotated, 0 for no size based rotation.
+                            //! Also the size preallocated for a new file.
+    uint64_t interval_ns;   //! time after which the file is rotated, 0 for no time based rotation
+    unsigned retention;     //! number of rotated files kept
+};
+
+/**
+ * Open a log file sink. The file is appended if it exists.
+ *
+ * @param   path     path of the log file. The rotated files have suffixes .1, .2, ...
+ *                   with .1 being the newest.
+ * @param   config   rotation of the file
+ *
+ * @return  the sink in case of success,
+ *          NULL in case of error. Errno is set as by open() or to ENOMEM.
+ */
+struct file_sink *mdclog_internal_file_sink_open(const char *path, const struct file_sink_config *config);
+
+/**
+ * Replace the current sink. The log entries are written to the standard out if
+ * the sink is NULL. The previous sink is closed when no thread is writing to it.
+ * Must not be called in an epoch critical section.
+ *
+ * @param   sink   new sink, NULL for the standard out
+ */
+void mdclog_internal_file_sink_set(struct file_sink *sink);
+
+/**
+ * Check if the log entries are written to a file
+ *
+ * @return  non-zero if a file sink is set
+ */
+int mdclog_internal_file_sink_active(void);
+
+/**
+ * Get the generation of the output, which changes whenever the log entries
+ * start to be written to another file: when the sink is replaced or the file
+ * is rotated
+ *
+ * @return  generation of the output
+ */
+unsigned long mdclog_internal_output_generation(void);
+
+/**
+ * Get the file descriptor the log entries are written to: the current file of
+ * the file sink, or the standard out. Must be called in an epoch critical
+ * section, and the descriptor is valid until the section is left.
+ *
+ * @return  the file descriptor, -1 if the entries are sent to a connected socket sink
+ */
+int mdclog_internal_output_fd(void);
+
+/**
+ * Start a new output generation, when the log entries start to be written to
+ * another destination than the file sink, e.g. a socket connection
+ */
+void mdclog_internal_output_changed(void);
+
+/**
+ * Write to the connected socket sink, or to the current file sink. The file is
+ * rotated after the write if it is due; the other threads keep writing to the
+ * previous file meanwhile.
+ *
+ * @param   buffer   data to write
+ * @param   len      length of the data
+ *
+ * @return  as write()
+ */
+ssize_t mdclog_internal_output_write(const void *buffer, size_t len);
+
+/**
+ * Write to the current file sink, or to the standard out if there is none,
+ * bypassing the socket sink
+ *
+ * @return  as mdclog_internal_output_write()
+ */
+ssize_t mdclog_internal_output_write_local(const void *buffer, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INCLUDE_PRIVATE_FILESINK_H_ */
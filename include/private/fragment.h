@@ -0,0 +1,65 @@
+/*
+ * fragment.h
+ *
+ * Internal splitting of large log entries into fragments
+ *
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ */
+
+
+#ifndef INCLUDE_PRIVATE_FRAGMENT_H_
+#define INCLUDE_PRIVATE_FRAGMENT_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Function writing a fragment
+ *
+ * @param   fragment   fragment, including the ending newline
+ * @param   len        length of the fragment, at most PIPE_BUF bytes
+ */
+typedef void (*fragment_write_fn_t)(const char *fragment, size_t len);
+
+/**
+ * Split a log entry into fragments, which are written one by one. Every fragment is
+ * a json object of one line, at most PIPE_BUF bytes long:
+ *
+ * {"fragment":{"pid":1234,"id":5,"seq":0,"last":false},"data":"..."}
+ *
+ * The fragments of an entry have the same process id and entry id, and sequence
+ * numbers starting from 0. The entry is reassembled by concatenating the de-escaped
+ * data strings of the fragments in sequence order.
+ *
+ * @param   entry   formatted log entry, without the ending newline
+ * @param   len     length of the log entry
+ * @param   write   function writing the fragments
+ *
+ * @return  number of fragments written
+ */
+size_t mdclog_internal_write_fragments(const char *entry, size_t len, fragment_write_fn_t write);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INCLUDE_PRIVATE_FRAGMENT_H_ */
@@ -26,6 +26,7 @@
 
 #include <stddef.h>
 #include <stdarg.h>
+#include <limits.h>
 #include <sys/time.h>
 
 #include "mdclog/mdclog.h"
@@ -33,19 +34,154 @@
 
 #define MIN_BUFFER_LENGTH   1000
 
+/**
+ * Maximum length of the MDC section captured to a deferred log entry.
+ * Leaves room for the other fields when the entry is formatted to a PIPE_BUF long buffer.
+ */
+#define DEFERRED_MDC_MAX_LENGTH   (PIPE_BUF - 256)
+
+/**
+ * Number of log entry fields
+ */
+#define JSON_FIELD_COUNT        (MDCLOG_FIELD_MESSAGE + 1)
+
+/**
+ * Number of severities with a header template of their own. Unknown severities
+ * share one more template, which has no severity field.
+ */
+#define JSON_SEVERITY_COUNT     (MDCLOG_TRACE + 1)
+
+/**
+ * Size of the text of a header template. Fits all fields with the longest keys.
+ */
+#define JSON_HEADER_MAX_LENGTH  512
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/**
+ * Keys and order of the log entry fields
+ */
+struct json_layout
+{
+    char           keys[JSON_FIELD_COUNT][MDCLOG_FIELD_KEY_MAX_LENGTH + 1];  //! indexed by mdclog_field_t
+    mdclog_field_t order[JSON_FIELD_COUNT];  //! written fields, the message is the last one
+    size_t         field_count;
+};
+
+enum json_part_type
+{
+    JSON_PART_CONSTANT,     //! run of fields that do not change between log entries
+    JSON_PART_TIMESTAMP,
+    JSON_PART_MDC,
+    JSON_PART_MESSAGE
+};
+
+/**
+ * Part of a header template. A constant part is a run of complete fields, each
+ * followed by a comma. The other parts contain the key of the field, whose value
+ * is formatted for every log entry.
+ */
+struct json_part
+{
+    enum json_part_type type;
+    unsigned short      offset;         //! start of the part in the template text
+    unsigned short      len;
+    unsigned short      field_ends[JSON_FIELD_COUNT];   //! ends of the constant fields in the part
+    unsigned short      field_count;
+};
+
+/**
+ * Pre-rendered fields of the log entries with one severity
+ */
+struct json_header
+{
+    char             text[JSON_HEADER_MAX_LENGTH];
+    struct json_part parts[JSON_FIELD_COUNT];
+    size_t           part_count;
+};
+
+/**
+ * Log entry layout compiled to header templates
+ */
+struct json_schema
+{
+    struct json_header        headers[JSON_SEVERITY_COUNT + 1];
+    size_t                    minimum_message_len;  //! length of the message field containing only the truncation text
+    mdclog_timestamp_format_t timestamp_format;     //! format of the timestamp field
+};
+
+/**
+ * Information about a formatted log entry
+ */
+struct json_info
+{
+    size_t timestamp_start;     //! location of the timestamp field in the entry
+    size_t timestamp_end;       //! after the comma following the field, equal to start if there is no timestamp
+    int    truncated;           //! the message was truncated to fit to the buffer
+};
+
+/**
+ * An MDC of a log entry, whose value is escaped
+ */
+struct json_mdc
+{
+    const char* key;
+    size_t      key_len;
+    const char* value;
+    size_t      value_len;
+};
+
+/**
+ * Set the default keys and order of the log entry fields
+ *
+ * @param   layout   output: default layout
+ */
+void mdclog_internal_default_layout(struct json_layout* layout);
+
+/**
+ * Set the key of a log entry field
+ *
+ * @param   layout   layout
+ * @param   field    log entry field
+ * @param   key      key of the field
+ *
+ * @return  0 in case of success, -1 in case of error. Errno is set
+ */
+int mdclog_internal_set_layout_key(struct json_layout* layout, mdclog_field_t field, const char* key);
+
+/**
+ * Set the written log entry fields and their order
+ *
+ * @param   layout   layout
+ * @param   fields   fields in the order they are written, the message must be the last one
+ * @param   count    number of fields
+ *
+ * @return  0 in case of success, -1 in case of error. Errno is set
+ */
+int mdclog_internal_set_layout_order(struct json_layout* layout, const mdclog_field_t* fields, size_t count);
+
+/**
+ * Render the header templates of a layout. The timestamps are rendered in milliseconds since the epoch
+ * until the caller sets another format to the schema
+ *
+ * @param   schema     output: header templates
+ * @param   layout     keys and order of the fields
+ * @param   identity   name of the logger, escaped
+ */
+void mdclog_internal_compile_schema(struct json_schema* schema, const struct json_layout* layout, const char* identity);
+
 /**
  * Format a log entry into a json string
  *
  * @param   buffer     output: json string with the ending zero
  * @param   len        size of the buffer, including the ending zero
  * @param   timestamp  timestamp
- * @param   logger     name of the logger
+ * @param   schema     header templates
  * @param   severity   severity of the log message
  * @param   mdc        MDC
+ * @param   info       output: information about the formatted entry, may be NULL
  * @param   msg        log message
  * @param   va_list    variable length arguments list
  *
@@ -56,14 +192,120 @@ extern "C" {
 int mdclog_internal_format_to_json_str(char* buffer,
                        size_t len,
                        struct timeval* timestamp,
-                       const char* logger,
+                       const struct json_schema* schema,
+                       mdclog_severity_t severity,
+                       mdc_t* mdc,
+                       struct json_info* info,
+                       const char* msg,
+                       va_list arglist);
+
+/**
+ * Capture a log entry for formatting it later with mdclog_internal_format_deferred_to_json_str().
+ * The MDC object is formatted, the message arguments are copied without formatting them.
+ *
+ * @param   buffer     output: captured log entry
+ * @param   len        size of the buffer
+ * @param   timestamp  timestamp
+ * @param   severity   severity of the log message
+ * @param   mdc        MDC
+ * @param   msg        log message format, must stay valid until the entry is formatted
+ * @param   va_list    variable length arguments list
+ *
+ * @return  in case of success: length of the captured log entry
+ *          in case of error: -1, if the message format is not supported or the entry does not fit
+ */
+int mdclog_internal_capture_deferred(char* buffer,
+                       size_t len,
+                       struct timeval* timestamp,
                        mdclog_severity_t severity,
                        mdc_t* mdc,
                        const char* msg,
                        va_list arglist);
 
 /**
- * Escape \ and " characters
+ * Format a log entry captured with mdclog_internal_capture_deferred() into a json string
+ *
+ * @param   buffer      output: json string with the ending zero
+ * @param   len         size of the buffer, including the ending zero
+ * @param   schema      header templates
+ * @param   record      captured log entry
+ * @param   record_len  length of the captured log entry
+ *
+ * @return  in case of success: length of the output json string, excluding the ending zero
+ *          in case of error: -1
+ */
+int mdclog_internal_format_deferred_to_json_str(char* buffer,
+                       size_t len,
+                       const struct json_schema* schema,
+                       const char* record,
+                       size_t record_len);
+
+/**
+ * Format a log entry into a json string from an array of MDCs and message arguments
+ * captured with mdclog_internal_capture_args(). The result is the same as formatting
+ * the original arguments with mdclog_internal_format_to_json_str(), when the MDCs are
+ * given in the order the MDC object is formatted.
+ *
+ * @param   buffer     output: json string with the ending zero
+ * @param   len        size of the buffer, including the ending zero
+ * @param   timestamp  timestamp
+ * @param   schema     header templates
+ * @param   severity   severity of the log message
+ * @param   mdcs       MDCs, can be NULL if the count is 0
+ * @param   mdc_count  number of the MDCs
+ * @param   info       output: information about the formatted entry, may be NULL
+ * @param   msg        log message format
+ * @param   args       captured arguments
+ * @param   args_len   length of the captured arguments
+ *
+ * @return  in case of success: length of the output json string, excluding the ending zero
+ *          in case of error: -1
+ */
+int mdclog_internal_format_captured_to_json_str(char* buffer,
+                       size_t len,
+                       const struct timeval* timestamp,
+                       const struct json_schema* schema,
+                       mdclog_severity_t severity,
+                       const struct json_mdc* mdcs,
+                       size_t mdc_count,
+                       struct json_info* info,
+                       const char* msg,
+                       const char* args,
+                       size_t args_len);
+
+/**
+ * Format a log entry with typed fields into a json string. The message is
+ * escaped without formatting, and the fields that fit to the buffer are
+ * written before the message field.
+ *
+ * @param   buffer       output: json string with the ending zero
+ * @param   len          size of the buffer, including the ending zero
+ * @param   timestamp    timestamp
+ * @param   schema       header templates
+ * @param   severity     severity of the log message
+ * @param   mdc          MDC
+ * @param   info         output: information about the formatted entry, may be NULL
+ * @param   msg          log message
+ * @param   fields       the fields
+ * @param   field_count  number of the fields
+ *
+ * @return  in case of success: length of the output json string, excluding the ending zero
+ *          in case of error: -1
+ */
+int mdclog_internal_format_kv_to_json_str(char* buffer,
+                       size_t len,
+                       struct timeval* timestamp,
+                       const struct json_schema* schema,
+                       mdclog_severity_t severity,
+                       mdc_t* mdc,
+                       struct json_info* info,
+                       const char* msg,
+                       const mdclog_kv_t* fields,
+                       size_t field_count);
+
+/**
+ * Escape \ and " characters and replace characters outside of the printable
+ * ASCII range with a space.
  * If the escaped string does not fit to the buffer, it is cut.
  *
  * @param   buffer    output: escaped str
@@ -75,6 +317,20 @@ int mdclog_internal_format_to_json_str(char* buffer,
  */
 size_t mdclog_internal_escape(char* buffer, size_t len, const char* str, int* truncated);
 
+/**
+ * Escape a string of the given length like mdclog_internal_escape(). A zero
+ * character in the string is replaced with a space.
+ *
+ * @param   buffer    output: escaped str
+ * @param   len       size of the buffer, including the ending zero
+ * @param   str       string to be escaped
+ * @param   str_len   length of the string
+ * @param   truncated output: was the escaped string truncated
+ *
+ * @return  length of the escaped string, excluding the ending zero
+ */
+size_t mdclog_internal_escape_len(char* buffer, size_t len, const char* str, size_t str_len, int* truncated);
+
 /**
  * De-escape the string and replace non-printable chars with a space.
  * If the de-escaped string does not fit to the buffer, it is cut.
@@ -0,0 +1,82 @@
+/*
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ */
+
+
+#ifndef INCLUDE_PRIVATE_KV_H_
+#define INCLUDE_PRIVATE_KV_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mdclog/mdclog.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Size of a buffer that fits any number formatted by the functions below
+ */
+#define KV_NUMBER_MAX_LENGTH 32
+
+/**
+ * Format an unsigned integer in decimal
+ *
+ * @param   buffer   output: the digits, not zero terminated. KV_NUMBER_MAX_LENGTH bytes.
+ * @param   value    the integer
+ *
+ * @return  number of the digits
+ */
+size_t mdclog_internal_format_uint64(char *buffer, uint64_t value);
+
+/**
+ * Format a signed integer in decimal
+ *
+ * @return  as mdclog_internal_format_uint64()
+ */
+size_t mdclog_internal_format_int64(char *buffer, int64_t value);
+
+/**
+ * Format a double as a json number with the fewest significant digits that
+ * are parsed back to the same value. Not finite values are formatted as null.
+ *
+ * @return  as mdclog_internal_format_uint64()
+ */
+size_t mdclog_internal_format_double(char *buffer, double value);
+
+/**
+ * Format fields to json object members, each followed by a comma. The fields
+ * are formatted until one does not fit to the buffer. A field without a key
+ * is skipped.
+ *
+ * @param   buffer   output: the members, zero terminated
+ * @param   len      size of the buffer, including the ending zero
+ * @param   fields   the fields
+ * @param   count    number of the fields
+ *
+ * @return  length of the members, excluding the ending zero
+ */
+size_t mdclog_internal_format_kv_fields(char *buffer, size_t len, const mdclog_kv_t *fields, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INCLUDE_PRIVATE_KV_H_ */
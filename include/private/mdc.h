@@ -26,6 +26,8 @@
 #ifndef INCLUDE_PRIVATE_MDC_H_
 #define INCLUDE_PRIVATE_MDC_H_
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -42,7 +44,9 @@ int mdclog_internal_init_mdc(void);
 
 /**
  * Get first MDC in the list for the thread
- * or null if there are no MDC's set
+ * or null if there are no MDC's set.
+ * The MDCs are iterated from the newest to the oldest. The returned MDC is
+ * valid until the MDCs of the thread are modified.
  *
  * @return    MDC pointer or NULL
  */
@@ -65,6 +69,49 @@ int mdclog_internal_put_mdc(const char *key, const char *value);
  */
 void mdclog_internal_rm_mdc(const char *key);
 
+/**
+ * Start an MDC scope of the thread
+ *
+ * @return   number of the scope, -1 in case of error. Errno is set
+ */
+int mdclog_internal_push_mdc_scope(void);
+
+/**
+ * End an MDC scope of the thread and the scopes inside it, and remove the
+ * MDCs added in them
+ *
+ * @param    scope   number of the scope returned by mdclog_internal_push_mdc_scope()
+ *
+ * @return   -1 if the scope is not open. Errno is set
+ */
+int mdclog_internal_pop_mdc_scope(int scope);
+
+/**
+ * Take a snapshot of the MDCs of the thread. The snapshot is cached until
+ * the MDCs of the thread are modified.
+ *
+ * @return   snapshot with a reference for the caller,
+ *           NULL in case of error. Errno is set
+ */
+struct mdclog_mdc_snapshot *mdclog_internal_snapshot_mdcs(void);
+
+/**
+ * Replace the MDCs of the thread with the MDCs of a snapshot. The thread
+ * takes a reference to the snapshot.
+ *
+ * @param    snapshot   the snapshot
+ *
+ * @return   -1 in case of error. Errno is set
+ */
+int mdclog_internal_adopt_mdcs(struct mdclog_mdc_snapshot *snapshot);
+
+/**
+ * Release a reference to a snapshot, and free it if it was the last one
+ *
+ * @param    snapshot   the snapshot or NULL
+ */
+void mdclog_internal_release_mdc_snapshot(struct mdclog_mdc_snapshot *snapshot);
+
 /**
  * Get next MDC in the list
  *
@@ -105,6 +152,97 @@ const char *mdclog_internal_get_mdc_val(mdc_t *mdc);
  */
 const char *mdclog_internal_get_mdc_key(mdc_t *mdc);
 
+/**
+ * MDCs serialized to json object members, "key1":"value1","key2":"value2".
+ * The object members are the global MDCs followed by the thread MDCs,
+ * joined with a comma if both are non-empty.
+ */
+struct mdc_json
+{
+    const char *global;        //! global MDCs not overridden by the thread, can be empty
+    size_t      global_len;
+    const char *thread;        //! thread MDCs in the list order, can be empty
+    size_t      thread_len;
+};
+
+/**
+ * Get the MDCs of the calling thread and the global MDCs serialized to json.
+ * A thread MDC overrides a global MDC with the same key. The thread MDCs are
+ * cached and serialized again only after the MDCs have been modified.
+ * Must be called in an epoch critical section, see private/epoch.h.
+ *
+ * @param   mdc    first MDC of the list to serialize. The cache is used only if
+ *                 it is the first MDC of the calling thread, NULL if the list is empty.
+ * @param   json   output: serialized MDCs, valid until the MDCs of the thread are modified.
+ *                 The global MDCs are valid until the epoch critical section is left.
+ *
+ * @return  0 in case of success
+ *          -1 if mdc is not the first MDC of the thread or memory cannot be allocated
+ */
+int mdclog_internal_get_mdc_json(mdc_t *mdc, struct mdc_json *json);
+
+/**
+ * Set the process global MDCs, which are shared by all threads. The
+ * previous global MDCs are replaced. The global MDCs are not modified after
+ * they have been set, so they can be read without locking. The replaced
+ * global MDCs are freed after the epoch critical sections reading them have
+ * been left, so the function must not be called in a critical section.
+ *
+ * @param   keys     the keys. A duplicate key is ignored.
+ * @param   values   the values
+ * @param   count    number of the MDCs
+ *
+ * @return  -1 in case of error. Errno is set
+ */
+int mdclog_internal_set_global_mdcs(const char *const *keys, const char *const *values, size_t count);
+
+/**
+ * Get the first global MDC. The rest of the global MDCs are got with
+ * mdclog_internal_get_next_mdc(). Must be called in an epoch critical
+ * section, and the MDCs are valid until the section is left.
+ *
+ * @return  MDC or NULL if there are no global MDCs
+ */
+mdc_t *mdclog_internal_get_first_global_mdc(void);
+
+/**
+ * Search a global MDC with key. Must be called in an epoch critical
+ * section, and the MDC is valid until the section is left.
+ *
+ * @param    key   The key
+ *
+ * @return   MDC or NULL if MDC is not found
+ */
+mdc_t *mdclog_internal_search_global_mdc(const char *key);
+
+/**
+ * Remove the global MDCs. Must not be called in an epoch critical section.
+ */
+void mdclog_internal_clean_global_mdcs(void);
+
+/**
+ * Get the scratch buffer of the calling thread. The buffer is grown when
+ * needed, and released when the thread exits.
+ *
+ * @param   len   minimum size of the buffer
+ *
+ * @return  buffer, valid until the next call from the same thread,
+ *          NULL if memory cannot be allocated
+ */
+char *mdclog_internal_get_scratch(size_t len);
+
+/**
+ * Get the buffer of the calling thread for formatting log entries that do not
+ * fit to PIPE_BUF bytes. The buffer is grown when needed, and released when
+ * the thread exits.
+ *
+ * @param   len   minimum size of the buffer
+ *
+ * @return  buffer, valid until the next call from the same thread,
+ *          NULL if memory cannot be allocated
+ */
+char *mdclog_internal_get_entry_buffer(size_t len);
+
 /**
  * Destroy whole MDC list, including the list pointer itself
  */
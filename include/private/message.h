@@ -0,0 +1,56 @@
+/*
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ */
+
+
+#ifndef INCLUDE_PRIVATE_MESSAGE_H_
+#define INCLUDE_PRIVATE_MESSAGE_H_
+
+#include <stddef.h>
+#include <stdarg.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Format a printf style message and escape it for json in the same pass,
+ * directly to the output buffer. The output equals the output of vsnprintf()
+ * escaped with mdclog_internal_escape(). The parsed format string is cached
+ * per calling thread.
+ *
+ * If the format string has a conversion that is not supported, the arguments
+ * are not read and the caller shall format the message in some other way.
+ *
+ * @param   buffer     output: the escaped message, zero terminated
+ * @param   len        size of the buffer, including the ending zero
+ * @param   format     printf style format string
+ * @param   arglist    the arguments of the format string
+ * @param   truncated  output: was the escaped message truncated
+ *
+ * @return  length of the escaped message, excluding the ending zero,
+ *          or -1 if the format string is not supported
+ */
+int mdclog_internal_format_message(char* buffer, size_t len, const char* format, va_list arglist, int* truncated);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INCLUDE_PRIVATE_MESSAGE_H_ */
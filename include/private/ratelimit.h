@@ -0,0 +1,132 @@
+/*
+ * ratelimit.h
+ *
+ * Internal rate limiting and sampling of log entries
+ *
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ */
+
+
+#ifndef INCLUDE_PRIVATE_RATELIMIT_H_
+#define INCLUDE_PRIVATE_RATELIMIT_H_
+
+#include <stdint.h>
+
+#include "mdclog/mdclog.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Number of call sites, identified by the format string, that get a token bucket of their own.
+ * The call sites not fitting to the table share one bucket.
+ */
+#define RATE_LIMIT_SITES                    1024
+
+/**
+ * Default interval of the suppression summary entries
+ */
+#define SUPPRESSION_DEFAULT_SUMMARY_INTERVAL_MS  10000
+
+/**
+ * Counts of log entries suppressed since the previous summary
+ */
+struct suppression_summary
+{
+    uint64_t          rate_limited;   //! entries discarded by the rate limiting
+    uint64_t          sampled_out;    //! entries discarded by the sampling
+    mdclog_severity_t severity;       //! severity of the most severe discarded entry
+};
+
+/**
+ * Set the rate limit of a call site
+ *
+ * @param   per_second   entries per second a call site can write on average, 0 disables rate limiting
+ * @param   burst        entries a call site can write at once, 0 for the same as per_second
+ *
+ * @return  0 in case of success, -1 in case of error. Errno is set
+ */
+int mdclog_internal_set_rate_limit(unsigned per_second, unsigned burst);
+
+/**
+ * Set the probability of writing an entry with the given severity
+ *
+ * @param   severity      severity of the log entries
+ * @param   probability   probability between 0.0 and 1.0
+ *
+ * @return  0 in case of success, -1 in case of error. Errno is set
+ */
+int mdclog_internal_set_sampling(mdclog_severity_t severity, double probability);
+
+/**
+ * Set the minimum interval between two suppression summaries
+ *
+ * @param   interval_ms   interval in milliseconds
+ */
+void mdclog_internal_set_summary_interval(unsigned interval_ms);
+
+/**
+ * Check if rate limiting or sampling is in use, or if there are suppressed entries
+ * not yet reported. If not, mdclog_internal_admit() need not be called.
+ *
+ * @return  non-zero if mdclog_internal_admit() must be called
+ */
+int mdclog_internal_suppression_active(void);
+
+/**
+ * Decide whether a log entry passing the logging level is written.
+ * The entry is first sampled according to its severity, and then taken a token from
+ * the bucket of its call site.
+ *
+ * @param   site     call site of the entry, NULL if the call site is identified by the format string
+ * @param   format   format string of the entry
+ * @param   severity severity of the entry
+ * @param   now_ns   current time of a monotonic clock in nanoseconds
+ *
+ * @return  1 if the entry is written, 0 if it is suppressed
+ */
+int mdclog_internal_admit(mdclog_site_t *site, const char *format, mdclog_severity_t severity, uint64_t now_ns);
+
+/**
+ * Take the counts of the entries suppressed since the previous summary, if the summary
+ * interval has elapsed since the first of them was suppressed. The interval starts when
+ * this function is called the first time after the entry was suppressed.
+ * Only one of concurrent callers gets the summary.
+ *
+ * @param   now_ns    current time of a monotonic clock in nanoseconds
+ * @param   force     non-zero to ignore the summary interval
+ * @param   summary   output: suppressed entries
+ *
+ * @return  1 if a summary must be written, 0 if not
+ */
+int mdclog_internal_take_summary(uint64_t now_ns, int force, struct suppression_summary *summary);
+
+/**
+ * Get the cumulative suppression statistics
+ *
+ * @param   stats   output: the rate_limited and sampled_out fields are set
+ */
+void mdclog_internal_suppression_stats(mdclog_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INCLUDE_PRIVATE_RATELIMIT_H_ */
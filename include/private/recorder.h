@@ -0,0 +1,140 @@
+/*
+ * recorder.h
+ *
+ * Internal memory mapped flight recorder of log entries
+ *
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ */
+
+
+#ifndef INCLUDE_PRIVATE_RECORDER_H_
+#define INCLUDE_PRIVATE_RECORDER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The recorder file starts with a header page, followed by the ring of records.
+ * All integers are in the byte order of the writing host.
+ */
+#define RECORDER_MAGIC        0x4d44434c4f475245ULL   //! "MDCLOGRE"
+#define RECORDER_VERSION      1
+#define RECORDER_HEADER_SIZE  4096
+
+/**
+ * Every record is preceded by its sequence number XORed with this value,
+ * so that a stale or torn record is not mistaken for a valid one
+ */
+#define RECORDER_RECORD_MAGIC 0x5245434f52440000ULL
+
+struct recorder_header
+{
+    uint64_t magic;       //! RECORDER_MAGIC
+    uint32_t version;     //! RECORDER_VERSION
+    uint32_t header_size; //! offset of the ring in the file
+    uint64_t capacity;    //! size of the ring, a power of two
+    uint64_t head;        //! sequence number of the next record
+};
+
+/**
+ * A record in the ring. The sequence number of a record is its byte position
+ * in the unbounded stream of records, i.e. the ring offset is the sequence
+ * number modulo the capacity. Records are 8 byte aligned and can wrap around
+ * the end of the ring.
+ */
+struct recorder_record
+{
+    uint64_t stamp;  //! sequence number XOR RECORDER_RECORD_MAGIC, stored after the entry
+    uint32_t length; //! length of the log entry following the record header
+    uint32_t size;   //! size of the record, including the header and padding
+};
+
+struct recorder;
+
+/**
+ * Function receiving an entry of the recorder
+ *
+ * @param   entry      log entry, without a newline
+ * @param   len        length of the log entry
+ * @param   sequence   sequence number of the entry
+ * @param   arg        argument given to mdclog_internal_recorder_read()
+ */
+typedef void (*recorder_read_fn_t)(const char *entry, size_t len, uint64_t sequence, void *arg);
+
+/**
+ * Open and map a recorder file. A file with the same capacity is continued,
+ * otherwise the file is initialized.
+ *
+ * @param   path       path of the file
+ * @param   capacity   size of the ring, a power of two
+ *
+ * @return  the recorder in case of success,
+ *          NULL in case of error. Errno is set as by open(), ftruncate() or mmap().
+ */
+struct recorder *mdclog_internal_recorder_open(const char *path, size_t capacity);
+
+/**
+ * Unmap a recorder that has not been set as the current one
+ *
+ * @param   recorder   recorder to close, can be NULL
+ */
+void mdclog_internal_recorder_close(struct recorder *recorder);
+
+/**
+ * Replace the current recorder. The previous recorder is unmapped when no
+ * thread is writing to it. Must not be called in an epoch critical section.
+ *
+ * @param   recorder   new recorder, NULL to stop recording
+ */
+void mdclog_internal_recorder_set(struct recorder *recorder);
+
+/**
+ * Append a log entry to the current recorder. The space is reserved with an
+ * atomic add, and the entry is copied to the mapped file. Does nothing if no
+ * recorder is set or the entry does not fit to half of the ring.
+ *
+ * @param   entry   log entry, without a newline
+ * @param   len     length of the log entry
+ */
+void mdclog_internal_recorder_write(const char *entry, size_t len);
+
+/**
+ * Read the entries of a recorder file from the oldest to the newest. Records
+ * that were being written or have been partly overwritten are skipped.
+ *
+ * @param   file       contents of the recorder file
+ * @param   file_len   length of the file
+ * @param   read       function receiving the entries
+ * @param   arg        argument of the function
+ *
+ * @return  number of entries read,
+ *          -1 in case of error. Errno EINVAL is set if the file is not a recorder file,
+ *             ENOMEM if memory cannot be allocated.
+ */
+long mdclog_internal_recorder_read(const void *file, size_t file_len, recorder_read_fn_t read, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INCLUDE_PRIVATE_RECORDER_H_ */
@@ -0,0 +1,92 @@
+/*
+ * repeat.h
+ *
+ * Internal suppression of repeated log entries
+ *
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ */
+
+
+#ifndef INCLUDE_PRIVATE_REPEAT_H_
+#define INCLUDE_PRIVATE_REPEAT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Function writing a log entry
+ *
+ * @param   entry   log entry, including the ending newline
+ * @param   len     length of the log entry
+ */
+typedef void (*repeat_write_fn_t)(const char *entry, size_t len);
+
+/**
+ * Compare a formatted log entry to the previous entry of the calling thread.
+ * The timestamps of the entries are not compared. A repeated entry is not written,
+ * but counted. The count is written as the "repeated" field of the latest repeated
+ * entry when a different entry is logged, or when the timeout has elapsed since the
+ * first uncounted repetition. After the timeout the count is written by the next call,
+ * or by the timer thread if it has been started.
+ *
+ * @param   entry        formatted log entry, without the ending newline
+ * @param   len          length of the log entry
+ * @param   skip_start   start of the timestamp field in the entry
+ * @param   skip_end     end of the timestamp field, equal to skip_start if the entry has no timestamp
+ * @param   timeout_ns   maximum time repetitions are counted before they are written
+ * @param   now_ns       current time of a monotonic clock in nanoseconds
+ * @param   write        function writing the repetition count entries, also when the thread exits
+ *
+ * @return  1 if the entry is a repetition and must not be written,
+ *          0 if the caller must write the entry
+ */
+int mdclog_internal_repeat_filter(const char *entry, size_t len, size_t skip_start, size_t skip_end,
+                                  uint64_t timeout_ns, uint64_t now_ns, repeat_write_fn_t write);
+
+/**
+ * Write the repetition count of the calling thread, if there are counted repetitions,
+ * and forget the previous entry
+ */
+void mdclog_internal_repeat_flush(void);
+
+/**
+ * Start the timer thread, which writes the repetition counts when their timeout
+ * elapses also if the threads do not log any more entries. The deadlines are
+ * compared to CLOCK_MONOTONIC, so now_ns of mdclog_internal_repeat_filter()
+ * must be read from it. The thread is stopped by mdclog_internal_repeat_flush_all().
+ *
+ * @return  -1 if the thread cannot be created. Errno is set
+ */
+int mdclog_internal_repeat_timer_start(void);
+
+/**
+ * Stop the timer thread, write the repetition counts of all threads and forget
+ * their previous entries
+ */
+void mdclog_internal_repeat_flush_all(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INCLUDE_PRIVATE_REPEAT_H_ */
@@ -0,0 +1,68 @@
+/*
+ * scan.h
+ *
+ * Scanning strings for characters that must be escaped in json strings
+ *
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ */
+
+
+#ifndef INCLUDE_PRIVATE_SCAN_H_
+#define INCLUDE_PRIVATE_SCAN_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Check if the character is special: backslash (\), double quotation mark (")
+ * or a character outside of the printable ASCII range
+ */
+#define SCAN_IS_SPECIAL(c) \
+    ((unsigned char)(c) < 0x20 || (unsigned char)(c) >= 0x7f || (c) == '\\' || (c) == '"')
+
+/**
+ * Find the first special character. The implementation is selected at load time
+ * based on the instruction set extensions supported by the CPU.
+ *
+ * @param   str   string to scan, does not need to be zero terminated
+ * @param   len   length of the string
+ *
+ * @return  index of the first special character, len if there are none
+ */
+size_t mdclog_internal_find_special(const char* str, size_t len);
+
+/*
+ * Implementations of mdclog_internal_find_special(), exposed for testing.
+ * The SSE2 and AVX2 variants exist only on x86-64, and the AVX2 variant
+ * must be called only if the CPU supports it.
+ */
+size_t mdclog_internal_find_special_scalar(const char* str, size_t len);
+#if defined(__x86_64__)
+size_t mdclog_internal_find_special_sse2(const char* str, size_t len);
+size_t mdclog_internal_find_special_avx2(const char* str, size_t len);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INCLUDE_PRIVATE_SCAN_H_ */
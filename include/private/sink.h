@@ -0,0 +1,107 @@
+/*
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ */
+
+
+#ifndef INCLUDE_PRIVATE_SINK_H_
+#define INCLUDE_PRIVATE_SINK_H_
+
+#include <stddef.h>
+
+#include "mdclog/mdclog.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Formats wanted by the sinks, returned by mdclog_internal_sinks_wanted()
+ */
+#define SINK_WANTS_JSON     0x1
+#define SINK_WANTS_RECORD   0x2
+
+/**
+ * Add a user sink
+ *
+ * @param   sink   the sink, copied
+ *
+ * @return  identifier of the sink, or -1 in case of error. Errno is set.
+ */
+int mdclog_internal_sink_add(const mdclog_sink_t *sink);
+
+/**
+ * Remove a user sink. The sink is not called when the function returns.
+ * Must not be called in an epoch critical section.
+ *
+ * @param   id   identifier returned by mdclog_internal_sink_add()
+ *
+ * @return  0 in case of success, -1 in case of error. Errno is set.
+ */
+int mdclog_internal_sink_remove(int id);
+
+/**
+ * Remove all user sinks. Must not be called in an epoch critical section.
+ */
+void mdclog_internal_sinks_clear(void);
+
+/**
+ * Lowest severity wanted by any sink
+ *
+ * @return  the level, -1 if there are no sinks
+ */
+int mdclog_internal_sink_level(void);
+
+/**
+ * Check which formats the sinks want for a log entry
+ *
+ * @param   severity   severity of the log entry
+ *
+ * @return  SINK_WANTS_JSON and SINK_WANTS_RECORD flags, 0 if no sink wants the entry
+ */
+int mdclog_internal_sinks_wanted(mdclog_severity_t severity);
+
+/**
+ * Check if the calling thread is running a sink. The log entries written by a
+ * sink are discarded.
+ *
+ * @return  non-zero if a sink is running
+ */
+int mdclog_internal_sink_running(void);
+
+/**
+ * Pass a json log entry to the json sinks wanting its severity
+ *
+ * @param   severity   severity of the log entry
+ * @param   entry      zero terminated log entry without the ending newline
+ * @param   len        length of the log entry
+ */
+void mdclog_internal_sinks_write_json(mdclog_severity_t severity, const char *entry, size_t len);
+
+/**
+ * Pass a record to the record sinks wanting its severity
+ *
+ * @param   record   the record
+ */
+void mdclog_internal_sinks_write_record(const mdclog_record_t *record);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INCLUDE_PRIVATE_SINK_H_ */
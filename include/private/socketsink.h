@@ -0,0 +1,120 @@
+/*
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ */
+
+
+#ifndef INCLUDE_PRIVATE_SOCKETSINK_H_
+#define INCLUDE_PRIVATE_SOCKETSINK_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "mdclog/mdclog.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Length of the frame header, the payload length as a 32-bit big-endian integer
+ */
+#define SOCKET_FRAME_HEADER_LENGTH   4
+
+/**
+ * Delay of the first reconnection attempt. The delay is doubled after every
+ * failed attempt up to the maximum.
+ */
+#define SOCKET_SINK_MIN_BACKOFF_MS   100
+#define SOCKET_SINK_MAX_BACKOFF_MS   10000
+
+/**
+ * How long a send may wait for the collector to read, before the connection
+ * is considered broken
+ */
+#define SOCKET_SINK_SEND_TIMEOUT_MS  1000
+
+struct socket_sink;
+
+/**
+ * Socket sink configuration
+ */
+struct socket_sink_config
+{
+    mdclog_socket_type_t type;
+    size_t               batch_size;          //! maximum bytes sent with one system call
+    unsigned             flush_interval_ms;   //! how long a partial batch may wait for more entries
+    int                  lines;               //! the written data are newline terminated log entries,
+                                              //! which are framed one by one without the newline.
+                                              //! Otherwise every write is one frame.
+};
+
+/**
+ * Open a unix domain socket sink and start its sender thread. The connection is
+ * tried once before returning; if the collector is not listening, the sender
+ * thread keeps reconnecting.
+ *
+ * @param   path     path of the socket
+ * @param   config   configuration
+ *
+ * @return  the sink in case of success,
+ *          NULL in case of error. Errno is set to ENAMETOOLONG, ENOMEM or as by pthread_create().
+ */
+struct socket_sink *mdclog_internal_socket_sink_open(const char *path, const struct socket_sink_config *config);
+
+/**
+ * Send the queued entries, stop the sender thread and free the sink. The sink
+ * must not be the current one.
+ *
+ * @param   sink   sink, can be NULL
+ */
+void mdclog_internal_socket_sink_close(struct socket_sink *sink);
+
+/**
+ * Replace the current socket sink. The previous sink sends the queued entries,
+ * if it is connected, and is closed when no thread is writing to it.
+ * Must not be called in an epoch critical section.
+ *
+ * @param   sink   new sink, NULL for none
+ */
+void mdclog_internal_socket_sink_set(struct socket_sink *sink);
+
+/**
+ * Check if the log entries are sent to a connected socket
+ *
+ * @return  non-zero if a socket sink is set and connected
+ */
+int mdclog_internal_socket_sink_connected(void);
+
+/**
+ * Queue data to be sent to the current socket sink. Waits if the queue is full.
+ *
+ * @param   buffer   data to write
+ * @param   len      length of the data
+ *
+ * @return  len in case of success,
+ *          -1 in case of error. Errno ENOTCONN is set if there is no socket sink or it is
+ *          not connected, in which case the data should be written to the fallback output.
+ */
+ssize_t mdclog_internal_socket_sink_write(const void *buffer, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INCLUDE_PRIVATE_SOCKETSINK_H_ */
@@ -46,6 +46,14 @@ extern "C" {
 ssize_t system_write(int, const void*,size_t);
 #endif
 
+// Thread local variables of the library are accessed with the initial-exec model,
+// which does not need a function call to find the variable
+#if defined(__GNUC__)
+#define TLS_INITIAL_EXEC __attribute__((tls_model("initial-exec")))
+#else
+#define TLS_INITIAL_EXEC
+#endif
+
 #ifndef TEMP_FAILURE_RETRY
 // this has slightly different semantics
 // than glibc's unistd.h: we continue
@@ -0,0 +1,93 @@
+/*
+ * timestamp.h
+ *
+ * Internal clock sources and timestamp rendering
+ *
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ */
+
+
+#ifndef INCLUDE_PRIVATE_TIMESTAMP_H_
+#define INCLUDE_PRIVATE_TIMESTAMP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "mdclog/mdclog.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Maximum length of a decimal rendered with mdclog_internal_render_decimal()
+ */
+#define DECIMAL_MAX_LENGTH  20
+
+/**
+ * How often the time stamp counter is calibrated against CLOCK_REALTIME
+ */
+#define TSC_CALIBRATION_INTERVAL_NS  1000000000ULL
+
+/**
+ * Read the wall clock time from the given clock source
+ *
+ * @param   clock   clock source. MDCLOG_CLOCK_TSC falls back to MDCLOG_CLOCK_REALTIME
+ *                  if the CPU has no invariant time stamp counter.
+ * @param   tv      output: current time
+ */
+void mdclog_internal_clock_read(mdclog_clock_t clock, struct timeval *tv);
+
+/**
+ * Check if the CPU has a time stamp counter usable as a clock source
+ *
+ * @return  non-zero if MDCLOG_CLOCK_TSC reads the time stamp counter
+ */
+int mdclog_internal_tsc_available(void);
+
+/**
+ * Render an unsigned integer as a decimal number, without the ending zero
+ *
+ * @param   buffer   output: at least DECIMAL_MAX_LENGTH bytes
+ * @param   value    value to render
+ *
+ * @return  length of the rendered number
+ */
+size_t mdclog_internal_render_decimal(char *buffer, uint64_t value);
+
+/**
+ * Render the value of the timestamp field in the given format.
+ * The part that changes only once per second is cached by the calling thread.
+ *
+ * @param   buffer   output: timestamp value with the ending zero
+ * @param   len      size of the buffer
+ * @param   tv       timestamp
+ * @param   format   timestamp format
+ *
+ * @return  length of the rendered value, 0 if it does not fit to the buffer
+ */
+size_t mdclog_internal_render_timestamp(char *buffer, size_t len, const struct timeval *tv,
+                                        mdclog_timestamp_format_t format);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INCLUDE_PRIVATE_TIMESTAMP_H_ */
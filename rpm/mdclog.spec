@@ -39,6 +39,8 @@ rm -f %{buildroot}%{_libdir}/lib*.*a
 
 %files
 %{_libdir}/*.so.*
+%{_bindir}/mdclog-recorder
+%{_bindir}/mdclog-decode
 
 %files devel
 %{_libdir}/*.so
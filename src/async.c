@@ -0,0 +1,747 @@
+/*
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ *
+ * Asynchronous logging
+ * Every logging thread queues its log entries to a thread specific single
+ * producer, single consumer ring buffer. The ring buffers are linked to a
+ * registry, which is emptied by a background drain thread.
+ * When a thread exits, its ring buffer is marked closed and the drain thread
+ * releases it after the remaining entries have been written.
+ * A ring buffer holds either formatted log entries or deferred entries, which
+ * the drain thread formats before writing them.
+ * The drain thread collects the entries to a batch buffer and writes several
+ * entries with one system call. When the standard out is a pipe, a batch is at
+ * most PIPE_BUF bytes so that the entries are not interleaved with the output
+ * of other processes writing to the same pipe.
+ *
+ */
+#include "private/async.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "private/epoch.h"
+#include "private/filesink.h"
+#include "private/system.h"
+
+#define CACHE_LINE           64
+#define RECORD_ALIGN         8
+#define RECORD_HEADER_SIZE   sizeof(struct record_header)
+#define RECORD_SIZE(len)     ((RECORD_HEADER_SIZE + (len) + RECORD_ALIGN - 1) & ~((uint64_t)RECORD_ALIGN - 1))
+#define MAX_ENTRY_LENGTH     PIPE_BUF
+#define DRAIN_INTERVAL_MS    100
+#define DRAIN_BATCH          64     // max entries written from one ring before moving to the next one
+#define BLOCK_SPIN_COUNT     100
+#define BLOCK_SLEEP_NS       50000
+
+enum record_type
+{
+    RECORD_ENTRY    = 0,
+    RECORD_PADDING  = 1,    // fills the end of the buffer when a record does not fit before wrapping
+    RECORD_DEFERRED = 2     // log entry to be formatted by the drain thread
+};
+
+struct record_header
+{
+    uint32_t len;           // payload length, excluding the header
+    uint32_t type;
+};
+
+struct ring
+{
+    // consumer side, the producer touches it only when dropping the oldest entries
+    _Atomic uint64_t head __attribute__((aligned(CACHE_LINE)));
+    // producer side
+    _Atomic uint64_t tail __attribute__((aligned(CACHE_LINE)));
+    _Atomic int      busy;
+    _Atomic uint64_t dropped;
+    // read-mostly
+    char            *data __attribute__((aligned(CACHE_LINE)));
+    uint64_t         mask;
+    int              closed;      // owner thread has exited, protected by registry_mutex
+    struct ring     *next;        // modified under registry_mutex
+};
+
+static struct
+{
+    pthread_mutex_t  control_mutex;     // serializes start and stop
+    pthread_mutex_t  registry_mutex;
+    struct ring     *rings;             // protected by registry_mutex
+    int              running;           // drain thread exists, protected by registry_mutex
+    _Atomic uint64_t written;
+    _Atomic uint64_t syscalls;
+    uint64_t         dropped;           // drops of released rings, protected by registry_mutex
+    pthread_mutex_t  wakeup_mutex;
+    pthread_cond_t   wakeup_cond;
+    _Atomic int      sleeping;
+    _Atomic int      active;
+    _Atomic int      stopping;
+    _Atomic size_t   capacity;
+    _Atomic int      policy;
+    _Atomic size_t   batch_size;
+    _Atomic unsigned flush_interval_ms;
+    async_format_fn_t format;
+    pthread_t        thread;
+} async =
+{
+    .control_mutex  = PTHREAD_MUTEX_INITIALIZER,
+    .registry_mutex = PTHREAD_MUTEX_INITIALIZER,
+    .wakeup_mutex   = PTHREAD_MUTEX_INITIALIZER,
+    .capacity       = ASYNC_DEFAULT_CAPACITY,
+    .policy         = MDCLOG_OVERFLOW_BLOCK,
+    .batch_size     = ASYNC_DEFAULT_BATCH_SIZE,
+};
+
+/*
+ * Log entries collected by the drain thread for writing them with one system call
+ */
+struct batch
+{
+    char            *buffer;        // room for max_size bytes and one more entry
+    size_t           max_size;
+    size_t           limit;         // current batch size limit
+    size_t           used;
+    unsigned         entries;
+    struct timespec  deadline;      // when the first entry must be written at the latest
+};
+
+static __thread struct ring *thread_ring;
+static pthread_key_t         ringkey;
+static pthread_once_t        ringkey_once = PTHREAD_ONCE_INIT;
+static pthread_once_t        async_once = PTHREAD_ONCE_INIT;
+
+static void wake_drain_thread(int force)
+{
+    if (force || (atomic_load(&async.sleeping) && atomic_exchange(&async.sleeping, 0)))
+    {
+        pthread_mutex_lock(&async.wakeup_mutex);
+        pthread_cond_signal(&async.wakeup_cond);
+        pthread_mutex_unlock(&async.wakeup_mutex);
+    }
+}
+
+static void free_ring(struct ring *ring)
+{
+    free(ring->data);
+    free(ring);
+}
+
+/*
+ * Thread exit handler. The drain thread releases the ring after it has been emptied.
+ */
+static void release_ring(void *ptr)
+{
+    struct ring  *ring = (struct ring*)ptr;
+    struct ring **prev;
+
+    pthread_mutex_lock(&async.registry_mutex);
+    if (async.running)
+    {
+        ring->closed = 1;
+        pthread_mutex_unlock(&async.registry_mutex);
+        wake_drain_thread(1);
+    }
+    else
+    {
+        for (prev = &async.rings; *prev && *prev != ring; prev = &(*prev)->next)
+            ;
+        if (*prev)
+            *prev = ring->next;
+        async.dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+        pthread_mutex_unlock(&async.registry_mutex);
+        free_ring(ring);
+    }
+    thread_ring = NULL;
+}
+
+static void create_ring_key(void)
+{
+    int ec = pthread_key_create(&ringkey, release_ring);
+
+    if (ec)
+    {
+        fprintf(stderr, "Cannot create pthread key: %s", strerror(ec));
+        abort();
+    }
+}
+
+static struct ring *create_ring(void)
+{
+    struct ring *ring;
+    size_t       capacity = atomic_load_explicit(&async.capacity, memory_order_relaxed);
+
+    pthread_once(&ringkey_once, create_ring_key);
+    if (posix_memalign((void**)&ring, CACHE_LINE, sizeof(*ring)))
+        return NULL;
+    memset(ring, 0, sizeof(*ring));
+    ring->data = malloc(capacity);
+    if (!ring->data)
+    {
+        free(ring);
+        return NULL;
+    }
+    ring->mask = capacity - 1;
+    if (pthread_setspecific(ringkey, ring))
+    {
+        free_ring(ring);
+        return NULL;
+    }
+    pthread_mutex_lock(&async.registry_mutex);
+    ring->next = async.rings;
+    async.rings = ring;
+    pthread_mutex_unlock(&async.registry_mutex);
+    thread_ring = ring;
+    return ring;
+}
+
+static struct ring *get_ring(void)
+{
+    return thread_ring ? thread_ring : create_ring();
+}
+
+static void write_header(struct ring *ring, uint64_t offset, size_t len, enum record_type type)
+{
+    struct record_header header = { (uint32_t)len, (uint32_t)type };
+
+    memcpy(&ring->data[offset], &header, sizeof(header));
+}
+
+static void read_header(struct ring *ring, uint64_t position, struct record_header *header)
+{
+    memcpy(header, &ring->data[position & ring->mask], sizeof(*header));
+}
+
+/*
+ * Discard the oldest record. The consumer may be reading the same record concurrently,
+ * whoever moves the head first wins.
+ */
+static void drop_oldest(struct ring *ring, uint64_t head)
+{
+    struct record_header header;
+
+    read_header(ring, head, &header);
+    if (atomic_compare_exchange_strong(&ring->head, &head, head + RECORD_SIZE(header.len)) &&
+        header.type != RECORD_PADDING)
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+}
+
+/*
+ * Wait for the drain thread to make room.
+ *
+ * @return  0 when the caller should try again
+ *          -1 if the asynchronous mode is stopping and the caller must give up
+ */
+static int wait_for_room(unsigned *spins)
+{
+    struct timespec ts = { 0, BLOCK_SLEEP_NS };
+
+    if (!atomic_load(&async.active))
+        return -1;
+    wake_drain_thread(*spins == 0);
+    if (++(*spins) < BLOCK_SPIN_COUNT)
+        sched_yield();
+    else
+        nanosleep(&ts, NULL);
+    return 0;
+}
+
+static int ring_push(struct ring *ring, const char *buffer, size_t len, enum record_type type)
+{
+    uint64_t capacity = ring->mask + 1;
+    uint64_t need = RECORD_SIZE(len);
+    unsigned spins = 0;
+
+    for (;;)
+    {
+        uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        uint64_t offset = tail & ring->mask;
+        uint64_t contiguous = capacity - offset;
+        uint64_t total = contiguous < need ? contiguous + need : need;
+
+        if (tail + total - head <= capacity)
+        {
+            if (contiguous < need)
+            {
+                write_header(ring, offset, contiguous - RECORD_HEADER_SIZE, RECORD_PADDING);
+                offset = 0;
+            }
+            write_header(ring, offset, len, type);
+            memcpy(&ring->data[offset + RECORD_HEADER_SIZE], buffer, len);
+            atomic_store_explicit(&ring->tail, tail + total, memory_order_release);
+            return 0;
+        }
+
+        switch (atomic_load_explicit(&async.policy, memory_order_relaxed))
+        {
+            case MDCLOG_OVERFLOW_DROP_NEWEST:
+                atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+                return 0;
+            case MDCLOG_OVERFLOW_DROP_OLDEST:
+                drop_oldest(ring, head);
+                break;
+            default:
+                if (wait_for_room(&spins))
+                    return -1;
+        }
+    }
+}
+
+/*
+ * Take the oldest entry from the ring.
+ *
+ * @return  length of the entry copied to the buffer, 0 if the ring is empty
+ */
+static size_t ring_pop(struct ring *ring, char *buffer, size_t len, enum record_type *type)
+{
+    struct record_header header;
+    uint64_t             head, tail, size;
+
+    for (;;)
+    {
+        head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (head == tail)
+            return 0;
+
+        read_header(ring, head, &header);
+        size = RECORD_SIZE(header.len);
+        // The header may have been overwritten if the producer dropped the record meanwhile.
+        // Then the head has moved and the compare-exchange below fails.
+        if (size > tail - head || (header.type != RECORD_PADDING && header.len > len))
+            continue;
+        if (header.type != RECORD_PADDING)
+            memcpy(buffer, &ring->data[(head & ring->mask) + RECORD_HEADER_SIZE], header.len);
+        if (atomic_compare_exchange_strong(&ring->head, &head, head + size) &&
+            header.type != RECORD_PADDING)
+        {
+            *type = (enum record_type)header.type;
+            return header.len;
+        }
+    }
+}
+
+static int ring_empty(struct ring *ring)
+{
+    return atomic_load_explicit(&ring->head, memory_order_acquire) ==
+           atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
+
+/*
+ * Release the rings whose owner thread has exited and which have been emptied.
+ * Called with registry_mutex locked.
+ */
+static void release_closed_rings(void)
+{
+    struct ring **prev = &async.rings;
+    struct ring  *ring;
+
+    while ((ring = *prev) != NULL)
+    {
+        if (ring->closed && ring_empty(ring))
+        {
+            *prev = ring->next;
+            async.dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+            free_ring(ring);
+        }
+        else
+            prev = &ring->next;
+    }
+}
+
+/*
+ * Maximum batch size when writing to the given file descriptor
+ */
+STATIC size_t get_batch_limit(int fd, size_t batch_size)
+{
+    struct stat st;
+
+    if (batch_size > PIPE_BUF && fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode))
+        return PIPE_BUF;
+    return batch_size;
+}
+
+/*
+ * Maximum batch size when writing to the current output. The entries sent to
+ * a socket sink are framed one by one, so their batches are not limited.
+ */
+static size_t get_output_batch_limit(size_t batch_size)
+{
+    size_t limit = batch_size;
+    int    fd;
+
+    mdclog_internal_epoch_enter();
+    fd = mdclog_internal_output_fd();
+    if (fd >= 0)
+        limit = get_batch_limit(fd, batch_size);
+    mdclog_internal_epoch_leave();
+    return limit;
+}
+
+static void write_all(const char *buffer, size_t len)
+{
+    long   ret;
+    size_t offset = 0;
+
+    while (offset < len)
+    {
+        ret = TEMP_FAILURE_RETRY(mdclog_internal_output_write(&buffer[offset], len - offset));
+        atomic_fetch_add_explicit(&async.syscalls, 1, memory_order_relaxed);
+        if (ret <= 0)
+            break;
+        offset += (size_t)ret;
+    }
+}
+
+/*
+ * Write the first len bytes of the batch, which contain the given number of entries
+ */
+static void flush_batch(struct batch *batch, size_t len, unsigned entries)
+{
+    write_all(batch->buffer, len);
+    atomic_fetch_add_explicit(&async.written, entries, memory_order_relaxed);
+    batch->used -= len;
+    batch->entries -= entries;
+    if (batch->used > 0)
+        memmove(batch->buffer, &batch->buffer[len], batch->used);
+}
+
+/*
+ * Add an entry copied to the end of the batch buffer. The earlier entries are
+ * written first if the new entry does not fit to the same batch.
+ */
+static void add_to_batch(struct batch *batch, size_t len)
+{
+    unsigned flush_interval_ms;
+
+    if (batch->used > 0 && batch->used + len > batch->limit)
+    {
+        // flush_batch() moves the new entry to the start of the buffer
+        batch->used += len;
+        flush_batch(batch, batch->used - len, batch->entries);
+        batch->used = 0;
+    }
+    if (batch->used == 0)
+    {
+        flush_interval_ms = atomic_load_explicit(&async.flush_interval_ms, memory_order_relaxed);
+        clock_gettime(CLOCK_MONOTONIC, &batch->deadline);
+        batch->deadline.tv_sec += flush_interval_ms / 1000;
+        batch->deadline.tv_nsec += (long)(flush_interval_ms % 1000) * 1000000L;
+        if (batch->deadline.tv_nsec >= 1000000000L)
+        {
+            batch->deadline.tv_sec++;
+            batch->deadline.tv_nsec -= 1000000000L;
+        }
+    }
+    batch->used += len;
+    batch->entries++;
+    if (batch->used >= batch->limit)
+        flush_batch(batch, batch->used, batch->entries);
+}
+
+static int deadline_passed(const struct timespec *deadline)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec > deadline->tv_sec ||
+           (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec);
+}
+
+/*
+ * Collect the queued entries to the batch. The registry lock is not held while
+ * writing so that a blocking write does not stall threads registering their rings.
+ * New rings are only added to the head of the list and only the drain thread
+ * removes rings, so the list can be walked from the head read under the lock.
+ *
+ * @return   number of entries taken from the rings
+ */
+static unsigned drain_rings(struct batch *batch, char *record)
+{
+    struct ring     *ring;
+    char            *entry;
+    size_t           record_len;
+    size_t           entry_len;
+    enum record_type type;
+    unsigned         count = 0;
+    unsigned         taken;
+
+    pthread_mutex_lock(&async.registry_mutex);
+    ring = async.rings;
+    pthread_mutex_unlock(&async.registry_mutex);
+
+    for (; ring; ring = ring->next)
+    {
+        for (taken = 0; taken < DRAIN_BATCH; taken++)
+        {
+            entry = &batch->buffer[batch->used];
+            record_len = ring_pop(ring, entry, MAX_ENTRY_LENGTH, &type);
+            if (record_len == 0)
+                break;
+            count++;
+            entry_len = record_len;
+            if (type == RECORD_DEFERRED)
+            {
+                memcpy(record, entry, record_len);
+                entry_len = async.format ? async.format(entry, MAX_ENTRY_LENGTH, record, record_len) : 0;
+            }
+            if (entry_len > 0)
+                add_to_batch(batch, entry_len);
+        }
+    }
+
+    pthread_mutex_lock(&async.registry_mutex);
+    release_closed_rings();
+    pthread_mutex_unlock(&async.registry_mutex);
+    return count;
+}
+
+static int entries_pending(void)
+{
+    struct ring *ring;
+    int          ret = 0;
+
+    pthread_mutex_lock(&async.registry_mutex);
+    for (ring = async.rings; ring && !ret; ring = ring->next)
+        ret = !ring_empty(ring) || ring->closed;
+    pthread_mutex_unlock(&async.registry_mutex);
+    return ret;
+}
+
+/*
+ * Wait for new entries. If a partial batch is pending, wait until its deadline
+ * without asking the logging threads to wake us up, so that the batch can fill.
+ */
+static void wait_for_entries(const struct timespec *deadline)
+{
+    struct timespec ts;
+
+    if (deadline)
+        ts = *deadline;
+    else
+    {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        ts.tv_sec += DRAIN_INTERVAL_MS / 1000;
+        ts.tv_nsec += (DRAIN_INTERVAL_MS % 1000) * 1000000L;
+        if (ts.tv_nsec >= 1000000000L)
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+    }
+    pthread_mutex_lock(&async.wakeup_mutex);
+    if (!deadline)
+        atomic_store(&async.sleeping, 1);
+    if (!entries_pending() && !atomic_load(&async.stopping))
+        pthread_cond_timedwait(&async.wakeup_cond, &async.wakeup_mutex, &ts);
+    atomic_store(&async.sleeping, 0);
+    pthread_mutex_unlock(&async.wakeup_mutex);
+}
+
+static void *drain_thread(void *arg)
+{
+    char          record[MAX_ENTRY_LENGTH];
+    char          single[MAX_ENTRY_LENGTH];
+    struct batch  batch;
+    unsigned long output_generation = mdclog_internal_output_generation();
+    unsigned long generation;
+    size_t        pipe_limit = get_output_batch_limit(ASYNC_MAX_BATCH_SIZE);
+    unsigned      count;
+    int           stopping;
+    int           idle;
+
+    (void)arg;
+    memset(&batch, 0, sizeof(batch));
+    batch.buffer = malloc(ASYNC_MAX_BATCH_SIZE + MAX_ENTRY_LENGTH);
+    if (batch.buffer)
+        batch.max_size = ASYNC_MAX_BATCH_SIZE;
+    else
+        batch.buffer = single;                  // write the entries one by one
+    for (;;)
+    {
+        stopping = atomic_load(&async.stopping);
+        // the output can be switched to another file or socket, or the file can be rotated
+        generation = mdclog_internal_output_generation();
+        if (generation != output_generation)
+        {
+            pipe_limit = get_output_batch_limit(ASYNC_MAX_BATCH_SIZE);
+            output_generation = generation;
+        }
+        batch.limit = atomic_load_explicit(&async.batch_size, memory_order_relaxed);
+        if (batch.limit > pipe_limit)
+            batch.limit = pipe_limit;
+        if (batch.limit > batch.max_size)
+            batch.limit = batch.max_size;
+
+        count = drain_rings(&batch, record);
+        idle = count == 0;
+        if (batch.used > 0 &&
+            ((idle && (stopping || atomic_load_explicit(&async.flush_interval_ms, memory_order_relaxed) == 0)) ||
+             deadline_passed(&batch.deadline)))
+            flush_batch(&batch, batch.used, batch.entries);
+        if (idle)
+        {
+            if (stopping)
+                break;
+            wait_for_entries(batch.used > 0 ? &batch.deadline : NULL);
+        }
+    }
+    if (batch.buffer != single)
+        free(batch.buffer);
+    return NULL;
+}
+
+static void init_async(void)
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&async.wakeup_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    atexit(mdclog_internal_async_stop);
+}
+
+static size_t round_capacity(size_t capacity)
+{
+    size_t ret = ASYNC_MIN_CAPACITY;
+
+    while (ret < capacity)
+        ret <<= 1;
+    return ret;
+}
+
+int mdclog_internal_async_start(const struct async_config *config)
+{
+    int ec = 0;
+
+    pthread_once(&async_once, init_async);
+    pthread_mutex_lock(&async.control_mutex);
+    atomic_store(&async.capacity, round_capacity(config->capacity ? config->capacity : ASYNC_DEFAULT_CAPACITY));
+    atomic_store(&async.policy, config->policy);
+    atomic_store(&async.batch_size, config->batch_size);
+    atomic_store(&async.flush_interval_ms, config->flush_interval_ms);
+    if (!async.running)
+    {
+        async.format = config->format;
+        ec = pthread_create(&async.thread, NULL, drain_thread, NULL);
+        if (!ec)
+        {
+            pthread_mutex_lock(&async.registry_mutex);
+            async.running = 1;
+            pthread_mutex_unlock(&async.registry_mutex);
+            atomic_store(&async.active, 1);
+        }
+    }
+    pthread_mutex_unlock(&async.control_mutex);
+    if (ec)
+    {
+        errno = ec;
+        return -1;
+    }
+    return 0;
+}
+
+void mdclog_internal_async_stop(void)
+{
+    struct ring *ring;
+
+    pthread_mutex_lock(&async.control_mutex);
+    if (!async.running)
+    {
+        pthread_mutex_unlock(&async.control_mutex);
+        return;
+    }
+    // After this no new entries are queued. Wait for the producers
+    // which saw the mode active to finish.
+    atomic_store(&async.active, 0);
+    pthread_mutex_lock(&async.registry_mutex);
+    for (ring = async.rings; ring; ring = ring->next)
+        while (atomic_load(&ring->busy))
+            sched_yield();
+    pthread_mutex_unlock(&async.registry_mutex);
+
+    atomic_store(&async.stopping, 1);
+    wake_drain_thread(1);
+    pthread_join(async.thread, NULL);
+    atomic_store(&async.stopping, 0);
+
+    pthread_mutex_lock(&async.registry_mutex);
+    async.running = 0;
+    pthread_mutex_unlock(&async.registry_mutex);
+    pthread_mutex_unlock(&async.control_mutex);
+}
+
+static int push_record(const char *buffer, size_t len, enum record_type type)
+{
+    struct ring *ring;
+    int          ret;
+
+    if (!atomic_load_explicit(&async.active, memory_order_relaxed) || len > MAX_ENTRY_LENGTH)
+        return -1;
+    ring = get_ring();
+    if (!ring)
+        return -1;
+
+    // Pairs with mdclog_internal_async_stop(): either the stopper sees the
+    // ring busy or this thread sees the mode inactive.
+    atomic_store(&ring->busy, 1);
+    if (atomic_load(&async.active))
+        ret = ring_push(ring, buffer, len, type);
+    else
+        ret = -1;
+    atomic_store(&ring->busy, 0);
+
+    if (ret == 0)
+        wake_drain_thread(0);
+    return ret;
+}
+
+int mdclog_internal_async_push(const char *buffer, size_t len)
+{
+    return push_record(buffer, len, RECORD_ENTRY);
+}
+
+int mdclog_internal_async_push_deferred(const char *record, size_t len)
+{
+    return push_record(record, len, RECORD_DEFERRED);
+}
+
+void mdclog_internal_async_stats(mdclog_stats_t *stats)
+{
+    struct ring *ring;
+
+    pthread_mutex_lock(&async.registry_mutex);
+    stats->written = atomic_load_explicit(&async.written, memory_order_relaxed);
+    stats->syscalls = atomic_load_explicit(&async.syscalls, memory_order_relaxed);
+    stats->dropped = async.dropped;
+    for (ring = async.rings; ring; ring = ring->next)
+        stats->dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+    pthread_mutex_unlock(&async.registry_mutex);
+}
@@ -0,0 +1,861 @@
+/*
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ *
+ * Compact binary encoding of log entries, see private/binary.h for the format.
+ *
+ * The encoder stores what the json formatting would read: the timestamp, the
+ * severity, the format string, the MDCs in the order of the MDC object, and
+ * the message arguments packed with mdclog_internal_pack_args(). The decoder
+ * formats them with the json formatting of the library, so a decoded entry is
+ * equal to the json entry, including the truncation of a too long entry. The
+ * constant fields are not encoded at all; the decoder compiles them from the
+ * layout in the stream header.
+ *
+ * A format string that cannot be packed, e.g. one with the %m conversion, is
+ * formatted when the entry is encoded, and encoded as the argument of "%s".
+ */
+#include "private/binary.h"
+#include "private/deferred.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "private/timestamp.h"
+
+#define DICTIONARY_SLOTS      (2 * BINARY_MAX_DEFINITIONS)
+#define UNKNOWN_SEVERITY      0xff
+#define INLINE_ID             0
+#define FALLBACK_FORMAT       "%s"
+#define MDC_OVERHEAD          6         // "key":"value",
+#define USEC_PER_SEC          1000000LL
+
+/*
+ * Growable output buffer. Once an allocation has failed, nothing is added.
+ */
+struct output
+{
+    char   *data;
+    size_t  len;
+    size_t  size;
+    int     failed;
+};
+
+/*
+ * Interned strings. The ids are indexes of the strings plus one.
+ */
+struct dictionary
+{
+    char     *strings[BINARY_MAX_DEFINITIONS];
+    size_t    lens[BINARY_MAX_DEFINITIONS];
+    uint16_t  slots[DICTIONARY_SLOTS];      // ids in an open addressing hash table, 0 if free
+    size_t    count;
+};
+
+struct binary_encoder
+{
+    struct binary_stream stream;
+    int                  header_pending;
+    int64_t              previous_us;
+    struct dictionary    formats;
+    struct dictionary    keys;
+    struct output        records;
+    struct output        entry;
+    struct output        args;
+    char                *message;          // message formatted when the arguments cannot be packed
+    struct json_mdc     *mdcs;
+    size_t               mdc_capacity;
+};
+
+size_t mdclog_internal_put_varint(char *buffer, size_t len, uint64_t value)
+{
+    size_t i = 0;
+
+    do
+    {
+        if (i == len)
+            return 0;
+        buffer[i++] = (char)((value & 0x7f) | (value >= 0x80 ? 0x80 : 0));
+        value >>= 7;
+    } while (value);
+    return i;
+}
+
+size_t mdclog_internal_put_svarint(char *buffer, size_t len, int64_t value)
+{
+    return mdclog_internal_put_varint(buffer, len, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+size_t mdclog_internal_get_varint(const char *buffer, size_t len, uint64_t *value)
+{
+    uint64_t result = 0;
+    size_t   i;
+
+    for (i = 0; i < len && i < VARINT_MAX_LENGTH; i++)
+    {
+        result |= (uint64_t)(buffer[i] & 0x7f) << (7 * i);
+        if (!(buffer[i] & 0x80))
+        {
+            *value = result;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+size_t mdclog_internal_get_svarint(const char *buffer, size_t len, int64_t *value)
+{
+    uint64_t v;
+    size_t   n = mdclog_internal_get_varint(buffer, len, &v);
+
+    if (n)
+        *value = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+    return n;
+}
+
+static int reserve(struct output *out, size_t n)
+{
+    size_t size = out->size ? out->size : PIPE_BUF;
+    char  *data;
+
+    if (out->failed)
+        return -1;
+    if (out->len + n <= out->size)
+        return 0;
+    while (size < out->len + n)
+        size *= 2;
+    data = realloc(out->data, size);
+    if (!data)
+    {
+        out->failed = 1;
+        return -1;
+    }
+    out->data = data;
+    out->size = size;
+    return 0;
+}
+
+static void put_bytes(struct output *out, const void *data, size_t n)
+{
+    if (reserve(out, n) == 0)
+    {
+        memcpy(&out->data[out->len], data, n);
+        out->len += n;
+    }
+}
+
+static void put_byte(struct output *out, unsigned char byte)
+{
+    put_bytes(out, &byte, 1);
+}
+
+static void put_uint(struct output *out, uint64_t value)
+{
+    if (reserve(out, VARINT_MAX_LENGTH) == 0)
+        out->len += mdclog_internal_put_varint(&out->data[out->len], VARINT_MAX_LENGTH, value);
+}
+
+static void put_int(struct output *out, int64_t value)
+{
+    if (reserve(out, VARINT_MAX_LENGTH) == 0)
+        out->len += mdclog_internal_put_svarint(&out->data[out->len], VARINT_MAX_LENGTH, value);
+}
+
+static void put_string(struct output *out, const char *str, size_t len)
+{
+    put_uint(out, len);
+    put_bytes(out, str, len);
+}
+
+static size_t hash(const char *str, size_t len)
+{
+    uint64_t h = 14695981039346656037ULL;   // FNV-1a
+    size_t   i;
+
+    for (i = 0; i < len; i++)
+        h = (h ^ (unsigned char)str[i]) * 1099511628211ULL;
+    return (size_t)(h ^ (h >> 32));
+}
+
+static void clear_dictionary(struct dictionary *dictionary)
+{
+    size_t i;
+
+    for (i = 0; i < dictionary->count; i++)
+        free(dictionary->strings[i]);
+    memset(dictionary->slots, 0, sizeof(dictionary->slots));
+    dictionary->count = 0;
+}
+
+/*
+ * Find the id of a string, or add the string to the dictionary
+ *
+ * @param   added   output: set if the string was added
+ *
+ * @return  id of the string, INLINE_ID if the dictionary is full
+ */
+static unsigned intern(struct dictionary *dictionary, const char *str, size_t len, int *added)
+{
+    size_t   slot = hash(str, len) & (DICTIONARY_SLOTS - 1);
+    unsigned id;
+    char    *copy;
+
+    *added = 0;
+    while ((id = dictionary->slots[slot]) != 0)
+    {
+        if (dictionary->lens[id - 1] == len && memcmp(dictionary->strings[id - 1], str, len) == 0)
+            return id;
+        slot = (slot + 1) & (DICTIONARY_SLOTS - 1);
+    }
+    if (dictionary->count == BINARY_MAX_DEFINITIONS || !(copy = malloc(len + 1)))
+        return INLINE_ID;
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    dictionary->strings[dictionary->count] = copy;
+    dictionary->lens[dictionary->count] = len;
+    id = (unsigned)++dictionary->count;
+    dictionary->slots[slot] = (uint16_t)id;
+    *added = 1;
+    return id;
+}
+
+/*
+ * Encode a reference to an interned string to the entry, and the definition
+ * of a new string to the records preceding the entry
+ */
+static void put_reference(struct binary_encoder *encoder, struct dictionary *dictionary, unsigned char type,
+                          const char *str, size_t len)
+{
+    int      added;
+    unsigned id = intern(dictionary, str, len, &added);
+
+    if (added)
+    {
+        put_byte(&encoder->records, type);
+        put_uint(&encoder->records, id);
+        put_string(&encoder->records, str, len);
+    }
+    put_uint(&encoder->entry, id);
+    if (id == INLINE_ID)
+        put_string(&encoder->entry, str, len);
+}
+
+static void put_header(struct binary_encoder *encoder)
+{
+    const struct binary_stream *stream = &encoder->stream;
+    struct output              *out = &encoder->records;
+    size_t                      i;
+
+    put_byte(out, BINARY_RECORD_HEADER);
+    put_bytes(out, BINARY_MAGIC, BINARY_MAGIC_LENGTH);
+    put_byte(out, BINARY_VERSION);
+    put_uint(out, stream->max_entry_size);
+    put_byte(out, (unsigned char)stream->timestamp_format);
+    put_byte(out, (unsigned char)stream->layout.field_count);
+    for (i = 0; i < stream->layout.field_count; i++)
+        put_byte(out, (unsigned char)stream->layout.order[i]);
+    for (i = 0; i < JSON_FIELD_COUNT; i++)
+        put_string(out, stream->layout.keys[i], strlen(stream->layout.keys[i]));
+    put_string(out, stream->identity, strlen(stream->identity));
+    put_byte(out, sizeof(long double));
+}
+
+/*
+ * Add an MDC to the collected MDCs
+ *
+ * @return  1 if the MDC was added, 0 if it cannot fit to a log entry of the maximum size,
+ *          -1 if memory cannot be allocated
+ */
+static int add_mdc(struct binary_encoder *encoder, mdc_t *mdc, size_t *count, size_t *total)
+{
+    struct json_mdc *mdcs;
+    struct json_mdc *added;
+    size_t           capacity;
+
+    if (*count == encoder->mdc_capacity)
+    {
+        capacity = encoder->mdc_capacity ? 2 * encoder->mdc_capacity : 16;
+        mdcs = realloc(encoder->mdcs, capacity * sizeof(*mdcs));
+        if (!mdcs)
+            return -1;
+        encoder->mdcs = mdcs;
+        encoder->mdc_capacity = capacity;
+    }
+    added = &encoder->mdcs[*count];
+    added->key = mdclog_internal_get_mdc_key(mdc);
+    added->key_len = strlen(added->key);
+    added->value = mdclog_internal_get_mdc_val(mdc);
+    added->value_len = strlen(added->value);
+    *total += added->key_len + added->value_len + MDC_OVERHEAD;
+    if (*total >= encoder->stream.max_entry_size)
+        return 0;
+    (*count)++;
+    return 1;
+}
+
+/*
+ * Collect the MDCs in the order the MDC object is formatted: the global MDCs not
+ * overridden by the thread, followed by the MDCs of the thread.
+ *
+ * @return  number of the MDCs, -1 if memory cannot be allocated
+ */
+static long collect_mdcs(struct binary_encoder *encoder, mdc_t *mdc)
+{
+    mdc_t *global;
+    size_t count = 0;
+    size_t total = 0;
+    int    ret;
+
+    for (global = mdclog_internal_get_first_global_mdc(); global; global = mdclog_internal_get_next_mdc(global))
+    {
+        if (mdclog_internal_search_mdc(mdclog_internal_get_mdc_key(global)))
+            continue;
+        if ((ret = add_mdc(encoder, global, &count, &total)) <= 0)
+            return ret < 0 ? -1 : (long)count;
+    }
+    for (; mdc; mdc = mdclog_internal_get_next_mdc(mdc))
+    {
+        if ((ret = add_mdc(encoder, mdc, &count, &total)) <= 0)
+            return ret < 0 ? -1 : (long)count;
+    }
+    return (long)count;
+}
+
+struct binary_encoder *mdclog_internal_binary_encoder_create(void)
+{
+    struct binary_encoder *encoder = calloc(1, sizeof(*encoder));
+
+    if (!encoder)
+        errno = ENOMEM;
+    return encoder;
+}
+
+void mdclog_internal_binary_encoder_destroy(struct binary_encoder *encoder)
+{
+    if (encoder)
+    {
+        clear_dictionary(&encoder->formats);
+        clear_dictionary(&encoder->keys);
+        free(encoder->records.data);
+        free(encoder->entry.data);
+        free(encoder->args.data);
+        free(encoder->message);
+        free(encoder->mdcs);
+        free(encoder);
+    }
+}
+
+void mdclog_internal_binary_encoder_reset(struct binary_encoder *encoder, const struct binary_stream *stream)
+{
+    char *message;
+
+    if (stream->max_entry_size != encoder->stream.max_entry_size)
+    {
+        message = realloc(encoder->message, stream->max_entry_size);
+        if (message)
+            encoder->message = message;
+    }
+    encoder->stream = *stream;
+    encoder->header_pending = 1;
+    encoder->previous_us = 0;
+    clear_dictionary(&encoder->formats);
+    clear_dictionary(&encoder->keys);
+}
+
+long mdclog_internal_binary_encode(struct binary_encoder *encoder,
+                       const struct timeval *timestamp,
+                       mdclog_severity_t severity,
+                       mdc_t *mdc,
+                       const char *msg,
+                       va_list arglist,
+                       const char **records)
+{
+    const size_t max_entry_size = encoder->stream.max_entry_size;
+    int64_t      us = (int64_t)timestamp->tv_sec * USEC_PER_SEC + timestamp->tv_usec;
+    long         mdc_count;
+    long         i;
+    int          args_len = -1;
+    va_list      copy;
+
+    encoder->records.len = encoder->records.failed = 0;
+    encoder->entry.len = encoder->entry.failed = 0;
+    encoder->args.len = encoder->args.failed = 0;
+    if (encoder->header_pending)
+    {
+        if (!encoder->message)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        put_header(encoder);
+        encoder->header_pending = 0;
+    }
+
+    put_byte(&encoder->entry, BINARY_RECORD_ENTRY);
+    put_byte(&encoder->entry, (int)severity >= 0 && (int)severity < JSON_SEVERITY_COUNT ?
+                              (unsigned char)severity : UNKNOWN_SEVERITY);
+    put_int(&encoder->entry, us - encoder->previous_us);
+    encoder->previous_us = us;
+
+    // arguments longer than the entry are not visible in it
+    if (reserve(&encoder->args, max_entry_size) == 0)
+    {
+        va_copy(copy, arglist);
+        args_len = mdclog_internal_pack_args(encoder->args.data, max_entry_size, msg, copy);
+        va_end(copy);
+    }
+    if (args_len >= 0)
+        encoder->args.len = (size_t)args_len;
+    else
+    {
+        va_copy(copy, arglist);
+        if (vsnprintf(encoder->message, max_entry_size, msg, copy) < 0)
+            encoder->message[0] = '\0';
+        va_end(copy);
+        msg = FALLBACK_FORMAT;
+        encoder->args.len = 0;
+        put_uint(&encoder->args, strlen(encoder->message) + 1);
+        put_bytes(&encoder->args, encoder->message, strlen(encoder->message));
+    }
+    put_reference(encoder, &encoder->formats, BINARY_RECORD_FORMAT, msg, strlen(msg));
+
+    mdc_count = collect_mdcs(encoder, mdc);
+    if (mdc_count < 0)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    put_uint(&encoder->entry, (uint64_t)mdc_count);
+    for (i = 0; i < mdc_count; i++)
+    {
+        put_reference(encoder, &encoder->keys, BINARY_RECORD_KEY, encoder->mdcs[i].key, encoder->mdcs[i].key_len);
+        put_string(&encoder->entry, encoder->mdcs[i].value, encoder->mdcs[i].value_len);
+    }
+    put_string(&encoder->entry, encoder->args.data, encoder->args.len);
+    put_bytes(&encoder->records, encoder->entry.data, encoder->entry.len);
+    if (encoder->records.failed || encoder->entry.failed || encoder->args.failed)
+    {
+        // the definitions may have been lost, so the stream is started again
+        encoder->header_pending = 1;
+        clear_dictionary(&encoder->formats);
+        clear_dictionary(&encoder->keys);
+        errno = ENOMEM;
+        return -1;
+    }
+    *records = encoder->records.data;
+    return (long)encoder->records.len;
+}
+
+/*
+ * Decoding
+ */
+
+#define READ_SHORT    1     // the record continues beyond the data
+#define READ_INVALID  2
+
+struct binary_decoder
+{
+    int                  has_stream;
+    struct binary_stream stream;
+    struct json_schema   schema;
+    int64_t              previous_us;
+    char                *formats[BINARY_MAX_DEFINITIONS];
+    size_t               format_count;
+    char                *keys[BINARY_MAX_DEFINITIONS];
+    size_t               key_lens[BINARY_MAX_DEFINITIONS];
+    size_t               key_count;
+    struct json_mdc     *mdcs;
+    size_t               mdc_capacity;
+    struct output        format;            // format string given in the entry
+    struct output        args;              // unpacked arguments
+    char                *entry;             // max_entry_size bytes
+};
+
+struct reader
+{
+    const char *data;
+    size_t      len;
+    size_t      pos;
+    int         status;
+};
+
+static const char *read_bytes(struct reader *reader, size_t n)
+{
+    const char *bytes = &reader->data[reader->pos];
+
+    if (reader->status)
+        return NULL;
+    if (n > reader->len - reader->pos)
+    {
+        reader->status = READ_SHORT;
+        return NULL;
+    }
+    reader->pos += n;
+    return bytes;
+}
+
+static unsigned char read_byte(struct reader *reader)
+{
+    const char *byte = read_bytes(reader, 1);
+
+    return byte ? (unsigned char)*byte : 0;
+}
+
+static uint64_t read_uint(struct reader *reader)
+{
+    uint64_t value = 0;
+    size_t   n;
+
+    if (reader->status)
+        return 0;
+    n = mdclog_internal_get_varint(&reader->data[reader->pos], reader->len - reader->pos, &value);
+    if (n == 0)
+    {
+        reader->status = reader->len - reader->pos >= VARINT_MAX_LENGTH ? READ_INVALID : READ_SHORT;
+        return 0;
+    }
+    reader->pos += n;
+    return value;
+}
+
+static int64_t read_int(struct reader *reader)
+{
+    uint64_t value = read_uint(reader);
+
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+/*
+ * Read a string of at most max_len characters
+ */
+static const char *read_string(struct reader *reader, size_t *len, size_t max_len)
+{
+    uint64_t n = read_uint(reader);
+
+    if (!reader->status && n > max_len)
+        reader->status = READ_INVALID;
+    *len = (size_t)n;
+    return read_bytes(reader, (size_t)n);
+}
+
+static void clear_definitions(struct binary_decoder *decoder)
+{
+    size_t i;
+
+    for (i = 0; i < decoder->format_count; i++)
+        free(decoder->formats[i]);
+    for (i = 0; i < decoder->key_count; i++)
+        free(decoder->keys[i]);
+    decoder->format_count = decoder->key_count = 0;
+}
+
+static int decode_header(struct binary_decoder *decoder, struct reader *reader)
+{
+    struct binary_stream stream;
+    const char          *magic;
+    const char          *order;
+    const char          *keys[JSON_FIELD_COUNT];
+    size_t               key_lens[JSON_FIELD_COUNT];
+    mdclog_field_t       fields[JSON_FIELD_COUNT];
+    char                 key[MDCLOG_FIELD_KEY_MAX_LENGTH + 1];
+    const char          *identity;
+    size_t               identity_len;
+    unsigned             version, timestamp_format, field_count, long_double_size;
+    uint64_t             max_entry_size;
+    char                *entry;
+    size_t               i;
+
+    magic = read_bytes(reader, BINARY_MAGIC_LENGTH);
+    version = read_byte(reader);
+    max_entry_size = read_uint(reader);
+    timestamp_format = read_byte(reader);
+    field_count = read_byte(reader);
+    if (!reader->status && (field_count == 0 || field_count > JSON_FIELD_COUNT))
+        reader->status = READ_INVALID;
+    order = read_bytes(reader, field_count);
+    for (i = 0; i < JSON_FIELD_COUNT; i++)
+        keys[i] = read_string(reader, &key_lens[i], MDCLOG_FIELD_KEY_MAX_LENGTH);
+    identity = read_string(reader, &identity_len, IDENTITY_MAX_LENGTH);
+    long_double_size = read_byte(reader);
+    if (reader->status)
+        return 0;
+
+    if (memcmp(magic, BINARY_MAGIC, BINARY_MAGIC_LENGTH) || version != BINARY_VERSION ||
+        max_entry_size < PIPE_BUF || max_entry_size > MDCLOG_MAX_ENTRY_SIZE ||
+        timestamp_format > MDCLOG_TIMESTAMP_RFC3339 || long_double_size != sizeof(long double))
+        goto invalid;
+    mdclog_internal_default_layout(&stream.layout);
+    for (i = 0; i < JSON_FIELD_COUNT; i++)
+    {
+        memcpy(key, keys[i], key_lens[i]);
+        key[key_lens[i]] = '\0';
+        if (mdclog_internal_set_layout_key(&stream.layout, (mdclog_field_t)i, key))
+            goto invalid;
+    }
+    for (i = 0; i < field_count; i++)
+        fields[i] = (mdclog_field_t)(unsigned char)order[i];
+    if (mdclog_internal_set_layout_order(&stream.layout, fields, field_count))
+        goto invalid;
+    memcpy(stream.identity, identity, identity_len);
+    stream.identity[identity_len] = '\0';
+    stream.timestamp_format = (mdclog_timestamp_format_t)timestamp_format;
+    stream.max_entry_size = (size_t)max_entry_size;
+    entry = realloc(decoder->entry, stream.max_entry_size);
+    if (!entry)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    decoder->entry = entry;
+    decoder->stream = stream;
+    mdclog_internal_compile_schema(&decoder->schema, &stream.layout, stream.identity);
+    decoder->schema.timestamp_format = stream.timestamp_format;
+    clear_definitions(decoder);
+    decoder->previous_us = 0;
+    decoder->has_stream = 1;
+    return 0;
+
+invalid:
+    errno = EINVAL;
+    return -1;
+}
+
+static int decode_definition(struct binary_decoder *decoder, struct reader *reader, char type)
+{
+    uint64_t    id = read_uint(reader);
+    size_t      len;
+    const char *str = read_string(reader, &len, MDCLOG_MAX_ENTRY_SIZE);
+    size_t     *count = type == BINARY_RECORD_FORMAT ? &decoder->format_count : &decoder->key_count;
+    char       *copy;
+
+    if (reader->status)
+        return 0;
+    if (!decoder->has_stream || id != *count + 1 || id > BINARY_MAX_DEFINITIONS || memchr(str, '\0', len))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    copy = malloc(len + 1);
+    if (!copy)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    if (type == BINARY_RECORD_FORMAT)
+        decoder->formats[*count] = copy;
+    else
+    {
+        decoder->keys[*count] = copy;
+        decoder->key_lens[*count] = len;
+    }
+    (*count)++;
+    return 0;
+}
+
+/*
+ * Format the entry like the library, which formats to a PIPE_BUF long buffer
+ * first, and again to the maximum entry size if the message was truncated
+ */
+static int format_entry(struct binary_decoder *decoder, const struct timeval *tv, mdclog_severity_t severity,
+                        size_t mdc_count, const char *format, size_t args_len)
+{
+    const size_t     max_entry_size = decoder->stream.max_entry_size;
+    struct json_info info;
+    int              len;
+
+    len = mdclog_internal_format_captured_to_json_str(decoder->entry, PIPE_BUF - 1, tv, &decoder->schema,
+            severity, decoder->mdcs, mdc_count, &info, format, decoder->args.data, args_len);
+    if (info.truncated && max_entry_size > PIPE_BUF)
+        len = mdclog_internal_format_captured_to_json_str(decoder->entry, max_entry_size - 1, tv,
+                &decoder->schema, severity, decoder->mdcs, mdc_count, &info, format,
+                decoder->args.data, args_len);
+    return len;
+}
+
+static int decode_entry(struct binary_decoder *decoder, struct reader *reader, binary_entry_fn_t fn, void *arg)
+{
+    const size_t     max_entry_size = decoder->stream.max_entry_size;
+    unsigned         severity = read_byte(reader);
+    int64_t          delta = read_int(reader);
+    uint64_t         format_id = read_uint(reader);
+    const char      *format = NULL;
+    size_t           format_len = 0;
+    uint64_t         mdc_count;
+    uint64_t         key_id;
+    struct json_mdc *mdcs;
+    const char      *packed;
+    size_t           packed_len;
+    int              args_len;
+    int64_t          us;
+    struct timeval   tv;
+    size_t           i;
+    int              len;
+
+    if (format_id == INLINE_ID)
+        format = read_string(reader, &format_len, MDCLOG_MAX_ENTRY_SIZE);
+    mdc_count = read_uint(reader);
+    if (!reader->status && (!decoder->has_stream || mdc_count > max_entry_size / MDC_OVERHEAD))
+        goto invalid;
+    if (!reader->status && mdc_count > decoder->mdc_capacity)
+    {
+        mdcs = realloc(decoder->mdcs, mdc_count * sizeof(*mdcs));
+        if (!mdcs)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        decoder->mdcs = mdcs;
+        decoder->mdc_capacity = mdc_count;
+    }
+    for (i = 0; i < mdc_count && !reader->status; i++)
+    {
+        key_id = read_uint(reader);
+        if (key_id == INLINE_ID)
+            decoder->mdcs[i].key = read_string(reader, &decoder->mdcs[i].key_len, MDCLOG_MAX_ENTRY_SIZE);
+        else if (key_id <= decoder->key_count)
+        {
+            decoder->mdcs[i].key = decoder->keys[key_id - 1];
+            decoder->mdcs[i].key_len = decoder->key_lens[key_id - 1];
+        }
+        else if (!reader->status)
+            goto invalid;
+        decoder->mdcs[i].value = read_string(reader, &decoder->mdcs[i].value_len, max_entry_size);
+    }
+    // a message rendered by the encoder is max_entry_size - 1 long and packed with its length
+    packed = read_string(reader, &packed_len, max_entry_size + VARINT_MAX_LENGTH);
+    if (reader->status)
+        return 0;
+
+    if (format_id == INLINE_ID)
+    {
+        decoder->format.len = 0;
+        put_bytes(&decoder->format, format, format_len);
+        put_byte(&decoder->format, '\0');
+        if (decoder->format.failed)
+        {
+            decoder->format.failed = 0;
+            errno = ENOMEM;
+            return -1;
+        }
+        format = decoder->format.data;
+    }
+    else if (format_id <= decoder->format_count)
+        format = decoder->formats[format_id - 1];
+    else
+        goto invalid;
+    // an argument is at most 16 bytes when unpacked, and a string grows by its length field
+    decoder->args.len = 0;
+    if (reserve(&decoder->args, 16 * packed_len + 16))
+    {
+        decoder->args.failed = 0;
+        errno = ENOMEM;
+        return -1;
+    }
+    args_len = mdclog_internal_unpack_args(decoder->args.data, decoder->args.size, format, packed, packed_len);
+    if (args_len < 0)
+        goto invalid;
+
+    us = decoder->previous_us + delta;
+    decoder->previous_us = us;
+    tv.tv_sec = (time_t)(us / USEC_PER_SEC);
+    tv.tv_usec = (suseconds_t)(us % USEC_PER_SEC);
+    if (tv.tv_usec < 0)
+    {
+        tv.tv_sec--;
+        tv.tv_usec += USEC_PER_SEC;
+    }
+    len = format_entry(decoder, &tv, severity == UNKNOWN_SEVERITY ? (mdclog_severity_t)-1 : (mdclog_severity_t)severity,
+                       (size_t)mdc_count, format, (size_t)args_len);
+    if (len > 0)
+        fn(decoder->entry, (size_t)len, arg);
+    return 0;
+
+invalid:
+    errno = EINVAL;
+    return -1;
+}
+
+struct binary_decoder *mdclog_internal_binary_decoder_create(void)
+{
+    struct binary_decoder *decoder = calloc(1, sizeof(*decoder));
+
+    if (!decoder)
+        errno = ENOMEM;
+    return decoder;
+}
+
+void mdclog_internal_binary_decoder_destroy(struct binary_decoder *decoder)
+{
+    if (decoder)
+    {
+        clear_definitions(decoder);
+        free(decoder->mdcs);
+        free(decoder->format.data);
+        free(decoder->args.data);
+        free(decoder->entry);
+        free(decoder);
+    }
+}
+
+long mdclog_internal_binary_decode(struct binary_decoder *decoder, const char *data, size_t len,
+                                   binary_entry_fn_t entry, void *arg)
+{
+    struct reader reader = { .data = data, .len = len };
+    size_t        decoded = 0;
+    int           ret;
+
+    while (decoded < len)
+    {
+        reader.pos = decoded;
+        switch (read_byte(&reader))
+        {
+            case BINARY_RECORD_HEADER:
+                ret = decode_header(decoder, &reader);
+                break;
+            case BINARY_RECORD_FORMAT:
+                ret = decode_definition(decoder, &reader, BINARY_RECORD_FORMAT);
+                break;
+            case BINARY_RECORD_KEY:
+                ret = decode_definition(decoder, &reader, BINARY_RECORD_KEY);
+                break;
+            case BINARY_RECORD_ENTRY:
+                ret = decode_entry(decoder, &reader, entry, arg);
+                break;
+            default:
+                errno = EINVAL;
+                return -1;
+        }
+        if (ret < 0)
+            return -1;
+        if (reader.status == READ_INVALID)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+        if (reader.status == READ_SHORT)
+            break;
+        decoded = reader.pos;
+    }
+    return (long)decoded;
+}
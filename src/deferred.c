@@ -0,0 +1,484 @@
+/*
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ *
+ * Deferred formatting of printf style arguments.
+ * The arguments are copied to a binary payload in the order they appear in
+ * the format string. Integers are stored with their promoted type, strings
+ * as a 32-bit length followed by the characters and the ending zero.
+ * The payload is later formatted by calling snprintf() once per conversion
+ * specification.
+ *
+ * The binary log encoding stores the arguments in a packed payload instead,
+ * which is converted back to the captured payload when the log entry is decoded.
+ *
+ */
+#include "private/deferred.h"
+#include "private/binary.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define NULL_STRING       UINT32_MAX
+
+int mdclog_internal_parse_conversion(const char* spec, struct conversion* conv)
+{
+    size_t i = 1;
+    int    longs = 0;
+    int    modifier = 0;
+
+    memset(conv, 0, sizeof(*conv));
+    conv->precision = -1;
+
+    while (spec[i] != '\0' && strchr("-+ #0'I", spec[i]))
+        i++;
+    if (spec[i] == '*')
+    {
+        conv->width_arg = 1;
+        i++;
+    }
+    while (spec[i] >= '0' && spec[i] <= '9')
+        i++;
+    if (spec[i] == '$')
+        return -1;                          // positional arguments
+    if (spec[i] == '.')
+    {
+        i++;
+        if (spec[i] == '*')
+        {
+            conv->precision_arg = 1;
+            i++;
+        }
+        else
+        {
+            conv->precision = 0;
+            while (spec[i] >= '0' && spec[i] <= '9')
+                conv->precision = conv->precision * 10 + (spec[i++] - '0');
+        }
+    }
+    for (;; i++)
+    {
+        if (spec[i] == 'h')
+            modifier = 'h';
+        else if (spec[i] == 'l')
+            longs++;
+        else if (spec[i] == 'q' || spec[i] == 'L')
+            longs = 2;
+        else if (spec[i] == 'j' || spec[i] == 'z' || spec[i] == 'Z' || spec[i] == 't')
+            modifier = spec[i];
+        else
+            break;
+    }
+
+    switch (spec[i])
+    {
+        case '%':
+            conv->type = ARG_NONE;
+            break;
+        case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+            if (modifier == 'j')
+                conv->type = ARG_INTMAX;
+            else if (modifier == 'z' || modifier == 'Z')
+                conv->type = ARG_SIZE;
+            else if (modifier == 't')
+                conv->type = ARG_PTRDIFF;
+            else if (longs >= 2)
+                conv->type = ARG_LLONG;
+            else if (longs == 1)
+                conv->type = ARG_LONG;
+            else
+                conv->type = ARG_INT;
+            break;
+        case 'c':
+            if (longs)
+                return -1;                  // wide character
+            conv->type = ARG_INT;
+            break;
+        case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+            conv->type = longs >= 2 ? ARG_LDOUBLE : ARG_DOUBLE;
+            break;
+        case 's':
+            if (longs)
+                return -1;                  // wide string
+            conv->type = ARG_STRING;
+            break;
+        case 'p':
+            conv->type = ARG_POINTER;
+            break;
+        default:
+            return -1;                      // %n, %m, %C, %S and unknown conversions
+    }
+    conv->len = i + 1;
+    if (conv->len >= CONVERSION_MAX_LENGTH)
+        return -1;
+    return 0;
+}
+
+#define CAPTURE(type, promoted)                             \
+    do {                                                    \
+        type v = (type)va_arg(arglist, promoted);           \
+        if (offset + sizeof(v) > len)                       \
+            return -1;                                      \
+        memcpy(&buffer[offset], &v, sizeof(v));             \
+        offset += sizeof(v);                                \
+    } while (0)
+
+int mdclog_internal_capture_args(char* buffer, size_t len, const char* format, va_list arglist)
+{
+    struct conversion conv;
+    size_t            offset = 0;
+    const char*       p;
+    const char*       str;
+    uint32_t          str_len;
+    int               precision;
+
+    for (p = strchr(format, '%'); p; p = strchr(p + conv.len, '%'))
+    {
+        if (mdclog_internal_parse_conversion(p, &conv))
+            return -1;
+        precision = conv.precision;
+        if (conv.width_arg)
+            CAPTURE(int, int);
+        if (conv.precision_arg)
+        {
+            CAPTURE(int, int);
+            memcpy(&precision, &buffer[offset - sizeof(int)], sizeof(int));
+        }
+        switch (conv.type)
+        {
+            case ARG_NONE:     break;
+            case ARG_INT:      CAPTURE(int, int); break;
+            case ARG_LONG:     CAPTURE(long, long); break;
+            case ARG_LLONG:    CAPTURE(long long, long long); break;
+            case ARG_INTMAX:   CAPTURE(intmax_t, intmax_t); break;
+            case ARG_SIZE:     CAPTURE(size_t, size_t); break;
+            case ARG_PTRDIFF:  CAPTURE(ptrdiff_t, ptrdiff_t); break;
+            case ARG_DOUBLE:   CAPTURE(double, double); break;
+            case ARG_LDOUBLE:  CAPTURE(long double, long double); break;
+            case ARG_POINTER:  CAPTURE(void*, void*); break;
+            case ARG_STRING:
+                str = va_arg(arglist, const char*);
+                if (str)
+                    // with a precision the string need not be zero terminated
+                    str_len = (uint32_t)(precision >= 0 ? strnlen(str, (size_t)precision) : strlen(str));
+                else
+                    str_len = NULL_STRING;
+                if (offset + sizeof(str_len) > len)
+                    return -1;
+                memcpy(&buffer[offset], &str_len, sizeof(str_len));
+                offset += sizeof(str_len);
+                if (str)
+                {
+                    if (offset + str_len + 1 > len)
+                        return -1;
+                    memcpy(&buffer[offset], str, str_len);
+                    buffer[offset + str_len] = '\0';
+                    offset += str_len + 1;
+                }
+                break;
+        }
+    }
+    return (int)offset;
+}
+
+#define RENDER(type)                                                                    \
+    do {                                                                                \
+        type v;                                                                         \
+        if (offset + sizeof(v) > args_len)                                              \
+            return -1;                                                                  \
+        memcpy(&v, &args[offset], sizeof(v));                                           \
+        offset += sizeof(v);                                                            \
+        if (conv.width_arg && conv.precision_arg)                                       \
+            ret = snprintf(out, out_len, spec, width, precision, v);                    \
+        else if (conv.width_arg)                                                        \
+            ret = snprintf(out, out_len, spec, width, v);                               \
+        else if (conv.precision_arg)                                                    \
+            ret = snprintf(out, out_len, spec, precision, v);                           \
+        else                                                                            \
+            ret = snprintf(out, out_len, spec, v);                                      \
+    } while (0)
+
+#define READ_INT(dst)                                                                   \
+    do {                                                                                \
+        if (offset + sizeof(int) > args_len)                                            \
+            return -1;                                                                  \
+        memcpy(&(dst), &args[offset], sizeof(int));                                     \
+        offset += sizeof(int);                                                          \
+    } while (0)
+
+int mdclog_internal_render_args(char* buffer, size_t len, const char* format, const char* args, size_t args_len)
+{
+    struct conversion conv;
+    char              spec[CONVERSION_MAX_LENGTH];
+    size_t            total = 0;
+    size_t            offset = 0;
+    size_t            literal;
+    const char*       p = format;
+    const char*       next;
+    char*             out;
+    size_t            out_len;
+    int               width = 0;
+    int               precision = 0;
+    int               ret;
+    uint32_t          str_len;
+
+    if (len == 0)
+        return -1;
+    buffer[0] = '\0';
+    for (;;)
+    {
+        next = strchr(p, '%');
+        literal = next ? (size_t)(next - p) : strlen(p);
+        if (total < len - 1)
+        {
+            size_t n = literal < len - 1 - total ? literal : len - 1 - total;
+            memcpy(&buffer[total], p, n);
+            buffer[total + n] = '\0';
+        }
+        total += literal;
+        if (!next)
+            break;
+
+        if (mdclog_internal_parse_conversion(next, &conv))
+            return -1;
+        memcpy(spec, next, conv.len);
+        spec[conv.len] = '\0';
+        p = next + conv.len;
+
+        out = total < len - 1 ? &buffer[total] : NULL;
+        out_len = total < len - 1 ? len - total : 0;
+        if (conv.width_arg)
+            READ_INT(width);
+        if (conv.precision_arg)
+            READ_INT(precision);
+        switch (conv.type)
+        {
+            case ARG_NONE:
+                ret = 1;
+                if (out)
+                {
+                    out[0] = '%';
+                    out[1] = '\0';
+                }
+                break;
+            case ARG_INT:      RENDER(int); break;
+            case ARG_LONG:     RENDER(long); break;
+            case ARG_LLONG:    RENDER(long long); break;
+            case ARG_INTMAX:   RENDER(intmax_t); break;
+            case ARG_SIZE:     RENDER(size_t); break;
+            case ARG_PTRDIFF:  RENDER(ptrdiff_t); break;
+            case ARG_DOUBLE:   RENDER(double); break;
+            case ARG_LDOUBLE:  RENDER(long double); break;
+            case ARG_POINTER:  RENDER(void*); break;
+            case ARG_STRING:
+            {
+                const char* str = NULL;
+
+                if (offset + sizeof(str_len) > args_len)
+                    return -1;
+                memcpy(&str_len, &args[offset], sizeof(str_len));
+                offset += sizeof(str_len);
+                if (str_len != NULL_STRING)
+                {
+                    if (offset + str_len + 1 > args_len)
+                        return -1;
+                    str = &args[offset];
+                    offset += str_len + 1;
+                }
+                if (conv.width_arg && conv.precision_arg)
+                    ret = snprintf(out, out_len, spec, width, precision, str);
+                else if (conv.width_arg)
+                    ret = snprintf(out, out_len, spec, width, str);
+                else if (conv.precision_arg)
+                    ret = snprintf(out, out_len, spec, precision, str);
+                else
+                    ret = snprintf(out, out_len, spec, str);
+                break;
+            }
+            default:
+                return -1;
+        }
+        if (ret < 0)
+            return -1;
+        total += (size_t)ret;
+    }
+    return (int)total;
+}
+
+#define PACK_SIGNED(type, promoted)                                                     \
+    do {                                                                                \
+        type v = (type)va_arg(arglist, promoted);                                       \
+        n = mdclog_internal_put_svarint(&buffer[offset], len - offset, (int64_t)v);     \
+        if (n == 0)                                                                     \
+            return -1;                                                                  \
+        offset += n;                                                                    \
+    } while (0)
+
+#define PACK_UNSIGNED(type, promoted)                                                   \
+    do {                                                                                \
+        type v = (type)va_arg(arglist, promoted);                                       \
+        n = mdclog_internal_put_varint(&buffer[offset], len - offset, (uint64_t)v);     \
+        if (n == 0)                                                                     \
+            return -1;                                                                  \
+        offset += n;                                                                    \
+    } while (0)
+
+int mdclog_internal_pack_args(char* buffer, size_t len, const char* format, va_list arglist)
+{
+    struct conversion conv;
+    size_t            offset = 0;
+    size_t            n;
+    const char*       p;
+    const char*       str;
+    size_t            str_len;
+    int               precision;
+
+    for (p = strchr(format, '%'); p; p = strchr(p + conv.len, '%'))
+    {
+        if (mdclog_internal_parse_conversion(p, &conv))
+            return -1;
+        precision = conv.precision;
+        if (conv.width_arg)
+            PACK_SIGNED(int, int);
+        if (conv.precision_arg)
+        {
+            precision = va_arg(arglist, int);
+            n = mdclog_internal_put_svarint(&buffer[offset], len - offset, precision);
+            if (n == 0)
+                return -1;
+            offset += n;
+        }
+        switch (conv.type)
+        {
+            case ARG_NONE:     break;
+            case ARG_INT:      PACK_SIGNED(int, int); break;
+            case ARG_LONG:     PACK_SIGNED(long, long); break;
+            case ARG_LLONG:    PACK_SIGNED(long long, long long); break;
+            case ARG_INTMAX:   PACK_SIGNED(intmax_t, intmax_t); break;
+            case ARG_PTRDIFF:  PACK_SIGNED(ptrdiff_t, ptrdiff_t); break;
+            case ARG_SIZE:     PACK_UNSIGNED(size_t, size_t); break;
+            case ARG_POINTER:  PACK_UNSIGNED(uintptr_t, void*); break;
+            case ARG_DOUBLE:   CAPTURE(double, double); break;
+            case ARG_LDOUBLE:  CAPTURE(long double, long double); break;
+            case ARG_STRING:
+                str = va_arg(arglist, const char*);
+                str_len = str ? (precision >= 0 ? strnlen(str, (size_t)precision) : strlen(str)) : 0;
+                n = mdclog_internal_put_varint(&buffer[offset], len - offset, str ? str_len + 1 : 0);
+                if (n == 0 || str_len >= NULL_STRING || offset + n + str_len > len)
+                    return -1;
+                offset += n;
+                if (str)
+                {
+                    memcpy(&buffer[offset], str, str_len);
+                    offset += str_len;
+                }
+                break;
+        }
+    }
+    return (int)offset;
+}
+
+#define UNPACK_SIGNED(type)                                                             \
+    do {                                                                                \
+        int64_t v;                                                                      \
+        type    t;                                                                      \
+        n = mdclog_internal_get_svarint(&packed[in], packed_len - in, &v);              \
+        if (n == 0 || offset + sizeof(t) > len)                                         \
+            return -1;                                                                  \
+        in += n;                                                                        \
+        t = (type)v;                                                                    \
+        memcpy(&buffer[offset], &t, sizeof(t));                                         \
+        offset += sizeof(t);                                                            \
+    } while (0)
+
+#define UNPACK_UNSIGNED(type)                                                           \
+    do {                                                                                \
+        uint64_t v;                                                                     \
+        type     t;                                                                     \
+        n = mdclog_internal_get_varint(&packed[in], packed_len - in, &v);               \
+        if (n == 0 || offset + sizeof(t) > len)                                         \
+            return -1;                                                                  \
+        in += n;                                                                        \
+        t = (type)(uintptr_t)v;                                                         \
+        memcpy(&buffer[offset], &t, sizeof(t));                                         \
+        offset += sizeof(t);                                                            \
+    } while (0)
+
+#define UNPACK_FIXED(type)                                                              \
+    do {                                                                                \
+        if (in + sizeof(type) > packed_len || offset + sizeof(type) > len)              \
+            return -1;                                                                  \
+        memcpy(&buffer[offset], &packed[in], sizeof(type));                             \
+        in += sizeof(type);                                                             \
+        offset += sizeof(type);                                                         \
+    } while (0)
+
+int mdclog_internal_unpack_args(char* buffer, size_t len, const char* format, const char* packed, size_t packed_len)
+{
+    struct conversion conv;
+    size_t            offset = 0;
+    size_t            in = 0;
+    size_t            n;
+    const char*       p;
+    uint64_t          str_size;
+    uint32_t          str_len;
+
+    for (p = strchr(format, '%'); p; p = strchr(p + conv.len, '%'))
+    {
+        if (mdclog_internal_parse_conversion(p, &conv))
+            return -1;
+        if (conv.width_arg)
+            UNPACK_SIGNED(int);
+        if (conv.precision_arg)
+            UNPACK_SIGNED(int);
+        switch (conv.type)
+        {
+            case ARG_NONE:     break;
+            case ARG_INT:      UNPACK_SIGNED(int); break;
+            case ARG_LONG:     UNPACK_SIGNED(long); break;
+            case ARG_LLONG:    UNPACK_SIGNED(long long); break;
+            case ARG_INTMAX:   UNPACK_SIGNED(intmax_t); break;
+            case ARG_PTRDIFF:  UNPACK_SIGNED(ptrdiff_t); break;
+            case ARG_SIZE:     UNPACK_UNSIGNED(size_t); break;
+            case ARG_POINTER:  UNPACK_UNSIGNED(void*); break;
+            case ARG_DOUBLE:   UNPACK_FIXED(double); break;
+            case ARG_LDOUBLE:  UNPACK_FIXED(long double); break;
+            case ARG_STRING:
+                n = mdclog_internal_get_varint(&packed[in], packed_len - in, &str_size);
+                if (n == 0 || str_size > NULL_STRING || (str_size ? str_size - 1 : 0) > packed_len - in - n)
+                    return -1;
+                in += n;
+                str_len = str_size ? (uint32_t)(str_size - 1) : NULL_STRING;
+                if (offset + sizeof(str_len) + (str_size ? str_size : 0) > len)
+                    return -1;
+                memcpy(&buffer[offset], &str_len, sizeof(str_len));
+                offset += sizeof(str_len);
+                if (str_size)
+                {
+                    memcpy(&buffer[offset], &packed[in], str_len);
+                    buffer[offset + str_len] = '\0';
+                    offset += str_size;
+                    in += str_len;
+                }
+                break;
+        }
+    }
+    return in == packed_len ? (int)offset : -1;
+}
@@ -0,0 +1,154 @@
+/*
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ *
+ * Epoch based reclamation. Each thread reading shared data has a reader
+ * record, which holds the global epoch the thread had when it entered its
+ * read side critical section, or 0 outside of it. A writer unpublishes the
+ * data, advances the global epoch and waits until no reader is in an epoch
+ * before the advance. Readers touch only their own record, so reading does
+ * not move cache lines between the cores.
+ *
+ * The reader records are never freed. A record of an exited thread is
+ * reused by a new thread. If a record cannot be allocated, the thread is
+ * counted in a shared counter instead.
+ *
+ */
+#include "private/epoch.h"
+#include "private/system.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CACHE_LINE_SIZE 64
+
+struct reader
+{
+    _Atomic uint64_t epoch;     // epoch of the critical section, 0 outside of it
+    struct reader   *next;      // protected by registry_mutex
+    int              in_use;    // protected by registry_mutex
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+static _Atomic uint64_t global_epoch = 1;
+static _Atomic unsigned unregistered_readers;   // readers in a critical section without a record
+static pthread_mutex_t  registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct reader   *readers;                // protected by registry_mutex
+static pthread_key_t    readerkey;
+static pthread_once_t   readerkey_once = PTHREAD_ONCE_INIT;
+static int              readerkey_created;
+
+static __thread struct reader *thread_reader TLS_INITIAL_EXEC;
+static __thread unsigned       thread_depth TLS_INITIAL_EXEC;
+
+static void release_reader(void *ptr)
+{
+    struct reader *reader = (struct reader*)ptr;
+
+    pthread_mutex_lock(&registry_mutex);
+    reader->in_use = 0;
+    pthread_mutex_unlock(&registry_mutex);
+    thread_reader = NULL;
+}
+
+static void create_reader_key(void)
+{
+    readerkey_created = pthread_key_create(&readerkey, release_reader) == 0;
+}
+
+static struct reader *register_reader(void)
+{
+    struct reader *reader;
+
+    pthread_once(&readerkey_once, create_reader_key);
+    if (!readerkey_created)
+        return NULL;
+    pthread_mutex_lock(&registry_mutex);
+    for (reader = readers; reader && reader->in_use; reader = reader->next)
+        ;
+    if (!reader)
+    {
+        reader = aligned_alloc(CACHE_LINE_SIZE, sizeof(*reader));
+        if (reader)
+        {
+            memset(reader, 0, sizeof(*reader));
+            reader->next = readers;
+            readers = reader;
+        }
+    }
+    if (reader)
+    {
+        if (pthread_setspecific(readerkey, reader) == 0)
+            reader->in_use = 1;
+        else
+            reader = NULL;
+    }
+    pthread_mutex_unlock(&registry_mutex);
+    thread_reader = reader;
+    return reader;
+}
+
+void mdclog_internal_epoch_enter(void)
+{
+    struct reader *reader;
+
+    if (thread_depth++ > 0)
+        return;
+    reader = thread_reader ? thread_reader : register_reader();
+    if (reader)
+        atomic_store_explicit(&reader->epoch, atomic_load_explicit(&global_epoch, memory_order_relaxed),
+                memory_order_relaxed);
+    else
+        atomic_fetch_add_explicit(&unregistered_readers, 1, memory_order_relaxed);
+    // the announcement must be visible before the shared data is read
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+void mdclog_internal_epoch_leave(void)
+{
+    if (--thread_depth > 0)
+        return;
+    if (thread_reader)
+        atomic_store_explicit(&thread_reader->epoch, 0, memory_order_release);
+    else
+        atomic_fetch_sub_explicit(&unregistered_readers, 1, memory_order_release);
+}
+
+void mdclog_internal_epoch_synchronize(void)
+{
+    struct reader *reader;
+    uint64_t       epoch;
+    uint64_t       reader_epoch;
+
+    // readers which entered before the advance may hold unpublished data
+    epoch = atomic_fetch_add_explicit(&global_epoch, 1, memory_order_seq_cst);
+    atomic_thread_fence(memory_order_seq_cst);
+    pthread_mutex_lock(&registry_mutex);
+    for (reader = readers; reader; reader = reader->next)
+    {
+        while ((reader_epoch = atomic_load_explicit(&reader->epoch, memory_order_acquire)) != 0 &&
+               reader_epoch <= epoch)
+            sched_yield();
+    }
+    pthread_mutex_unlock(&registry_mutex);
+    while (atomic_load_explicit(&unregistered_readers, memory_order_acquire))
+        sched_yield();
+}
@@ -0,0 +1,308 @@
+/*
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ *
+ * Output of the log entries to a rotated file.
+ *
+ * The file currently written is a segment published with an atomic pointer.
+ * Writers append to it with O_APPEND in an epoch critical section, and count
+ * the written bytes. The writer that finds the rotation due takes the rotation
+ * mutex without waiting, renames the files, opens a new segment and publishes
+ * it, while the other writers keep appending to the previous segment. The
+ * previous segment is closed when no writer can see it any more. The segments
+ * are preallocated to the rotation size, so most appends do not need to
+ * allocate blocks for the file.
+ */
+#include "private/filesink.h"
+#include "private/epoch.h"
+#include "private/socketsink.h"
+#include "private/system.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// room for the suffix of a rotated file
+#define SUFFIX_MAX_LENGTH 12
+
+struct segment
+{
+    int              fd;
+    _Atomic size_t   size;          // size of the file, including the writes in progress
+    uint64_t         deadline_ns;   // time based rotation, UINT64_MAX if none
+    _Atomic uint64_t retry_ns;      // not rotated before this time after a failure
+};
+
+struct file_sink
+{
+    char                     *path;
+    struct file_sink_config   config;
+    _Atomic(struct segment *) segment;
+};
+
+static _Atomic(struct file_sink *) current_sink;
+static _Atomic unsigned long       output_generation;
+static pthread_mutex_t             rotation_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t coarse_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static struct segment *open_segment(const char *path, const struct file_sink_config *config, uint64_t now_ns)
+{
+    struct segment *segment = malloc(sizeof(*segment));
+    struct stat     st;
+    size_t          size = 0;
+    int             ret;
+
+    if (!segment)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    segment->fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (segment->fd < 0)
+    {
+        free(segment);
+        return NULL;
+    }
+    if (fstat(segment->fd, &st) == 0)
+        size = (size_t)st.st_size;
+    // not supported by all file systems, in which case the blocks are allocated on append
+    if (config->max_size > size)
+    {
+        ret = fallocate(segment->fd, FALLOC_FL_KEEP_SIZE, (off_t)size, (off_t)(config->max_size - size));
+        (void)ret;
+    }
+    atomic_init(&segment->size, size);
+    segment->deadline_ns = config->interval_ns ? now_ns + config->interval_ns : UINT64_MAX;
+    atomic_init(&segment->retry_ns, 0);
+    return segment;
+}
+
+/*
+ * Release the preallocated blocks beyond the end of the file and close it
+ */
+static void close_segment(struct segment *segment)
+{
+    struct stat st;
+    int         ret;
+
+    if (fstat(segment->fd, &st) == 0)
+    {
+        ret = ftruncate(segment->fd, st.st_size);
+        (void)ret;
+    }
+    close(segment->fd);
+    free(segment);
+}
+
+/*
+ * Rename the log file to .1, .1 to .2 and so on. The oldest file is replaced.
+ */
+static void shift_rotated_files(const struct file_sink *sink)
+{
+    char     from[PATH_MAX];
+    char     to[PATH_MAX];
+    unsigned i;
+
+    if (sink->config.retention == 0)
+    {
+        unlink(sink->path);
+        return;
+    }
+    for (i = sink->config.retention; i > 1; i--)
+    {
+        snprintf(from, sizeof(from), "%s.%u", sink->path, i - 1);
+        snprintf(to, sizeof(to), "%s.%u", sink->path, i);
+        rename(from, to);
+    }
+    snprintf(to, sizeof(to), "%s.1", sink->path);
+    rename(sink->path, to);
+}
+
+static int rotation_due(const struct file_sink *sink, struct segment *segment, size_t size, uint64_t now_ns)
+{
+    return ((sink->config.max_size && size >= sink->config.max_size) || now_ns >= segment->deadline_ns) &&
+           now_ns >= atomic_load_explicit(&segment->retry_ns, memory_order_relaxed);
+}
+
+/*
+ * Rotate the current file, unless another thread is already rotating it
+ */
+static void rotate(uint64_t now_ns)
+{
+    struct file_sink *sink;
+    struct segment   *old;
+    struct segment   *segment;
+
+    if (pthread_mutex_trylock(&rotation_mutex) != 0)
+        return;
+    sink = atomic_load_explicit(&current_sink, memory_order_acquire);
+    old = sink ? atomic_load_explicit(&sink->segment, memory_order_relaxed) : NULL;
+    if (!old || !rotation_due(sink, old, atomic_load_explicit(&old->size, memory_order_relaxed), now_ns))
+    {
+        // rotated by another thread meanwhile
+        pthread_mutex_unlock(&rotation_mutex);
+        return;
+    }
+    shift_rotated_files(sink);
+    segment = open_segment(sink->path, &sink->config, now_ns);
+    if (!segment)
+    {
+        // the entries are appended to the renamed file until the retry
+        atomic_store_explicit(&old->retry_ns, now_ns + FILE_SINK_ROTATION_RETRY_NS, memory_order_relaxed);
+        pthread_mutex_unlock(&rotation_mutex);
+        return;
+    }
+    atomic_store_explicit(&sink->segment, segment, memory_order_release);
+    atomic_fetch_add_explicit(&output_generation, 1, memory_order_relaxed);
+    pthread_mutex_unlock(&rotation_mutex);
+    mdclog_internal_epoch_synchronize();
+    close_segment(old);
+}
+
+struct file_sink *mdclog_internal_file_sink_open(const char *path, const struct file_sink_config *config)
+{
+    struct file_sink *sink;
+    struct segment   *segment;
+
+    if (strlen(path) + SUFFIX_MAX_LENGTH >= PATH_MAX)
+    {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    sink = malloc(sizeof(*sink));
+    if (!sink || !(sink->path = strdup(path)))
+    {
+        free(sink);
+        errno = ENOMEM;
+        return NULL;
+    }
+    sink->config = *config;
+    segment = open_segment(path, config, coarse_ns());
+    if (!segment)
+    {
+        free(sink->path);
+        free(sink);
+        return NULL;
+    }
+    atomic_init(&sink->segment, segment);
+    return sink;
+}
+
+void mdclog_internal_file_sink_set(struct file_sink *sink)
+{
+    struct file_sink *old;
+
+    pthread_mutex_lock(&rotation_mutex);
+    old = atomic_exchange_explicit(&current_sink, sink, memory_order_acq_rel);
+    if (old || sink)
+        atomic_fetch_add_explicit(&output_generation, 1, memory_order_relaxed);
+    pthread_mutex_unlock(&rotation_mutex);
+    if (old)
+    {
+        mdclog_internal_epoch_synchronize();
+        close_segment(atomic_load_explicit(&old->segment, memory_order_relaxed));
+        free(old->path);
+        free(old);
+    }
+}
+
+int mdclog_internal_file_sink_active(void)
+{
+    return atomic_load_explicit(&current_sink, memory_order_relaxed) != NULL;
+}
+
+unsigned long mdclog_internal_output_generation(void)
+{
+    return atomic_load_explicit(&output_generation, memory_order_relaxed);
+}
+
+int mdclog_internal_output_fd(void)
+{
+    struct file_sink *sink;
+
+    if (mdclog_internal_socket_sink_connected())
+        return -1;
+    sink = atomic_load_explicit(&current_sink, memory_order_acquire);
+    return sink ? atomic_load_explicit(&sink->segment, memory_order_acquire)->fd : STDOUT_FILENO;
+}
+
+void mdclog_internal_output_changed(void)
+{
+    atomic_fetch_add_explicit(&output_generation, 1, memory_order_relaxed);
+}
+
+ssize_t mdclog_internal_output_write(const void *buffer, size_t len)
+{
+    ssize_t ret = mdclog_internal_socket_sink_write(buffer, len);
+
+    if (ret >= 0 || errno != ENOTCONN)
+        return ret;
+    return mdclog_internal_output_write_local(buffer, len);
+}
+
+ssize_t mdclog_internal_output_write_local(const void *buffer, size_t len)
+{
+    struct file_sink *sink;
+    struct segment   *segment;
+    ssize_t           ret;
+    size_t            size;
+    uint64_t          now_ns = 0;
+    int               due = 0;
+
+    if (!atomic_load_explicit(&current_sink, memory_order_relaxed))
+        return SYSTEM(write(STDOUT_FILENO, buffer, len));
+    mdclog_internal_epoch_enter();
+    sink = atomic_load_explicit(&current_sink, memory_order_acquire);
+    if (!sink)
+    {
+        // the sink was removed meanwhile
+        mdclog_internal_epoch_leave();
+        return SYSTEM(write(STDOUT_FILENO, buffer, len));
+    }
+    segment = atomic_load_explicit(&sink->segment, memory_order_acquire);
+    ret = SYSTEM(write(segment->fd, buffer, len));
+    if (ret > 0)
+    {
+        size = atomic_fetch_add_explicit(&segment->size, (size_t)ret, memory_order_relaxed) + (size_t)ret;
+        if ((sink->config.max_size && size >= sink->config.max_size) || segment->deadline_ns != UINT64_MAX)
+        {
+            now_ns = coarse_ns();
+            due = rotation_due(sink, segment, size, now_ns);
+        }
+    }
+    mdclog_internal_epoch_leave();
+    // the epoch critical section must be left before waiting for the other writers
+    if (due)
+        rotate(now_ns);
+    return ret;
+}
@@ -0,0 +1,84 @@
+/*
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ *
+ * Splitting of large log entries into fragments.
+ *
+ * A write of at most PIPE_BUF bytes to a pipe is atomic, so an entry that is
+ * written as fragments of that size is not interleaved with the output of
+ * other threads or processes, even though other entries can be written
+ * between its fragments. The fragment data is the entry escaped as a json
+ * string. A formatted entry contains only printable characters, so only the
+ * backslash and the double quote need to be escaped.
+ */
+#include "private/fragment.h"
+
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FRAGMENT_HEADER "{\"fragment\":{\"pid\":%ld,\"id\":%llu,\"seq\":%zu,\"last\":%s},\"data\":\""
+#define FRAGMENT_END    "\"}\n"
+
+static _Atomic unsigned long long next_id = 1;
+
+static int needs_escape(char c)
+{
+    return c == '\\' || c == '"';
+}
+
+size_t mdclog_internal_write_fragments(const char *entry, size_t len, fragment_write_fn_t write)
+{
+    char               buffer[PIPE_BUF];
+    unsigned long long id = atomic_fetch_add_explicit(&next_id, 1, memory_order_relaxed);
+    long               pid = (long)getpid();
+    const size_t       end_len = strlen(FRAGMENT_END);
+    size_t             offset = 0;
+    size_t             seq = 0;
+    size_t             end, escaped, n;
+    int                ret;
+
+    do
+    {
+        // the header is the longest when the fragment is not the last one
+        ret = snprintf(buffer, sizeof(buffer), FRAGMENT_HEADER, pid, id, seq, "false");
+        if (ret < 0 || (size_t)ret + end_len >= sizeof(buffer))
+            break;
+        for (end = offset, escaped = 0; end < len; end++)
+        {
+            n = needs_escape(entry[end]) ? 2 : 1;
+            if (escaped + n > sizeof(buffer) - (size_t)ret - end_len)
+                break;
+            escaped += n;
+        }
+        if (end == len)
+            ret = snprintf(buffer, sizeof(buffer), FRAGMENT_HEADER, pid, id, seq, "true");
+        for (n = (size_t)ret; offset < end; offset++)
+        {
+            if (needs_escape(entry[offset]))
+                buffer[n++] = '\\';
+            buffer[n++] = entry[offset];
+        }
+        memcpy(&buffer[n], FRAGMENT_END, end_len);
+        write(buffer, n + end_len);
+        seq++;
+    } while (offset < len);
+    return seq;
+}
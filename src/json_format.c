@@ -29,17 +29,27 @@
  *  "mdc":{"key1":"value1","key2":"value2"},
  *  "message": "This is an example log"}
  *
+ * The keys and the order of the fields are configurable. When the library is
+ * initialized, the layout is compiled to one header template per severity.
+ * The severity and identity fields, which do not change between log entries,
+ * are rendered to the template, so that only the timestamp, the MDCs and the
+ * message are formatted for every log entry.
  */
 
 #include "private/json_format.h"
 
+#include <errno.h>
 #include <stddef.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <ctype.h>
 
 #include "private/system.h"
+#include "private/deferred.h"
+#include "private/kv.h"
+#include "private/message.h"
+#include "private/scan.h"
+#include "private/timestamp.h"
 
 #define TIMESTAMP_KEY "ts"
 #define SEVERITY_KEY  "crit"
@@ -47,48 +57,102 @@
 #define MESSAGE_KEY   "msg"
 #define MDC_KEY       "mdc"
 
-#define SEVERITY_ERR_VAL    "ERROR"
-#define SEVERITY_WARN_VAL   "WARNING"
-#define SEVERITY_INFO_VAL   "INFO"
-#define SEVERITY_DEBUG_VAL  "DEBUG"
+#define TIMESTAMP_PREFIX    "\"" TIMESTAMP_KEY "\":"
+#define MDC_PREFIX          "\"" MDC_KEY "\":"
+#define MESSAGE_PREFIX      "\"" MESSAGE_KEY "\":\""
 
 #define TRUNCATED           "[truncated]"
-#define MINIMUM_MESSAGE     "\"" MESSAGE_KEY "\":\"" TRUNCATED "\""
 #define REPLACEMENT_CHAR    ' '
 
+static const char* const severity_values[JSON_SEVERITY_COUNT] = {
+    [MDCLOG_FATAL] = "FATAL",
+    [MDCLOG_ERR]   = "ERROR",
+    [MDCLOG_WARN]  = "WARNING",
+    [MDCLOG_INFO]  = "INFO",
+    [MDCLOG_DEBUG] = "DEBUG",
+    [MDCLOG_TRACE] = "TRACE",
+};
+
+/*
+ * Source of the log message: either a format string with its
+ * variable length arguments or with arguments captured earlier,
+ * or a literal message with typed fields.
+ */
+struct message
+{
+    const char*        format;
+    va_list            arglist;     // used if args and fields are NULL
+    const char*        args;        // captured arguments
+    size_t             args_len;
+    const mdclog_kv_t* fields;      // the format is a literal message if not NULL
+    size_t             field_count;
+};
+
+/*
+ * MDCs of a log entry: the MDC list of the thread, an MDC object formatted
+ * earlier, or an array of MDCs, in this order of precedence
+ */
+struct mdc_source
+{
+    mdc_t*                 list;
+    const char*            str;
+    size_t                 str_len;
+    const struct json_mdc* pairs;
+    size_t                 pair_count;
+};
+
+/*
+ * Header of a deferred log entry. It is followed by the formatted
+ * MDC section and the captured arguments.
+ */
+struct deferred_entry
+{
+    struct timeval    timestamp;
+    const char*       format;
+    mdclog_severity_t severity;
+    unsigned int      mdc_len;
+    unsigned int      args_len;
+};
+
 size_t mdclog_internal_escape(char* buffer, size_t len, const char* str, int* truncated)
 {
-    size_t s, d;
-    size_t ret;
-    int    tmp_truncated = 0;
+    return mdclog_internal_escape_len(buffer, len, str, strlen(str), truncated);
+}
 
-    // escape \ and " characters
-    for (s = 0, d = 0; d < len - 1 && str[s] != '\0'; s++, d++)
+size_t mdclog_internal_escape_len(char* buffer, size_t len, const char* str, size_t str_len, int* truncated)
+{
+    size_t s = 0, d = 0;
+    size_t run;
+
+    for (;;)
     {
-        if (str[s] == '\\' || str[s] == '"' )
+        // copy the run of characters that need no escaping
+        run = mdclog_internal_find_special(&str[s], str_len - s);
+        if (run > len - 1 - d)
+            run = len - 1 - d;
+        memcpy(&buffer[d], &str[s], run);
+        s += run;
+        d += run;
+        if (s == str_len || d == len - 1)
+            break;
+
+        // escape \ and " characters, replace non-printable characters
+        if (str[s] == '\\' || str[s] == '"')
+        {
+            // do not cut between the escape char and the escaped char
+            if (d + 2 > len - 1)
+                break;
             buffer[d++] = '\\';
-        if (isprint(str[s]))
-            buffer[d] = str[s];
+            buffer[d++] = str[s];
+        }
         else
-            buffer[d] = REPLACEMENT_CHAR;
-    }
-    if (d == len)
-    {
-        // last char was escaped, but it must be truncated
-        buffer[len - 2] = '\0';
-        tmp_truncated = 1;
-        ret = len - 2;
-    }
-    else
-    {
-        buffer[d] = '\0';
-        if (str[s] != '\0')
-            tmp_truncated = 1;
-        ret = d;
+            buffer[d++] = REPLACEMENT_CHAR;
+        s++;
     }
+    buffer[d] = '\0';
     if (truncated)
-        *truncated = tmp_truncated;
-    return ret;
+        *truncated = s != str_len;
+    return d;
 }
 
 size_t mdclog_internal_deescape(char* buffer, size_t len, const char* str)
@@ -114,10 +178,14 @@ size_t mdclog_internal_deescape(char* buffer, size_t len, const char* str)
 
 size_t mdclog_internal_escaped_size(const char* str)
 {
+    size_t str_len = strlen(str);
     size_t i, len;
 
-    for (i = 0, len = 0; str[i] != '\0'; i++, len++)
+    for (i = 0, len = str_len; ; i++)
     {
+        i += mdclog_internal_find_special(&str[i], str_len - i);
+        if (i == str_len)
+            break;
         if (str[i] == '\\' || str[i] == '"')
             len++;
     }
@@ -126,61 +194,66 @@ size_t mdclog_internal_escaped_size(const char* str)
 
 int mdclog_internal_contains_special_characters(const char* str)
 {
-    int i;
+    size_t str_len = strlen(str);
 
-    for (i = 0; str[i] != '\0'; i++)
-        if (!isprint(str[i]) || str[i] == '\\' || str[i] == '"')
-            return 1;
-    return 0;
+    return mdclog_internal_find_special(str, str_len) != str_len;
 }
 
-STATIC size_t format_timestamp(char* buffer, size_t len, struct timeval* tv)
+void mdclog_internal_default_layout(struct json_layout* layout)
 {
-    int                ret;
-    unsigned long long timestamp =
-        (unsigned long long)(tv->tv_sec) * 1000 +
-        (unsigned long long)(tv->tv_usec) / 1000;
+    mdclog_field_t field;
+
+    strcpy(layout->keys[MDCLOG_FIELD_TIMESTAMP], TIMESTAMP_KEY);
+    strcpy(layout->keys[MDCLOG_FIELD_SEVERITY], SEVERITY_KEY);
+    strcpy(layout->keys[MDCLOG_FIELD_IDENTITY], LOGGER_KEY);
+    strcpy(layout->keys[MDCLOG_FIELD_MDC], MDC_KEY);
+    strcpy(layout->keys[MDCLOG_FIELD_MESSAGE], MESSAGE_KEY);
+    for (field = MDCLOG_FIELD_TIMESTAMP; field <= MDCLOG_FIELD_MESSAGE; field++)
+        layout->order[field] = field;
+    layout->field_count = JSON_FIELD_COUNT;
+}
 
-    ret = snprintf(buffer, len, "\"%s\":%llu", TIMESTAMP_KEY, timestamp);
-    if (ret < 0 || (size_t)ret >= len)
+int mdclog_internal_set_layout_key(struct json_layout* layout, mdclog_field_t field, const char* key)
+{
+    if ((int)field < 0 || (int)field >= JSON_FIELD_COUNT || !key || key[0] == '\0' ||
+        strlen(key) > MDCLOG_FIELD_KEY_MAX_LENGTH || mdclog_internal_contains_special_characters(key))
     {
-        buffer[0] = '\0';
-        return 0U;
+        errno = EINVAL;
+        return -1;
     }
-    else
-        return (size_t)ret;
+    strcpy(layout->keys[field], key);
+    return 0;
 }
 
-STATIC size_t format_severity(char* buffer, size_t len, mdclog_severity_t severity)
+int mdclog_internal_set_layout_order(struct json_layout* layout, const mdclog_field_t* fields, size_t count)
 {
-    char* severity_val;
-    int   ret;
+    unsigned seen = 0;
+    size_t   i;
 
-    switch(severity)
+    if (!fields || count == 0 || count > JSON_FIELD_COUNT || fields[count - 1] != MDCLOG_FIELD_MESSAGE)
     {
-        case MDCLOG_ERR:    severity_val = SEVERITY_ERR_VAL; break;
-        case MDCLOG_WARN:   severity_val = SEVERITY_WARN_VAL; break;
-        case MDCLOG_INFO:   severity_val = SEVERITY_INFO_VAL; break;
-        case MDCLOG_DEBUG:  severity_val = SEVERITY_DEBUG_VAL; break;
-        default:
-            buffer[0] = '\0';
-            return 0;
+        errno = EINVAL;
+        return -1;
     }
-
-    ret = snprintf(buffer, len, "\"%s\":\"%s\"", SEVERITY_KEY, severity_val);
-    if (ret < 0 || (size_t)ret >= len)
+    for (i = 0; i < count; i++)
     {
-        buffer[0] = '\0';
-        return 0U;
+        if ((int)fields[i] < 0 || (int)fields[i] >= JSON_FIELD_COUNT || (seen & (1U << fields[i])))
+        {
+            errno = EINVAL;
+            return -1;
+        }
+        seen |= 1U << fields[i];
     }
-    return (size_t)ret;
+    memcpy(layout->order, fields, count * sizeof(fields[0]));
+    layout->field_count = count;
+    return 0;
 }
 
-STATIC size_t format_identity(char* buffer, size_t len, const char* identity)
+static size_t format_string_field(char* buffer, size_t len, const char* key, const char* value)
 {
     int ret;
 
-    ret = snprintf(buffer, len, "\"%s\":\"%.*s\"", LOGGER_KEY, IDENTITY_MAX_LENGTH, identity ? identity : "(null)");
+    ret = snprintf(buffer, len, "\"%s\":\"%.*s\"", key, IDENTITY_MAX_LENGTH, value);
     if (ret < 0 || (size_t)ret >= len)
     {
         buffer[0] = '\0';
@@ -189,46 +262,126 @@ STATIC size_t format_identity(char* buffer, size_t len, const char* identity)
     return (size_t)ret;
 }
 
-STATIC size_t format_message(char* buffer, size_t len, const char* msg, va_list arglist)
+static size_t format_severity_field(char* buffer, size_t len, const char* key, mdclog_severity_t severity)
 {
-    int msg_start;
-    size_t msg_len;
-    size_t escaped_msg_len;
-    size_t total_len;
-    int    truncated = 0;
-    int    escape_truncated;
-    size_t i;
-    char*  tmp_buf;
-
-    if ( len <= strlen(MINIMUM_MESSAGE))
+    if ((int)severity < 0 || (int)severity >= JSON_SEVERITY_COUNT)
     {
         buffer[0] = '\0';
         return 0;
     }
+    return format_string_field(buffer, len, key, severity_values[severity]);
+}
 
-	msg_start = snprintf(buffer, len, "\"%s\":\"", MESSAGE_KEY);
-    if (msg_start < 0 || (size_t)msg_start >= len)
+/*
+ * Format the timestamp field. The prefix is the key of the field with the colon.
+ */
+static size_t format_timestamp_field(char* buffer, size_t len, const char* prefix, size_t prefix_len,
+                                     const struct timeval* tv, mdclog_timestamp_format_t format)
+{
+    size_t ret;
+
+    if (len <= prefix_len)
+    {
+        if (len > 0)
+            buffer[0] = '\0';
+        return 0U;
+    }
+    memcpy(buffer, prefix, prefix_len);
+    ret = mdclog_internal_render_timestamp(&buffer[prefix_len], len - prefix_len, tv, format);
+    if (ret == 0)
     {
         buffer[0] = '\0';
         return 0U;
     }
+    return prefix_len + ret;
+}
+
+#ifdef UNITTEST
+/*
+ * Format the fields with the default keys, used by the unit tests
+ */
+STATIC size_t format_timestamp(char* buffer, size_t len, struct timeval* tv, mdclog_timestamp_format_t format)
+{
+    return format_timestamp_field(buffer, len, TIMESTAMP_PREFIX, strlen(TIMESTAMP_PREFIX), tv, format);
+}
 
-    tmp_buf = (char*)malloc(len - (size_t)msg_start);
-    if (!tmp_buf)
+STATIC size_t format_severity(char* buffer, size_t len, mdclog_severity_t severity)
+{
+    return format_severity_field(buffer, len, SEVERITY_KEY, severity);
+}
+
+STATIC size_t format_identity(char* buffer, size_t len, const char* identity)
+{
+    return format_string_field(buffer, len, LOGGER_KEY, identity ? identity : "(null)");
+}
+#endif
+
+/*
+ * Format the message field. The prefix is the key of the field with the colon
+ * and the opening quote.
+ */
+static size_t format_message_body(char* buffer, size_t len, const char* prefix, size_t prefix_len,
+                                  struct message* message, int* message_truncated)
+{
+    size_t      msg_start = prefix_len;
+    size_t      msg_len;
+    size_t      escaped_msg_len = 0;
+    size_t      total_len;
+    int         truncated = 0;
+    int         escape_truncated;
+    size_t      i;
+    int         ret;
+    char*       tmp_buf;
+    const char* text;
+
+    if (len <= prefix_len + strlen(TRUNCATED "\""))
     {
         buffer[0] = '\0';
         return 0;
     }
+    memcpy(buffer, prefix, prefix_len);
 
-    msg_len = vsnprintf(tmp_buf, len - msg_start, msg, arglist);
+    if (message->fields)
+    {
+        // a literal message is escaped without formatting
+        text = message->format;
+        msg_len = 0;
+    }
+    else if (!message->args &&
+             (ret = mdclog_internal_format_message(&buffer[msg_start], len - msg_start - 1,
+                     message->format, message->arglist, &escape_truncated)) >= 0)   // -1 for the " character
+    {
+        // formatted and escaped in one pass
+        text = NULL;
+        msg_len = 0;
+        escaped_msg_len = ret;
+        truncated = escape_truncated;
+    }
+    else
+    {
+        tmp_buf = mdclog_internal_get_scratch(len - msg_start);
+        if (!tmp_buf)
+        {
+            buffer[0] = '\0';
+            return 0;
+        }
+        if (message->args)
+            msg_len = mdclog_internal_render_args(tmp_buf, len - msg_start, message->format,
+                    message->args, message->args_len);
+        else
+            msg_len = vsnprintf(tmp_buf, len - msg_start, message->format, message->arglist);
+        text = tmp_buf;
+    }
     if (msg_len + 1 >= len - msg_start)                            // +1 for the " character
         truncated = 1;
 
-    escaped_msg_len = mdclog_internal_escape(&buffer[msg_start], len - msg_start - 1,
-            tmp_buf, &escape_truncated);  // -1 for the " character
-    if (escape_truncated)
-        truncated = 1;
-    free(tmp_buf);
+    if (text)
+    {
+        escaped_msg_len = mdclog_internal_escape(&buffer[msg_start], len - msg_start - 1,
+                text, &escape_truncated);  // -1 for the " character
+        if (escape_truncated)
+            truncated = 1;
+    }
 
     total_len = msg_start + escaped_msg_len;
 
@@ -246,31 +399,102 @@ STATIC size_t format_message(char* buffer, size_t len, const char* msg, va_list
     else
         total_len += sprintf(&buffer[total_len], "\"");
 
+    if (message_truncated)
+        *message_truncated = truncated;
     return total_len;
 }
 
-STATIC size_t format_mdc(char* buffer, size_t len, mdc_t* mdc)
+#ifdef UNITTEST
+/*
+ * Format a message from a va_list, used by the unit tests
+ */
+STATIC size_t format_message(char* buffer, size_t len, const char* msg, va_list arglist)
 {
-    int ret;
-    int offset = 0;
-    int mdc_count;
+    struct message message;
+    size_t         ret;
+
+    message.format = msg;
+    message.args = NULL;
+    message.fields = NULL;
+    message.field_count = 0;
+    va_copy(message.arglist, arglist);
+    ret = format_message_body(buffer, len, MESSAGE_PREFIX, strlen(MESSAGE_PREFIX), &message, NULL);
+    va_end(message.arglist);
+    return ret;
+}
+#endif
+
+/*
+ * Append one MDC, followed by a comma
+ *
+ * @return  0 if the MDC does not fit to the buffer
+ */
+static int format_one_mdc(char* buffer, size_t len, mdc_t* mdc)
+{
+    int ret = snprintf(buffer, len, "\"%s\":\"%s\",", mdclog_internal_get_mdc_key(mdc),
+            mdclog_internal_get_mdc_val(mdc));
 
-    ret = snprintf(buffer, len, "\"%s\":{", MDC_KEY);
-    if (ret < 0 || (size_t)ret + 1 >= len)  // +1 for the } character
+    if (ret < 0 || (size_t)ret >= len)
+        return 0;
+    return ret;
+}
+
+/*
+ * Format the MDC field. The prefix is the key of the field with the colon,
+ * or empty for formatting only the MDC object.
+ */
+static size_t format_mdc_field(char* buffer, size_t len, const char* prefix, size_t prefix_len, mdc_t* mdc)
+{
+    int             ret;
+    size_t          offset = 0;
+    int             mdc_count = 0;
+    mdc_t*          global;
+    struct mdc_json json;
+    size_t          json_len;
+
+    if (prefix_len + 2 >= len)  // +2 for the { and } characters
     {
-        buffer[0] = '\0';
+        if (len > 0)
+            buffer[0] = '\0';
         return 0U;
     }
-
-    offset += ret;
-    for (mdc_count=0 ; mdc; (mdc = mdclog_internal_get_next_mdc(mdc)), mdc_count++)
+    memcpy(buffer, prefix, prefix_len);
+    offset = prefix_len;
+    buffer[offset++] = '{';
+    // the global MDCs and the MDCs of the calling thread are cached in json format
+    if (!mdclog_internal_get_mdc_json(mdc, &json))
+    {
+        json_len = json.global_len + json.thread_len + (json.global_len && json.thread_len);
+        if (offset + json_len + 2 <= len)   // +2 for the } character and the ending zero
+        {
+            memcpy(&buffer[offset], json.global, json.global_len);
+            offset += json.global_len;
+            if (json.global_len && json.thread_len)
+                buffer[offset++] = ',';
+            memcpy(&buffer[offset], json.thread, json.thread_len);
+            offset += json.thread_len;
+            buffer[offset++] = '}';
+            buffer[offset] = '\0';
+            return offset;
+        }
+    }
+    for (global = mdclog_internal_get_first_global_mdc(); global; global = mdclog_internal_get_next_mdc(global))
     {
-        ret = snprintf(&buffer[offset], len-offset, "\"%s\":\"%s\",", mdclog_internal_get_mdc_key(mdc),
-                mdclog_internal_get_mdc_val(mdc));
-        if (ret < 0 || (size_t)ret >= len-offset)
+        if (mdclog_internal_search_mdc(mdclog_internal_get_mdc_key(global)))
+            continue;
+        ret = format_one_mdc(&buffer[offset], len - offset, global);
+        if (ret == 0)
+            break;
+        offset += ret;
+        mdc_count++;
+    }
+    for (; mdc && !global; mdc = mdclog_internal_get_next_mdc(mdc))   // global is set if it did not fit
+    {
+        ret = format_one_mdc(&buffer[offset], len - offset, mdc);
+        if (ret == 0)
             break;
-
         offset += ret;
+        mdc_count++;
     }
     // remove the last comma
     if (mdc_count > 0)
@@ -278,62 +502,274 @@ STATIC size_t format_mdc(char* buffer, size_t len, mdc_t* mdc)
     buffer[offset++] = '}';
     buffer[offset] = '\0';
 
-    return (size_t)offset;
+    return offset;
 }
 
-
-STATIC int format_log_entry(char* buffer,
-                       size_t len,
-                       struct timeval* timestamp,
-                       const char* identity,
-                       mdclog_severity_t severity,
-                       mdc_t* mdc,
-                       const char* msg,
-                       va_list arglist)
+/*
+ * Format the MDC field from an array of MDCs. Like format_mdc_field(),
+ * the MDCs are written until one does not fit to the buffer.
+ */
+static size_t format_mdc_pairs(char* buffer, size_t len, const char* prefix, size_t prefix_len,
+                               const struct json_mdc* mdcs, size_t mdc_count)
 {
-    int    offset = 0;
-    size_t ret;
+    size_t offset;
+    size_t i, n;
 
+    if (prefix_len + 2 >= len)  // +2 for the { and } characters
+    {
+        if (len > 0)
+            buffer[0] = '\0';
+        return 0U;
+    }
+    memcpy(buffer, prefix, prefix_len);
+    offset = prefix_len;
     buffer[offset++] = '{';
-    ret = format_timestamp(&buffer[offset], len - offset - strlen(MINIMUM_MESSAGE) - 1, timestamp);
-    if (ret > 0)
+    for (i = 0; i < mdc_count; i++)
     {
-        offset += ret;
-        buffer[offset++] = ',';
+        n = mdcs[i].key_len + mdcs[i].value_len + strlen("\"\":\"\",");
+        if (offset + n >= len)
+            break;
+        buffer[offset++] = '"';
+        memcpy(&buffer[offset], mdcs[i].key, mdcs[i].key_len);
+        offset += mdcs[i].key_len;
+        memcpy(&buffer[offset], "\":\"", 3);
+        offset += 3;
+        memcpy(&buffer[offset], mdcs[i].value, mdcs[i].value_len);
+        offset += mdcs[i].value_len;
+        memcpy(&buffer[offset], "\",", 2);
+        offset += 2;
     }
-    ret = format_severity(&buffer[offset], len - offset - strlen(MINIMUM_MESSAGE) - 1, severity);
-    if (ret > 0)
+    // remove the last comma
+    if (i > 0)
+        offset--;
+    buffer[offset++] = '}';
+    buffer[offset] = '\0';
+
+    return offset;
+}
+
+#ifdef UNITTEST
+/*
+ * Format the MDC field with the default key, used by the unit tests
+ */
+STATIC size_t format_mdc(char* buffer, size_t len, mdc_t* mdc)
+{
+    return format_mdc_field(buffer, len, MDC_PREFIX, strlen(MDC_PREFIX), mdc);
+}
+#endif
+
+/*
+ * Copy an MDC object formatted earlier with format_mdc_field(), if it fits to the buffer
+ */
+static size_t copy_mdc(char* buffer, size_t len, const char* prefix, size_t prefix_len,
+                       const char* mdc_str, size_t mdc_len)
+{
+    if (prefix_len + mdc_len + 1 > len)
     {
-        offset += ret;
-        buffer[offset++] = ',';
+        buffer[0] = '\0';
+        return 0U;
     }
-    ret = format_identity(&buffer[offset], len - offset - strlen(MINIMUM_MESSAGE) - 1, identity);
-    if (ret > 0)
+    memcpy(buffer, prefix, prefix_len);
+    memcpy(&buffer[prefix_len], mdc_str, mdc_len);
+    buffer[prefix_len + mdc_len] = '\0';
+    return prefix_len + mdc_len;
+}
+
+/*
+ * Start a new part of the header template
+ */
+static struct json_part* add_part(struct json_header* header, enum json_part_type type, size_t offset)
+{
+    struct json_part* part = &header->parts[header->part_count++];
+
+    part->type = type;
+    part->offset = (unsigned short)offset;
+    part->len = 0;
+    part->field_count = 0;
+    return part;
+}
+
+static void compile_header(struct json_header* header, const struct json_layout* layout, const char* identity,
+                           mdclog_severity_t severity)
+{
+    const size_t      size = sizeof(header->text);
+    struct json_part* part = NULL;
+    size_t            offset = 0;
+    size_t            i, n;
+    mdclog_field_t    field;
+    const char*       key;
+    int               ret;
+
+    header->part_count = 0;
+    for (i = 0; i < layout->field_count; i++)
     {
-        offset += ret;
-        buffer[offset++] = ',';
+        field = layout->order[i];
+        key = layout->keys[field];
+        if (field == MDCLOG_FIELD_SEVERITY || field == MDCLOG_FIELD_IDENTITY)
+        {
+            // -1 for the comma
+            if (field == MDCLOG_FIELD_SEVERITY)
+                n = format_severity_field(&header->text[offset], size - offset - 1, key, severity);
+            else
+                n = format_string_field(&header->text[offset], size - offset - 1, key,
+                                        identity ? identity : "(null)");
+            if (n == 0)
+                continue;
+            header->text[offset + n++] = ',';
+            // consecutive constant fields are copied at once
+            if (!part || part->type != JSON_PART_CONSTANT)
+                part = add_part(header, JSON_PART_CONSTANT, offset);
+            part->len = (unsigned short)(part->len + n);
+            part->field_ends[part->field_count++] = part->len;
+        }
+        else
+        {
+            ret = snprintf(&header->text[offset], size - offset, "\"%s\":%s", key,
+                           field == MDCLOG_FIELD_MESSAGE ? "\"" : "");
+            if (ret < 0 || (size_t)ret >= size - offset)
+                continue;
+            n = (size_t)ret;
+            part = add_part(header, field == MDCLOG_FIELD_TIMESTAMP ? JSON_PART_TIMESTAMP :
+                                    field == MDCLOG_FIELD_MDC ? JSON_PART_MDC : JSON_PART_MESSAGE, offset);
+            part->len = (unsigned short)n;
+        }
+        offset += n;
     }
-    ret = format_mdc(&buffer[offset], len - offset - strlen(MINIMUM_MESSAGE) - 1, mdc);
-    if (ret > 0)
+}
+
+void mdclog_internal_compile_schema(struct json_schema* schema, const struct json_layout* layout, const char* identity)
+{
+    int severity;
+
+    // the last template is for unknown severities
+    for (severity = 0; severity <= JSON_SEVERITY_COUNT; severity++)
+        compile_header(&schema->headers[severity], layout, identity, (mdclog_severity_t)severity);
+    schema->minimum_message_len = strlen("\"\":\"" TRUNCATED "\"") + strlen(layout->keys[MDCLOG_FIELD_MESSAGE]);
+    schema->timestamp_format = MDCLOG_TIMESTAMP_EPOCH_MS;
+}
+
+/*
+ * Copy the constant fields that fit to the buffer
+ */
+static size_t copy_constant_fields(char* buffer, size_t avail, const char* text, const struct json_part* part)
+{
+    size_t offset = 0;
+    size_t start = 0;
+    size_t i, n;
+
+    if (part->len <= avail)
     {
-        offset += ret;
-        buffer[offset++] = ',';
+        memcpy(buffer, text, part->len);
+        return part->len;
     }
-    ret = format_message(&buffer[offset], len - offset - 1, msg, arglist);
-    if (ret > 0)
-        offset += ret;
-    else
+    for (i = 0; i < part->field_count; start = part->field_ends[i++])
     {
-        buffer[0] = '\0';
+        n = part->field_ends[i] - start;
+        if (offset + n <= avail)
+        {
+            memcpy(&buffer[offset], &text[start], n);
+            offset += n;
+        }
+    }
+    return offset;
+}
+
+/*
+ * Format a log entry. The fields before the message are left
+ * out if they do not fit to the buffer with the minimum truncated message.
+ */
+static int format_entry(char* buffer,
+                       size_t len,
+                       const struct timeval* timestamp,
+                       const struct json_schema* schema,
+                       mdclog_severity_t severity,
+                       const struct mdc_source* mdcs,
+                       struct message* message,
+                       struct json_info* info)
+{
+    const struct json_header* header;
+    const struct json_part*   part;
+    const char*               text;
+    size_t                    reserve = schema->minimum_message_len + 1;    // +1 for the } character
+    size_t                    offset = 0;
+    size_t                    avail;
+    size_t                    i, ret;
+    struct json_info          ignored;
+
+    if (!info)
+        info = &ignored;
+    info->timestamp_start = info->timestamp_end = 0;
+    info->truncated = 0;
+    if (len < reserve + 2)      // +2 for the { character and the ending zero
+    {
+        if (len > 0)
+            buffer[0] = '\0';
         return -1;
     }
+    header = &schema->headers[(int)severity >= 0 && (int)severity < JSON_SEVERITY_COUNT ?
+                              (int)severity : JSON_SEVERITY_COUNT];
+    buffer[offset++] = '{';
+    for (i = 0; i < header->part_count; i++)
+    {
+        part = &header->parts[i];
+        text = &header->text[part->offset];
+        // room for the field and its comma
+        avail = len - offset - reserve;
+        switch (part->type)
+        {
+        case JSON_PART_CONSTANT:
+            offset += copy_constant_fields(&buffer[offset], avail, text, part);
+            break;
+        case JSON_PART_TIMESTAMP:
+            ret = format_timestamp_field(&buffer[offset], avail, text, part->len, timestamp, schema->timestamp_format);
+            if (ret > 0)
+            {
+                info->timestamp_start = offset;
+                offset += ret;
+                buffer[offset++] = ',';
+                info->timestamp_end = offset;
+            }
+            break;
+        case JSON_PART_MDC:
+            if (mdcs->str)
+                ret = copy_mdc(&buffer[offset], avail, text, part->len, mdcs->str, mdcs->str_len);
+            else if (mdcs->pairs)
+                ret = format_mdc_pairs(&buffer[offset], avail, text, part->len, mdcs->pairs, mdcs->pair_count);
+            else
+                ret = format_mdc_field(&buffer[offset], avail, text, part->len, mdcs->list);
+            if (ret > 0)
+            {
+                offset += ret;
+                buffer[offset++] = ',';
+            }
+            break;
+        case JSON_PART_MESSAGE:
+            // the typed fields are members of the entry before the message
+            if (message->field_count > 0)
+                offset += mdclog_internal_format_kv_fields(&buffer[offset], avail, message->fields,
+                                                           message->field_count);
+            ret = format_message_body(&buffer[offset], len - offset - 1, text, part->len, message,
+                                      &info->truncated);
+            if (ret == 0)
+            {
+                buffer[0] = '\0';
+                return -1;
+            }
+            offset += ret;
+            break;
+        }
+    }
 
     buffer[offset++] = '}';
     buffer[offset] = '\0';
-    return offset;
+    return (int)offset;
 }
 
-int mdclog_internal_format_to_json_str(char* buffer,
+#ifdef UNITTEST
+/*
+ * Format a log entry with the default layout, used by the unit tests
+ */
+STATIC int format_log_entry(char* buffer,
                        size_t len,
                        struct timeval* timestamp,
                        const char* identity,
@@ -342,8 +778,158 @@ int mdclog_internal_format_to_json_str(char* buffer,
                        const char* msg,
                        va_list arglist)
 {
+    static __thread struct json_schema schema;
+    struct json_layout                 layout;
+    struct message                     message;
+    int                                ret;
+
+    mdclog_internal_default_layout(&layout);
+    mdclog_internal_compile_schema(&schema, &layout, identity);
+    struct mdc_source                  mdcs = { .list = mdc };
+
+    message.format = msg;
+    message.args = NULL;
+    message.fields = NULL;
+    message.field_count = 0;
+    va_copy(message.arglist, arglist);
+    ret = format_entry(buffer, len, timestamp, &schema, severity, &mdcs, &message, NULL);
+    va_end(message.arglist);
+    return ret;
+}
+#endif
+
+int mdclog_internal_format_to_json_str(char* buffer,
+                       size_t len,
+                       struct timeval* timestamp,
+                       const struct json_schema* schema,
+                       mdclog_severity_t severity,
+                       mdc_t* mdc,
+                       struct json_info* info,
+                       const char* msg,
+                       va_list arglist)
+{
+    struct message    message;
+    struct mdc_source mdcs = { .list = mdc };
+    int               ret;
+
     if (len < MIN_BUFFER_LENGTH)
         return -1;
-    return format_log_entry(buffer, len, timestamp, identity, severity, mdc, msg, arglist);
+    message.format = msg;
+    message.args = NULL;
+    message.fields = NULL;
+    message.field_count = 0;
+    va_copy(message.arglist, arglist);
+    ret = format_entry(buffer, len, timestamp, schema, severity, &mdcs, &message, info);
+    va_end(message.arglist);
+    return ret;
 }
 
+
+int mdclog_internal_capture_deferred(char* buffer,
+                       size_t len,
+                       struct timeval* timestamp,
+                       mdclog_severity_t severity,
+                       mdc_t* mdc,
+                       const char* msg,
+                       va_list arglist)
+{
+    struct deferred_entry entry;
+    size_t                offset = sizeof(entry);
+    size_t                mdc_len;
+    int                   args_len;
+
+    if (len < offset + DEFERRED_MDC_MAX_LENGTH)
+        return -1;
+    // only the MDC object, the key is added when the entry is formatted
+    mdc_len = format_mdc_field(&buffer[offset], DEFERRED_MDC_MAX_LENGTH, "", 0, mdc);
+    offset += mdc_len;
+    args_len = mdclog_internal_capture_args(&buffer[offset], len - offset, msg, arglist);
+    if (args_len < 0)
+        return -1;
+
+    entry.timestamp = *timestamp;
+    entry.format = msg;
+    entry.severity = severity;
+    entry.mdc_len = (unsigned int)mdc_len;
+    entry.args_len = (unsigned int)args_len;
+    memcpy(buffer, &entry, sizeof(entry));
+    return (int)(offset + (size_t)args_len);
+}
+
+int mdclog_internal_format_deferred_to_json_str(char* buffer,
+                       size_t len,
+                       const struct json_schema* schema,
+                       const char* record,
+                       size_t record_len)
+{
+    struct deferred_entry entry;
+    struct message        message;
+    struct mdc_source     mdcs = { .list = NULL };
+
+    if (len < MIN_BUFFER_LENGTH || record_len < sizeof(entry))
+        return -1;
+    memcpy(&entry, record, sizeof(entry));
+    if (sizeof(entry) + entry.mdc_len + entry.args_len > record_len)
+        return -1;
+
+    message.format = entry.format;
+    message.args = &record[sizeof(entry) + entry.mdc_len];
+    message.args_len = entry.args_len;
+    message.fields = NULL;
+    message.field_count = 0;
+    mdcs.str = &record[sizeof(entry)];
+    mdcs.str_len = entry.mdc_len;
+    return format_entry(buffer, len, &entry.timestamp, schema, entry.severity, &mdcs, &message, NULL);
+}
+
+int mdclog_internal_format_captured_to_json_str(char* buffer,
+                       size_t len,
+                       const struct timeval* timestamp,
+                       const struct json_schema* schema,
+                       mdclog_severity_t severity,
+                       const struct json_mdc* mdcs,
+                       size_t mdc_count,
+                       struct json_info* info,
+                       const char* msg,
+                       const char* args,
+                       size_t args_len)
+{
+    struct message    message;
+    struct mdc_source source = { .pairs = mdcs, .pair_count = mdc_count };
+    struct json_mdc   none;
+
+    if (len < MIN_BUFFER_LENGTH)
+        return -1;
+    if (!mdcs)
+        source.pairs = &none;
+    message.format = msg;
+    message.args = args;
+    message.args_len = args_len;
+    message.fields = NULL;
+    message.field_count = 0;
+    return format_entry(buffer, len, timestamp, schema, severity, &source, &message, info);
+}
+
+int mdclog_internal_format_kv_to_json_str(char* buffer,
+                       size_t len,
+                       struct timeval* timestamp,
+                       const struct json_schema* schema,
+                       mdclog_severity_t severity,
+                       mdc_t* mdc,
+                       struct json_info* info,
+                       const char* msg,
+                       const mdclog_kv_t* fields,
+                       size_t field_count)
+{
+    struct message    message;
+    struct mdc_source mdcs = { .list = mdc };
+    mdclog_kv_t       none;
+
+    if (len < MIN_BUFFER_LENGTH)
+        return -1;
+    message.format = msg ? msg : "";
+    message.args = NULL;
+    message.fields = fields ? fields : &none;
+    message.field_count = fields ? field_count : 0;
+    return format_entry(buffer, len, timestamp, schema, severity, &mdcs, &message, info);
+}
@@ -0,0 +1,190 @@
+/*
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ *
+ * Typed fields of the structured log entries. The numbers are formatted
+ * without printf: the integers two digits at a time from a table, and the
+ * doubles with the shortest of 15, 16 and 17 significant digits that reads
+ * back to the same value. Any double printed with fewer digits than 15 is
+ * found by the 15 digit form too, because %g drops the trailing zeros.
+ */
+#include "private/kv.h"
+#include "private/json_format.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+size_t mdclog_internal_format_uint64(char *buffer, uint64_t value)
+{
+    char   digits[20];
+    size_t i = sizeof(digits);
+    size_t len;
+
+    while (value >= 100)
+    {
+        unsigned pair = (unsigned)(value % 100) * 2;
+
+        value /= 100;
+        digits[--i] = digit_pairs[pair + 1];
+        digits[--i] = digit_pairs[pair];
+    }
+    if (value >= 10)
+    {
+        digits[--i] = digit_pairs[value * 2 + 1];
+        digits[--i] = digit_pairs[value * 2];
+    }
+    else
+        digits[--i] = (char)('0' + value);
+    len = sizeof(digits) - i;
+    memcpy(buffer, &digits[i], len);
+    return len;
+}
+
+size_t mdclog_internal_format_int64(char *buffer, int64_t value)
+{
+    if (value >= 0)
+        return mdclog_internal_format_uint64(buffer, (uint64_t)value);
+    buffer[0] = '-';
+    // the magnitude of INT64_MIN does not fit to int64_t
+    return 1 + mdclog_internal_format_uint64(&buffer[1], (uint64_t)0 - (uint64_t)value);
+}
+
+size_t mdclog_internal_format_double(char *buffer, double value)
+{
+    int    precision;
+    int    len = 0;
+    int    i;
+
+    if (!isfinite(value))
+    {
+        memcpy(buffer, "null", 4);
+        return 4;
+    }
+    for (precision = 15; precision <= 17; precision++)
+    {
+        len = snprintf(buffer, KV_NUMBER_MAX_LENGTH, "%.*g", precision, value);
+        if (strtod(buffer, NULL) == value)
+            break;
+    }
+    // the decimal point of the locale
+    for (i = 0; i < len; i++)
+        if (buffer[i] != '-' && buffer[i] != '+' && buffer[i] != 'e' && (buffer[i] < '0' || buffer[i] > '9'))
+            buffer[i] = '.';
+    return (size_t)len;
+}
+
+/*
+ * Append a string to the buffer if it fits with the ending zero
+ *
+ * @return  0 if it does not fit
+ */
+static int append(char *buffer, size_t len, size_t *offset, const char *str, size_t str_len)
+{
+    if (str_len >= len - *offset)
+        return 0;
+    memcpy(&buffer[*offset], str, str_len);
+    *offset += str_len;
+    return 1;
+}
+
+/*
+ * Append an escaped string and the given suffix if they fit with the ending zero
+ */
+static int append_escaped(char *buffer, size_t len, size_t *offset, const char *str, size_t str_len,
+                          const char *suffix, size_t suffix_len)
+{
+    int    truncated;
+    size_t escaped_len;
+
+    if (*offset + suffix_len >= len)
+        return 0;
+    escaped_len = mdclog_internal_escape_len(&buffer[*offset], len - *offset - suffix_len, str, str_len, &truncated);
+    if (truncated)
+        return 0;
+    *offset += escaped_len;
+    return append(buffer, len, offset, suffix, suffix_len);
+}
+
+static int append_value(char *buffer, size_t len, size_t *offset, const mdclog_kv_t *field)
+{
+    char   number[KV_NUMBER_MAX_LENGTH];
+    size_t number_len;
+
+    switch (field->type)
+    {
+        case MDCLOG_KV_INT64:
+            number_len = mdclog_internal_format_int64(number, field->value.i64);
+            break;
+        case MDCLOG_KV_UINT64:
+            number_len = mdclog_internal_format_uint64(number, field->value.u64);
+            break;
+        case MDCLOG_KV_DOUBLE:
+            number_len = mdclog_internal_format_double(number, field->value.d);
+            break;
+        case MDCLOG_KV_BOOL:
+            return field->value.b ? append(buffer, len, offset, "true", 4) : append(buffer, len, offset, "false", 5);
+        case MDCLOG_KV_STRING:
+            if (!field->value.s.str)
+                return append(buffer, len, offset, "null", 4);
+            return append(buffer, len, offset, "\"", 1) &&
+                   append_escaped(buffer, len, offset, field->value.s.str, field->value.s.len, "\"", 1);
+        default:
+            return append(buffer, len, offset, "null", 4);
+    }
+    return append(buffer, len, offset, number, number_len);
+}
+
+size_t mdclog_internal_format_kv_fields(char *buffer, size_t len, const mdclog_kv_t *fields, size_t count)
+{
+    size_t offset = 0;
+    size_t field_start;
+    size_t i;
+
+    if (len == 0)
+        return 0;
+    for (i = 0; i < count; i++)
+    {
+        if (!fields[i].key)
+            continue;
+        field_start = offset;
+        if (!append(buffer, len, &offset, "\"", 1) ||
+            !append_escaped(buffer, len, &offset, fields[i].key, strlen(fields[i].key), "\":", 2) ||
+            !append_value(buffer, len, &offset, &fields[i]) ||
+            !append(buffer, len, &offset, ",", 1))
+        {
+            offset = field_start;
+            break;
+        }
+    }
+    buffer[offset] = '\0';
+    return offset;
+}
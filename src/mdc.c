@@ -18,234 +18,779 @@
  *  platform project (RICP).
  *
  * Internal MDC manipulation functions
- * The MDC values are stored to a thread specific list.
- * The list pointer is stored to a memory area got from pthread key functions.
- * The thread MDC list is destroyed when the thread exits.
+ * The MDC values are stored to a thread specific store. The store is a
+ * contiguous array of MDC entries indexed with an open addressing hash
+ * table. The keys and values are stored to one contiguous data buffer.
+ * The entries are kept in the order they are added, and iterated from the
+ * newest to the oldest. A removed entry is marked removed and the space is
+ * reclaimed when the array or the data buffer is full.
+ * The store pointer is kept in an initial-exec thread local variable and
+ * registered to a pthread key, which destroys the store when the thread exits.
+ * The store caches its MDCs serialized to json. The cache is rebuilt
+ * when the MDCs are read after they have been modified.
+ * A scope records the number of the entries when it is started, and ending
+ * it drops the entries added after that from the end of the array. An MDC
+ * added in a scope with the key of an older entry, added before the scope,
+ * is a new entry that shadows the older one, which is hidden from the index
+ * and the iteration until the shadowing entry is dropped.
+ * The store also holds the scratch buffer the thread uses for formatting, and
+ * the buffer for the log entries that do not fit to PIPE_BUF bytes.
+ * The buffers of the store grow when needed and are kept when the MDCs are
+ * removed, so setting MDCs and logging do not allocate memory after the
+ * buffers have grown large enough. All of them are released together when
+ * the thread exits.
+ *
+ * A snapshot is an immutable copy of the MDCs of a thread, serialized to
+ * json when it is taken, and shared by reference counting. A thread adopting
+ * a snapshot only refers to it, and reads its MDCs and json from the snapshot
+ * until the MDCs of the thread are modified. Then the entries of the snapshot
+ * are copied to the store of the thread as they are, already escaped. A
+ * snapshot taken of the same MDCs again is the cached one.
+ *
+ * In addition there is a process global MDC store, which is set once at
+ * initialization and is never modified after that. It is serialized to json
+ * when it is set. Setting the global MDCs again replaces the whole store.
+ * The global store is read in epoch critical sections, and a replaced store
+ * is freed when no reader can see it any more.
  *
  */
 #include "private/mdc.h"
+#include "private/epoch.h"
 #include "private/json_format.h"
+#include "private/system.h"
 
 #include <errno.h>
+#include <limits.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
+#define MDC_INITIAL_CAPACITY   16      // entries, including the sentinel. Must be a power of two.
+#define MDC_INITIAL_DATA_SIZE  512
+#define MDC_INITIAL_SCOPES     8
+#define MDC_MIN_JSON_SIZE      256
+#define MDC_MIN_SCRATCH_SIZE   1024
+
+#define MDC_REMOVED            0x1
+#define MDC_SENTINEL           0x2     // the first entry of the array, before the oldest MDC
+#define MDC_SHADOWED           0x4     // hidden by an entry added in an inner scope
+#define MDC_HIDDEN             (MDC_REMOVED | MDC_SHADOWED)
+
+#define INDEX_EMPTY            0U
+#define INDEX_REMOVED          UINT32_MAX
+
 struct mdc
 {
-    struct mdc *prev;
-    struct mdc *next;
-    char       *key;
-    char       *value;
+    char     *key;
+    char     *value;            // escaped value
+    uint32_t  key_len;
+    uint32_t  value_len;
+    uint32_t  value_size;       // space reserved for the value, including the ending zero
+    uint32_t  hash;
+    uint32_t  flags;
+    uint32_t  shadowed;         // entry shadowed by this one, 0 if none
+};
+
+struct mdc_store
+{
+    struct mdc *entries;        // entries[0] is a sentinel, the newest MDC is entries[count - 1]
+    uint32_t    count;          // used entries, including the removed ones and the sentinel
+    uint32_t    removed;
+    uint32_t    capacity;
+    uint32_t   *index;          // entry numbers, 2 * capacity slots
+    uint32_t    index_mask;
+    uint32_t    index_used;     // slots that are not empty, including the removed ones
+    char       *data;           // keys and values
+    size_t      data_used;
+    size_t      data_size;
+    size_t      garbage;        // bytes of removed and replaced keys and values in data
+    char       *json;           // cached "key":"value" pairs, valid if json_valid is set
+    size_t      json_len;
+    size_t      json_size;      // allocated size
+    int         json_valid;
+    unsigned    json_generation;  // generation of the global MDCs the cache was built for
+    int         json_merged;      // the global MDCs not overridden by the thread are included
+    char       *scratch;        // formatting buffer of the thread
+    size_t      scratch_size;
+    char       *entry;          // buffer of the large log entries of the thread
+    size_t      entry_size;
+    uint32_t   *scopes;         // first entry of each open scope, from the outermost
+    uint32_t    scope_count;
+    uint32_t    scope_capacity;
+    struct mdclog_mdc_snapshot *snapshot;   // snapshot of the MDCs, NULL after they have been modified
+    int         adopted;        // the MDCs are the ones of the snapshot instead of the entries
 };
 
-struct mdclist
+/*
+ * Immutable MDCs of a thread, shared by reference counting
+ */
+struct mdclog_mdc_snapshot
 {
-    struct mdc *head;
+    atomic_uint         refs;
+    struct mdc_store    store;
+};
+
+/*
+ * Immutable store of global MDCs
+ */
+struct global_mdcs
+{
+    unsigned            generation;
+    struct mdc_store    store;
 };
 
 static pthread_key_t  mdcpthreadkey;
 static pthread_once_t mdckey_once = PTHREAD_ONCE_INIT;
 
-static struct mdc *alloc_entry(void)
+static __thread struct mdc_store *thread_store TLS_INITIAL_EXEC;
+
+static _Atomic(struct global_mdcs *) global_mdcs;
+static pthread_mutex_t               global_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned                      global_generation;
+
+/*
+ * FNV-1a hash of the key. The length of the key is returned too.
+ */
+static uint32_t hash_key(const char *key, size_t *len)
+{
+    uint32_t hash = 2166136261U;
+    size_t   i;
+
+    for (i = 0; key[i] != '\0'; i++)
+    {
+        hash ^= (unsigned char)key[i];
+        hash *= 16777619U;
+    }
+    *len = i;
+    return hash;
+}
+
+static int store_init(struct mdc_store *store)
+{
+    store->entries = calloc(MDC_INITIAL_CAPACITY, sizeof(*store->entries));
+    store->index = calloc(2 * MDC_INITIAL_CAPACITY, sizeof(*store->index));
+    if (!store->entries || !store->index)
+        return -1;
+    store->entries[0].flags = MDC_SENTINEL;
+    store->count = 1;
+    store->capacity = MDC_INITIAL_CAPACITY;
+    store->index_mask = 2 * MDC_INITIAL_CAPACITY - 1;
+    return 0;
+}
+
+static void store_free(struct mdc_store *store)
 {
-    struct mdc *mdc = malloc(sizeof(*mdc));
+    free(store->entries);
+    free(store->index);
+    free(store->data);
+    free(store->json);
+    free(store->scratch);
+    free(store->entry);
+    free(store->scopes);
+}
 
-    if (mdc)
-        memset(mdc, 0, sizeof(*mdc));
-    return mdc;
+/*
+ * The first entry of the innermost scope. The entries before it belong to
+ * the outer scopes.
+ */
+static uint32_t scope_start(const struct mdc_store *store)
+{
+    return store->scope_count ? store->scopes[store->scope_count - 1] : 1;
 }
 
-static void add_to_list(struct mdc *mdc, struct mdclist *list)
+/*
+ * Move the start of the scopes to the end of the array, if the entries
+ * have been dropped from the end before it
+ */
+static void clamp_scopes(struct mdc_store *store)
+{
+    uint32_t i;
+
+    for (i = store->scope_count; i-- > 0 && store->scopes[i] > store->count;)
+        store->scopes[i] = store->count;
+}
+
+static void store_clean(struct mdc_store *store)
+{
+    store->count = 1;
+    store->removed = 0;
+    memset(store->index, 0, (store->index_mask + 1) * sizeof(*store->index));
+    store->index_used = 0;
+    store->data_used = 0;
+    store->garbage = 0;
+    store->json_valid = 0;
+    clamp_scopes(store);
+}
+
+/*
+ * Find the index slot of the MDC with the key
+ *
+ * @return  pointer to the slot or NULL if the key is not found
+ */
+static uint32_t *find_slot(const struct mdc_store *store, const char *key, size_t key_len, uint32_t hash)
 {
-    if (list->head)
+    uint32_t          i;
+    uint32_t          n;
+    const struct mdc *mdc;
+
+    for (i = hash & store->index_mask; (n = store->index[i]) != INDEX_EMPTY; i = (i + 1) & store->index_mask)
     {
-        mdc->next = list->head;
-        list->head->prev = mdc;
+        if (n == INDEX_REMOVED)
+            continue;
+        mdc = &store->entries[n];
+        if (mdc->hash == hash && mdc->key_len == key_len && !memcmp(mdc->key, key, key_len))
+            return &store->index[i];
     }
-    list->head = mdc;
+    return NULL;
 }
 
-static struct mdc *list_head(struct mdclist *list)
+static void insert_to_index(struct mdc_store *store, uint32_t n)
 {
-    return list->head;
+    uint32_t i;
+
+    for (i = store->entries[n].hash & store->index_mask;
+         store->index[i] != INDEX_EMPTY && store->index[i] != INDEX_REMOVED;
+         i = (i + 1) & store->index_mask)
+        ;
+    if (store->index[i] == INDEX_EMPTY)
+        store->index_used++;
+    store->index[i] = n;
 }
 
-static void mdc_destroy(struct mdc *mdc)
+static void rebuild_index(struct mdc_store *store)
 {
-    if (mdc->key)
-        free(mdc->key);
-    if (mdc->value)
-        free(mdc->value);
-    free(mdc);
+    uint32_t n;
+
+    memset(store->index, 0, (store->index_mask + 1) * sizeof(*store->index));
+    store->index_used = 0;
+    for (n = 1; n < store->count; n++)
+    {
+        if (!(store->entries[n].flags & MDC_HIDDEN))
+            insert_to_index(store, n);
+    }
 }
 
-static void rm_from_list(struct mdc *mdc, struct mdclist *list)
+/*
+ * Make room for one more entry, by dropping the removed entries or by
+ * doubling the capacity
+ *
+ * @return  0 in case of success, -1 if memory cannot be allocated
+ */
+static int reserve_entry(struct mdc_store *store)
 {
+    uint32_t    capacity = store->capacity * 2;
+    uint32_t   *index;
+    struct mdc *entries;
+    struct mdc *mdc;
+    uint32_t    n, live, scope;
 
-    if (mdc == list->head)
-        list->head = mdc->next;
-    if (mdc->prev)
-        mdc->prev->next = mdc->next;
-    if (mdc->next)
-        mdc->next->prev = mdc->prev;
-    mdc_destroy(mdc);
+    if (store->count < store->capacity)
+        return 0;
+    if (store->removed >= store->capacity / 4)
+    {
+        // the index is rebuilt, so meanwhile it maps the old entry numbers to the new ones
+        for (n = 1, live = 1, scope = 0; n < store->count; n++)
+        {
+            for (; scope < store->scope_count && store->scopes[scope] <= n; scope++)
+                store->scopes[scope] = live;
+            mdc = &store->entries[n];
+            if (mdc->flags & MDC_REMOVED)
+                continue;
+            if (mdc->shadowed)
+                mdc->shadowed = store->index[mdc->shadowed];
+            store->index[n] = live;
+            store->entries[live++] = *mdc;
+        }
+        for (; scope < store->scope_count; scope++)
+            store->scopes[scope] = live;
+        store->count = live;
+        store->removed = 0;
+        rebuild_index(store);
+        return 0;
+    }
+    if (capacity > INDEX_REMOVED / 2)
+        return -1;
+    index = malloc(2 * capacity * sizeof(*index));
+    if (!index)
+        return -1;
+    entries = realloc(store->entries, capacity * sizeof(*entries));
+    if (!entries)
+    {
+        free(index);
+        return -1;
+    }
+    free(store->index);
+    store->entries = entries;
+    store->index = index;
+    store->capacity = capacity;
+    store->index_mask = 2 * capacity - 1;
+    rebuild_index(store);
+    return 0;
 }
 
-static void empty_list(struct mdclist *list)
+/*
+ * Make room for extra bytes to the data buffer. The keys and values in use
+ * are copied to a new buffer, leaving the removed ones out.
+ *
+ * @return  0 in case of success, -1 if memory cannot be allocated
+ */
+static int reserve_data(struct mdc_store *store, size_t extra)
 {
+    size_t      live = store->data_used - store->garbage;
+    size_t      size = store->data_size ? store->data_size : MDC_INITIAL_DATA_SIZE;
     struct mdc *mdc;
+    char       *data;
+    char       *p;
+    uint32_t    n;
 
-    if (!list)
-        return;
-    mdc = list_head(list);
-    while (mdc)
+    if (store->data_used + extra <= store->data_size)
+        return 0;
+    while (live + extra > size / 2)
+        size *= 2;
+    data = malloc(size);
+    if (!data)
+        return -1;
+    for (n = 1, p = data; n < store->count; n++)
     {
-        struct mdc *next = mdc->next;
-        rm_from_list(mdc, list);
-        mdc = next;
+        mdc = &store->entries[n];
+        if (mdc->flags & MDC_REMOVED)
+            continue;
+        memcpy(p, mdc->key, mdc->key_len + 1);
+        mdc->key = p;
+        p += mdc->key_len + 1;
+        memcpy(p, mdc->value, mdc->value_size);
+        mdc->value = p;
+        p += mdc->value_size;
     }
+    free(store->data);
+    store->data = data;
+    store->data_size = size;
+    store->data_used = (size_t)(p - data);
+    store->garbage = 0;
+    return 0;
 }
 
-static void destroy_list(void *ptr)
+static char *alloc_data(struct mdc_store *store, size_t len)
 {
-    struct mdclist *list = (struct mdclist*)ptr;
+    char *p = &store->data[store->data_used];
 
-    empty_list(list);
-    free(list);
-    pthread_setspecific(mdcpthreadkey, NULL);
+    store->data_used += len;
+    return p;
 }
 
-static void create_pthread_key(void)
+static void set_value(struct mdc *mdc, const char *value, size_t value_size)
 {
-    int ec = pthread_key_create(&mdcpthreadkey, destroy_list);
+    mdc->value_len = (uint32_t)mdclog_internal_escape(mdc->value, value_size, value, NULL);
+}
 
-    if (ec)
+static int store_put(struct mdc_store *store, const char *key, const char *value)
+{
+    struct mdc *mdc;
+    uint32_t   *slot;
+    size_t      key_len;
+    uint32_t    hash = hash_key(key, &key_len);
+    size_t      value_size = mdclog_internal_escaped_size(value);
+
+    if (key_len >= INDEX_REMOVED || value_size >= INDEX_REMOVED)
     {
-        fprintf(stderr, "Cannot create pthread key: %s", strerror(errno));
-        abort();
+        errno = EINVAL;
+        return -1;
     }
+    store->json_valid = 0;
+    slot = find_slot(store, key, key_len, hash);
+    if (slot && *slot >= scope_start(store))
+    {
+        mdc = &store->entries[*slot];
+        if (value_size > mdc->value_size)
+        {
+            if (reserve_data(store, value_size))
+            {
+                errno = ENOMEM;
+                return -1;
+            }
+            store->garbage += mdc->value_size;
+            mdc->value = alloc_data(store, value_size);
+            mdc->value_size = (uint32_t)value_size;
+        }
+        set_value(mdc, value, value_size);
+        return 0;
+    }
+
+    if (reserve_entry(store) || reserve_data(store, key_len + 1 + value_size))
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    if (store->index_used >= store->capacity)
+        rebuild_index(store);
+    if (slot)   // an MDC of an outer scope, which may have been renumbered
+        slot = find_slot(store, key, key_len, hash);
+    mdc = &store->entries[store->count];
+    mdc->key = alloc_data(store, key_len + 1);
+    memcpy(mdc->key, key, key_len + 1);
+    mdc->value = alloc_data(store, value_size);
+    mdc->key_len = (uint32_t)key_len;
+    mdc->value_size = (uint32_t)value_size;
+    mdc->hash = hash;
+    mdc->flags = 0;
+    mdc->shadowed = 0;
+    set_value(mdc, value, value_size);
+    if (slot)
+    {
+        mdc->shadowed = *slot;
+        store->entries[*slot].flags |= MDC_SHADOWED;
+        *slot = store->count++;
+    }
+    else
+        insert_to_index(store, store->count++);
+    return 0;
 }
 
-int mdclog_internal_init_mdc(void)
+static struct mdc *store_search(const struct mdc_store *store, const char *key)
 {
-    int ec = pthread_once(&mdckey_once, create_pthread_key);
+    size_t    key_len;
+    uint32_t  hash = hash_key(key, &key_len);
+    uint32_t *slot = find_slot(store, key, key_len, hash);
 
-    if (ec)
+    return slot ? &store->entries[*slot] : NULL;
+}
+
+/*
+ * Drop the last entry, and its data if it is at the end of the buffer
+ */
+static void drop_last(struct mdc_store *store)
+{
+    struct mdc *mdc = &store->entries[--store->count];
+
+    if (mdc->value == mdc->key + mdc->key_len + 1 &&
+        mdc->value + mdc->value_size == &store->data[store->data_used])
     {
-        errno = ec;
-        return -1;
+        store->data_used -= mdc->key_len + 1 + mdc->value_size;
+        store->garbage -= mdc->key_len + 1 + mdc->value_size;
     }
-    return 0;
 }
 
-static struct mdclist *get_list(void)
+/*
+ * Drop the removed entries from the end, so that the newest entry is a live one
+ */
+static void trim_removed(struct mdc_store *store)
+{
+    while (store->count > 1 && (store->entries[store->count - 1].flags & MDC_REMOVED))
+    {
+        store->removed--;
+        drop_last(store);
+    }
+    clamp_scopes(store);
+}
+
+static void store_rm(struct mdc_store *store, const char *key)
+{
+    struct mdc *mdc;
+    size_t      key_len;
+    uint32_t    hash = hash_key(key, &key_len);
+    uint32_t   *slot = find_slot(store, key, key_len, hash);
+
+    if (!slot)
+        return;
+    // the MDCs of the outer scopes shadowed by the removed one are removed too
+    for (mdc = &store->entries[*slot]; ; mdc = &store->entries[mdc->shadowed])
+    {
+        mdc->flags |= MDC_REMOVED;
+        store->removed++;
+        store->garbage += mdc->key_len + 1 + mdc->value_size;
+        if (!mdc->shadowed)
+            break;
+    }
+    *slot = INDEX_REMOVED;
+    store->json_valid = 0;
+    trim_removed(store);
+}
+
+static int store_push_scope(struct mdc_store *store)
 {
-    struct mdclist *list;
-    int             ec;
+    uint32_t  capacity = store->scope_capacity ? store->scope_capacity * 2 : MDC_INITIAL_SCOPES;
+    uint32_t *scopes;
 
-    list = (struct mdclist*)pthread_getspecific(mdcpthreadkey);
-    if (!list)
+    if (store->scope_count >= INT_MAX)
     {
-        list = malloc(sizeof(*list));
-        if (!list)
+        errno = ENOSPC;
+        return -1;
+    }
+    if (store->scope_count == store->scope_capacity)
+    {
+        scopes = realloc(store->scopes, capacity * sizeof(*scopes));
+        if (!scopes)
         {
             errno = ENOMEM;
-            return NULL;
+            return -1;
         }
-        memset(list, 0, sizeof(*list));
-        ec = pthread_setspecific(mdcpthreadkey, list);
-        if (ec)
+        store->scopes = scopes;
+        store->scope_capacity = capacity;
+    }
+    store->scopes[store->scope_count++] = store->count;
+    return (int)store->scope_count;
+}
+
+/*
+ * Drop the entries of the scope and the scopes inside it from the end of
+ * the array, and make the entries they shadowed visible again
+ */
+static void store_pop_scope(struct mdc_store *store, uint32_t scope)
+{
+    uint32_t    start = store->scopes[scope - 1];
+    struct mdc *mdc;
+    uint32_t   *slot;
+
+    store->scope_count = scope - 1;
+    if (store->count > start)
+        store->json_valid = 0;
+    while (store->count > start)
+    {
+        mdc = &store->entries[store->count - 1];
+        if (mdc->flags & MDC_REMOVED)
+            store->removed--;
+        else
         {
-            errno = ec;
-            return NULL;
+            // the entries of the inner scopes shadowing this one have been dropped already
+            slot = find_slot(store, mdc->key, mdc->key_len, mdc->hash);
+            if (mdc->shadowed)
+            {
+                store->entries[mdc->shadowed].flags &= ~MDC_SHADOWED;
+                *slot = mdc->shadowed;
+            }
+            else
+                *slot = INDEX_REMOVED;
+            store->garbage += mdc->key_len + 1 + mdc->value_size;
         }
+        drop_last(store);
     }
-    return list;
+    trim_removed(store);
+}
+
+/*
+ * The newest MDC of the store. The newest entry is never a removed or a
+ * shadowed one.
+ */
+static struct mdc *store_first(const struct mdc_store *store)
+{
+    return store->count > 1 ? &store->entries[store->count - 1] : NULL;
 }
 
-static char* escape_and_copy(const char* str)
+/*
+ * The store holding the MDCs of the thread
+ */
+static struct mdc_store *mdcs_of(struct mdc_store *store)
 {
-    size_t len = mdclog_internal_escaped_size(str);
-    char  *buf = malloc(len);
+    return store->adopted ? &store->snapshot->store : store;
+}
 
-    if (buf)
+static void release_snapshot(struct mdclog_mdc_snapshot *snapshot)
+{
+    if (snapshot && atomic_fetch_sub_explicit(&snapshot->refs, 1, memory_order_acq_rel) == 1)
     {
-        mdclog_internal_escape(buf, len, str, NULL);
-        return buf;
+        store_free(&snapshot->store);
+        free(snapshot);
     }
-    else
-        return NULL;
 }
 
-int mdclog_internal_put_mdc(const char *key, const char *value)
+/*
+ * Copy the MDCs of src to the empty store dst, leaving the removed and the
+ * shadowed entries out. The values are copied as they are, already escaped.
+ *
+ * @return  0 in case of success, -1 if memory cannot be allocated
+ */
+static int store_copy(struct mdc_store *dst, const struct mdc_store *src)
 {
-    struct mdc     *mdc;
-    struct mdclist *list = get_list();
+    const struct mdc *from;
+    struct mdc       *to;
+    uint32_t          n;
 
-    if (!list)
-        return -1;
+    for (n = 1; n < src->count; n++)
+    {
+        from = &src->entries[n];
+        if (from->flags & MDC_HIDDEN)
+            continue;
+        if (reserve_entry(dst) || reserve_data(dst, from->key_len + from->value_len + 2))
+            return -1;
+        to = &dst->entries[dst->count];
+        to->key = alloc_data(dst, from->key_len + 1);
+        memcpy(to->key, from->key, from->key_len + 1);
+        to->value = alloc_data(dst, from->value_len + 1);
+        memcpy(to->value, from->value, from->value_len + 1);
+        to->key_len = from->key_len;
+        to->value_len = from->value_len;
+        to->value_size = from->value_len + 1;
+        to->hash = from->hash;
+        to->flags = 0;
+        to->shadowed = 0;
+        insert_to_index(dst, dst->count++);
+    }
+    return 0;
+}
 
-    mdc = mdclog_internal_search_mdc(key);
-    if (!mdc)
+/*
+ * Prepare the MDCs of the thread to be modified. The entries of an adopted
+ * snapshot are copied to the store, and the snapshot is released.
+ *
+ * @return  0 in case of success, -1 if memory cannot be allocated. Errno is set
+ */
+static int store_modify(struct mdc_store *store)
+{
+    struct mdclog_mdc_snapshot *snapshot = store->snapshot;
+
+    if (!snapshot)
+        return 0;
+    if (store->adopted)
     {
-        mdc = alloc_entry();
-        if (!mdc)
+        store_clean(store);
+        if (store_copy(store, &snapshot->store))
         {
+            store_clean(store);
             errno = ENOMEM;
             return -1;
         }
-        mdc->key = strdup(key);
-        add_to_list(mdc, list);
-    } else
-        free(mdc->value);
+        store->adopted = 0;
+    }
+    store->snapshot = NULL;
+    release_snapshot(snapshot);
+    return 0;
+}
 
-    mdc->value = escape_and_copy(value);
-    if (mdc->key && mdc->value)
-        return 0;
+static void destroy_store(void *ptr)
+{
+    struct mdc_store *store = (struct mdc_store*)ptr;
 
-    mdc_destroy(mdc);
-    errno = ENOMEM;
-    return -1;
+    if (store)
+    {
+        release_snapshot(store->snapshot);
+        store_free(store);
+    }
+    free(store);
+    thread_store = NULL;
+    pthread_setspecific(mdcpthreadkey, NULL);
 }
 
-mdc_t *mdclog_internal_search_mdc(const char *key)
+static void create_pthread_key(void)
 {
-    struct mdc     *mdc;
-    struct mdclist *list = get_list();
+    int ec = pthread_key_create(&mdcpthreadkey, destroy_store);
 
-    if (!list)
-        return NULL;
+    if (ec)
+    {
+        fprintf(stderr, "Cannot create pthread key: %s", strerror(errno));
+        abort();
+    }
+}
+
+int mdclog_internal_init_mdc(void)
+{
+    int ec = pthread_once(&mdckey_once, create_pthread_key);
 
-    mdc = list_head(list);
-    while (mdc)
+    if (ec)
     {
-        if (!strcmp(key, mdc->key))
-            return mdc;
-        mdc = mdc->next;
+        errno = ec;
+        return -1;
     }
-    return NULL;
+    return 0;
+}
+
+static struct mdc_store *get_store(void)
+{
+    struct mdc_store *store = thread_store;
+    int               ec;
+
+    if (store)
+        return store;
+    if (mdclog_internal_init_mdc())
+        return NULL;
+    store = calloc(1, sizeof(*store));
+    if (!store || store_init(store))
+    {
+        if (store)
+            store_free(store);
+        free(store);
+        errno = ENOMEM;
+        return NULL;
+    }
+    ec = pthread_setspecific(mdcpthreadkey, store);
+    if (ec)
+    {
+        store_free(store);
+        free(store);
+        errno = ec;
+        return NULL;
+    }
+    thread_store = store;
+    return store;
+}
+
+int mdclog_internal_put_mdc(const char *key, const char *value)
+{
+    struct mdc_store *store = get_store();
+
+    if (!store || store_modify(store))
+        return -1;
+    return store_put(store, key, value);
+}
+
+mdc_t *mdclog_internal_search_mdc(const char *key)
+{
+    struct mdc_store *store = thread_store;
+
+    return store ? store_search(mdcs_of(store), key) : NULL;
 }
 
 void mdclog_internal_rm_mdc(const char *key)
 {
-    struct mdc *mdc = mdclog_internal_search_mdc(key);
+    struct mdc_store *store = thread_store;
+
+    if (store && store_search(mdcs_of(store), key) && !store_modify(store))
+        store_rm(store, key);
+}
+
+int mdclog_internal_push_mdc_scope(void)
+{
+    struct mdc_store *store = get_store();
 
-    if (mdc)
-        rm_from_list(mdc, get_list());
+    if (!store || store_modify(store))
+        return -1;
+    return store_push_scope(store);
+}
+
+int mdclog_internal_pop_mdc_scope(int scope)
+{
+    struct mdc_store *store = thread_store;
+
+    if (!store || scope < 1 || (uint32_t)scope > store->scope_count)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (store_modify(store))
+        return -1;
+    store_pop_scope(store, (uint32_t)scope);
+    return 0;
 }
 
 mdc_t *mdclog_internal_get_first_mdc()
 {
-    struct mdclist *list = get_list();
+    struct mdc_store *store = thread_store;
 
-    return list ? list_head(list) : NULL;
+    return store ? store_first(mdcs_of(store)) : NULL;
 }
 
 mdc_t *mdclog_internal_get_next_mdc(mdc_t *mdc)
 {
-    return mdc ? mdc->next : NULL;
+    if (!mdc)
+        return NULL;
+    for (mdc--; !(mdc->flags & MDC_SENTINEL); mdc--)
+    {
+        if (!(mdc->flags & MDC_HIDDEN))
+            return mdc;
+    }
+    return NULL;
 }
 
 const char *mdclog_internal_get_mdc_val(mdc_t *mdc)
@@ -258,12 +803,315 @@ const char *mdclog_internal_get_mdc_key(mdc_t *mdc)
     return mdc ? mdc->key : NULL;
 }
 
+static size_t json_size(const struct mdc *mdc)
+{
+    return mdc->key_len + mdc->value_len + sizeof("\"\":\"\",") - 1;
+}
+
+static char *append_json(char *p, const struct mdc *mdc)
+{
+    *p++ = '"';
+    memcpy(p, mdc->key, mdc->key_len);
+    p += mdc->key_len;
+    memcpy(p, "\":\"", 3);
+    p += 3;
+    memcpy(p, mdc->value, mdc->value_len);
+    p += mdc->value_len;
+    *p++ = '"';
+    return p;
+}
+
+static int overrides(const struct mdc_store *store, const struct mdc *mdc)
+{
+    return find_slot(store, mdc->key, mdc->key_len, mdc->hash) != NULL;
+}
+
+/*
+ * Serialize the MDCs of a store to the json cache of the cache store, which
+ * is the same store unless the MDCs are the ones of an adopted snapshot. If
+ * the MDCs override any of the global MDCs, the global MDCs left are
+ * serialized first to the same string.
+ *
+ * @return  0 in case of success, -1 if memory cannot be allocated
+ */
+static int build_json(struct mdc_store *cache, const struct mdc_store *store, struct global_mdcs *global)
+{
+    struct mdc *first_global = global ? store_first(&global->store) : NULL;
+    struct mdc *mdc;
+    size_t      size = 1;
+    size_t      new_size;
+    int         merged = 0;
+    char       *json;
+    char       *p;
+
+    for (mdc = first_global; mdc && !merged; mdc = mdclog_internal_get_next_mdc(mdc))
+        merged = overrides(store, mdc);
+    for (mdc = merged ? first_global : NULL; mdc; mdc = mdclog_internal_get_next_mdc(mdc))
+        size += json_size(mdc);
+    for (mdc = store_first(store); mdc; mdc = mdclog_internal_get_next_mdc(mdc))
+        size += json_size(mdc);
+    if (size > cache->json_size)
+    {
+        for (new_size = cache->json_size ? cache->json_size * 2 : MDC_MIN_JSON_SIZE; new_size < size; new_size *= 2)
+            ;
+        json = realloc(cache->json, new_size);
+        if (!json)
+            return -1;
+        cache->json = json;
+        cache->json_size = new_size;
+    }
+
+    p = cache->json;
+    for (mdc = merged ? first_global : NULL; mdc; mdc = mdclog_internal_get_next_mdc(mdc))
+    {
+        if (overrides(store, mdc))
+            continue;
+        if (p != cache->json)
+            *p++ = ',';
+        p = append_json(p, mdc);
+    }
+    for (mdc = store_first(store); mdc; mdc = mdclog_internal_get_next_mdc(mdc))
+    {
+        if (p != cache->json)
+            *p++ = ',';
+        p = append_json(p, mdc);
+    }
+    *p = '\0';
+    cache->json_len = (size_t)(p - cache->json);
+    cache->json_valid = 1;
+    cache->json_generation = global ? global->generation : 0;
+    cache->json_merged = merged;
+    return 0;
+}
+
+int mdclog_internal_get_mdc_json(mdc_t *mdc, struct mdc_json *json)
+{
+    struct mdc_store   *store = thread_store;
+    struct global_mdcs *global = atomic_load_explicit(&global_mdcs, memory_order_acquire);
+    struct mdc_store   *mdcs;
+    unsigned            generation;
+
+    if (!store)
+    {
+        if (mdc)
+            return -1;
+        json->thread = "";
+        json->thread_len = 0;
+    }
+    else
+    {
+        mdcs = mdcs_of(store);
+        if (mdc != store_first(mdcs))
+            return -1;
+        generation = global ? global->generation : 0;
+        // the json of an adopted snapshot is used unless the global MDCs have been replaced after it was taken
+        if (mdcs == store || mdcs->json_generation != generation)
+        {
+            if ((!store->json_valid || store->json_generation != generation) && build_json(store, mdcs, global))
+                return -1;
+            mdcs = store;
+        }
+        json->thread = mdcs->json;
+        json->thread_len = mdcs->json_len;
+        if (mdcs->json_merged)
+            global = NULL;
+    }
+    json->global = global ? global->store.json : "";
+    json->global_len = global ? global->store.json_len : 0;
+    return 0;
+}
+
+struct mdclog_mdc_snapshot *mdclog_internal_snapshot_mdcs(void)
+{
+    struct mdc_store           *store = get_store();
+    struct mdclog_mdc_snapshot *snapshot;
+    int                         ret;
+
+    if (!store)
+        return NULL;
+    if (!store->snapshot)
+    {
+        snapshot = calloc(1, sizeof(*snapshot));
+        if (!snapshot)
+        {
+            errno = ENOMEM;
+            return NULL;
+        }
+        atomic_init(&snapshot->refs, 1);
+        ret = store_init(&snapshot->store) ? -1 : store_copy(&snapshot->store, store);
+        if (!ret)
+        {
+            mdclog_internal_epoch_enter();
+            ret = build_json(&snapshot->store, &snapshot->store,
+                             atomic_load_explicit(&global_mdcs, memory_order_acquire));
+            mdclog_internal_epoch_leave();
+        }
+        if (ret)
+        {
+            release_snapshot(snapshot);
+            errno = ENOMEM;
+            return NULL;
+        }
+        store->snapshot = snapshot;
+    }
+    atomic_fetch_add_explicit(&store->snapshot->refs, 1, memory_order_relaxed);
+    return store->snapshot;
+}
+
+int mdclog_internal_adopt_mdcs(struct mdclog_mdc_snapshot *snapshot)
+{
+    struct mdc_store *store = get_store();
+
+    if (!store)
+        return -1;
+    atomic_fetch_add_explicit(&snapshot->refs, 1, memory_order_relaxed);
+    release_snapshot(store->snapshot);
+    store->snapshot = snapshot;
+    store->adopted = 1;
+    store->json_valid = 0;
+    return 0;
+}
+
+void mdclog_internal_release_mdc_snapshot(struct mdclog_mdc_snapshot *snapshot)
+{
+    release_snapshot(snapshot);
+}
+
+static void destroy_global_mdcs(struct global_mdcs *global)
+{
+    if (global)
+        store_free(&global->store);
+    free(global);
+}
+
+/*
+ * Publish the global MDCs and free the replaced ones when no reader can see them
+ */
+static void publish_global_mdcs(struct global_mdcs *global)
+{
+    struct global_mdcs *replaced;
+
+    pthread_mutex_lock(&global_mutex);
+    if (global)
+        global->generation = ++global_generation;
+    replaced = atomic_exchange_explicit(&global_mdcs, global, memory_order_acq_rel);
+    pthread_mutex_unlock(&global_mutex);
+    if (replaced)
+    {
+        mdclog_internal_epoch_synchronize();
+        destroy_global_mdcs(replaced);
+    }
+}
+
+/*
+ * Check if keys[i] is given also before the index i
+ */
+static int is_duplicate(const char *const *keys, size_t i)
+{
+    size_t j;
+
+    for (j = 0; j < i; j++)
+    {
+        if (!strcmp(keys[j], keys[i]))
+            return 1;
+    }
+    return 0;
+}
+
+int mdclog_internal_set_global_mdcs(const char *const *keys, const char *const *values, size_t count)
+{
+    struct global_mdcs *global = calloc(1, sizeof(*global));
+    int                 ret;
+    size_t              i;
+
+    ret = (global && !store_init(&global->store)) ? 0 : -1;
+    // the store iterates from the newest to the oldest, so the MDCs are added in reverse order
+    for (i = count; i-- > 0 && ret == 0;)
+    {
+        if (!is_duplicate(keys, i))
+            ret = store_put(&global->store, keys[i], values[i]);
+    }
+    if (ret || build_json(&global->store, &global->store, NULL))
+    {
+        destroy_global_mdcs(global);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    publish_global_mdcs(global);
+    return 0;
+}
+
+mdc_t *mdclog_internal_get_first_global_mdc(void)
+{
+    struct global_mdcs *global = atomic_load_explicit(&global_mdcs, memory_order_acquire);
+
+    return global ? store_first(&global->store) : NULL;
+}
+
+mdc_t *mdclog_internal_search_global_mdc(const char *key)
+{
+    struct global_mdcs *global = atomic_load_explicit(&global_mdcs, memory_order_acquire);
+
+    return global ? store_search(&global->store, key) : NULL;
+}
+
+void mdclog_internal_clean_global_mdcs(void)
+{
+    publish_global_mdcs(NULL);
+}
+
+static char *grow_buffer(char **buffer, size_t *buffer_size, size_t len)
+{
+    size_t size;
+    char  *grown;
+
+    if (len <= *buffer_size)
+        return *buffer;
+    for (size = MDC_MIN_SCRATCH_SIZE; size < len; size *= 2)
+        ;
+    grown = malloc(size);
+    if (!grown)
+        return NULL;
+    free(*buffer);
+    *buffer = grown;
+    *buffer_size = size;
+    return grown;
+}
+
+char *mdclog_internal_get_scratch(size_t len)
+{
+    struct mdc_store *store = get_store();
+
+    if (!store)
+        return NULL;
+    return grow_buffer(&store->scratch, &store->scratch_size, len);
+}
+
+char *mdclog_internal_get_entry_buffer(size_t len)
+{
+    struct mdc_store *store = get_store();
+
+    if (!store)
+        return NULL;
+    return grow_buffer(&store->entry, &store->entry_size, len);
+}
+
 void mdclog_internal_clean_mdclist(void)
 {
-    empty_list(get_list());
+    struct mdc_store *store = thread_store;
+
+    if (store)
+    {
+        release_snapshot(store->snapshot);
+        store->snapshot = NULL;
+        store->adopted = 0;
+        store_clean(store);
+    }
 }
 
 void mdclog_internal_destroy_mdclist(void)
 {
-    destroy_list(get_list());
+    if (thread_store)
+        destroy_store(thread_store);
 }
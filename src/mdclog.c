@@ -41,15 +41,32 @@
 #include <poll.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include <sys/un.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
 
+#include "private/async.h"
+#include "private/epoch.h"
+#include "private/filesink.h"
+#include "private/fragment.h"
+#include "private/kv.h"
 #include "private/mdc.h"
+#include "private/ratelimit.h"
+#include "private/recorder.h"
+#include "private/binary.h"
+#include "private/repeat.h"
+#include "private/sink.h"
+#include "private/socketsink.h"
 #include "private/system.h"
+#include "private/timestamp.h"
 #include "private/json_format.h"
 
-static mdclog_severity_t current_level = MDCLOG_ERR;
+int mdclog_current_level = MDCLOG_ERR;
+static int output_level = MDCLOG_ERR;    // level of the entries written to the output
+static int recorder_level = -1;          // level of the recorded entries, -1 if none
 extern char *__progname;
 
 #define STR_BUFF 128
@@ -57,21 +74,76 @@ extern char *__progname;
 
 
 /*
- * The configuration variable is library global
- * and is protected with read/write mutex
+ * The configuration is an immutable snapshot published with an atomic pointer.
+ * Readers load the pointer in an epoch critical section, and a replaced
+ * snapshot is freed when no reader can see it any more. The writers, i.e.
+ * initialization and cleaning, are serialized with the mutex.
  */
-static struct
+struct config
 {
-    uint8_t  init_done;
-    uint8_t  log_format_init_done;
-    char    *identity;
-} mdclog_configuration;
+    struct json_schema schema;  // header templates including the identity
+    uint8_t  async;
+    size_t   async_capacity;
+    mdclog_overflow_policy_t overflow_policy;
+    uint8_t  deferred_format;
+    size_t   batch_size;
+    unsigned flush_interval_ms;
+    unsigned repeat_timeout_ms;
+    mdclog_clock_t clock;
+    mdclog_timestamp_format_t timestamp_format;
+    size_t   max_entry_size;
+    mdclog_large_entry_policy_t large_entry_policy;
+    mdclog_output_format_t output_format;
+    struct binary_stream stream;    // parameters of the binary stream
+    unsigned long serial;           // identifies the configuration the binary stream was started for
+};
 
-static pthread_rwlock_t config_mutex = PTHREAD_RWLOCK_INITIALIZER;
+static _Atomic(struct config *) mdclog_configuration;
+static pthread_mutex_t          config_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Used if the configuration cannot be allocated
+ */
+static struct config fallback_configuration = { .overflow_policy = MDCLOG_OVERFLOW_BLOCK,
+                                                .max_entry_size = PIPE_BUF };
+static int           fallback_schema_compiled;
+
+static uint8_t log_format_init_done;
+static _Atomic unsigned long config_serial;
+
+/*
+ * The binary records refer to the earlier records of the stream, so they are
+ * encoded and written in the same order under the mutex. A new stream is
+ * started when the configuration or the output file changes.
+ */
+static struct binary_encoder *binary_encoder;
+static unsigned long          binary_serial;
+static unsigned long          binary_generation;
+static pthread_mutex_t        binary_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 typedef struct mdclog_attr
 {
     char *identity;
+    uint8_t async;
+    size_t async_capacity;
+    mdclog_overflow_policy_t overflow_policy;
+    uint8_t deferred_format;
+    size_t batch_size;
+    unsigned flush_interval_ms;
+    unsigned repeat_timeout_ms;
+    mdclog_clock_t clock;
+    mdclog_timestamp_format_t timestamp_format;
+    struct json_layout layout;
+    size_t max_entry_size;
+    mdclog_large_entry_policy_t large_entry_policy;
+    mdclog_output_format_t output_format;
+    char *file_path;
+    struct file_sink_config file_rotation;
+    char *socket_path;
+    struct socket_sink_config socket;
+    char *recorder_path;
+    size_t recorder_size;
+    mdclog_severity_t recorder_level;
 } mdclog_attr_t;
 
 typedef enum log_format_fields {
@@ -83,25 +155,67 @@ typedef enum log_format_fields {
 } log_field_t;
 
 const char *LOGFIELDS[5] = {"SYSTEM_NAME","HOST_NAME","SERVICE_NAME","CONTAINER_NAME","POD_NAME"};
+#define LOGFIELD_COUNT (sizeof(LOGFIELDS)/sizeof(char*))
 
 
-static void init_library(mdclog_attr_t *attr)
+/*
+ * Get the current configuration. The configuration can be used until
+ * leave_configuration() is called.
+ */
+static const struct config *enter_configuration(void)
 {
-    size_t      escaped_size;
-    char       *identity;
+    struct config *config;
 
-    if (mdclog_configuration.init_done)
-        return;
-    mdclog_internal_init_mdc();
-    pthread_rwlock_wrlock(&config_mutex);
-    if (mdclog_configuration.identity)
-    {
-        free(mdclog_configuration.identity);
-        mdclog_configuration.identity = NULL;
-    }
+    mdclog_internal_epoch_enter();
+    config = atomic_load_explicit(&mdclog_configuration, memory_order_acquire);
+    // NULL if the library has been cleaned meanwhile
+    return config ? config : &fallback_configuration;
+}
+
+static void leave_configuration(void)
+{
+    mdclog_internal_epoch_leave();
+}
+
+/*
+ * Format a deferred log entry in the asynchronous mode background thread
+ */
+static size_t format_deferred_entry(char *buffer, size_t len, const char *record, size_t record_len)
+{
+    int entry_len;
+
+    const struct config *config = enter_configuration();
+
+    // Format function can use buffer size -1. The last byte is reserved for a newline char.
+    entry_len = mdclog_internal_format_deferred_to_json_str(buffer, len - 1, &config->schema,
+            record, record_len);
+    leave_configuration();
+    if (entry_len <= 0)
+        return 0;
+    buffer[entry_len] = '\n';
+    return (size_t)entry_len + 1;
+}
+
+static void free_configuration(struct config *config)
+{
+    if (config && config != &fallback_configuration)
+        free(config);
+}
+
+static struct config *create_configuration(mdclog_attr_t *attr)
+{
+    size_t             escaped_size;
+    char              *identity;
+    char              *escaped = NULL;
+    struct json_layout default_layout;
+    struct config     *config = malloc(sizeof(*config));
+
+    if (!config)
+        return &fallback_configuration;
+    memset(config, 0, sizeof(*config));
     if (attr && attr->identity)
     {
-        mdclog_configuration.identity = attr->identity;
+        escaped = attr->identity;
         attr->identity = NULL;
     }
     else
@@ -116,64 +230,713 @@ static void init_library(mdclog_attr_t *attr)
             if (mdclog_internal_contains_special_characters(identity))
             {
                 escaped_size = mdclog_internal_escaped_size(identity);
-                mdclog_configuration.identity = malloc(escaped_size);
-                if (mdclog_configuration.identity)
-                    mdclog_internal_escape(mdclog_configuration.identity, escaped_size, identity, NULL);
+                escaped = malloc(escaped_size);
+                if (escaped)
+                    mdclog_internal_escape(escaped, escaped_size, identity, NULL);
                 free(identity);
             }
             else
-                mdclog_configuration.identity = identity;
+                escaped = identity;
         }
     }
-    mdclog_configuration.init_done = 1;
-    pthread_rwlock_unlock(&config_mutex);
+    if (!attr)
+        mdclog_internal_default_layout(&default_layout);
+    mdclog_internal_compile_schema(&config->schema, attr ? &attr->layout : &default_layout, escaped);
+    config->stream.layout = attr ? attr->layout : default_layout;
+    // the header templates use the same cut identity
+    snprintf(config->stream.identity, sizeof(config->stream.identity), "%s", escaped ? escaped : "(null)");
+    free(escaped);
+    config->async = attr ? attr->async : 0;
+    config->async_capacity = attr ? attr->async_capacity : 0;
+    config->overflow_policy = attr ? attr->overflow_policy : MDCLOG_OVERFLOW_BLOCK;
+    config->deferred_format = attr ? attr->deferred_format : 0;
+    config->batch_size = attr ? attr->batch_size : ASYNC_DEFAULT_BATCH_SIZE;
+    config->flush_interval_ms = attr ? attr->flush_interval_ms : 0;
+    config->repeat_timeout_ms = attr ? attr->repeat_timeout_ms : 0;
+    config->clock = attr ? attr->clock : MDCLOG_CLOCK_REALTIME;
+    config->timestamp_format = attr ? attr->timestamp_format : MDCLOG_TIMESTAMP_EPOCH_MS;
+    config->max_entry_size = attr ? attr->max_entry_size : PIPE_BUF;
+    config->large_entry_policy = attr ? attr->large_entry_policy : MDCLOG_LARGE_ENTRY_FRAGMENT_PIPE;
+    config->output_format = attr ? attr->output_format : MDCLOG_OUTPUT_JSON;
+    config->schema.timestamp_format = config->timestamp_format;
+    config->stream.timestamp_format = config->timestamp_format;
+    config->stream.max_entry_size = config->max_entry_size;
+    config->serial = atomic_fetch_add_explicit(&config_serial, 1, memory_order_relaxed) + 1;
+    return config;
+}
+
+/*
+ * Publish a new configuration and start or stop the asynchronous mode accordingly
+ *
+ * @param   attr      attributes, NULL for the defaults
+ * @param   replace   replace the configuration if it has been already set
+ */
+static void set_configuration(mdclog_attr_t *attr, int replace)
+{
+    struct config      *config;
+    struct config      *old;
+    struct async_config async_config;
+    struct json_layout  default_layout;
+
+    mdclog_internal_init_mdc();
+    config = create_configuration(attr);
+    pthread_mutex_lock(&config_mutex);
+    if (!fallback_schema_compiled)
+    {
+        // used when the configuration cannot be allocated, or after cleaning the library
+        mdclog_internal_default_layout(&default_layout);
+        mdclog_internal_compile_schema(&fallback_configuration.schema, &default_layout, NULL);
+        fallback_schema_compiled = 1;
+    }
+    old = atomic_load_explicit(&mdclog_configuration, memory_order_relaxed);
+    if (old && !replace)
+    {
+        // another thread initialized the library meanwhile
+        pthread_mutex_unlock(&config_mutex);
+        free_configuration(config);
+        return;
+    }
+    atomic_store_explicit(&mdclog_configuration, config, memory_order_release);
+
+    // The background thread formats the deferred entries with the new configuration.
+    // Stopping it waits until all queued entries have been written.
+    if (config->async)
+    {
+        async_config.capacity = config->async_capacity;
+        async_config.policy = config->overflow_policy;
+        async_config.batch_size = config->batch_size;
+        async_config.flush_interval_ms = config->flush_interval_ms;
+        async_config.format = format_deferred_entry;
+        mdclog_internal_async_start(&async_config);
+    }
+    else
+        mdclog_internal_async_stop();
+    // writes the repetition counts of the threads that stop logging
+    if (config->repeat_timeout_ms)
+        mdclog_internal_repeat_timer_start();
+    pthread_mutex_unlock(&config_mutex);
+
+    if (old)
+    {
+        mdclog_internal_epoch_synchronize();
+        free_configuration(old);
+    }
+}
+
+static void init_library(mdclog_attr_t *attr)
+{
+    if (atomic_load_explicit(&mdclog_configuration, memory_order_acquire))
+        return;
+    set_configuration(attr, 0);
+}
+
+/*
+ * The level checked before a log entry is formatted is the lowest of the
+ * output, the recorder and the sink levels. The level is computed under the
+ * mutex, so that the last caller stores a level that includes every change.
+ */
+static void update_current_level(void)
+{
+    int level;
+    int recorded;
+    int sinks;
+
+    pthread_mutex_lock(&config_mutex);
+    level = __atomic_load_n(&output_level, __ATOMIC_RELAXED);
+    recorded = __atomic_load_n(&recorder_level, __ATOMIC_RELAXED);
+    sinks = mdclog_internal_sink_level();
+    if (recorded > level)
+        level = recorded;
+    __atomic_store_n(&mdclog_current_level, sinks > level ? sinks : level, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&config_mutex);
+}
+
+static void set_recorder(struct recorder *recorder, int level)
+{
+    mdclog_internal_recorder_set(recorder);
+    __atomic_store_n(&recorder_level, recorder ? level : -1, __ATOMIC_RELAXED);
+    update_current_level();
 }
 
 int mdclog_init(mdclog_attr_t *attr)
 {
-    // Set init_done to zero so that the init is done always
-    // when this function is called.
-    mdclog_configuration.init_done = 0;
-    mdclog_configuration.log_format_init_done=0;
-    init_library(attr);
+    struct file_sink   *sink = NULL;
+    struct socket_sink *socket_sink = NULL;
+    struct recorder    *recorder = NULL;
+
+    if (attr && attr->recorder_path)
+    {
+        recorder = mdclog_internal_recorder_open(attr->recorder_path, attr->recorder_size);
+        if (!recorder)
+            return -1;
+    }
+    if (attr && attr->socket_path)
+    {
+        // the binary records of an entry are one frame
+        attr->socket.lines = attr->output_format == MDCLOG_OUTPUT_JSON;
+        socket_sink = mdclog_internal_socket_sink_open(attr->socket_path, &attr->socket);
+        if (!socket_sink)
+        {
+            mdclog_internal_recorder_close(recorder);
+            return -1;
+        }
+    }
+    if (attr && attr->file_path)
+    {
+        sink = mdclog_internal_file_sink_open(attr->file_path, &attr->file_rotation);
+        if (!sink)
+        {
+            mdclog_internal_socket_sink_close(socket_sink);
+            mdclog_internal_recorder_close(recorder);
+            return -1;
+        }
+    }
+    log_format_init_done = 0;
+    set_configuration(attr, 1);
+    mdclog_internal_file_sink_set(sink);
+    mdclog_internal_socket_sink_set(socket_sink);
+    set_recorder(recorder, attr ? (int)attr->recorder_level : -1);
     return 0;
 }
 
-void mdclog_write(mdclog_severity_t severity, const char *format, ...)
+static uint64_t monotonic_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+/*
+ * Write to the output. Only entries longer than PIPE_BUF can be written partially.
+ */
+static void write_output(const char *entry, size_t len)
 {
-    char           buffer[PIPE_BUF];
-    struct timeval tv;
-    int            len;
-    va_list        va;
+    ssize_t ret;
+
+    while (len > 0)
+    {
+        ret = TEMP_FAILURE_RETRY(mdclog_internal_output_write(entry, len));
+        if (ret <= 0)
+            break;
+        entry += ret;
+        len -= (size_t)ret;
+    }
+}
 
-    if (severity > current_level)
+/*
+ * Write a formatted log entry, including the ending newline
+ */
+static void write_formatted(const char *entry, size_t len)
+{
+    if (mdclog_internal_async_push(entry, len) == 0)
         return;
+    write_output(entry, len);
+}
 
-    init_library(NULL);
-    gettimeofday(&tv, NULL);
+/*
+ * Encode a log entry to the binary stream and write it
+ */
+static void write_binary(struct timeval *tv, mdclog_severity_t severity, const char *format, va_list va)
+{
+    const struct config *config;
+    const char          *records;
+    unsigned long        generation;
+    long                 len = -1;
+
+    pthread_mutex_lock(&binary_mutex);
+    if (!binary_encoder)
+        binary_encoder = mdclog_internal_binary_encoder_create();
+    config = enter_configuration();
+    if (binary_encoder)
+    {
+        generation = mdclog_internal_output_generation();
+        if (config->serial != binary_serial || generation != binary_generation)
+        {
+            mdclog_internal_binary_encoder_reset(binary_encoder, &config->stream);
+            binary_serial = config->serial;
+            binary_generation = generation;
+        }
+        len = mdclog_internal_binary_encode(binary_encoder, tv, severity, mdclog_internal_get_first_mdc(),
+                                            format, va, &records);
+    }
+    leave_configuration();
+    // a rotation of the log file changes the generation, so the next entry starts a new stream
+    if (len > 0)
+        write_output(records, (size_t)len);
+    pthread_mutex_unlock(&binary_mutex);
+}
+
+static void write_binary_args(struct timeval *tv, mdclog_severity_t severity, const char *format, ...)
+    __attribute__ ((format (printf, 3, 4)));
+
+static void write_binary_args(struct timeval *tv, mdclog_severity_t severity, const char *format, ...)
+{
+    va_list va;
 
     va_start(va, format);
-    pthread_rwlock_rdlock(&config_mutex);
-    // Format function can use buffer size -1. The last byte is reserved for a newline char.
-    len = mdclog_internal_format_to_json_str(buffer, sizeof(buffer) - 1, &tv, mdclog_configuration.identity,
-            severity, mdclog_internal_get_first_mdc(), format, va);
-    pthread_rwlock_unlock(&config_mutex);
+    write_binary(tv, severity, format, va);
     va_end(va);
+}
+
+/*
+ * Write a log entry to the binary stream. The binary records have no typed
+ * fields, so the fields are appended to the message as a json object.
+ */
+static void write_binary_entry(struct timeval *tv, mdclog_severity_t severity,
+                               const mdclog_kv_t *fields, size_t field_count, const char *format, va_list va)
+{
+    char   object[PIPE_BUF];
+    size_t len;
+
+    if (!fields)
+    {
+        write_binary(tv, severity, format, va);
+        return;
+    }
+    if (field_count == 0)
+    {
+        write_binary_args(tv, severity, "%s", format);
+        return;
+    }
+    object[0] = '{';
+    len = mdclog_internal_format_kv_fields(&object[1], sizeof(object) - 1, fields, field_count);
+    // replaces the comma after the last field
+    object[len > 0 ? len : 1] = '}';
+    object[len > 0 ? len + 1 : 2] = '\0';
+    write_binary_args(tv, severity, "%s %s", format, object);
+}
+
+/*
+ * Check if the log entries are written to a pipe, where writes longer than PIPE_BUF are not atomic
+ */
+static int output_is_pipe(void)
+{
+    struct stat st;
+
+    return !mdclog_internal_file_sink_active() && !mdclog_internal_socket_sink_connected() &&
+           fstat(STDOUT_FILENO, &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+/*
+ * Write a log entry longer than PIPE_BUF according to the large entry policy
+ *
+ * @param   entry   log entry without the ending newline. The buffer must have room for it.
+ */
+static void write_large_entry(char *entry, size_t len, mdclog_large_entry_policy_t policy)
+{
+    if (policy == MDCLOG_LARGE_ENTRY_FRAGMENT ||
+        (policy == MDCLOG_LARGE_ENTRY_FRAGMENT_PIPE && output_is_pipe()))
+    {
+        mdclog_internal_write_fragments(entry, len, write_formatted);
+        return;
+    }
+    entry[len] = '\n';
+    write_formatted(entry, len + 1);
+}
+
+/*
+ * Capture the log entry and queue it to be formatted by the background thread
+ *
+ * @return  0 if the entry was handled, -1 if the caller must format it
+ */
+static int write_deferred(struct timeval *tv, mdclog_severity_t severity, const char *format, va_list va)
+{
+    char    record[PIPE_BUF];
+    char    buffer[PIPE_BUF];
+    int     len;
+    size_t  entry_len;
+    va_list copy;
+
+    va_copy(copy, va);
+    mdclog_internal_epoch_enter();      // protects the global MDCs
+    len = mdclog_internal_capture_deferred(record, sizeof(record), tv, severity,
+            mdclog_internal_get_first_mdc(), format, copy);
+    mdclog_internal_epoch_leave();
+    va_end(copy);
+    if (len < 0)
+        return -1;
+    if (mdclog_internal_async_push_deferred(record, (size_t)len) < 0)
+    {
+        // the asynchronous mode was stopped meanwhile
+        entry_len = format_deferred_entry(buffer, sizeof(buffer), record, (size_t)len);
+        if (entry_len > 0)
+            write_output(buffer, entry_len);
+    }
+    return 0;
+}
+
+/*
+ * Pass a log entry to the record sinks. The message is formatted without
+ * the json escaping, truncated to the maximum entry size.
+ */
+static void write_record(struct timeval *tv, mdclog_severity_t severity,
+                         const mdclog_kv_t *fields, size_t field_count, const char *format, va_list va)
+{
+    char                 buffer[PIPE_BUF];
+    char                 identity[IDENTITY_MAX_LENGTH + 1];
+    char                *large;
+    size_t               max_entry_size;
+    mdclog_record_t      record;
+    const struct config *config;
+    int                  saved_errno = errno;
+    int                  len;
+    va_list              copy;
+
+    config = enter_configuration();
+    memcpy(identity, config->stream.identity, sizeof(identity));
+    max_entry_size = config->max_entry_size;
+    leave_configuration();
+
+    // a plain message has no fields, although its literal text is marked with an empty array
+    record.fields = field_count > 0 ? fields : NULL;
+    record.field_count = field_count;
+    if (fields)
+    {
+        // the message is not a format string
+        record.message = format;
+        record.message_len = strlen(format);
+        len = 0;
+    }
+    else
+    {
+        record.message = buffer;
+        errno = saved_errno;    // for %m
+        va_copy(copy, va);
+        len = vsnprintf(buffer, sizeof(buffer), format, copy);
+        va_end(copy);
+        if (len < 0)
+            return;
+        record.message_len = (size_t)len < sizeof(buffer) ? (size_t)len : sizeof(buffer) - 1;
+    }
+    if ((size_t)len >= sizeof(buffer) && max_entry_size > sizeof(buffer) &&
+        (large = mdclog_internal_get_entry_buffer(max_entry_size)) != NULL)
+    {
+        errno = saved_errno;    // for %m
+        va_copy(copy, va);
+        len = vsnprintf(large, max_entry_size, format, copy);
+        va_end(copy);
+        record.message = large;
+        record.message_len = (size_t)len < max_entry_size ? (size_t)len : max_entry_size - 1;
+    }
+    record.timestamp = *tv;
+    record.severity = severity;
+    record.identity = identity;
+    record.mdc = mdclog_internal_get_first_mdc();
+    errno = saved_errno;
+    mdclog_internal_sinks_write_record(&record);
+}
+
+/*
+ * Format a log entry to json
+ */
+static int format_json(char *buffer, size_t len, struct timeval *tv, const struct config *config,
+                       mdclog_severity_t severity, const mdclog_kv_t *fields, size_t field_count,
+                       struct json_info *info, const char *format, va_list va)
+{
+    if (fields)
+        return mdclog_internal_format_kv_to_json_str(buffer, len, tv, &config->schema, severity,
+                mdclog_internal_get_first_mdc(), info, format, fields, field_count);
+    return mdclog_internal_format_to_json_str(buffer, len, tv, &config->schema, severity,
+            mdclog_internal_get_first_mdc(), info, format, va);
+}
+
+/*
+ * Format and write a log entry that has passed the filtering. If fields is
+ * not NULL, the format is a literal message and the arguments are not used.
+ */
+static void write_entry(mdclog_severity_t severity, const mdclog_kv_t *fields, size_t field_count,
+                        const char *format, va_list va)
+{
+    char                 buffer[PIPE_BUF];
+    char                *entry = buffer;
+    char                *large;
+    struct timeval       tv;
+    struct json_info     info;
+    int                  len;
+    int                  deferred;
+    int                  recorded;
+    int                  output;
+    int                  sinks;
+    int                  rendered;
+    int                  binary;
+    unsigned             repeat_timeout_ms;
+    mdclog_large_entry_policy_t large_entry_policy;
+    const struct config *config;
+
+    // a sink runs in an epoch critical section, where the output cannot be written
+    if (mdclog_internal_sink_running())
+        return;
+    init_library(NULL);
+
+    recorded = (int)severity <= __atomic_load_n(&recorder_level, __ATOMIC_RELAXED);
+    output = (int)severity <= __atomic_load_n(&output_level, __ATOMIC_RELAXED);
+    sinks = mdclog_internal_sinks_wanted(severity);
+    // the json entry is formatted once for the recorder, the json sinks and the output
+    rendered = recorded || (sinks & SINK_WANTS_JSON);
+    config = enter_configuration();
+    mdclog_internal_clock_read(config->clock, &tv);
+    repeat_timeout_ms = config->repeat_timeout_ms;
+    large_entry_policy = config->large_entry_policy;
+    binary = config->output_format == MDCLOG_OUTPUT_BINARY;
+    // repetitions are detected from the formatted entries, so they cannot be deferred,
+    // and the background thread formats at most PIPE_BUF bytes. The recorded entries
+    // and the entries of the json sinks are formatted by the writing thread.
+    deferred = config->async && config->deferred_format && !repeat_timeout_ms &&
+               config->max_entry_size <= PIPE_BUF && !rendered && !binary && !fields;
+    leave_configuration();
+    if (!repeat_timeout_ms)
+        mdclog_internal_repeat_flush();
+    if (sinks & SINK_WANTS_RECORD)
+        write_record(&tv, severity, fields, field_count, format, va);
+    if (!output && !rendered)
+        return;
+    // an entry that is not rendered passed the output level
+    if (binary && !rendered)
+    {
+        write_binary_entry(&tv, severity, fields, field_count, format, va);
+        return;
+    }
+    if (deferred && write_deferred(&tv, severity, format, va) == 0)
+        return;
+    config = enter_configuration();
+    // Format function can use buffer size -1. The last byte is reserved for a newline char.
+    len = format_json(buffer, sizeof(buffer) - 1, &tv, config, severity, fields, field_count, &info, format, va);
+    // a truncated entry is formatted again if a larger entry is allowed
+    if (info.truncated && config->max_entry_size > sizeof(buffer) &&
+        (large = mdclog_internal_get_entry_buffer(config->max_entry_size)) != NULL)
+    {
+        entry = large;
+        len = format_json(entry, config->max_entry_size - 1, &tv, config, severity, fields, field_count,
+                          &info, format, va);
+    }
+    leave_configuration();
     if (len > 0)
     {
-        buffer[len] = '\n';
-        TEMP_FAILURE_RETRY(SYSTEM(write(STDOUT_FILENO, buffer, len + 1)));
+        if (recorded)
+            mdclog_internal_recorder_write(entry, (size_t)len);
+        if (sinks & SINK_WANTS_JSON)
+            mdclog_internal_sinks_write_json(severity, entry, (size_t)len);
+        if (!output)
+            return;
+        if (binary)
+        {
+            write_binary_entry(&tv, severity, fields, field_count, format, va);
+            return;
+        }
+        if (repeat_timeout_ms &&
+            mdclog_internal_repeat_filter(entry, (size_t)len, info.timestamp_start, info.timestamp_end,
+                                          repeat_timeout_ms * 1000000ULL, monotonic_ns(), write_formatted))
+            return;
+        if ((size_t)len + 1 > PIPE_BUF)
+        {
+            write_large_entry(entry, (size_t)len, large_entry_policy);
+            return;
+        }
+        entry[len] = '\n';
+        write_formatted(entry, (size_t)len + 1);
     }
 }
 
+static void write_entry_args(mdclog_severity_t severity, const char *format, ...)
+    __attribute__ ((format (printf, 2, 3)));
+
+static void write_entry_args(mdclog_severity_t severity, const char *format, ...)
+{
+    va_list va;
+
+    va_start(va, format);
+    write_entry(severity, NULL, 0, format, va);
+    va_end(va);
+}
+
+/*
+ * Write the counts of the log entries discarded by the rate limiting and the sampling.
+ * The entry has the severity of the most severe discarded entry, and it is not filtered.
+ */
+static void write_summary(uint64_t now_ns, int force)
+{
+    struct suppression_summary summary;
+
+    if (mdclog_internal_take_summary(now_ns, force, &summary))
+        write_entry_args(summary.severity, "suppressed %llu log entries: %llu by rate limiting, %llu by sampling",
+                         (unsigned long long)(summary.rate_limited + summary.sampled_out),
+                         (unsigned long long)summary.rate_limited,
+                         (unsigned long long)summary.sampled_out);
+}
+
+/*
+ * Apply the rate limiting and the sampling to a log entry
+ *
+ * @return  1 if the entry is written, 0 if it is discarded
+ */
+static int admit_entry(mdclog_site_t *site, const char *format, mdclog_severity_t severity)
+{
+    uint64_t now_ns;
+    int      admitted;
+
+    if (!mdclog_internal_suppression_active())
+        return 1;
+    now_ns = monotonic_ns();
+    admitted = mdclog_internal_admit(site, format, severity, now_ns);
+    write_summary(now_ns, 0);
+    return admitted;
+}
+
+void mdclog_write(mdclog_severity_t severity, const char *format, ...)
+{
+    va_list va;
+
+    if (!mdclog_level_enabled(severity) || !admit_entry(NULL, format, severity))
+        return;
+    va_start(va, format);
+    write_entry(severity, NULL, 0, format, va);
+    va_end(va);
+}
+
+void mdclog_write_site(mdclog_site_t *site, mdclog_severity_t severity, const char *format, ...)
+{
+    va_list va;
+
+    if (!mdclog_level_enabled(severity) || !admit_entry(site, format, severity))
+        return;
+    va_start(va, format);
+    write_entry(severity, NULL, 0, format, va);
+    va_end(va);
+}
+
+int mdclog_rate_limit_set(unsigned per_second, unsigned burst)
+{
+    return mdclog_internal_set_rate_limit(per_second, burst);
+}
+
+int mdclog_sampling_set(mdclog_severity_t severity, double probability)
+{
+    return mdclog_internal_set_sampling(severity, probability);
+}
+
+void mdclog_summary_interval_set(unsigned interval_ms)
+{
+    mdclog_internal_set_summary_interval(interval_ms);
+}
+
 void mdclog_level_set(mdclog_severity_t level)
 {
-    current_level = level;
+    __atomic_store_n(&output_level, (int)level, __ATOMIC_RELAXED);
+    update_current_level();
+}
+
+static void write_kv_entry(mdclog_severity_t severity, const mdclog_kv_t *fields, size_t field_count,
+                           const char *message, ...)
+{
+    va_list va;
+
+    va_start(va, message);
+    write_entry(severity, fields, field_count, message, va);
+    va_end(va);
+}
+
+void mdclog_write_kv(mdclog_severity_t severity, const char *message, const mdclog_kv_t *fields, size_t field_count)
+{
+    mdclog_kv_t none;
+
+    if (!message)
+        message = "";
+    if (!mdclog_level_enabled(severity) || !admit_entry(NULL, message, severity))
+        return;
+    if (!fields)
+        write_kv_entry(severity, &none, 0, message);
+    else
+        write_kv_entry(severity, fields, field_count, message);
+}
+
+void mdclog_write_formatted(mdclog_severity_t severity, const char *format, const char *message)
+{
+    mdclog_kv_t none;
+
+    if (!message)
+        message = "";
+    if (!mdclog_level_enabled(severity) || !admit_entry(NULL, format ? format : message, severity))
+        return;
+    write_kv_entry(severity, &none, 0, message);
+}
+
+int mdclog_kv_begin(mdclog_kv_builder_t *builder, mdclog_severity_t severity, const char *message)
+{
+    builder->severity = severity;
+    builder->message = message;
+    builder->field_count = 0;
+    return mdclog_level_enabled(severity);
+}
+
+int mdclog_kv_add(mdclog_kv_builder_t *builder, mdclog_kv_t field)
+{
+    if (!builder)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (builder->field_count >= MDCLOG_KV_BUILDER_MAX_FIELDS)
+    {
+        errno = ENOSPC;
+        return -1;
+    }
+    builder->fields[builder->field_count++] = field;
+    return 0;
+}
+
+void mdclog_kv_end(mdclog_kv_builder_t *builder)
+{
+    mdclog_write_kv(builder->severity, builder->message, builder->fields, builder->field_count);
 }
 
 mdclog_severity_t mdclog_level_get(void)
 {
-    return current_level;
+    return (mdclog_severity_t)__atomic_load_n(&output_level, __ATOMIC_RELAXED);
+}
+
+int mdclog_sink_add(const mdclog_sink_t *sink)
+{
+    int id = mdclog_internal_sink_add(sink);
+
+    if (id > 0)
+        update_current_level();
+    return id;
+}
+
+int mdclog_sink_remove(int id)
+{
+    if (mdclog_internal_sink_remove(id) < 0)
+        return -1;
+    update_current_level();
+    return 0;
+}
+
+void mdclog_mdc_iter_init(mdclog_mdc_iter_t *iter, const mdclog_record_t *record)
+{
+    // the sinks are called in an epoch critical section, which protects the global MDCs
+    iter->global = mdclog_internal_get_first_global_mdc();
+    iter->thread = record->mdc;
+}
+
+int mdclog_mdc_iter_next(mdclog_mdc_iter_t *iter, const char **key, const char **value)
+{
+    mdc_t *mdc;
+
+    while ((mdc = (mdc_t *)iter->global) != NULL)
+    {
+        iter->global = mdclog_internal_get_next_mdc(mdc);
+        // a global MDC overridden by the thread is got with the thread MDCs
+        if (!mdclog_internal_search_mdc(mdclog_internal_get_mdc_key(mdc)))
+            break;
+    }
+    if (!mdc && (mdc = (mdc_t *)iter->thread) != NULL)
+        iter->thread = mdclog_internal_get_next_mdc(mdc);
+    if (!mdc)
+        return 0;
+    *key = mdclog_internal_get_mdc_key(mdc);
+    *value = mdclog_internal_get_mdc_val(mdc);
+    return 1;
 }
 
 int mdclog_attr_init(mdclog_attr_t **attr)
@@ -184,6 +947,12 @@ int mdclog_attr_init(mdclog_attr_t **attr)
         return -1;
     }
     memset(*attr, 0, sizeof(mdclog_attr_t));
+    (*attr)->batch_size = ASYNC_DEFAULT_BATCH_SIZE;
+    (*attr)->max_entry_size = PIPE_BUF;
+    (*attr)->file_rotation.retention = MDCLOG_DEFAULT_FILE_RETENTION;
+    (*attr)->socket.batch_size = MDCLOG_DEFAULT_SOCKET_BATCH_SIZE;
+    (*attr)->socket.flush_interval_ms = MDCLOG_DEFAULT_SOCKET_FLUSH_INTERVAL_MS;
+    mdclog_internal_default_layout(&(*attr)->layout);
     return 0;
 }
 
@@ -193,6 +962,9 @@ void mdclog_attr_destroy(mdclog_attr_t *attr)
     {
         if (attr->identity)
             free(attr->identity);
+        free(attr->file_path);
+        free(attr->socket_path);
+        free(attr->recorder_path);
         free(attr);
     }
 }
@@ -209,6 +981,261 @@ int mdclog_attr_set_ident(mdclog_attr_t *attr, const char *identity)
     return 0;
 }
 
+int mdclog_attr_set_async(mdclog_attr_t *attr, int enable)
+{
+    if (!attr)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    attr->async = enable ? 1 : 0;
+    return 0;
+}
+
+int mdclog_attr_set_deferred_format(mdclog_attr_t *attr, int enable)
+{
+    if (!attr)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    attr->deferred_format = enable ? 1 : 0;
+    return 0;
+}
+
+int mdclog_attr_set_async_capacity(mdclog_attr_t *attr, size_t capacity)
+{
+    if (!attr || capacity < ASYNC_MIN_CAPACITY)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    attr->async_capacity = capacity;
+    return 0;
+}
+
+int mdclog_attr_set_overflow_policy(mdclog_attr_t *attr, mdclog_overflow_policy_t policy)
+{
+    if (!attr || (policy != MDCLOG_OVERFLOW_BLOCK && policy != MDCLOG_OVERFLOW_DROP_NEWEST &&
+        policy != MDCLOG_OVERFLOW_DROP_OLDEST))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    attr->overflow_policy = policy;
+    return 0;
+}
+
+int mdclog_attr_set_batch_size(mdclog_attr_t *attr, size_t batch_size)
+{
+    if (!attr || batch_size > ASYNC_MAX_BATCH_SIZE)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    attr->batch_size = batch_size;
+    return 0;
+}
+
+int mdclog_attr_set_flush_interval(mdclog_attr_t *attr, unsigned interval_ms)
+{
+    if (!attr)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    attr->flush_interval_ms = interval_ms;
+    return 0;
+}
+
+int mdclog_attr_set_repeat_suppression(mdclog_attr_t *attr, unsigned timeout_ms)
+{
+    if (!attr)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    attr->repeat_timeout_ms = timeout_ms;
+    return 0;
+}
+
+int mdclog_attr_set_clock(mdclog_attr_t *attr, mdclog_clock_t clock)
+{
+    if (!attr || (clock != MDCLOG_CLOCK_REALTIME && clock != MDCLOG_CLOCK_REALTIME_COARSE &&
+                  clock != MDCLOG_CLOCK_TSC))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    attr->clock = clock;
+    return 0;
+}
+
+int mdclog_attr_set_timestamp_format(mdclog_attr_t *attr, mdclog_timestamp_format_t format)
+{
+    if (!attr || (format != MDCLOG_TIMESTAMP_EPOCH_MS && format != MDCLOG_TIMESTAMP_RFC3339))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    attr->timestamp_format = format;
+    return 0;
+}
+
+int mdclog_attr_set_field_key(mdclog_attr_t *attr, mdclog_field_t field, const char *key)
+{
+    if (!attr)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    return mdclog_internal_set_layout_key(&attr->layout, field, key);
+}
+
+int mdclog_attr_set_field_order(mdclog_attr_t *attr, const mdclog_field_t *fields, size_t count)
+{
+    if (!attr)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    return mdclog_internal_set_layout_order(&attr->layout, fields, count);
+}
+
+int mdclog_attr_set_max_entry_size(mdclog_attr_t *attr, size_t size)
+{
+    if (!attr || size < PIPE_BUF || size > MDCLOG_MAX_ENTRY_SIZE)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    attr->max_entry_size = size;
+    return 0;
+}
+
+int mdclog_attr_set_large_entry_policy(mdclog_attr_t *attr, mdclog_large_entry_policy_t policy)
+{
+    if (!attr || (policy != MDCLOG_LARGE_ENTRY_FRAGMENT_PIPE && policy != MDCLOG_LARGE_ENTRY_FRAGMENT &&
+                  policy != MDCLOG_LARGE_ENTRY_WRITE))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    attr->large_entry_policy = policy;
+    return 0;
+}
+
+int mdclog_attr_set_output_format(mdclog_attr_t *attr, mdclog_output_format_t format)
+{
+    if (!attr || (format != MDCLOG_OUTPUT_JSON && format != MDCLOG_OUTPUT_BINARY))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    attr->output_format = format;
+    return 0;
+}
+
+int mdclog_attr_set_file(mdclog_attr_t *attr, const char *path)
+{
+    char *copy = NULL;
+
+    if (!attr || (path && !*path))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (path && !(copy = strdup(path)))
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    free(attr->file_path);
+    attr->file_path = copy;
+    return 0;
+}
+
+int mdclog_attr_set_file_rotation(mdclog_attr_t *attr, size_t max_size, unsigned interval_s)
+{
+    if (!attr)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    attr->file_rotation.max_size = max_size;
+    attr->file_rotation.interval_ns = interval_s * 1000000000ULL;
+    return 0;
+}
+
+int mdclog_attr_set_file_retention(mdclog_attr_t *attr, unsigned count)
+{
+    if (!attr || count > MDCLOG_MAX_FILE_RETENTION)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    attr->file_rotation.retention = count;
+    return 0;
+}
+
+int mdclog_attr_set_socket(mdclog_attr_t *attr, const char *path, mdclog_socket_type_t type)
+{
+    struct sockaddr_un address;
+    char              *copy = NULL;
+
+    if (!attr || (path && (!*path || strlen(path) >= sizeof(address.sun_path))) ||
+        (type != MDCLOG_SOCKET_STREAM && type != MDCLOG_SOCKET_SEQPACKET))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (path && !(copy = strdup(path)))
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    free(attr->socket_path);
+    attr->socket_path = copy;
+    attr->socket.type = type;
+    return 0;
+}
+
+int mdclog_attr_set_socket_batching(mdclog_attr_t *attr, size_t batch_size, unsigned interval_ms)
+{
+    if (!attr || batch_size > MDCLOG_MAX_SOCKET_BATCH_SIZE)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    attr->socket.batch_size = batch_size;
+    attr->socket.flush_interval_ms = interval_ms;
+    return 0;
+}
+
+int mdclog_attr_set_flight_recorder(mdclog_attr_t *attr, const char *path, size_t size, mdclog_severity_t level)
+{
+    char  *copy = NULL;
+    size_t capacity = MDCLOG_MIN_RECORDER_SIZE;
+
+    if (!attr || (path && (!*path || size > MDCLOG_MAX_RECORDER_SIZE || (unsigned)level > MDCLOG_TRACE)))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (path && !(copy = strdup(path)))
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    while (capacity < size)
+        capacity *= 2;
+    free(attr->recorder_path);
+    attr->recorder_path = copy;
+    attr->recorder_size = capacity;
+    attr->recorder_level = level;
+    return 0;
+}
+
 int mdclog_mdc_add(const char *key, const char *value)
 {
     if (!key || !value || mdclog_internal_contains_special_characters(key))
@@ -223,6 +1250,7 @@ int mdclog_mdc_add(const char *key, const char *value)
 char *mdclog_mdc_get(const char *key)
 {
     mdc_t *mdc;
+    char  *value;
 
     if (!key)
         return NULL;
@@ -231,7 +1259,11 @@ char *mdclog_mdc_get(const char *key)
     mdc = mdclog_internal_search_mdc(key);
     if (mdc)
         return strdup(mdclog_internal_get_mdc_val(mdc));
-    return NULL;
+    mdclog_internal_epoch_enter();
+    mdc = mdclog_internal_search_global_mdc(key);
+    value = mdc ? strdup(mdclog_internal_get_mdc_val(mdc)) : NULL;
+    mdclog_internal_epoch_leave();
+    return value;
 }
 
 void mdclog_mdc_remove(const char *key)
@@ -248,13 +1280,78 @@ void mdclog_mdc_clean(void)
     mdclog_internal_clean_mdclist();
 }
 
+int mdclog_mdc_scope_push(void)
+{
+    init_library(NULL);
+    return mdclog_internal_push_mdc_scope();
+}
+
+int mdclog_mdc_scope_pop(int scope)
+{
+    init_library(NULL);
+    return mdclog_internal_pop_mdc_scope(scope);
+}
+
+mdclog_mdc_snapshot_t *mdclog_mdc_snapshot(void)
+{
+    init_library(NULL);
+    return mdclog_internal_snapshot_mdcs();
+}
+
+int mdclog_mdc_adopt(mdclog_mdc_snapshot_t *snapshot)
+{
+    if (!snapshot)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    init_library(NULL);
+    return mdclog_internal_adopt_mdcs(snapshot);
+}
+
+void mdclog_mdc_snapshot_release(mdclog_mdc_snapshot_t *snapshot)
+{
+    mdclog_internal_release_mdc_snapshot(snapshot);
+}
+
+int mdclog_stats_get(mdclog_stats_t *stats)
+{
+    if (!stats)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    mdclog_internal_async_stats(stats);
+    mdclog_internal_suppression_stats(stats);
+    return 0;
+}
+
 void mdclog_lib_clean(void)
 {
-    if (mdclog_configuration.identity)
-        free(mdclog_configuration.identity);
-    mdclog_configuration.identity = NULL;
-    mdclog_configuration.init_done = 0;
-    mdclog_configuration.log_format_init_done = 0;
+    struct config *config;
+
+    write_summary(monotonic_ns(), 1);
+    mdclog_internal_repeat_flush_all();
+    pthread_mutex_lock(&config_mutex);
+    mdclog_internal_async_stop();
+    config = atomic_exchange_explicit(&mdclog_configuration, NULL, memory_order_acq_rel);
+    pthread_mutex_unlock(&config_mutex);
+    // the entries that cannot be sent are written to the file sink
+    mdclog_internal_socket_sink_set(NULL);
+    mdclog_internal_file_sink_set(NULL);
+    mdclog_internal_sinks_clear();
+    set_recorder(NULL, -1);
+    pthread_mutex_lock(&binary_mutex);
+    mdclog_internal_binary_encoder_destroy(binary_encoder);
+    binary_encoder = NULL;
+    pthread_mutex_unlock(&binary_mutex);
+    mdclog_internal_clean_global_mdcs();
+    if (config)
+    {
+        mdclog_internal_epoch_synchronize();
+        free_configuration(config);
+    }
+    log_format_init_done = 0;
 }
 
 char *read_env_param(const char*envkey)
@@ -292,6 +1389,14 @@ void  update_mdc_log_level_severity(char* log_level)
     {
         level = MDCLOG_DEBUG;
     }
+    else if(strcasecmp(log_level,"TRACE")==0)
+    {
+        level = MDCLOG_TRACE;
+    }
+    else if(strcasecmp(log_level,"FATAL")==0)
+    {
+        level = MDCLOG_FATAL;
+    }
 
     mdclog_level_set(level);
 }
@@ -364,12 +1469,12 @@ static void * monitor_loglevel_change_handler(void* arg)
         if( wfd < 0 ) {
             fprintf( stderr, "### ERR ### unable to add watch on config file %s: %s\n", fileName, strerror( errno ) );
         } else {
-            mdclog_configuration.log_format_init_done = 1;
+            log_format_init_done = 1;
 #ifdef UNITTEST
-            mdclog_configuration.log_format_init_done = 0;
+            log_format_init_done = 0;
 #endif
             memset( &timeout, 0, sizeof(timeout) );
-            while( mdclog_configuration.log_format_init_done ) {
+            while( log_format_init_done ) {
                 FD_ZERO (&fds);
                 FD_SET (ifd, &fds);
                 timeout.tv_sec=1;
@@ -427,41 +1532,45 @@ static int enable_log_change_notify(const char* fileName)
     return ret;
 }
 
-static int update_mdclog_array(const char* key, const char* value)
+/*
+ * Set the log fields and the PID as global MDCs, visible to all threads
+ */
+static int set_global_log_fields(void)
 {
-    char *old_value = mdclog_mdc_get(key);
-    if(old_value)
+    const size_t field_count = LOGFIELD_COUNT;
+    const char  *keys[LOGFIELD_COUNT + 1];
+    const char  *values[LOGFIELD_COUNT + 1];
+    char        *field_values[LOGFIELD_COUNT];
+    char         pid_string[STR_BUFF];
+    int          ret;
+
+    // the values are escaped like the values of the thread MDCs
+    for (size_t i = 0; i < field_count; i++)
     {
-        mdclog_mdc_remove(key);
-        free(old_value);
+        field_values[i] = read_env_param(LOGFIELDS[i]);
+        keys[i] = LOGFIELDS[i];
+        values[i] = field_values[i] ? field_values[i] : "";
     }
-    return  mdclog_mdc_add(key,value);
-
+    snprintf(pid_string, sizeof(pid_string), "%d", getpid());
+    keys[field_count] = "PID";
+    values[field_count] = pid_string;
+    ret = mdclog_internal_set_global_mdcs(keys, values, field_count + 1);
+    for (size_t i = 0; i < field_count; i++)
+        free(field_values[i]);
+    return ret;
 }
 
 int mdclog_format_initialize(const int logfile_monitor)
 {
     int ret = 0;
     char* log_level_init=NULL;
-    if( 0 == mdclog_configuration.log_format_init_done)
+    if( 0 == log_format_init_done)
     {
-        char buff_string[STR_BUFF]={'\0'};
-        for(uint8_t i=0; ((0 == ret) && (i < sizeof(LOGFIELDS)/sizeof(char*))); i++)
-        {
-            char *field_value = read_env_param(LOGFIELDS[i]);
-            if (field_value) {
-                ret = update_mdclog_array(LOGFIELDS[i],field_value);
-                free(field_value);
-            } else {
-                mdclog_mdc_add(LOGFIELDS[i],"");
-            }
-        }
+        init_library(NULL);
+        ret = set_global_log_fields();
         if(0 == ret)
         {
-            memset(buff_string,'\0',STR_BUFF);
-            snprintf(buff_string,STR_BUFF,"%d",getpid());
             char *logFile_Name = read_env_param(LOG_FILE_CONFIG_MAP);
-            ret = update_mdclog_array("PID",buff_string);
             if(logFile_Name)
             {
                 log_level_init = parse_file(logFile_Name);
@@ -0,0 +1,535 @@
+/*
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ *
+ * Fused formatting and escaping of the log messages. A format string is
+ * compiled once to a list of operations: literal text, which is checked for
+ * characters to escape at compile time, strings and characters, which are
+ * escaped while they are copied, and numbers, which never need escaping and
+ * are printed straight to the output. The compiled formats are kept in a
+ * small direct mapped cache of each thread, keyed by the format pointer and
+ * validated by the content, so a reused format buffer is compiled again.
+ */
+#include "private/message.h"
+#include "private/deferred.h"
+#include "private/json_format.h"
+#include "private/kv.h"
+#include "private/scan.h"
+#include "private/system.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#define FORMAT_CACHE_BITS     7
+#define FORMAT_CACHE_SIZE     (1U << FORMAT_CACHE_BITS)
+#define ERRNO_MESSAGE_LENGTH  256
+
+enum op_type
+{
+    OP_LITERAL,     // text of the format string
+    OP_STRING,      // %s, with the - flag, width and precision
+    OP_CHAR,        // %c, with the - flag and width
+    OP_SIGNED,      // %d and %i without flags, width or precision
+    OP_UNSIGNED,    // %u without flags, width or precision
+    OP_NUMBER,      // other conversions, printed with snprintf
+    OP_ERRNO        // %m
+};
+
+struct op
+{
+    enum op_type  type;
+    enum arg_type arg;
+    const char*   text;             // the literal or the conversion specification, zero terminated
+    size_t        len;              // length of the literal
+    int           clean;            // the literal has no characters to escape
+    int           left;             // - flag
+    int           width;            // 0 if none
+    int           width_arg;
+    int           precision;        // -1 if none
+    int           precision_arg;
+};
+
+struct compiled_format
+{
+    const char* format;             // the format pointer that the entry was compiled from
+    size_t      format_len;
+    int         supported;
+    size_t      op_count;
+    struct op*  ops;
+    char*       text;               // copy of the format, followed by the conversion specifications
+};
+
+struct format_cache
+{
+    struct compiled_format* slots[FORMAT_CACHE_SIZE];
+};
+
+struct output
+{
+    char*  buffer;
+    size_t len;                     // size of the buffer, including the ending zero
+    size_t offset;
+    int    full;                    // the output did not fit and was cut
+    int    ended;                   // a zero character ended the output like in vsnprintf
+};
+
+static pthread_key_t                  cache_key;
+static pthread_once_t                 cache_once = PTHREAD_ONCE_INIT;
+static int                            cache_key_created;
+static __thread struct format_cache*  thread_cache TLS_INITIAL_EXEC;
+
+static void put_clean(struct output* out, const char* str, size_t len)
+{
+    size_t room = out->len - 1 - out->offset;
+
+    if (out->full)
+        return;
+    if (len > room)
+    {
+        len = room;
+        out->full = 1;
+    }
+    memcpy(&out->buffer[out->offset], str, len);
+    out->offset += len;
+}
+
+static void put_spaces(struct output* out, size_t count)
+{
+    size_t room = out->len - 1 - out->offset;
+
+    if (out->full)
+        return;
+    if (count > room)
+    {
+        count = room;
+        out->full = 1;
+    }
+    memset(&out->buffer[out->offset], ' ', count);
+    out->offset += count;
+}
+
+static void put_escaped(struct output* out, const char* str, size_t len)
+{
+    int truncated;
+
+    if (out->full)
+        return;
+    out->offset += mdclog_internal_escape_len(&out->buffer[out->offset], out->len - out->offset,
+                                              str, len, &truncated);
+    if (truncated)
+        out->full = 1;
+}
+
+/*
+ * Print a number with the conversion specification, which never produces
+ * characters that need escaping
+ */
+#define PUT_NUMBER(out, op, va, type)                                                   \
+    do {                                                                                \
+        int    width_ = (op)->width_arg ? va_arg(va, int) : 0;                          \
+        int    precision_ = (op)->precision_arg ? va_arg(va, int) : 0;                  \
+        type   value_ = va_arg(va, type);                                               \
+        size_t room_ = (out)->len - (out)->offset;                                      \
+        char*  dst_ = &(out)->buffer[(out)->offset];                                    \
+        int    ret_;                                                                    \
+        if ((op)->width_arg && (op)->precision_arg)                                     \
+            ret_ = snprintf(dst_, room_, (op)->text, width_, precision_, value_);       \
+        else if ((op)->width_arg)                                                       \
+            ret_ = snprintf(dst_, room_, (op)->text, width_, value_);                   \
+        else if ((op)->precision_arg)                                                   \
+            ret_ = snprintf(dst_, room_, (op)->text, precision_, value_);               \
+        else                                                                            \
+            ret_ = snprintf(dst_, room_, (op)->text, value_);                           \
+        if (ret_ < 0)                                                                   \
+            dst_[0] = '\0';                                                             \
+        else if ((size_t)ret_ >= room_)                                                 \
+        {                                                                               \
+            (out)->offset = (out)->len - 1;                                             \
+            (out)->full = 1;                                                            \
+        }                                                                               \
+        else                                                                            \
+            (out)->offset += ret_;                                                      \
+    } while (0)
+
+static void put_number(struct output* out, const struct op* op, va_list* va)
+{
+    switch (op->arg)
+    {
+        case ARG_INT:      PUT_NUMBER(out, op, *va, int);         break;
+        case ARG_LONG:     PUT_NUMBER(out, op, *va, long);        break;
+        case ARG_LLONG:    PUT_NUMBER(out, op, *va, long long);   break;
+        case ARG_INTMAX:   PUT_NUMBER(out, op, *va, intmax_t);    break;
+        case ARG_SIZE:     PUT_NUMBER(out, op, *va, size_t);      break;
+        case ARG_PTRDIFF:  PUT_NUMBER(out, op, *va, ptrdiff_t);   break;
+        case ARG_DOUBLE:   PUT_NUMBER(out, op, *va, double);      break;
+        case ARG_LDOUBLE:  PUT_NUMBER(out, op, *va, long double); break;
+        case ARG_POINTER:  PUT_NUMBER(out, op, *va, void*);       break;
+        default:                                                  break;
+    }
+}
+
+static int64_t get_signed(const struct op* op, va_list* va)
+{
+    switch (op->arg)
+    {
+        case ARG_LONG:     return va_arg(*va, long);
+        case ARG_LLONG:    return va_arg(*va, long long);
+        case ARG_INTMAX:   return va_arg(*va, intmax_t);
+        case ARG_SIZE:     return (ssize_t)va_arg(*va, size_t);
+        case ARG_PTRDIFF:  return va_arg(*va, ptrdiff_t);
+        default:           return va_arg(*va, int);
+    }
+}
+
+static uint64_t get_unsigned(const struct op* op, va_list* va)
+{
+    switch (op->arg)
+    {
+        case ARG_LONG:     return va_arg(*va, unsigned long);
+        case ARG_LLONG:    return va_arg(*va, unsigned long long);
+        case ARG_INTMAX:   return va_arg(*va, uintmax_t);
+        case ARG_SIZE:     return va_arg(*va, size_t);
+        case ARG_PTRDIFF:  return (size_t)va_arg(*va, ptrdiff_t);
+        default:           return va_arg(*va, unsigned int);
+    }
+}
+
+/*
+ * Print %s or %c, escaping the argument and padding it to the width
+ */
+static void put_text(struct output* out, const struct op* op, va_list* va)
+{
+    int         width = op->width_arg ? va_arg(*va, int) : op->width;
+    int         precision = op->precision_arg ? va_arg(*va, int) : op->precision;
+    int         left = op->left;
+    const char* str;
+    char        c = '\0';
+    size_t      len;
+    size_t      pad = 0;
+
+    if (op->type == OP_CHAR)
+    {
+        c = (char)va_arg(*va, int);
+        str = &c;
+        len = 1;
+    }
+    else
+    {
+        str = va_arg(*va, const char*);
+        if (!str)
+        {
+            // as glibc, which prints nothing if the precision does not fit the whole text
+            str = "(null)";
+            len = precision < 0 || precision >= 6 ? 6 : 0;
+        }
+        else if (precision >= 0)
+            len = strnlen(str, (size_t)precision);
+        else
+            len = strlen(str);
+    }
+    if (width < 0)
+    {
+        left = 1;
+        width = width == INT_MIN ? 0 : -width;
+    }
+    if ((size_t)width > len)
+        pad = width - len;
+
+    if (!left)
+        put_spaces(out, pad);
+    if (op->type == OP_CHAR && c == '\0')
+    {
+        // the escaped message of vsnprintf output ends to the first zero character
+        out->ended = 1;
+        return;
+    }
+    put_escaped(out, str, len);
+    if (left)
+        put_spaces(out, pad);
+}
+
+/*
+ * Compile the conversion specification to the operation
+ *
+ * @return  0 in case of success, -1 if the conversion is not supported
+ */
+static int compile_conversion(const char* spec, const struct conversion* conv, struct op* op, char** specs)
+{
+    char   conversion = spec[conv->len - 1];
+    size_t flags = strspn(&spec[1], "-+ #0'I");
+    size_t i;
+
+    op->text = spec;
+    op->len = 0;
+    op->arg = conv->type;
+    op->width = 0;
+    op->width_arg = conv->width_arg;
+    op->precision = conv->precision;
+    op->precision_arg = conv->precision_arg;
+    op->left = memchr(&spec[1], '-', flags) != NULL;
+
+    if (conversion == 's' || conversion == 'c')
+    {
+        if (strspn(&spec[1], "-") != flags)
+            return -1;                      // flags, which are not defined for strings
+        op->type = conversion == 's' ? OP_STRING : OP_CHAR;
+        if (!conv->width_arg && spec[flags + 1] >= '0' && spec[flags + 1] <= '9')
+            op->width = atoi(&spec[flags + 1]);
+        for (i = flags + 1; i < conv->len - 1; i++)
+        {
+            if (spec[i] == 'h' || spec[i] == 'j' || spec[i] == 'z' || spec[i] == 'Z' || spec[i] == 't')
+                return -1;                  // length modifiers of the integer conversions
+        }
+        return 0;
+    }
+    if ((conversion == 'd' || conversion == 'i' || conversion == 'u') &&
+        strspn(&spec[1], "lqLjzt") == conv->len - 2)
+    {
+        // a plain integer is printed without snprintf
+        op->type = conversion == 'u' ? OP_UNSIGNED : OP_SIGNED;
+        return 0;
+    }
+    op->type = OP_NUMBER;
+    memcpy(*specs, spec, conv->len);
+    (*specs)[conv->len] = '\0';
+    op->text = *specs;
+    *specs += conv->len + 1;
+    return 0;
+}
+
+static void add_literal(struct compiled_format* compiled, const char* text, size_t len)
+{
+    struct op* op;
+
+    if (len == 0)
+        return;
+    op = &compiled->ops[compiled->op_count++];
+    memset(op, 0, sizeof(*op));
+    op->type = OP_LITERAL;
+    op->text = text;
+    op->len = len;
+    op->clean = mdclog_internal_find_special(text, len) == len;
+}
+
+/*
+ * Compile the format string to a list of operations. The entry is allocated
+ * at once: the header, the operations, the copy of the format and the zero
+ * terminated copies of the conversion specifications.
+ */
+static struct compiled_format* compile(const char* format)
+{
+    struct compiled_format* compiled;
+    struct conversion       conv;
+    size_t                  format_len = strlen(format);
+    size_t                  percents = 0;
+    size_t                  max_ops;
+    const char*             p;
+    const char*             next;
+    char*                   specs;
+
+    for (p = strchr(format, '%'); p; p = strchr(p + 1, '%'))
+        percents++;
+    max_ops = 2 * percents + 1;
+    compiled = malloc(sizeof(*compiled) + max_ops * sizeof(struct op) + 2 * format_len + percents + 1);
+    if (!compiled)
+        return NULL;
+    compiled->format = format;
+    compiled->format_len = format_len;
+    compiled->supported = 1;
+    compiled->op_count = 0;
+    compiled->ops = (struct op*)(compiled + 1);
+    compiled->text = (char*)(compiled->ops + max_ops);
+    memcpy(compiled->text, format, format_len + 1);
+    specs = compiled->text + format_len + 1;
+
+    for (p = compiled->text; ; p = next + conv.len)
+    {
+        next = strchr(p, '%');
+        if (!next)
+        {
+            add_literal(compiled, p, strlen(p));
+            break;
+        }
+        add_literal(compiled, p, next - p);
+
+        if (next[1] == 'm')
+        {
+            memset(&conv, 0, sizeof(conv));
+            conv.len = 2;
+            memset(&compiled->ops[compiled->op_count], 0, sizeof(struct op));
+            compiled->ops[compiled->op_count++].type = OP_ERRNO;
+            continue;
+        }
+        if (mdclog_internal_parse_conversion(next, &conv))
+        {
+            compiled->supported = 0;
+            break;
+        }
+        if (conv.type == ARG_NONE)
+            add_literal(compiled, &next[conv.len - 1], 1);
+        else if (compile_conversion(next, &conv, &compiled->ops[compiled->op_count++], &specs))
+        {
+            compiled->supported = 0;
+            break;
+        }
+    }
+    return compiled;
+}
+
+static void free_cache(void* arg)
+{
+    struct format_cache* cache = arg;
+    size_t               i;
+
+    for (i = 0; i < FORMAT_CACHE_SIZE; i++)
+        free(cache->slots[i]);
+    free(cache);
+    thread_cache = NULL;
+}
+
+static void create_cache_key(void)
+{
+    cache_key_created = pthread_key_create(&cache_key, free_cache) == 0;
+}
+
+static struct format_cache* get_cache(void)
+{
+    struct format_cache* cache = thread_cache;
+
+    if (cache)
+        return cache;
+    pthread_once(&cache_once, create_cache_key);
+    if (!cache_key_created)
+        return NULL;
+    cache = calloc(1, sizeof(*cache));
+    if (!cache)
+        return NULL;
+    if (pthread_setspecific(cache_key, cache))
+    {
+        free(cache);
+        return NULL;
+    }
+    thread_cache = cache;
+    return cache;
+}
+
+static struct compiled_format* lookup(const char* format)
+{
+    struct format_cache*    cache = get_cache();
+    struct compiled_format* compiled;
+    size_t                  slot;
+
+    if (!cache)
+        return NULL;
+    slot = (size_t)(((uint64_t)(uintptr_t)format * 0x9e3779b97f4a7c15ULL) >> (64 - FORMAT_CACHE_BITS));
+    compiled = cache->slots[slot];
+    if (compiled && compiled->format == format &&
+        strncmp(compiled->text, format, compiled->format_len + 1) == 0)
+        return compiled;
+
+    compiled = compile(format);
+    if (!compiled)
+        return NULL;
+    free(cache->slots[slot]);
+    cache->slots[slot] = compiled;
+    return compiled;
+}
+
+int mdclog_internal_format_message(char* buffer, size_t len, const char* format, va_list arglist, int* truncated)
+{
+    int                     saved_errno = errno;
+    struct compiled_format* compiled;
+    const struct op*        op;
+    struct output           out;
+    va_list                 va;
+    char                    number[KV_NUMBER_MAX_LENGTH];
+    char                    error[ERRNO_MESSAGE_LENGTH];
+    const char*             str;
+    size_t                  i;
+
+    if (len == 0)
+        return -1;
+    compiled = lookup(format);
+    if (!compiled || !compiled->supported)
+    {
+        errno = saved_errno;
+        return -1;
+    }
+
+    out.buffer = buffer;
+    out.len = len;
+    out.offset = 0;
+    out.full = 0;
+    out.ended = 0;
+    if (compiled->op_count == 1 && compiled->ops[0].type == OP_LITERAL)
+    {
+        // a message without conversions
+        op = &compiled->ops[0];
+        if (op->clean)
+            put_clean(&out, op->text, op->len);
+        else
+            put_escaped(&out, op->text, op->len);
+        buffer[out.offset] = '\0';
+        *truncated = out.full;
+        errno = saved_errno;
+        return (int)out.offset;
+    }
+
+    va_copy(va, arglist);
+    for (i = 0; i < compiled->op_count && !out.full && !out.ended; i++)
+    {
+        op = &compiled->ops[i];
+        switch (op->type)
+        {
+            case OP_LITERAL:
+                if (op->clean)
+                    put_clean(&out, op->text, op->len);
+                else
+                    put_escaped(&out, op->text, op->len);
+                break;
+            case OP_STRING:
+            case OP_CHAR:
+                put_text(&out, op, &va);
+                break;
+            case OP_SIGNED:
+                put_clean(&out, number, mdclog_internal_format_int64(number, get_signed(op, &va)));
+                break;
+            case OP_UNSIGNED:
+                put_clean(&out, number, mdclog_internal_format_uint64(number, get_unsigned(op, &va)));
+                break;
+            case OP_NUMBER:
+                put_number(&out, op, &va);
+                break;
+            case OP_ERRNO:
+                str = strerror_r(saved_errno, error, sizeof(error));
+                put_escaped(&out, str, strlen(str));
+                break;
+        }
+    }
+    va_end(va);
+    buffer[out.offset] = '\0';
+    *truncated = out.full;
+    errno = saved_errno;
+    return (int)out.offset;
+}
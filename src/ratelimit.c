@@ -0,0 +1,279 @@
+/*
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ *
+ * Rate limiting and sampling of log entries.
+ *
+ * Every call site has a token bucket, implemented as the generic cell rate
+ * algorithm: the bucket is a single timestamp, the theoretical arrival time of
+ * the next entry, which is advanced by one emission interval per written entry.
+ * An entry is discarded if the timestamp is more than the burst tolerance ahead
+ * of the current time. A bucket is updated with one compare-and-swap, and a
+ * discarded entry does not write to the bucket at all.
+ *
+ * The call sites of the MDCLOG_WRITE() macros have a bucket in a static
+ * mdclog_site_t object. The call sites of mdclog_write() are identified by the
+ * format string pointer, which is looked up from a fixed size open addressing
+ * table. The entries of the table are never removed.
+ *
+ * Sampling draws a number from a thread local xorshift generator and compares
+ * it to the per-severity threshold.
+ */
+#include "private/ratelimit.h"
+#include "private/system.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define NS_PER_SECOND       1000000000ULL
+#define NS_PER_MS           1000000ULL
+#define SITE_PROBES         8
+#define SAMPLE_SCALE        4294967296.0      // 2^32, the range of the sampled numbers
+#define SEVERITY_COUNT      (MDCLOG_TRACE + 1)
+#define NO_SEVERITY         INT_MAX
+
+struct site
+{
+    _Atomic uint64_t tat;       // theoretical arrival time of the next entry
+};
+
+_Static_assert(sizeof(struct site) <= sizeof(mdclog_site_t), "mdclog_site_t is too small");
+
+struct format_site
+{
+    _Atomic(const char *) format;
+    struct site           site;
+};
+
+static struct
+{
+    _Atomic uint64_t   emission_interval_ns;    // 0 if rate limiting is disabled
+    _Atomic uint64_t   tolerance_ns;            // (burst - 1) * emission interval
+    _Atomic uint64_t   drop_threshold[SEVERITY_COUNT];  // 0 if all entries are written
+    _Atomic unsigned   sampled_severities;      // bit mask of severities with a drop threshold
+    _Atomic uint64_t   summary_interval_ns;
+    _Atomic uint64_t   summary_start_ns;        // time of the first unreported entry, 0 if none
+    _Atomic uint64_t   rate_limited;            // cumulative counters
+    _Atomic uint64_t   sampled_out;
+    _Atomic uint64_t   unreported_rate_limited; // counters since the previous summary
+    _Atomic uint64_t   unreported_sampled_out;
+    _Atomic int        summary_severity;
+    struct format_site sites[RATE_LIMIT_SITES];
+    struct site        overflow_site;           // shared by the sites not fitting to the table
+} limits = {
+    .summary_interval_ns = SUPPRESSION_DEFAULT_SUMMARY_INTERVAL_MS * NS_PER_MS,
+    .summary_severity = NO_SEVERITY,
+};
+
+static __thread uint64_t random_state TLS_INITIAL_EXEC;
+
+int mdclog_internal_set_rate_limit(unsigned per_second, unsigned burst)
+{
+    uint64_t interval;
+
+    if (per_second > NS_PER_SECOND)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (per_second == 0)
+    {
+        atomic_store_explicit(&limits.emission_interval_ns, 0, memory_order_relaxed);
+        return 0;
+    }
+    if (burst == 0)
+        burst = per_second;
+    interval = NS_PER_SECOND / per_second;
+    atomic_store_explicit(&limits.tolerance_ns, (burst - 1) * interval, memory_order_relaxed);
+    atomic_store_explicit(&limits.emission_interval_ns, interval, memory_order_relaxed);
+    return 0;
+}
+
+int mdclog_internal_set_sampling(mdclog_severity_t severity, double probability)
+{
+    uint64_t threshold;
+
+    if ((int)severity < 0 || (int)severity >= SEVERITY_COUNT || !(probability >= 0.0 && probability <= 1.0))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    threshold = (uint64_t)((1.0 - probability) * SAMPLE_SCALE);
+    atomic_store_explicit(&limits.drop_threshold[severity], threshold, memory_order_relaxed);
+    if (threshold)
+        atomic_fetch_or_explicit(&limits.sampled_severities, 1U << severity, memory_order_relaxed);
+    else
+        atomic_fetch_and_explicit(&limits.sampled_severities, ~(1U << severity), memory_order_relaxed);
+    return 0;
+}
+
+void mdclog_internal_set_summary_interval(unsigned interval_ms)
+{
+    atomic_store_explicit(&limits.summary_interval_ns, interval_ms * NS_PER_MS, memory_order_relaxed);
+}
+
+int mdclog_internal_suppression_active(void)
+{
+    return atomic_load_explicit(&limits.emission_interval_ns, memory_order_relaxed) ||
+           atomic_load_explicit(&limits.sampled_severities, memory_order_relaxed) ||
+           atomic_load_explicit(&limits.unreported_rate_limited, memory_order_relaxed) ||
+           atomic_load_explicit(&limits.unreported_sampled_out, memory_order_relaxed);
+}
+
+/*
+ * xorshift64*, seeded from the address of the thread local state and the time
+ */
+static uint32_t next_random(uint64_t now_ns)
+{
+    uint64_t x = random_state;
+
+    if (x == 0)
+    {
+        x = ((uint64_t)(uintptr_t)&random_state ^ now_ns) * 0x9E3779B97F4A7C15ULL;
+        if (x == 0)
+            x = 1;
+    }
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    random_state = x;
+    return (uint32_t)((x * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+static int sample(mdclog_severity_t severity, uint64_t now_ns)
+{
+    uint64_t threshold;
+
+    if ((int)severity < 0 || (int)severity >= SEVERITY_COUNT)
+        return 1;
+    threshold = atomic_load_explicit(&limits.drop_threshold[severity], memory_order_relaxed);
+    return threshold == 0 || next_random(now_ns) >= threshold;
+}
+
+static struct site *find_site(const char *format)
+{
+    size_t      hash = (size_t)(((uint64_t)(uintptr_t)format * 0x9E3779B97F4A7C15ULL) >> 32);
+    const char *expected;
+    int         i;
+
+    for (i = 0; i < SITE_PROBES; i++)
+    {
+        struct format_site *slot = &limits.sites[(hash + i) % RATE_LIMIT_SITES];
+
+        expected = atomic_load_explicit(&slot->format, memory_order_relaxed);
+        if (expected == NULL &&
+            atomic_compare_exchange_strong_explicit(&slot->format, &expected, format,
+                                                    memory_order_relaxed, memory_order_relaxed))
+            return &slot->site;
+        if (expected == format)
+            return &slot->site;
+    }
+    return &limits.overflow_site;
+}
+
+static int take_token(struct site *site, uint64_t now_ns)
+{
+    uint64_t interval = atomic_load_explicit(&limits.emission_interval_ns, memory_order_relaxed);
+    uint64_t tolerance = atomic_load_explicit(&limits.tolerance_ns, memory_order_relaxed);
+    uint64_t tat = atomic_load_explicit(&site->tat, memory_order_relaxed);
+    uint64_t start;
+
+    if (interval == 0)
+        return 1;
+    do
+    {
+        start = tat > now_ns ? tat : now_ns;
+        if (start - now_ns > tolerance)
+            return 0;
+    } while (!atomic_compare_exchange_weak_explicit(&site->tat, &tat, start + interval,
+                                                    memory_order_relaxed, memory_order_relaxed));
+    return 1;
+}
+
+static void count_suppressed(_Atomic uint64_t *total, _Atomic uint64_t *unreported, mdclog_severity_t severity)
+{
+    int current = atomic_load_explicit(&limits.summary_severity, memory_order_relaxed);
+
+    while ((int)severity < current &&
+           !atomic_compare_exchange_weak_explicit(&limits.summary_severity, &current, (int)severity,
+                                                  memory_order_relaxed, memory_order_relaxed))
+        ;
+    atomic_fetch_add_explicit(total, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(unreported, 1, memory_order_relaxed);
+}
+
+int mdclog_internal_admit(mdclog_site_t *site, const char *format, mdclog_severity_t severity, uint64_t now_ns)
+{
+    if (!sample(severity, now_ns))
+    {
+        count_suppressed(&limits.sampled_out, &limits.unreported_sampled_out, severity);
+        return 0;
+    }
+    if (atomic_load_explicit(&limits.emission_interval_ns, memory_order_relaxed) &&
+        !take_token(site ? (struct site *)site : find_site(format), now_ns))
+    {
+        count_suppressed(&limits.rate_limited, &limits.unreported_rate_limited, severity);
+        return 0;
+    }
+    return 1;
+}
+
+int mdclog_internal_take_summary(uint64_t now_ns, int force, struct suppression_summary *summary)
+{
+    uint64_t interval = atomic_load_explicit(&limits.summary_interval_ns, memory_order_relaxed);
+    uint64_t start;
+    int      severity;
+
+    if (!atomic_load_explicit(&limits.unreported_rate_limited, memory_order_relaxed) &&
+        !atomic_load_explicit(&limits.unreported_sampled_out, memory_order_relaxed))
+        return 0;
+    start = atomic_load_explicit(&limits.summary_start_ns, memory_order_relaxed);
+    if (!force)
+    {
+        if (start == 0)
+        {
+            // the first unreported entry starts the summary interval
+            if (!atomic_compare_exchange_strong_explicit(&limits.summary_start_ns, &start, now_ns,
+                                                         memory_order_relaxed, memory_order_relaxed) ||
+                interval > 0)
+                return 0;
+            start = now_ns;
+        }
+        if (now_ns - start < interval ||
+            !atomic_compare_exchange_strong_explicit(&limits.summary_start_ns, &start, 0,
+                                                     memory_order_relaxed, memory_order_relaxed))
+            return 0;
+    }
+    else
+        atomic_store_explicit(&limits.summary_start_ns, 0, memory_order_relaxed);
+
+    summary->rate_limited = atomic_exchange_explicit(&limits.unreported_rate_limited, 0, memory_order_relaxed);
+    summary->sampled_out = atomic_exchange_explicit(&limits.unreported_sampled_out, 0, memory_order_relaxed);
+    severity = atomic_exchange_explicit(&limits.summary_severity, NO_SEVERITY, memory_order_relaxed);
+    // a concurrently discarded entry may be counted before its severity is recorded
+    summary->severity = severity == NO_SEVERITY ? MDCLOG_WARN : (mdclog_severity_t)severity;
+    return summary->rate_limited || summary->sampled_out;
+}
+
+void mdclog_internal_suppression_stats(mdclog_stats_t *stats)
+{
+    stats->rate_limited = atomic_load_explicit(&limits.rate_limited, memory_order_relaxed);
+    stats->sampled_out = atomic_load_explicit(&limits.sampled_out, memory_order_relaxed);
+}
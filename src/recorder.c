@@ -0,0 +1,236 @@
+/*
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ *
+ * Flight recorder of log entries in a memory mapped ring file.
+ *
+ * A writer reserves space for its record by adding the record size to the
+ * head in the file header, copies the entry to the mapped ring and stores the
+ * record stamp last. The pages of the file are written back by the kernel, so
+ * the records survive a crash of the process.
+ *
+ * The sequence number of a record is its position in the unbounded stream of
+ * records, and the stamp of a valid record equals its own position. The reader
+ * therefore accepts only records whose stamp matches their position within the
+ * last capacity bytes before the head. Records that were being written, or
+ * have been partly overwritten by a later lap of the ring, are skipped by
+ * scanning forward to the next valid stamp.
+ */
+#include "private/recorder.h"
+#include "private/epoch.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define RECORD_ALIGN 8
+
+struct recorder
+{
+    struct recorder_header *header;
+    char                   *ring;
+    uint64_t                capacity;
+    size_t                  map_len;
+};
+
+static _Atomic(struct recorder *) current_recorder;
+
+static size_t record_size(size_t len)
+{
+    return (sizeof(struct recorder_record) + len + RECORD_ALIGN - 1) & ~(size_t)(RECORD_ALIGN - 1);
+}
+
+/*
+ * Copy to the ring at the given position, wrapping around the end of the ring
+ */
+static void copy_to_ring(char *ring, uint64_t capacity, uint64_t position, const char *data, size_t len)
+{
+    size_t offset = (size_t)(position & (capacity - 1));
+    size_t first = len < capacity - offset ? len : capacity - offset;
+
+    memcpy(&ring[offset], data, first);
+    memcpy(ring, &data[first], len - first);
+}
+
+static void copy_from_ring(char *buffer, const char *ring, uint64_t capacity, uint64_t position, size_t len)
+{
+    size_t offset = (size_t)(position & (capacity - 1));
+    size_t first = len < capacity - offset ? len : capacity - offset;
+
+    memcpy(buffer, &ring[offset], first);
+    memcpy(&buffer[first], ring, len - first);
+}
+
+static int header_valid(const struct recorder_header *header, uint64_t capacity)
+{
+    return header->magic == RECORDER_MAGIC && header->version == RECORDER_VERSION &&
+           header->header_size == RECORDER_HEADER_SIZE && header->capacity == capacity &&
+           header->head % RECORD_ALIGN == 0;
+}
+
+struct recorder *mdclog_internal_recorder_open(const char *path, size_t capacity)
+{
+    struct recorder *recorder = malloc(sizeof(*recorder));
+    size_t           map_len = RECORDER_HEADER_SIZE + capacity;
+    struct stat      st;
+    void            *map;
+    int              fd;
+
+    if (!recorder)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        free(recorder);
+        return NULL;
+    }
+    // the blocks are allocated up front, so that writing to the mapping cannot fail with SIGBUS
+    if (fstat(fd, &st) < 0 || ((size_t)st.st_size != map_len && ftruncate(fd, (off_t)map_len) < 0) ||
+        (fallocate(fd, 0, 0, (off_t)map_len) < 0 && errno != EOPNOTSUPP))
+    {
+        close(fd);
+        free(recorder);
+        return NULL;
+    }
+    map = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        free(recorder);
+        return NULL;
+    }
+    recorder->header = map;
+    recorder->ring = (char *)map + RECORDER_HEADER_SIZE;
+    recorder->capacity = capacity;
+    recorder->map_len = map_len;
+    if (!header_valid(recorder->header, capacity))
+    {
+        memset(recorder->header, 0, sizeof(*recorder->header));
+        recorder->header->version = RECORDER_VERSION;
+        recorder->header->header_size = RECORDER_HEADER_SIZE;
+        recorder->header->capacity = capacity;
+        __atomic_store_n(&recorder->header->magic, RECORDER_MAGIC, __ATOMIC_RELEASE);
+    }
+    return recorder;
+}
+
+void mdclog_internal_recorder_close(struct recorder *recorder)
+{
+    if (recorder)
+    {
+        munmap(recorder->header, recorder->map_len);
+        free(recorder);
+    }
+}
+
+void mdclog_internal_recorder_set(struct recorder *recorder)
+{
+    struct recorder *old = atomic_exchange_explicit(&current_recorder, recorder, memory_order_acq_rel);
+
+    if (old)
+    {
+        mdclog_internal_epoch_synchronize();
+        mdclog_internal_recorder_close(old);
+    }
+}
+
+void mdclog_internal_recorder_write(const char *entry, size_t len)
+{
+    struct recorder       *recorder;
+    struct recorder_record record;
+    uint64_t               sequence;
+    size_t                 size = record_size(len);
+
+    if (!atomic_load_explicit(&current_recorder, memory_order_relaxed))
+        return;
+    mdclog_internal_epoch_enter();
+    recorder = atomic_load_explicit(&current_recorder, memory_order_acquire);
+    if (recorder && size <= recorder->capacity / 2)
+    {
+        sequence = __atomic_fetch_add(&recorder->header->head, size, __ATOMIC_RELAXED);
+        record.length = (uint32_t)len;
+        record.size = (uint32_t)size;
+        // the aligned header fields never wrap around the end of the ring
+        memcpy(&recorder->ring[(sequence + offsetof(struct recorder_record, length)) & (recorder->capacity - 1)],
+               &record.length, sizeof(record.length) + sizeof(record.size));
+        copy_to_ring(recorder->ring, recorder->capacity, sequence + sizeof(record), entry, len);
+        __atomic_store_n((uint64_t *)&recorder->ring[sequence & (recorder->capacity - 1)],
+                         sequence ^ RECORDER_RECORD_MAGIC, __ATOMIC_RELEASE);
+    }
+    mdclog_internal_epoch_leave();
+}
+
+long mdclog_internal_recorder_read(const void *file, size_t file_len, recorder_read_fn_t read, void *arg)
+{
+    const struct recorder_header *header = file;
+    const char                   *ring;
+    char                         *buffer;
+    struct recorder_record        record;
+    uint64_t                      capacity;
+    uint64_t                      head;
+    uint64_t                      position;
+    long                          count = 0;
+
+    if (file_len < RECORDER_HEADER_SIZE || header->magic != RECORDER_MAGIC ||
+        header->version != RECORDER_VERSION || header->header_size != RECORDER_HEADER_SIZE)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    capacity = header->capacity;
+    head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+    if (capacity < RECORD_ALIGN || (capacity & (capacity - 1)) || file_len - RECORDER_HEADER_SIZE < capacity ||
+        head % RECORD_ALIGN)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    ring = (const char *)file + RECORDER_HEADER_SIZE;
+    buffer = malloc(capacity / 2);
+    if (!buffer)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    position = head > capacity ? head - capacity : 0;
+    while (position + sizeof(record) <= head)
+    {
+        copy_from_ring((char *)&record, ring, capacity, position, sizeof(record));
+        if ((record.stamp ^ RECORDER_RECORD_MAGIC) != position || record.size != record_size(record.length) ||
+            record.size > capacity / 2 || position + record.size > head)
+        {
+            position += RECORD_ALIGN;
+            continue;
+        }
+        copy_from_ring(buffer, ring, capacity, position + sizeof(record), record.length);
+        read(buffer, record.length, position, arg);
+        count++;
+        position += record.size;
+    }
+    free(buffer);
+    return count;
+}
@@ -0,0 +1,340 @@
+/*
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ *
+ * Suppression of repeated log entries.
+ *
+ * Every thread keeps a copy of its previous formatted log entry. A new entry
+ * is compared to it without the timestamp field. The copy is needed for writing the repetition count anyway, so
+ * the entries are compared byte by byte instead of by a hash. A repetition
+ * replaces the copy, so that the count is written with the timestamp of the
+ * latest repetition.
+ *
+ * The states of the threads are kept in a registry, so that a timer thread
+ * can write the counts of the threads that stop logging the repeated entry,
+ * and the counts of all threads can be written when the library is cleaned.
+ * The state of a thread is locked by the thread itself, and by the timer
+ * thread while it writes the count.
+ */
+#include "private/repeat.h"
+#include "private/system.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define REPEATED_FIELD "\"repeated\""
+
+struct repeat_state
+{
+    char                 entry[PIPE_BUF];  // previous entry, without the newline
+    size_t               len;              // 0 if there is no previous entry
+    size_t               skip_start;       // the timestamp field, not compared
+    size_t               skip_end;
+    uint64_t             repeats;          // repetitions not yet written
+    uint64_t             deadline_ns;      // when the repetitions are written at the latest
+    repeat_write_fn_t    write;
+    pthread_mutex_t      mutex;
+    struct repeat_state *next;
+};
+
+static struct
+{
+    pthread_mutex_t      mutex;            // protects the list and the timer
+    pthread_cond_t       wakeup;
+    struct repeat_state *states;
+    pthread_t            thread;
+    atomic_int           running;
+    int                  stopping;
+} registry = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static __thread struct repeat_state *thread_state TLS_INITIAL_EXEC;
+static pthread_key_t                 statekey;
+static pthread_once_t                statekey_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Write the previous entry with the repetition count. The closing brace of the
+ * entry is replaced with the count field. If the field does not fit to PIPE_BUF
+ * bytes, the entry is written without it. The state must be locked.
+ */
+static void write_repeats(struct repeat_state *state)
+{
+    char buffer[PIPE_BUF];
+    int  len = -1;
+
+    if (state->repeats == 0)
+        return;
+    if (state->entry[state->len - 1] == '}')
+        len = snprintf(buffer, sizeof(buffer), "%.*s," REPEATED_FIELD ":%llu}\n",
+                       (int)state->len - 1, state->entry, (unsigned long long)state->repeats);
+    if (len < 0 || (size_t)len >= sizeof(buffer))
+    {
+        memcpy(buffer, state->entry, state->len);
+        buffer[state->len] = '\n';
+        len = (int)state->len + 1;
+    }
+    state->repeats = 0;
+    state->write(buffer, (size_t)len);
+}
+
+static void flush_state(struct repeat_state *state)
+{
+    pthread_mutex_lock(&state->mutex);
+    write_repeats(state);
+    state->len = 0;
+    pthread_mutex_unlock(&state->mutex);
+}
+
+/*
+ * Thread exit handler
+ */
+static void release_state(void *ptr)
+{
+    struct repeat_state  *state = (struct repeat_state*)ptr;
+    struct repeat_state **prev;
+
+    pthread_mutex_lock(&registry.mutex);
+    for (prev = &registry.states; *prev != state; prev = &(*prev)->next)
+        ;
+    *prev = state->next;
+    pthread_mutex_unlock(&registry.mutex);
+    write_repeats(state);
+    pthread_mutex_destroy(&state->mutex);
+    free(state);
+    thread_state = NULL;
+}
+
+static void create_state_key(void)
+{
+    pthread_condattr_t attr;
+    int                ec = pthread_key_create(&statekey, release_state);
+
+    if (ec)
+    {
+        fprintf(stderr, "Cannot create pthread key: %s", strerror(ec));
+        abort();
+    }
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&registry.wakeup, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+static struct repeat_state *create_state(void)
+{
+    struct repeat_state *state;
+
+    pthread_once(&statekey_once, create_state_key);
+    state = malloc(sizeof(*state));
+    if (!state)
+        return NULL;
+    state->len = 0;
+    state->repeats = 0;
+    pthread_mutex_init(&state->mutex, NULL);
+    if (pthread_setspecific(statekey, state))
+    {
+        pthread_mutex_destroy(&state->mutex);
+        free(state);
+        return NULL;
+    }
+    pthread_mutex_lock(&registry.mutex);
+    state->next = registry.states;
+    registry.states = state;
+    pthread_mutex_unlock(&registry.mutex);
+    thread_state = state;
+    return state;
+}
+
+/*
+ * Wake up the timer thread to wait for the deadline of a new count
+ */
+static void wake_timer(void)
+{
+    pthread_mutex_lock(&registry.mutex);
+    pthread_cond_signal(&registry.wakeup);
+    pthread_mutex_unlock(&registry.mutex);
+}
+
+int mdclog_internal_repeat_filter(const char *entry, size_t len, size_t skip_start, size_t skip_end,
+                                  uint64_t timeout_ns, uint64_t now_ns, repeat_write_fn_t write)
+{
+    struct repeat_state *state = thread_state ? thread_state : create_state();
+    int                  repeated;
+    int                  counting = 0;
+
+    if (!state)
+        return 0;
+    pthread_mutex_lock(&state->mutex);
+    state->write = write;
+    if (len == 0 || len >= sizeof(state->entry))
+    {
+        write_repeats(state);
+        state->len = 0;
+        pthread_mutex_unlock(&state->mutex);
+        return 0;
+    }
+    if (skip_end < skip_start || skip_end > len)
+        skip_start = skip_end = 0;
+    repeated = state->len > 0 && skip_start == state->skip_start &&
+               len - skip_end == state->len - state->skip_end &&
+               memcmp(entry, state->entry, skip_start) == 0 &&
+               memcmp(&entry[skip_end], &state->entry[state->skip_end], len - skip_end) == 0;
+    if (!repeated)
+        write_repeats(state);
+    memcpy(state->entry, entry, len);
+    state->len = len;
+    state->skip_start = skip_start;
+    state->skip_end = skip_end;
+    if (repeated)
+    {
+        if (state->repeats++ == 0)
+        {
+            state->deadline_ns = now_ns + timeout_ns;
+            counting = 1;
+        }
+        if (now_ns >= state->deadline_ns)
+        {
+            write_repeats(state);
+            counting = 0;
+        }
+    }
+    pthread_mutex_unlock(&state->mutex);
+    if (counting && atomic_load_explicit(&registry.running, memory_order_relaxed))
+        wake_timer();
+    return repeated;
+}
+
+void mdclog_internal_repeat_flush(void)
+{
+    struct repeat_state *state = thread_state;
+
+    if (state)
+        flush_state(state);
+}
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+/*
+ * Write the counts whose deadline has passed. The registry must be locked.
+ *
+ * @return  the earliest deadline of the counts left, UINT64_MAX if there are none
+ */
+static uint64_t write_expired(uint64_t now_ns)
+{
+    struct repeat_state *state;
+    uint64_t             next = UINT64_MAX;
+
+    for (state = registry.states; state; state = state->next)
+    {
+        pthread_mutex_lock(&state->mutex);
+        if (state->repeats > 0)
+        {
+            if (now_ns >= state->deadline_ns)
+                write_repeats(state);
+            else if (state->deadline_ns < next)
+                next = state->deadline_ns;
+        }
+        pthread_mutex_unlock(&state->mutex);
+    }
+    return next;
+}
+
+static void *timer_thread(void *arg)
+{
+    struct timespec ts;
+    uint64_t        next;
+
+    (void)arg;
+    pthread_mutex_lock(&registry.mutex);
+    while (!registry.stopping)
+    {
+        next = write_expired(monotonic_ns());
+        if (next == UINT64_MAX)
+            pthread_cond_wait(&registry.wakeup, &registry.mutex);
+        else
+        {
+            ts.tv_sec = (time_t)(next / 1000000000ULL);
+            ts.tv_nsec = (long)(next % 1000000000ULL);
+            pthread_cond_timedwait(&registry.wakeup, &registry.mutex, &ts);
+        }
+    }
+    pthread_mutex_unlock(&registry.mutex);
+    return NULL;
+}
+
+int mdclog_internal_repeat_timer_start(void)
+{
+    int ec = 0;
+
+    pthread_once(&statekey_once, create_state_key);
+    pthread_mutex_lock(&registry.mutex);
+    if (!atomic_load_explicit(&registry.running, memory_order_relaxed) && !registry.stopping)
+    {
+        ec = pthread_create(&registry.thread, NULL, timer_thread, NULL);
+        if (!ec)
+            atomic_store_explicit(&registry.running, 1, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&registry.mutex);
+    if (ec)
+    {
+        errno = ec;
+        return -1;
+    }
+    return 0;
+}
+
+void mdclog_internal_repeat_flush_all(void)
+{
+    struct repeat_state *state;
+    int                  stop;
+
+    pthread_once(&statekey_once, create_state_key);
+    pthread_mutex_lock(&registry.mutex);
+    stop = atomic_load_explicit(&registry.running, memory_order_relaxed) && !registry.stopping;
+    if (stop)
+    {
+        registry.stopping = 1;
+        pthread_cond_signal(&registry.wakeup);
+    }
+    pthread_mutex_unlock(&registry.mutex);
+    if (stop)
+    {
+        pthread_join(registry.thread, NULL);
+        pthread_mutex_lock(&registry.mutex);
+        atomic_store_explicit(&registry.running, 0, memory_order_relaxed);
+        registry.stopping = 0;
+        pthread_mutex_unlock(&registry.mutex);
+    }
+    pthread_mutex_lock(&registry.mutex);
+    for (state = registry.states; state; state = state->next)
+        flush_state(state);
+    pthread_mutex_unlock(&registry.mutex);
+}
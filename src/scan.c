@@ -0,0 +1,120 @@
+/*
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ *
+ * Scanning strings for characters that must be escaped in json strings.
+ * On x86-64 the string is scanned 16 (SSE2) or 32 (AVX2) bytes at a time.
+ * The loads never read past the given length, the remaining tail is
+ * scanned byte by byte.
+ *
+ */
+#include "private/scan.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+size_t mdclog_internal_find_special_scalar(const char* str, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        if (SCAN_IS_SPECIAL(str[i]))
+            break;
+    return i;
+}
+
+#if defined(__x86_64__)
+
+size_t mdclog_internal_find_special_sse2(const char* str, size_t len)
+{
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i space = _mm_set1_epi8(0x20);
+    const __m128i del = _mm_set1_epi8(0x7f);
+    __m128i       chars, special;
+    int           mask;
+    size_t        i;
+
+    for (i = 0; i + sizeof(chars) <= len; i += sizeof(chars))
+    {
+        chars = _mm_loadu_si128((const __m128i*)&str[i]);
+        // signed comparison: the bytes 0x80-0xff are negative and thus less than space
+        special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chars, quote), _mm_cmpeq_epi8(chars, backslash)),
+                               _mm_or_si128(_mm_cmplt_epi8(chars, space), _mm_cmpeq_epi8(chars, del)));
+        mask = _mm_movemask_epi8(special);
+        if (mask)
+            return i + (size_t)__builtin_ctz((unsigned)mask);
+    }
+    return i + mdclog_internal_find_special_scalar(&str[i], len - i);
+}
+
+__attribute__((target("avx2")))
+size_t mdclog_internal_find_special_avx2(const char* str, size_t len)
+{
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i space = _mm256_set1_epi8(0x20);
+    const __m256i del = _mm256_set1_epi8(0x7f);
+    __m256i       chars, special;
+    unsigned      mask;
+    size_t        i;
+
+    for (i = 0; i + sizeof(chars) <= len; i += sizeof(chars))
+    {
+        chars = _mm256_loadu_si256((const __m256i*)&str[i]);
+        special = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chars, quote),
+                                                  _mm256_cmpeq_epi8(chars, backslash)),
+                                  _mm256_or_si256(_mm256_cmpgt_epi8(space, chars),
+                                                  _mm256_cmpeq_epi8(chars, del)));
+        mask = (unsigned)_mm256_movemask_epi8(special);
+        if (mask)
+            return i + (size_t)__builtin_ctz(mask);
+    }
+    return i + mdclog_internal_find_special_sse2(&str[i], len - i);
+}
+
+#endif
+
+#if defined(__x86_64__) && defined(HAVE_FUNC_ATTRIBUTE_IFUNC)
+
+typedef size_t (*find_special_fn_t)(const char* str, size_t len);
+
+static find_special_fn_t resolve_find_special(void)
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return mdclog_internal_find_special_avx2;
+    return mdclog_internal_find_special_sse2;
+}
+
+size_t mdclog_internal_find_special(const char* str, size_t len) __attribute__((ifunc("resolve_find_special")));
+
+#else
+
+size_t mdclog_internal_find_special(const char* str, size_t len)
+{
+#if defined(__x86_64__)
+    // SSE2 is part of the x86-64 baseline
+    return mdclog_internal_find_special_sse2(str, len);
+#else
+    return mdclog_internal_find_special_scalar(str, len);
+#endif
+}
+
+#endif
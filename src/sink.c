@@ -0,0 +1,238 @@
+/*
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ *
+ * User sinks. The sinks are an immutable array published with an atomic
+ * pointer, like the configuration. Adding or removing a sink copies the
+ * array under the mutex, and the replaced array is freed when no writer
+ * can be calling its sinks any more. The lowest severities wanted by the
+ * json and the record sinks are kept in atomic variables, so the writers
+ * can check them without entering a critical section.
+ */
+#include "private/sink.h"
+#include "private/epoch.h"
+#include "private/system.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+struct sink_entry
+{
+    int           id;
+    mdclog_sink_t sink;
+};
+
+struct sink_set
+{
+    size_t            count;
+    struct sink_entry entries[];
+};
+
+static _Atomic(struct sink_set *) current_sinks;
+static pthread_mutex_t            sinks_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int                        last_id;          // protected by sinks_mutex
+static int                        json_level = -1;
+static int                        record_level = -1;
+
+static __thread int running TLS_INITIAL_EXEC;
+
+static int sink_valid(const mdclog_sink_t *sink)
+{
+    if (!sink || (int)sink->level < MDCLOG_FATAL || (int)sink->level > MDCLOG_TRACE)
+        return 0;
+    switch (sink->format)
+    {
+        case MDCLOG_SINK_JSON:
+            return sink->write != NULL;
+        case MDCLOG_SINK_RECORD:
+            return sink->write_record != NULL;
+    }
+    return 0;
+}
+
+/*
+ * Replace the sinks and free the previous ones. Called with the mutex locked,
+ * which is unlocked before waiting for the writers.
+ */
+static void publish_sinks(struct sink_set *set)
+{
+    struct sink_set *old;
+    int              json = -1;
+    int              record = -1;
+    size_t           i;
+
+    for (i = 0; set && i < set->count; i++)
+    {
+        int *level = set->entries[i].sink.format == MDCLOG_SINK_JSON ? &json : &record;
+
+        if ((int)set->entries[i].sink.level > *level)
+            *level = (int)set->entries[i].sink.level;
+    }
+    old = atomic_exchange_explicit(&current_sinks, set, memory_order_acq_rel);
+    __atomic_store_n(&json_level, json, __ATOMIC_RELAXED);
+    __atomic_store_n(&record_level, record, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&sinks_mutex);
+    if (old)
+    {
+        mdclog_internal_epoch_synchronize();
+        free(old);
+    }
+}
+
+int mdclog_internal_sink_add(const mdclog_sink_t *sink)
+{
+    struct sink_set *old;
+    struct sink_set *set;
+    size_t           count;
+    int              id;
+
+    if (!sink_valid(sink))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    pthread_mutex_lock(&sinks_mutex);
+    old = atomic_load_explicit(&current_sinks, memory_order_relaxed);
+    count = old ? old->count : 0;
+    set = malloc(sizeof(*set) + (count + 1) * sizeof(set->entries[0]));
+    if (!set)
+    {
+        pthread_mutex_unlock(&sinks_mutex);
+        errno = ENOMEM;
+        return -1;
+    }
+    set->count = count + 1;
+    for (size_t i = 0; i < count; i++)
+        set->entries[i] = old->entries[i];
+    // the identifiers are positive, and not reused before they wrap around
+    id = last_id = last_id == INT_MAX ? 1 : last_id + 1;
+    set->entries[count].id = id;
+    set->entries[count].sink = *sink;
+    publish_sinks(set);
+    return id;
+}
+
+int mdclog_internal_sink_remove(int id)
+{
+    struct sink_set *old;
+    struct sink_set *set = NULL;
+    size_t           found;
+    size_t           i;
+
+    pthread_mutex_lock(&sinks_mutex);
+    old = atomic_load_explicit(&current_sinks, memory_order_relaxed);
+    for (found = 0; old && found < old->count && old->entries[found].id != id; found++)
+        ;
+    if (!old || found == old->count)
+    {
+        pthread_mutex_unlock(&sinks_mutex);
+        errno = ENOENT;
+        return -1;
+    }
+    if (old->count > 1)
+    {
+        set = malloc(sizeof(*set) + (old->count - 1) * sizeof(set->entries[0]));
+        if (!set)
+        {
+            pthread_mutex_unlock(&sinks_mutex);
+            errno = ENOMEM;
+            return -1;
+        }
+        set->count = 0;
+        for (i = 0; i < old->count; i++)
+            if (i != found)
+                set->entries[set->count++] = old->entries[i];
+    }
+    publish_sinks(set);
+    return 0;
+}
+
+void mdclog_internal_sinks_clear(void)
+{
+    pthread_mutex_lock(&sinks_mutex);
+    publish_sinks(NULL);
+}
+
+int mdclog_internal_sink_level(void)
+{
+    int json = __atomic_load_n(&json_level, __ATOMIC_RELAXED);
+    int record = __atomic_load_n(&record_level, __ATOMIC_RELAXED);
+
+    return json > record ? json : record;
+}
+
+int mdclog_internal_sinks_wanted(mdclog_severity_t severity)
+{
+    int wanted = 0;
+
+    if (running)
+        return 0;
+    if ((int)severity <= __atomic_load_n(&json_level, __ATOMIC_RELAXED))
+        wanted |= SINK_WANTS_JSON;
+    if ((int)severity <= __atomic_load_n(&record_level, __ATOMIC_RELAXED))
+        wanted |= SINK_WANTS_RECORD;
+    return wanted;
+}
+
+int mdclog_internal_sink_running(void)
+{
+    return running;
+}
+
+/*
+ * Call the sinks of the format wanting the severity. The errno of the writer
+ * is kept for the formatting of %m by the following outputs.
+ */
+static void call_sinks(mdclog_sink_format_t format, mdclog_severity_t severity,
+                       const char *entry, size_t len, const mdclog_record_t *record)
+{
+    const struct sink_set   *set;
+    const mdclog_sink_t     *sink;
+    int                      saved_errno = errno;
+    size_t                   i;
+
+    mdclog_internal_epoch_enter();
+    set = atomic_load_explicit(&current_sinks, memory_order_acquire);
+    running = 1;
+    for (i = 0; set && i < set->count; i++)
+    {
+        sink = &set->entries[i].sink;
+        if (sink->format != format || (int)severity > (int)sink->level)
+            continue;
+        if (format == MDCLOG_SINK_JSON)
+            sink->write(sink->arg, entry, len);
+        else
+            sink->write_record(sink->arg, record);
+    }
+    running = 0;
+    mdclog_internal_epoch_leave();
+    errno = saved_errno;
+}
+
+void mdclog_internal_sinks_write_json(mdclog_severity_t severity, const char *entry, size_t len)
+{
+    call_sinks(MDCLOG_SINK_JSON, severity, entry, len, NULL);
+}
+
+void mdclog_internal_sinks_write_record(const mdclog_record_t *record)
+{
+    call_sinks(MDCLOG_SINK_RECORD, record->severity, NULL, 0, record);
+}
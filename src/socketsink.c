@@ -0,0 +1,561 @@
+/*
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ *
+ * Output of the log entries to a unix domain socket.
+ *
+ * Writers frame the entries to a queue buffer under the mutex, and the sender
+ * thread swaps the queue with its own buffer and sends it without holding the
+ * mutex. A batch is sent when it reaches the batch size or has waited for the
+ * flush interval. While the socket is not connected, the writers return
+ * ENOTCONN and write to the fallback output themselves, and the sender thread
+ * reconnects with an exponential backoff. The current sink is published with
+ * an atomic pointer and closed when no writer can see it, like the file sink.
+ */
+#include "private/socketsink.h"
+#include "private/epoch.h"
+#include "private/filesink.h"
+#include "private/system.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+struct socket_sink
+{
+    struct sockaddr_un        address;
+    struct socket_sink_config config;
+    pthread_t                 thread;
+    pthread_mutex_t           mutex;
+    pthread_cond_t            wakeup;       // signals the sender thread
+    pthread_cond_t            space;        // signals the writers waiting for room in the queue
+    int                       fd;           // -1 if not connected
+    _Atomic int               connected;
+    int                       stopping;
+    char                     *queue;        // frames waiting to be sent
+    size_t                    queue_used;
+    size_t                    queue_size;
+    char                     *batch;        // frames being sent, owned by the sender thread
+    size_t                    batch_size;
+    struct timespec           deadline;     // when the oldest queued frame is sent at the latest
+    struct timespec           retry;        // next connection attempt
+    unsigned                  backoff_ms;
+};
+
+static _Atomic(struct socket_sink *) current_socket;
+static pthread_mutex_t               socket_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void add_ms(struct timespec *ts, unsigned ms)
+{
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L)
+    {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+static int expired(const struct timespec *ts)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec > ts->tv_sec || (now.tv_sec == ts->tv_sec && now.tv_nsec >= ts->tv_nsec);
+}
+
+static void put_frame_header(char *buffer, size_t len)
+{
+    buffer[0] = (char)(len >> 24);
+    buffer[1] = (char)(len >> 16);
+    buffer[2] = (char)(len >> 8);
+    buffer[3] = (char)len;
+}
+
+static size_t get_frame_length(const char *buffer)
+{
+    return (size_t)(unsigned char)buffer[0] << 24 | (size_t)(unsigned char)buffer[1] << 16 |
+           (size_t)(unsigned char)buffer[2] << 8 | (size_t)(unsigned char)buffer[3];
+}
+
+/*
+ * Length of the data framed: a frame for every line without the newline, or
+ * one frame for all data
+ */
+static size_t framed_length(const struct socket_sink *sink, const char *data, size_t len)
+{
+    const char *end = data + len;
+    const char *p;
+    size_t      frames = 0;
+    size_t      newlines = 0;
+
+    if (!sink->config.lines)
+        return SOCKET_FRAME_HEADER_LENGTH + len;
+    for (p = data; p < end; frames++)
+    {
+        p = memchr(p, '\n', (size_t)(end - p));
+        if (!p)
+            break;
+        newlines++;
+        p++;
+    }
+    return frames * SOCKET_FRAME_HEADER_LENGTH + len - newlines;
+}
+
+static void put_frames(struct socket_sink *sink, const char *data, size_t len)
+{
+    const char *end = data + len;
+    const char *line;
+    char       *out = &sink->queue[sink->queue_used];
+    size_t      line_len;
+
+    if (!sink->config.lines)
+    {
+        put_frame_header(out, len);
+        memcpy(&out[SOCKET_FRAME_HEADER_LENGTH], data, len);
+        sink->queue_used += SOCKET_FRAME_HEADER_LENGTH + len;
+        return;
+    }
+    while (data < end)
+    {
+        line = memchr(data, '\n', (size_t)(end - data));
+        line_len = line ? (size_t)(line - data) : (size_t)(end - data);
+        put_frame_header(out, line_len);
+        memcpy(&out[SOCKET_FRAME_HEADER_LENGTH], data, line_len);
+        out += SOCKET_FRAME_HEADER_LENGTH + line_len;
+        data += line_len + (line ? 1 : 0);
+    }
+    sink->queue_used = (size_t)(out - sink->queue);
+}
+
+/*
+ * Write frames to the fallback output as they were written to the sink. The frames
+ * are consumed: in the line mode the newline is put back after each entry, so that
+ * the entry is written with one system call.
+ */
+static void write_fallback(const struct socket_sink *sink, char *frames, size_t len)
+{
+    size_t  offset = 0;
+    size_t  frame_len;
+    char   *entry;
+    ssize_t ret;
+
+    while (offset + SOCKET_FRAME_HEADER_LENGTH <= len)
+    {
+        frame_len = get_frame_length(&frames[offset]);
+        entry = &frames[offset + SOCKET_FRAME_HEADER_LENGTH];
+        if (sink->config.lines)
+        {
+            memmove(entry - 1, entry, frame_len);
+            entry[frame_len - 1] = '\n';
+            entry--;
+        }
+        ret = TEMP_FAILURE_RETRY(mdclog_internal_output_write_local(entry, frame_len + (size_t)sink->config.lines));
+        (void)ret;
+        offset += SOCKET_FRAME_HEADER_LENGTH + frame_len;
+    }
+}
+
+static int connect_socket(const struct socket_sink *sink)
+{
+    int type = sink->config.type == MDCLOG_SOCKET_SEQPACKET ? SOCK_SEQPACKET : SOCK_STREAM;
+    int fd = socket(AF_UNIX, type | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (const struct sockaddr *)&sink->address, sizeof(sink->address)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Send the data, waiting for room in the socket buffer
+ *
+ * @return  number of bytes sent, less than len in case of error. Errno is set
+ */
+static size_t send_all(int fd, const char *data, size_t len)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+    size_t        offset = 0;
+    ssize_t       ret;
+
+    while (offset < len)
+    {
+        ret = send(fd, &data[offset], len - offset, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            // a collector that does not read is treated like a broken connection
+            do
+                ret = poll(&pfd, 1, SOCKET_SINK_SEND_TIMEOUT_MS);
+            while (ret < 0 && errno == EINTR);
+            if (ret <= 0)
+                return offset;
+            continue;
+        }
+        if (ret < 0)
+            return offset;
+        offset += (size_t)ret;
+    }
+    return offset;
+}
+
+/*
+ * Length of the whole frames in the beginning of the data
+ */
+static size_t whole_frames_length(const char *frames, size_t len)
+{
+    size_t offset = 0;
+    size_t frame_end;
+
+    while (offset + SOCKET_FRAME_HEADER_LENGTH <= len)
+    {
+        frame_end = offset + SOCKET_FRAME_HEADER_LENGTH + get_frame_length(&frames[offset]);
+        if (frame_end > len)
+            break;
+        offset = frame_end;
+    }
+    return offset;
+}
+
+/*
+ * Send the frames. A seqpacket message is a batch of whole frames, or one longer frame.
+ * If a stream socket fails after a partial send, the last frame the collector got
+ * may be torn; the caller disconnects, and the framing starts again from the next
+ * connection.
+ *
+ * @return  number of bytes of the frames sent completely
+ */
+static size_t send_frames(const struct socket_sink *sink, int fd, char *frames, size_t len)
+{
+    size_t start = 0;
+    size_t end;
+    size_t frame_end;
+    size_t sent;
+
+    if (sink->config.type == MDCLOG_SOCKET_STREAM)
+    {
+        sent = send_all(fd, frames, len);
+        return sent == len ? len : whole_frames_length(frames, sent);
+    }
+    while (start < len)
+    {
+        end = start;
+        do
+        {
+            frame_end = end + SOCKET_FRAME_HEADER_LENGTH + get_frame_length(&frames[end]);
+            if (end > start && frame_end - start > sink->config.batch_size)
+                break;
+            end = frame_end;
+        } while (end < len);
+        if (send_all(fd, &frames[start], end - start) < end - start)
+        {
+            // a message too long for the socket buffer is written to the fallback output alone
+            if (errno != EMSGSIZE)
+                return start;
+            write_fallback(sink, &frames[start], end - start);
+        }
+        start = end;
+    }
+    return len;
+}
+
+static void disconnect(struct socket_sink *sink)
+{
+    close(sink->fd);
+    sink->fd = -1;
+    atomic_store_explicit(&sink->connected, 0, memory_order_relaxed);
+    mdclog_internal_output_changed();
+    sink->backoff_ms = SOCKET_SINK_MIN_BACKOFF_MS;
+    add_ms(&sink->retry, sink->backoff_ms);
+    // the writers waiting for room write to the fallback output instead
+    pthread_cond_broadcast(&sink->space);
+}
+
+/*
+ * Try to connect, and schedule the next attempt if it fails. Called with the mutex locked.
+ */
+static void reconnect(struct socket_sink *sink)
+{
+    int fd;
+
+    pthread_mutex_unlock(&sink->mutex);
+    fd = connect_socket(sink);
+    pthread_mutex_lock(&sink->mutex);
+    if (fd >= 0)
+    {
+        sink->fd = fd;
+        atomic_store_explicit(&sink->connected, 1, memory_order_relaxed);
+        mdclog_internal_output_changed();
+        sink->backoff_ms = SOCKET_SINK_MIN_BACKOFF_MS;
+        return;
+    }
+    add_ms(&sink->retry, sink->backoff_ms);
+    sink->backoff_ms = sink->backoff_ms * 2 < SOCKET_SINK_MAX_BACKOFF_MS ?
+                       sink->backoff_ms * 2 : SOCKET_SINK_MAX_BACKOFF_MS;
+}
+
+static void *sender_thread(void *arg)
+{
+    struct socket_sink *sink = arg;
+    char               *frames;
+    size_t              size;
+    size_t              len;
+    size_t              sent;
+    size_t              queued;
+
+    pthread_mutex_lock(&sink->mutex);
+    for (;;)
+    {
+        if (sink->fd < 0)
+        {
+            if (sink->stopping)
+                break;
+            if (expired(&sink->retry))
+                reconnect(sink);
+            else
+                pthread_cond_timedwait(&sink->wakeup, &sink->mutex, &sink->retry);
+            continue;
+        }
+        if (sink->queue_used == 0)
+        {
+            if (sink->stopping)
+                break;
+            pthread_cond_wait(&sink->wakeup, &sink->mutex);
+            continue;
+        }
+        if (!sink->stopping && sink->queue_used < sink->config.batch_size && !expired(&sink->deadline))
+        {
+            pthread_cond_timedwait(&sink->wakeup, &sink->mutex, &sink->deadline);
+            continue;
+        }
+        frames = sink->queue;
+        size = sink->queue_size;
+        len = sink->queue_used;
+        sink->queue = sink->batch;
+        sink->queue_size = sink->batch_size;
+        sink->queue_used = 0;
+        sink->batch = frames;
+        sink->batch_size = size;
+        pthread_cond_broadcast(&sink->space);
+        pthread_mutex_unlock(&sink->mutex);
+
+        sent = send_frames(sink, sink->fd, frames, len);
+
+        pthread_mutex_lock(&sink->mutex);
+        if (sent < len)
+        {
+            disconnect(sink);
+            // The entries queued meanwhile are older than the entries written to the fallback
+            // from now on. The writers do not queue while disconnected, and only this thread
+            // reconnects, so the queue is written after the batch without the mutex.
+            queued = sink->queue_used;
+            pthread_mutex_unlock(&sink->mutex);
+            write_fallback(sink, &frames[sent], len - sent);
+            write_fallback(sink, sink->queue, queued);
+            pthread_mutex_lock(&sink->mutex);
+            sink->queue_used = 0;
+        }
+    }
+    if (sink->fd >= 0)
+    {
+        close(sink->fd);
+        sink->fd = -1;
+    }
+    pthread_mutex_unlock(&sink->mutex);
+    return NULL;
+}
+
+struct socket_sink *mdclog_internal_socket_sink_open(const char *path, const struct socket_sink_config *config)
+{
+    struct socket_sink *sink;
+    pthread_condattr_t  attr;
+    int                 ret;
+
+    if (strlen(path) >= sizeof(sink->address.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    sink = calloc(1, sizeof(*sink));
+    if (!sink)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    sink->address.sun_family = AF_UNIX;
+    strcpy(sink->address.sun_path, path);
+    sink->config = *config;
+    sink->queue_size = sink->batch_size = 2 * (config->batch_size ? config->batch_size : PIPE_BUF);
+    sink->queue = malloc(sink->queue_size);
+    sink->batch = malloc(sink->batch_size);
+    if (!sink->queue || !sink->batch)
+    {
+        free(sink->queue);
+        free(sink->batch);
+        free(sink);
+        errno = ENOMEM;
+        return NULL;
+    }
+    pthread_mutex_init(&sink->mutex, NULL);
+    // the deadlines are monotonic
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&sink->wakeup, &attr);
+    pthread_cond_init(&sink->space, &attr);
+    pthread_condattr_destroy(&attr);
+    sink->backoff_ms = SOCKET_SINK_MIN_BACKOFF_MS;
+    // the first entries are not written to the fallback output if the collector is listening
+    sink->fd = connect_socket(sink);
+    atomic_init(&sink->connected, sink->fd >= 0);
+    if (sink->fd < 0)
+        add_ms(&sink->retry, sink->backoff_ms);
+    ret = pthread_create(&sink->thread, NULL, sender_thread, sink);
+    if (ret != 0)
+    {
+        if (sink->fd >= 0)
+            close(sink->fd);
+        pthread_cond_destroy(&sink->wakeup);
+        pthread_cond_destroy(&sink->space);
+        pthread_mutex_destroy(&sink->mutex);
+        free(sink->queue);
+        free(sink->batch);
+        free(sink);
+        errno = ret;
+        return NULL;
+    }
+    return sink;
+}
+
+void mdclog_internal_socket_sink_close(struct socket_sink *sink)
+{
+    if (!sink)
+        return;
+    pthread_mutex_lock(&sink->mutex);
+    sink->stopping = 1;
+    pthread_cond_signal(&sink->wakeup);
+    pthread_mutex_unlock(&sink->mutex);
+    pthread_join(sink->thread, NULL);
+    // not sent because the connection was lost while stopping
+    if (sink->queue_used > 0)
+        write_fallback(sink, sink->queue, sink->queue_used);
+    pthread_cond_destroy(&sink->wakeup);
+    pthread_cond_destroy(&sink->space);
+    pthread_mutex_destroy(&sink->mutex);
+    free(sink->queue);
+    free(sink->batch);
+    free(sink);
+}
+
+void mdclog_internal_socket_sink_set(struct socket_sink *sink)
+{
+    struct socket_sink *old;
+
+    pthread_mutex_lock(&socket_mutex);
+    old = atomic_exchange_explicit(&current_socket, sink, memory_order_acq_rel);
+    if (old || sink)
+        mdclog_internal_output_changed();
+    pthread_mutex_unlock(&socket_mutex);
+    if (old)
+    {
+        mdclog_internal_epoch_synchronize();
+        mdclog_internal_socket_sink_close(old);
+    }
+}
+
+int mdclog_internal_socket_sink_connected(void)
+{
+    struct socket_sink *sink;
+    int                 connected;
+
+    if (!atomic_load_explicit(&current_socket, memory_order_relaxed))
+        return 0;
+    mdclog_internal_epoch_enter();
+    sink = atomic_load_explicit(&current_socket, memory_order_acquire);
+    connected = sink && atomic_load_explicit(&sink->connected, memory_order_relaxed);
+    mdclog_internal_epoch_leave();
+    return connected;
+}
+
+ssize_t mdclog_internal_socket_sink_write(const void *buffer, size_t len)
+{
+    struct socket_sink *sink;
+    size_t              framed;
+    char               *grown;
+
+    if (!atomic_load_explicit(&current_socket, memory_order_relaxed))
+    {
+        errno = ENOTCONN;
+        return -1;
+    }
+    mdclog_internal_epoch_enter();
+    sink = atomic_load_explicit(&current_socket, memory_order_acquire);
+    if (!sink || !atomic_load_explicit(&sink->connected, memory_order_relaxed))
+    {
+        mdclog_internal_epoch_leave();
+        errno = ENOTCONN;
+        return -1;
+    }
+    framed = framed_length(sink, buffer, len);
+    pthread_mutex_lock(&sink->mutex);
+    // the sender thread empties the queue, or fails and disconnects
+    while (sink->fd >= 0 && sink->queue_used > 0 && sink->queue_used + framed > sink->queue_size)
+        pthread_cond_wait(&sink->space, &sink->mutex);
+    if (sink->fd >= 0 && framed > sink->queue_size)
+    {
+        // an entry longer than the queue is sent alone
+        grown = realloc(sink->queue, framed);
+        if (grown)
+        {
+            sink->queue = grown;
+            sink->queue_size = framed;
+        }
+    }
+    if (sink->fd < 0 || sink->queue_used + framed > sink->queue_size)
+    {
+        pthread_mutex_unlock(&sink->mutex);
+        mdclog_internal_epoch_leave();
+        errno = ENOTCONN;
+        return -1;
+    }
+    if (sink->queue_used == 0)
+    {
+        add_ms(&sink->deadline, sink->config.flush_interval_ms);
+        pthread_cond_signal(&sink->wakeup);
+    }
+    put_frames(sink, buffer, len);
+    if (sink->queue_used >= sink->config.batch_size)
+        pthread_cond_signal(&sink->wakeup);
+    pthread_mutex_unlock(&sink->mutex);
+    mdclog_internal_epoch_leave();
+    return (ssize_t)len;
+}
@@ -0,0 +1,327 @@
+/*
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ *
+ * Clock sources and timestamp rendering.
+ *
+ * The time stamp counter clock converts the counter to nanoseconds with a
+ * 32.32 fixed point multiplier, relative to a base point read from
+ * CLOCK_REALTIME. The calibration is published with a sequence lock, and it is
+ * redone by one thread at a time when the calibration interval has elapsed
+ * since the base point. The calibration also moves the base point, so any
+ * drift from CLOCK_REALTIME is corrected every interval.
+ *
+ * Every thread caches the rendered second of its previous timestamp, so that
+ * a timestamp within the same second only renders its milliseconds.
+ */
+#include "private/timestamp.h"
+#include "private/system.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#define NS_PER_SECOND               1000000000ULL
+#define MIN_CALIBRATION_NS          10000000ULL     // minimum period the first calibration is measured
+#define RFC3339_SECOND_LENGTH       32
+
+struct timestamp_cache
+{
+    int      epoch_valid;
+    uint64_t epoch_second;
+    size_t   epoch_len;
+    char     epoch[DECIMAL_MAX_LENGTH];     // the digits of the second
+    int      rfc3339_valid;
+    uint64_t rfc3339_second;
+    size_t   rfc3339_len;
+    char     rfc3339[RFC3339_SECOND_LENGTH]; // "YYYY-MM-DDTHH:MM:SS
+};
+
+static __thread struct timestamp_cache thread_cache TLS_INITIAL_EXEC;
+
+static const char digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static uint64_t realtime_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * NS_PER_SECOND + (uint64_t)ts.tv_nsec;
+}
+
+#ifdef HAVE_TSC
+
+static struct
+{
+    _Atomic unsigned   seq;             // odd while the calibration is updated
+    _Atomic uint64_t   base_tsc;
+    _Atomic uint64_t   base_ns;
+    _Atomic uint64_t   mult;            // nanoseconds per tick, 32.32 fixed point, 0 if not calibrated
+    _Atomic uint64_t   limit_ticks;     // ticks after the base point when to recalibrate
+    uint64_t           sample_tsc;      // previous calibration point, accessed only
+    uint64_t           sample_ns;       // by the calibrating thread
+    atomic_flag        calibrating;
+    _Atomic int        available;       // 0 not checked, 1 yes, -1 no
+} tsc = {
+    .calibrating = ATOMIC_FLAG_INIT,
+};
+
+int mdclog_internal_tsc_available(void)
+{
+    int          available = atomic_load_explicit(&tsc.available, memory_order_relaxed);
+    unsigned int eax, ebx, ecx, edx;
+
+    if (available == 0)
+    {
+        // invariant TSC runs at a constant rate in all power states
+        available = __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1U << 8)) ? 1 : -1;
+        atomic_store_explicit(&tsc.available, available, memory_order_relaxed);
+    }
+    return available > 0;
+}
+
+/*
+ * Measure the tick rate over the period since the previous calibration point.
+ * Returns the current CLOCK_REALTIME time.
+ */
+static uint64_t calibrate(uint64_t ticks)
+{
+    uint64_t ns = realtime_ns();
+    uint64_t mult, limit;
+    unsigned seq;
+
+    if (atomic_flag_test_and_set_explicit(&tsc.calibrating, memory_order_acquire))
+        return ns;
+    if (tsc.sample_ns && ns > tsc.sample_ns + MIN_CALIBRATION_NS && ticks > tsc.sample_tsc)
+    {
+        mult = (uint64_t)(((unsigned __int128)(ns - tsc.sample_ns) << 32) / (ticks - tsc.sample_tsc));
+        if (mult)
+        {
+            limit = (uint64_t)(((unsigned __int128)TSC_CALIBRATION_INTERVAL_NS << 32) / mult);
+            seq = atomic_load_explicit(&tsc.seq, memory_order_relaxed);
+            atomic_store_explicit(&tsc.seq, seq + 1, memory_order_relaxed);
+            atomic_thread_fence(memory_order_release);
+            atomic_store_explicit(&tsc.base_tsc, ticks, memory_order_relaxed);
+            atomic_store_explicit(&tsc.base_ns, ns, memory_order_relaxed);
+            atomic_store_explicit(&tsc.mult, mult, memory_order_relaxed);
+            atomic_store_explicit(&tsc.limit_ticks, limit, memory_order_relaxed);
+            atomic_store_explicit(&tsc.seq, seq + 2, memory_order_release);
+        }
+        tsc.sample_tsc = ticks;
+        tsc.sample_ns = ns;
+    }
+    else if (tsc.sample_ns == 0 || ns < tsc.sample_ns || ticks < tsc.sample_tsc)
+    {
+        // the first point, or the clock was set backwards
+        tsc.sample_tsc = ticks;
+        tsc.sample_ns = ns;
+    }
+    atomic_flag_clear_explicit(&tsc.calibrating, memory_order_release);
+    return ns;
+}
+
+static uint64_t tsc_ns(void)
+{
+    uint64_t ticks = __rdtsc();
+    uint64_t base_tsc, base_ns, mult, limit;
+    unsigned seq;
+
+    do
+    {
+        seq = atomic_load_explicit(&tsc.seq, memory_order_acquire);
+        base_tsc = atomic_load_explicit(&tsc.base_tsc, memory_order_relaxed);
+        base_ns = atomic_load_explicit(&tsc.base_ns, memory_order_relaxed);
+        mult = atomic_load_explicit(&tsc.mult, memory_order_relaxed);
+        limit = atomic_load_explicit(&tsc.limit_ticks, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seq & 1) || seq != atomic_load_explicit(&tsc.seq, memory_order_relaxed));
+
+    // also a counter behind the base point, read on another CPU, wraps over the limit
+    if (mult == 0 || ticks - base_tsc >= limit)
+        return calibrate(ticks);
+    return base_ns + (uint64_t)(((unsigned __int128)(ticks - base_tsc) * mult) >> 32);
+}
+
+#else
+
+int mdclog_internal_tsc_available(void)
+{
+    return 0;
+}
+
+#endif
+
+void mdclog_internal_clock_read(mdclog_clock_t clock, struct timeval *tv)
+{
+    struct timespec ts;
+    uint64_t        ns;
+
+    switch (clock)
+    {
+#ifdef HAVE_TSC
+    case MDCLOG_CLOCK_TSC:
+        if (mdclog_internal_tsc_available())
+        {
+            ns = tsc_ns();
+            tv->tv_sec = (time_t)(ns / NS_PER_SECOND);
+            tv->tv_usec = (suseconds_t)(ns % NS_PER_SECOND / 1000);
+            return;
+        }
+        break;
+#endif
+#ifdef CLOCK_REALTIME_COARSE
+    case MDCLOG_CLOCK_REALTIME_COARSE:
+        clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+        tv->tv_sec = ts.tv_sec;
+        tv->tv_usec = (suseconds_t)(ts.tv_nsec / 1000);
+        return;
+#endif
+    default:
+        break;
+    }
+    (void)ns;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    tv->tv_sec = ts.tv_sec;
+    tv->tv_usec = (suseconds_t)(ts.tv_nsec / 1000);
+}
+
+size_t mdclog_internal_render_decimal(char *buffer, uint64_t value)
+{
+    char   digits[DECIMAL_MAX_LENGTH];
+    char  *p = &digits[sizeof(digits)];
+    size_t len;
+
+    while (value >= 100)
+    {
+        unsigned pair = (unsigned)(value % 100) * 2;
+
+        value /= 100;
+        *--p = digit_pairs[pair + 1];
+        *--p = digit_pairs[pair];
+    }
+    if (value >= 10)
+    {
+        *--p = digit_pairs[value * 2 + 1];
+        *--p = digit_pairs[value * 2];
+    }
+    else
+        *--p = (char)('0' + value);
+    len = (size_t)(&digits[sizeof(digits)] - p);
+    memcpy(buffer, p, len);
+    return len;
+}
+
+static void render_milliseconds(char *buffer, unsigned ms)
+{
+    buffer[0] = (char)('0' + ms / 100);
+    buffer[1] = digit_pairs[ms % 100 * 2];
+    buffer[2] = digit_pairs[ms % 100 * 2 + 1];
+}
+
+static size_t render_epoch_ms(char *buffer, size_t len, uint64_t second, unsigned ms)
+{
+    struct timestamp_cache *cache = &thread_cache;
+    char                    digits[DECIMAL_MAX_LENGTH];
+    size_t                  n;
+
+    if (second == 0)
+    {
+        n = mdclog_internal_render_decimal(digits, ms);
+        if (n >= len)
+            return 0;
+        memcpy(buffer, digits, n);
+        buffer[n] = '\0';
+        return n;
+    }
+    if (!cache->epoch_valid || cache->epoch_second != second)
+    {
+        cache->epoch_len = mdclog_internal_render_decimal(cache->epoch, second);
+        cache->epoch_second = second;
+        cache->epoch_valid = 1;
+    }
+    n = cache->epoch_len;
+    if (n + 3 >= len)
+        return 0;
+    memcpy(buffer, cache->epoch, n);
+    render_milliseconds(&buffer[n], ms);
+    buffer[n + 3] = '\0';
+    return n + 3;
+}
+
+static size_t render_rfc3339(char *buffer, size_t len, uint64_t second, unsigned ms)
+{
+    struct timestamp_cache *cache = &thread_cache;
+    time_t                  t = (time_t)second;
+    struct tm               tm;
+    size_t                  n;
+    int                     ret;
+
+    if (!cache->rfc3339_valid || cache->rfc3339_second != second)
+    {
+        if (!gmtime_r(&t, &tm))
+            return 0;
+        ret = snprintf(cache->rfc3339, sizeof(cache->rfc3339), "\"%04d-%02d-%02dT%02d:%02d:%02d",
+                       tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+        if (ret < 0 || (size_t)ret >= sizeof(cache->rfc3339))
+            return 0;
+        cache->rfc3339_len = (size_t)ret;
+        cache->rfc3339_second = second;
+        cache->rfc3339_valid = 1;
+    }
+    n = cache->rfc3339_len;
+    // ".mmmZ" and the closing quote
+    if (n + 6 >= len)
+        return 0;
+    memcpy(buffer, cache->rfc3339, n);
+    buffer[n] = '.';
+    render_milliseconds(&buffer[n + 1], ms);
+    buffer[n + 4] = 'Z';
+    buffer[n + 5] = '"';
+    buffer[n + 6] = '\0';
+    return n + 6;
+}
+
+size_t mdclog_internal_render_timestamp(char *buffer, size_t len, const struct timeval *tv,
+                                        mdclog_timestamp_format_t format)
+{
+    uint64_t second = (uint64_t)tv->tv_sec;
+    unsigned ms = (unsigned)(tv->tv_usec / 1000);
+
+    if (tv->tv_sec < 0)
+        return 0;
+    if (format == MDCLOG_TIMESTAMP_RFC3339)
+        return render_rfc3339(buffer, len, second, ms);
+    return render_epoch_ms(buffer, len, second, ms);
+}
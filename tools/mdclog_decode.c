@@ -0,0 +1,143 @@
+/*
+ * Decoder of the mdclog binary log output
+ *
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ *
+ * Decodes binary log streams written with MDCLOG_OUTPUT_BINARY to JSON log
+ * entries, one entry per line. The files are read in the given order, or the
+ * standard in if no files are given.
+ *
+ *     mdclog-decode [FILE...]
+ *
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "private/binary.h"
+
+#define READ_SIZE (64 * 1024)
+
+static void print_entry(const char *entry, size_t len, void *arg)
+{
+    (void)arg;
+    fwrite(entry, 1, len, stdout);
+    putchar('\n');
+}
+
+/*
+ * Decode a file
+ *
+ * @return  0 in case of success, -1 in case of error
+ */
+static int decode_file(struct binary_decoder *decoder, int fd, const char *name)
+{
+    char   *buffer = NULL;
+    char   *grown;
+    size_t  size = 0;
+    size_t  len = 0;
+    ssize_t n;
+    long    decoded;
+
+    for (;;)
+    {
+        if (size - len < READ_SIZE)
+        {
+            grown = realloc(buffer, size + READ_SIZE);
+            if (!grown)
+            {
+                fprintf(stderr, "%s: %s\n", name, strerror(ENOMEM));
+                free(buffer);
+                return -1;
+            }
+            buffer = grown;
+            size += READ_SIZE;
+        }
+        n = read(fd, &buffer[len], size - len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+        {
+            fprintf(stderr, "%s: %s\n", name, strerror(errno));
+            free(buffer);
+            return -1;
+        }
+        if (n == 0)
+            break;
+        len += (size_t)n;
+        decoded = mdclog_internal_binary_decode(decoder, buffer, len, print_entry, NULL);
+        if (decoded < 0)
+        {
+            fprintf(stderr, "%s: %s\n", name, errno == EINVAL ? "not a valid binary log stream" : strerror(errno));
+            free(buffer);
+            return -1;
+        }
+        // an incomplete record is decoded with the rest of the file
+        memmove(buffer, &buffer[decoded], len - (size_t)decoded);
+        len -= (size_t)decoded;
+    }
+    free(buffer);
+    if (len > 0)
+    {
+        fprintf(stderr, "%s: the last record is incomplete\n", name);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct binary_decoder *decoder = mdclog_internal_binary_decoder_create();
+    int                    status = 0;
+    int                    fd;
+    int                    i;
+
+    if (!decoder)
+    {
+        fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+        return 1;
+    }
+    if (argc > 1 && argv[1][0] == '-' && argv[1][1] != '\0')
+    {
+        fprintf(stderr, "usage: %s [FILE...]\n", argv[0]);
+        mdclog_internal_binary_decoder_destroy(decoder);
+        return 2;
+    }
+    if (argc == 1 && decode_file(decoder, STDIN_FILENO, "-") < 0)
+        status = 1;
+    for (i = 1; i < argc; i++)
+    {
+        fd = strcmp(argv[i], "-") == 0 ? STDIN_FILENO : open(argv[i], O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            fprintf(stderr, "%s: %s\n", argv[i], strerror(errno));
+            status = 1;
+            continue;
+        }
+        if (decode_file(decoder, fd, argv[i]) < 0)
+            status = 1;
+        if (fd != STDIN_FILENO)
+            close(fd);
+    }
+    mdclog_internal_binary_decoder_destroy(decoder);
+    return status;
+}
@@ -0,0 +1,93 @@
+/*
+ * Reader of the mdclog flight recorder files
+ *
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ *
+ * Prints the log entries of a flight recorder file from the oldest to the
+ * newest, one entry per line. With -s every entry is preceded by its
+ * sequence number.
+ *
+ *     mdclog-recorder [-s] FILE
+ *
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "private/recorder.h"
+
+static void print_entry(const char *entry, size_t len, uint64_t sequence, void *arg)
+{
+    if (*(int *)arg)
+        printf("%llu ", (unsigned long long)sequence);
+    fwrite(entry, 1, len, stdout);
+    putchar('\n');
+}
+
+int main(int argc, char **argv)
+{
+    struct stat st;
+    void       *file;
+    long        count;
+    int         sequences = 0;
+    int         fd;
+    int         opt;
+
+    while ((opt = getopt(argc, argv, "s")) != -1)
+    {
+        if (opt != 's')
+        {
+            fprintf(stderr, "usage: %s [-s] FILE\n", argv[0]);
+            return 2;
+        }
+        sequences = 1;
+    }
+    if (optind != argc - 1)
+    {
+        fprintf(stderr, "usage: %s [-s] FILE\n", argv[0]);
+        return 2;
+    }
+    fd = open(argv[optind], O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+        return 1;
+    }
+    file = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED)
+    {
+        fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+        return 1;
+    }
+    count = mdclog_internal_recorder_read(file, (size_t)st.st_size, print_entry, &sequences);
+    munmap(file, (size_t)st.st_size);
+    if (count < 0)
+    {
+        fprintf(stderr, "%s: %s\n", argv[optind],
+                errno == EINVAL ? "not a flight recorder file" : strerror(errno));
+        return 1;
+    }
+    return 0;
+}
@@ -23,6 +23,7 @@
 namespace mdclogtest
 {
    SystemMock* system = nullptr;
+   thread_local int inSystemCall = 0;
 
    void setSystemMock(SystemMock* mock)
    {
@@ -32,5 +33,10 @@ namespace mdclogtest
 
 ssize_t system_write(int fd, const void *buf, size_t count)
 {
-    return mdclogtest::system->write(fd, buf, count);
+    ssize_t ret;
+
+    mdclogtest::inSystemCall++;
+    ret = mdclogtest::system->write(fd, buf, count);
+    mdclogtest::inSystemCall--;
+    return ret;
 }
@@ -36,5 +36,10 @@ namespace mdclogtest
    };
 
    void setSystemMock(SystemMock *);
+
+   /*
+    * Nonzero while the calling thread executes a mocked system call
+    */
+   extern thread_local int inSystemCall;
 }
 #endif /* TST_SYSTEM_MOCK_HPP_ */
@@ -0,0 +1,210 @@
+/*
+ * Tests verifying that logging does not allocate memory in the steady state
+ *
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ */
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include "mdclog/mdclog.h"
+#include "private/mdc.h"
+#include "system_mock.hpp"
+
+using namespace testing;
+using namespace mdclogtest;
+
+extern "C" {
+void mdclog_lib_clean(void);
+}
+
+#ifdef __GLIBC__
+/*
+ * The test program interposes the allocation functions of the C library,
+ * counting the allocations made by a thread while counting is enabled.
+ * Allocations made by the mocked system calls are not counted.
+ */
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+}
+
+namespace
+{
+    thread_local bool   counting;
+    thread_local size_t allocations;
+
+    void countAllocation()
+    {
+        if (counting && !inSystemCall)
+            allocations++;
+    }
+}
+
+extern "C" void *malloc(size_t size)
+{
+    countAllocation();
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+    countAllocation();
+    return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+    countAllocation();
+    return __libc_realloc(ptr, size);
+}
+
+class AllocationTest: public testing::Test
+{
+public:
+    NiceMock<SystemMock> systemMock;
+    mdclog_attr_t*       attr;
+
+    void SetUp()
+    {
+        setSystemMock(&systemMock);
+        ON_CALL(systemMock, write(STDOUT_FILENO, NotNull(), _))
+            .WillByDefault(Invoke([] (int, const void*, size_t len) { return len; }));
+        ASSERT_EQ(0, mdclog_attr_init(&attr));
+        ASSERT_EQ(0, mdclog_attr_set_ident(attr, "allocationtest"));
+    }
+
+    void TearDown()
+    {
+        counting = false;
+        mdclog_attr_destroy(attr);
+        mdclog_internal_destroy_mdclist();
+        mdclog_lib_clean();
+    }
+
+    void startCounting()
+    {
+        void* (*volatile allocate)(size_t) = malloc;   // the compiler must not optimize the allocation away
+        void*  canary;
+        size_t canaryAllocations;
+
+        allocations = 0;
+        counting = true;
+        canary = allocate(1);
+        canaryAllocations = allocations;
+        counting = false;
+        free(canary);
+        ASSERT_EQ(1U, canaryAllocations) << "allocation functions are not interposed";
+        allocations = 0;
+        counting = true;
+    }
+
+    size_t stopCounting()
+    {
+        counting = false;
+        return allocations;
+    }
+
+    void writeEntries(int count)
+    {
+        for (int i = 0; i < count; i++)
+            mdclog_write(MDCLOG_ERR, "entry %d from %s: %f %c %s", i, "test", i * 0.5, 'x', "with \"quotes\"");
+    }
+
+    void writeEntriesWithChangingMDCs(int count)
+    {
+        char value[32];
+
+        for (int i = 0; i < count; i++)
+        {
+            snprintf(value, sizeof(value), "ue-%d", i % 1000);
+            ASSERT_EQ(0, mdclog_mdc_add("ue", value));
+            mdclog_write(MDCLOG_ERR, "entry %d", i);
+            mdclog_mdc_remove("ue");
+        }
+    }
+};
+
+TEST_F(AllocationTest, WriteDoesNotAllocateMemory)
+{
+    ASSERT_EQ(0, mdclog_init(attr));
+    ASSERT_EQ(0, mdclog_mdc_add("key1", "value1"));
+    ASSERT_EQ(0, mdclog_mdc_add("key2", "value2"));
+    writeEntries(1);
+
+    startCounting();
+    writeEntries(1000);
+    EXPECT_EQ(0U, stopCounting());
+}
+
+TEST_F(AllocationTest, SettingAndRemovingMDCsDoesNotAllocateMemory)
+{
+    ASSERT_EQ(0, mdclog_init(attr));
+    ASSERT_EQ(0, mdclog_mdc_add("key1", "value1"));
+    writeEntriesWithChangingMDCs(1);
+
+    startCounting();
+    writeEntriesWithChangingMDCs(10000);
+    EXPECT_EQ(0U, stopCounting());
+}
+
+TEST_F(AllocationTest, CleaningMDCsKeepsTheMemory)
+{
+    ASSERT_EQ(0, mdclog_init(attr));
+    ASSERT_EQ(0, mdclog_mdc_add("key1", "value1"));
+    writeEntries(1);
+
+    startCounting();
+    for (int i = 0; i < 1000; i++)
+    {
+        mdclog_mdc_clean();
+        ASSERT_EQ(0, mdclog_mdc_add("key1", "value1"));
+        writeEntries(1);
+    }
+    EXPECT_EQ(0U, stopCounting());
+}
+
+TEST_F(AllocationTest, AsynchronousWriteDoesNotAllocateMemory)
+{
+    ASSERT_EQ(0, mdclog_attr_set_async(attr, 1));
+    ASSERT_EQ(0, mdclog_init(attr));
+    ASSERT_EQ(0, mdclog_mdc_add("key1", "value1"));
+    writeEntries(1);
+
+    startCounting();
+    writeEntriesWithChangingMDCs(1000);
+    EXPECT_EQ(0U, stopCounting());
+}
+
+TEST_F(AllocationTest, DeferredFormattingDoesNotAllocateMemory)
+{
+    ASSERT_EQ(0, mdclog_attr_set_async(attr, 1));
+    ASSERT_EQ(0, mdclog_attr_set_deferred_format(attr, 1));
+    ASSERT_EQ(0, mdclog_init(attr));
+    ASSERT_EQ(0, mdclog_mdc_add("key1", "value1"));
+    writeEntries(1);
+
+    startCounting();
+    writeEntries(1000);
+    EXPECT_EQ(0U, stopCounting());
+}
+#endif
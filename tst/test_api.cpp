@@ -19,6 +19,10 @@
  */
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
 
 #include "mdclog/mdclog.h"
 #include "system_mock.hpp"
@@ -43,6 +47,7 @@ class APITest: public testing::Test
     char *               mdc;
     mdclog_attr_t*       attr;
     const char *         progname;
+    std::vector<std::string> written;
     void SetUp()
     {
         setSystemMock(&systemMock);
@@ -58,6 +63,19 @@ class APITest: public testing::Test
         mdclog_lib_clean();
     }
 
+    /*
+     * Collect all written log entries to the written vector
+     */
+    void collectWrites()
+    {
+        ON_CALL(systemMock, write(STDOUT_FILENO, NotNull(), _))
+            .WillByDefault(Invoke([this] (int, const void* buffer, size_t len)
+            {
+                written.push_back(std::string(static_cast<const char*>(buffer), len));
+                return len;
+            }));
+    }
+
     void setupWriteExpects(std::vector<const char*> substrs)
     {
         EXPECT_CALL(systemMock, write(STDOUT_FILENO, NotNull(), _))
@@ -115,6 +133,37 @@ TEST_F(APITest, LogReinitClearsSetAttributes)
     mdclog_write(MDCLOG_ERR, "logentry");
 }
 
+TEST_F(APITest, ReinitializationWhileOtherThreadsWriteIsSafe)
+{
+    std::atomic<bool> stop(false);
+    std::vector<std::thread> writers;
+
+    ON_CALL(systemMock, write(STDOUT_FILENO, NotNull(), _))
+        .WillByDefault(Invoke([] (int, const void* buffer, size_t len)
+        {
+            std::string received(static_cast<const char*>(buffer), len);
+            EXPECT_THAT(received, AnyOf(HasSubstr("\"first\""), HasSubstr("\"second\"")));
+            return len;
+        }));
+    for (int i = 0; i < 500; i++)
+    {
+        EXPECT_EQ(0, mdclog_attr_init(&attr));
+        EXPECT_EQ(0, mdclog_attr_set_ident(attr, i % 2 ? "second" : "first"));
+        EXPECT_EQ(0, mdclog_init(attr));
+        mdclog_attr_destroy(attr);
+        if (i == 0)
+            for (int j = 0; j < 4; j++)
+                writers.emplace_back([&stop]()
+                {
+                    while (!stop)
+                        mdclog_write(MDCLOG_ERR, "entry");
+                });
+    }
+    stop = true;
+    for (auto& writer: writers)
+        writer.join();
+}
+
 
 TEST_F(APITest, CheckAllLogFieldValuesPresent)
 {
@@ -158,6 +207,54 @@ TEST_F(APITest, LogLevelMultipleInitialisation)
     mdclog_write(MDCLOG_ERR, "logentry");
 }
 
+TEST_F(APITest, LogFieldValuesArePresentInAllThreads)
+{
+    setenv("POD_NAME", "mypod", 1);
+    EXPECT_EQ(0, mdclog_format_initialize(0));
+    unsetenv("POD_NAME");
+    std::vector<const char*> expected {"logentry", "\"POD_NAME\":\"mypod\"", "\"PID\":", "\"HOST_NAME\":\"\""};
+    setupWriteExpects(expected);
+    std::thread thread([]()
+    {
+        mdclog_write(MDCLOG_ERR, "logentry");
+        mdclog_internal_destroy_mdclist();
+    });
+    thread.join();
+}
+
+TEST_F(APITest, LogFieldValuesAreEscaped)
+{
+    setenv("POD_NAME", "my \"pod\" \\1", 1);
+    EXPECT_EQ(0, mdclog_format_initialize(0));
+    unsetenv("POD_NAME");
+    std::vector<const char*> expected {"logentry", "\"POD_NAME\":\"my \\\"pod\\\" \\\\1\""};
+    setupWriteExpects(expected);
+    mdclog_write(MDCLOG_ERR, "logentry");
+}
+
+TEST_F(APITest, ThreadMDCOverridesLogFieldValue)
+{
+    setenv("POD_NAME", "mypod", 1);
+    EXPECT_EQ(0, mdclog_format_initialize(0));
+    unsetenv("POD_NAME");
+    mdc = mdclog_mdc_get("POD_NAME");
+    EXPECT_THAT(mdc, StrEq("mypod"));
+    free(mdc);
+    mdc = NULL;
+    EXPECT_EQ(0, mdclog_mdc_add("POD_NAME", "override"));
+    mdc = mdclog_mdc_get("POD_NAME");
+    EXPECT_THAT(mdc, StrEq("override"));
+    EXPECT_CALL(systemMock, write(STDOUT_FILENO, NotNull(), _))
+        .WillOnce(Invoke([] (int, const void* buffer, int len)
+        {
+            std::string received(static_cast<const char*>(buffer), len);
+            EXPECT_THAT(received, HasSubstr("\"POD_NAME\":\"override\""));
+            EXPECT_THAT(received, Not(HasSubstr("mypod")));
+            return len;
+        }));
+    mdclog_write(MDCLOG_ERR, "logentry");
+}
+
 TEST_F(APITest, NullIsNotValidIdentity)
 {
     EXPECT_EQ(0, mdclog_attr_init(&attr));
@@ -202,6 +299,278 @@ TEST_F(APITest, TooLongIdentityIsNotValid)
     mdclog_attr_destroy(attr);
 }
 
+TEST_F(APITest, NullIsNotValidAttributeInAsyncSetters)
+{
+    EXPECT_EQ(-1, mdclog_attr_set_async(NULL, 1));
+    EXPECT_EQ(errno, EINVAL);
+    EXPECT_EQ(-1, mdclog_attr_set_async_capacity(NULL, 1024 * 1024));
+    EXPECT_EQ(errno, EINVAL);
+    EXPECT_EQ(-1, mdclog_attr_set_overflow_policy(NULL, MDCLOG_OVERFLOW_DROP_NEWEST));
+    EXPECT_EQ(errno, EINVAL);
+    EXPECT_EQ(-1, mdclog_attr_set_deferred_format(NULL, 1));
+    EXPECT_EQ(errno, EINVAL);
+    EXPECT_EQ(-1, mdclog_attr_set_batch_size(NULL, 4096));
+    EXPECT_EQ(errno, EINVAL);
+    EXPECT_EQ(-1, mdclog_attr_set_flush_interval(NULL, 10));
+    EXPECT_EQ(errno, EINVAL);
+}
+
+TEST_F(APITest, TooSmallAsyncCapacityIsNotValid)
+{
+    EXPECT_EQ(0, mdclog_attr_init(&attr));
+    EXPECT_EQ(-1, mdclog_attr_set_async_capacity(attr, 1024));
+    EXPECT_EQ(errno, EINVAL);
+    mdclog_attr_destroy(attr);
+}
+
+TEST_F(APITest, TooLargeBatchSizeIsNotValid)
+{
+    EXPECT_EQ(0, mdclog_attr_init(&attr));
+    EXPECT_EQ(-1, mdclog_attr_set_batch_size(attr, 2 * 1024 * 1024));
+    EXPECT_EQ(errno, EINVAL);
+    mdclog_attr_destroy(attr);
+}
+
+TEST_F(APITest, UnknownOverflowPolicyIsNotValid)
+{
+    EXPECT_EQ(0, mdclog_attr_init(&attr));
+    EXPECT_EQ(-1, mdclog_attr_set_overflow_policy(attr, static_cast<mdclog_overflow_policy_t>(3)));
+    EXPECT_EQ(errno, EINVAL);
+    mdclog_attr_destroy(attr);
+}
+
+TEST_F(APITest, AsyncLogEntriesAreWrittenWhenAsyncModeIsDisabled)
+{
+    EXPECT_EQ(0, mdclog_attr_init(&attr));
+    EXPECT_EQ(0, mdclog_attr_set_async(attr, 1));
+    EXPECT_EQ(0, mdclog_attr_set_async_capacity(attr, 1024 * 1024));
+    EXPECT_EQ(0, mdclog_attr_set_overflow_policy(attr, MDCLOG_OVERFLOW_DROP_OLDEST));
+    EXPECT_EQ(0, mdclog_attr_set_batch_size(attr, 4096));
+    EXPECT_EQ(0, mdclog_attr_set_flush_interval(attr, 10000));
+    EXPECT_EQ(0, mdclog_init(attr));
+    mdclog_attr_destroy(attr);
+    std::vector<const char*> expected {"async", "ERR", __progname};
+    setupWriteExpects(expected);
+    mdclog_write(MDCLOG_ERR, "async");
+    EXPECT_EQ(0, mdclog_init(NULL));
+}
+
+TEST_F(APITest, DeferredLogEntriesAreFormattedWhenAsyncModeIsDisabled)
+{
+    EXPECT_EQ(0, mdclog_attr_init(&attr));
+    EXPECT_EQ(0, mdclog_attr_set_async(attr, 1));
+    EXPECT_EQ(0, mdclog_attr_set_deferred_format(attr, 1));
+    EXPECT_EQ(0, mdclog_init(attr));
+    mdclog_attr_destroy(attr);
+    mdclog_mdc_add("foo1", "bar");
+    std::vector<const char*> expected {"deferred 1 \\\"quoted\\\"", "ERR", __progname, "foo1", "bar"};
+    setupWriteExpects(expected);
+    mdclog_write(MDCLOG_ERR, "deferred %d %s", 1, "\"quoted\"");
+    EXPECT_EQ(0, mdclog_init(NULL));
+}
+
+TEST_F(APITest, RepeatedLogEntriesAreCounted)
+{
+    collectWrites();
+    EXPECT_EQ(0, mdclog_attr_init(&attr));
+    EXPECT_EQ(0, mdclog_attr_set_repeat_suppression(attr, 60000));
+    EXPECT_EQ(0, mdclog_init(attr));
+    mdclog_attr_destroy(attr);
+    for (int i = 0; i < 4; i++)
+        mdclog_write(MDCLOG_ERR, "polling");
+    mdclog_mdc_add("foo", "bar");
+    mdclog_write(MDCLOG_ERR, "polling");
+    mdclog_write(MDCLOG_ERR, "polling");
+    EXPECT_EQ(0, mdclog_init(NULL));
+    mdclog_write(MDCLOG_ERR, "done");
+    ASSERT_EQ(5U, written.size());
+    EXPECT_THAT(written[0], AllOf(HasSubstr("polling"), Not(HasSubstr("repeated"))));
+    EXPECT_THAT(written[1], AllOf(HasSubstr("polling"), HasSubstr(",\"repeated\":3}\n")));
+    EXPECT_THAT(written[2], AllOf(HasSubstr("polling"), HasSubstr("foo"), Not(HasSubstr("repeated"))));
+    EXPECT_THAT(written[3], AllOf(HasSubstr("polling"), HasSubstr("foo"), HasSubstr(",\"repeated\":1}\n")));
+    EXPECT_THAT(written[4], HasSubstr("done"));
+}
+
+TEST_F(APITest, NullIsNotValidAttributeInSetRepeatSuppression)
+{
+    EXPECT_EQ(-1, mdclog_attr_set_repeat_suppression(NULL, 1000));
+    EXPECT_EQ(errno, EINVAL);
+}
+
+TEST_F(APITest, TimestampIsWrittenInRfc3339FormatWithTheSelectedClock)
+{
+    collectWrites();
+    EXPECT_EQ(0, mdclog_attr_init(&attr));
+    EXPECT_EQ(0, mdclog_attr_set_clock(attr, MDCLOG_CLOCK_TSC));
+    EXPECT_EQ(0, mdclog_attr_set_timestamp_format(attr, MDCLOG_TIMESTAMP_RFC3339));
+    EXPECT_EQ(0, mdclog_init(attr));
+    mdclog_attr_destroy(attr);
+    mdclog_write(MDCLOG_ERR, "rfc3339");
+    EXPECT_EQ(0, mdclog_init(NULL));
+    mdclog_write(MDCLOG_ERR, "epoch");
+    ASSERT_EQ(2U, written.size());
+    EXPECT_THAT(written[0], MatchesRegex("\\{\"ts\":\"[0-9]{4}-[0-9]{2}-[0-9]{2}T[0-9]{2}:[0-9]{2}:[0-9]{2}\\.[0-9]{3}Z\",.*rfc3339.*"));
+    EXPECT_THAT(written[1], MatchesRegex("\\{\"ts\":[0-9]+,.*epoch.*"));
+}
+
+TEST_F(APITest, InvalidClockAndTimestampFormatAreNotAccepted)
+{
+    EXPECT_EQ(-1, mdclog_attr_set_clock(NULL, MDCLOG_CLOCK_REALTIME));
+    EXPECT_EQ(errno, EINVAL);
+    EXPECT_EQ(-1, mdclog_attr_set_timestamp_format(NULL, MDCLOG_TIMESTAMP_EPOCH_MS));
+    EXPECT_EQ(errno, EINVAL);
+    EXPECT_EQ(0, mdclog_attr_init(&attr));
+    EXPECT_EQ(-1, mdclog_attr_set_clock(attr, (mdclog_clock_t)3));
+    EXPECT_EQ(errno, EINVAL);
+    EXPECT_EQ(-1, mdclog_attr_set_timestamp_format(attr, (mdclog_timestamp_format_t)2));
+    EXPECT_EQ(errno, EINVAL);
+    mdclog_attr_destroy(attr);
+}
+
+TEST_F(APITest, LogEntryIsWrittenWithTheConfiguredFieldKeysAndOrder)
+{
+    const mdclog_field_t order[] = { MDCLOG_FIELD_SEVERITY, MDCLOG_FIELD_TIMESTAMP, MDCLOG_FIELD_MESSAGE };
+
+    collectWrites();
+    EXPECT_EQ(0, mdclog_attr_init(&attr));
+    EXPECT_EQ(0, mdclog_attr_set_field_key(attr, MDCLOG_FIELD_SEVERITY, "level"));
+    EXPECT_EQ(0, mdclog_attr_set_field_key(attr, MDCLOG_FIELD_MESSAGE, "message"));
+    EXPECT_EQ(0, mdclog_attr_set_field_order(attr, order, 3));
+    EXPECT_EQ(0, mdclog_init(attr));
+    mdclog_attr_destroy(attr);
+    mdclog_write(MDCLOG_ERR, "custom %d", 1);
+    EXPECT_EQ(0, mdclog_init(NULL));
+    ASSERT_EQ(1U, written.size());
+    EXPECT_THAT(written[0], MatchesRegex("\\{\"level\":\"ERROR\",\"ts\":[0-9]+,\"message\":\"custom 1\"\\}\n"));
+}
+
+TEST_F(APITest, RepeatedEntriesAreDetectedWhenTheTimestampIsNotTheFirstField)
+{
+    const mdclog_field_t order[] = { MDCLOG_FIELD_SEVERITY, MDCLOG_FIELD_TIMESTAMP, MDCLOG_FIELD_MESSAGE };
+
+    collectWrites();
+    EXPECT_EQ(0, mdclog_attr_init(&attr));
+    EXPECT_EQ(0, mdclog_attr_set_field_order(attr, order, 3));
+    EXPECT_EQ(0, mdclog_attr_set_repeat_suppression(attr, 60000));
+    EXPECT_EQ(0, mdclog_init(attr));
+    mdclog_attr_destroy(attr);
+    mdclog_write(MDCLOG_ERR, "polling");
+    mdclog_write(MDCLOG_ERR, "polling");
+    mdclog_write(MDCLOG_FATAL, "polling");
+    EXPECT_EQ(0, mdclog_init(NULL));
+    ASSERT_EQ(3U, written.size());
+    EXPECT_THAT(written[1], AllOf(HasSubstr("ERROR"), HasSubstr(",\"repeated\":1}\n")));
+    EXPECT_THAT(written[2], AllOf(HasSubstr("FATAL"), Not(HasSubstr("repeated"))));
+}
+
+TEST_F(APITest, InvalidFieldKeyAndOrderAreNotAccepted)
+{
+    const mdclog_field_t order[] = { MDCLOG_FIELD_MESSAGE, MDCLOG_FIELD_TIMESTAMP };
+
+    EXPECT_EQ(-1, mdclog_attr_set_field_key(NULL, MDCLOG_FIELD_MESSAGE, "message"));
+    EXPECT_EQ(errno, EINVAL);
+    EXPECT_EQ(-1, mdclog_attr_set_field_order(NULL, order, 1));
+    EXPECT_EQ(errno, EINVAL);
+    EXPECT_EQ(0, mdclog_attr_init(&attr));
+    EXPECT_EQ(-1, mdclog_attr_set_field_key(attr, MDCLOG_FIELD_MESSAGE, NULL));
+    EXPECT_EQ(errno, EINVAL);
+    EXPECT_EQ(-1, mdclog_attr_set_field_order(attr, order, 2));
+    EXPECT_EQ(errno, EINVAL);
+    EXPECT_EQ(-1, mdclog_attr_set_field_order(attr, NULL, 2));
+    EXPECT_EQ(errno, EINVAL);
+    mdclog_attr_destroy(attr);
+}
+
+TEST_F(APITest, MessageIsTruncatedToPipeBufByDefault)
+{
+    std::string message(2 * PIPE_BUF, 'a');
+
+    collectWrites();
+    mdclog_write(MDCLOG_ERR, "%s", message.c_str());
+    ASSERT_EQ(1U, written.size());
+    EXPECT_GE(static_cast<size_t>(PIPE_BUF), written[0].size());
+    EXPECT_THAT(written[0], EndsWith("\"}\n"));
+}
+
+TEST_F(APITest, LargeEntryIsWrittenAtOnceWithWritePolicy)
+{
+    std::string message(16 * 1024, 'a');
+
+    collectWrites();
+    EXPECT_EQ(0, mdclog_attr_init(&attr));
+    EXPECT_EQ(0, mdclog_attr_set_max_entry_size(attr, 64 * 1024));
+    EXPECT_EQ(0, mdclog_attr_set_large_entry_policy(attr, MDCLOG_LARGE_ENTRY_WRITE));
+    EXPECT_EQ(0, mdclog_init(attr));
+    mdclog_attr_destroy(attr);
+    mdclog_write(MDCLOG_ERR, "%s", message.c_str());
+    mdclog_write(MDCLOG_ERR, "small");
+    ASSERT_EQ(2U, written.size());
+    EXPECT_THAT(written[0], EndsWith(",\"msg\":\"" + message + "\"}\n"));
+    EXPECT_THAT(written[1], EndsWith(",\"msg\":\"small\"}\n"));
+}
+
+TEST_F(APITest, LargeEntryIsTruncatedToMaxEntrySize)
+{
+    std::string message(128 * 1024, 'a');
+
+    collectWrites();
+    EXPECT_EQ(0, mdclog_attr_init(&attr));
+    EXPECT_EQ(0, mdclog_attr_set_max_entry_size(attr, 64 * 1024));
+    EXPECT_EQ(0, mdclog_attr_set_large_entry_policy(attr, MDCLOG_LARGE_ENTRY_WRITE));
+    EXPECT_EQ(0, mdclog_init(attr));
+    mdclog_attr_destroy(attr);
+    mdclog_write(MDCLOG_ERR, "%s", message.c_str());
+    ASSERT_EQ(1U, written.size());
+    EXPECT_GE(64U * 1024U, written[0].size());
+    EXPECT_LT(60U * 1024U, written[0].size());
+    EXPECT_THAT(written[0], EndsWith("aaa[truncated]\"}\n"));
+}
+
+TEST_F(APITest, LargeEntryIsFragmentedWithFragmentPolicy)
+{
+    std::string message(3 * PIPE_BUF, '"');
+    std::string data;
+
+    collectWrites();
+    EXPECT_EQ(0, mdclog_attr_init(&attr));
+    EXPECT_EQ(0, mdclog_attr_set_max_entry_size(attr, 64 * 1024));
+    EXPECT_EQ(0, mdclog_attr_set_large_entry_policy(attr, MDCLOG_LARGE_ENTRY_FRAGMENT));
+    EXPECT_EQ(0, mdclog_init(attr));
+    mdclog_attr_destroy(attr);
+    mdclog_write(MDCLOG_ERR, "%s", message.c_str());
+    ASSERT_LT(6U, written.size());
+    for (size_t i = 0; i < written.size(); i++)
+    {
+        EXPECT_GE(static_cast<size_t>(PIPE_BUF), written[i].size());
+        EXPECT_THAT(written[i], StartsWith("{\"fragment\":"));
+        EXPECT_THAT(written[i], HasSubstr(",\"seq\":" + std::to_string(i) + ","));
+    }
+    EXPECT_THAT(written.back(), HasSubstr("\"last\":true"));
+}
+
+TEST_F(APITest, InvalidMaxEntrySizeAndLargeEntryPolicyAreNotAccepted)
+{
+    EXPECT_EQ(-1, mdclog_attr_set_max_entry_size(NULL, 64 * 1024));
+    EXPECT_EQ(errno, EINVAL);
+    EXPECT_EQ(-1, mdclog_attr_set_large_entry_policy(NULL, MDCLOG_LARGE_ENTRY_WRITE));
+    EXPECT_EQ(errno, EINVAL);
+    EXPECT_EQ(0, mdclog_attr_init(&attr));
+    EXPECT_EQ(-1, mdclog_attr_set_max_entry_size(attr, PIPE_BUF - 1));
+    EXPECT_EQ(errno, EINVAL);
+    EXPECT_EQ(-1, mdclog_attr_set_max_entry_size(attr, MDCLOG_MAX_ENTRY_SIZE + 1));
+    EXPECT_EQ(errno, EINVAL);
+    EXPECT_EQ(0, mdclog_attr_set_max_entry_size(attr, MDCLOG_MAX_ENTRY_SIZE));
+    EXPECT_EQ(-1, mdclog_attr_set_large_entry_policy(attr, (mdclog_large_entry_policy_t)3));
+    EXPECT_EQ(errno, EINVAL);
+    mdclog_attr_destroy(attr);
+}
+
+TEST_F(APITest, StatsCannotBeReadToNull)
+{
+    EXPECT_EQ(-1, mdclog_stats_get(NULL));
+    EXPECT_EQ(errno, EINVAL);
+}
+
 TEST_F(APITest, SetMDCValuesAreIncludedInLog)
 {
     mdclog_mdc_add("foo1", "bar");
@@ -226,6 +595,137 @@ TEST_F(APITest, UserCanReadCurrentLoggingLevel)
     EXPECT_EQ(mdclog_level_get(), MDCLOG_ERR);
 }
 
+TEST_F(APITest, FatalEntryIsWrittenWithErrorLoggingLevel)
+{
+    mdclog_level_set(MDCLOG_ERR);
+    std::vector<const char*> expected {"fatal", "FATAL", __progname};
+    setupWriteExpects(expected);
+    mdclog_write(MDCLOG_DEBUG, "debug");
+    mdclog_write(MDCLOG_FATAL, "fatal");
+}
+
+TEST_F(APITest, TraceLoggingLevelEnablesAllSeverities)
+{
+    mdclog_level_set(MDCLOG_TRACE);
+    EXPECT_EQ(MDCLOG_TRACE, mdclog_level_get());
+    EXPECT_TRUE(mdclog_level_enabled(MDCLOG_TRACE));
+    EXPECT_TRUE(mdclog_level_enabled(MDCLOG_FATAL));
+    std::vector<const char*> expected {"trace", "TRACE", __progname};
+    setupWriteExpects(expected);
+    mdclog_write(MDCLOG_TRACE, "trace");
+    mdclog_level_set(MDCLOG_ERR);
+}
+
+static int evaluations;
+
+static int evaluated(int value)
+{
+    evaluations++;
+    return value;
+}
+
+TEST_F(APITest, WriteMacroDoesNotEvaluateArgumentsOfFilteredMessage)
+{
+    evaluations = 0;
+    mdclog_level_set(MDCLOG_WARN);
+    EXPECT_FALSE(mdclog_level_enabled(MDCLOG_INFO));
+    std::vector<const char*> expected {"warning 2", "WARNING", __progname};
+    setupWriteExpects(expected);
+    MDCLOG_INFO_WRITE("info %d", evaluated(1));
+    MDCLOG_DEBUG_WRITE("debug %d", evaluated(1));
+    MDCLOG_WRITE(MDCLOG_WARN, "warning %d", evaluated(2));
+    EXPECT_EQ(1, evaluations);
+    mdclog_level_set(MDCLOG_ERR);
+}
+
+#undef MDCLOG_COMPILE_LEVEL
+#define MDCLOG_COMPILE_LEVEL MDCLOG_WARN
+
+TEST_F(APITest, WriteMacroBelowCompileLevelIsCompiledOut)
+{
+    evaluations = 0;
+    mdclog_level_set(MDCLOG_TRACE);
+    std::vector<const char*> expected {"error", "ERROR", __progname};
+    setupWriteExpects(expected);
+    MDCLOG_TRACE_WRITE("trace %d", evaluated(1));
+    MDCLOG_INFO_WRITE("info %d", evaluated(1));
+    MDCLOG_ERR_WRITE("error");
+    EXPECT_EQ(0, evaluations);
+    mdclog_level_set(MDCLOG_ERR);
+}
+
+#undef MDCLOG_COMPILE_LEVEL
+#define MDCLOG_COMPILE_LEVEL MDCLOG_TRACE
+
+TEST_F(APITest, RateLimitedEntriesAreReportedInSummary)
+{
+    mdclog_stats_t before, after;
+
+    collectWrites();
+    ASSERT_EQ(0, mdclog_stats_get(&before));
+    mdclog_summary_interval_set(0);
+    ASSERT_EQ(0, mdclog_rate_limit_set(10, 2));
+    // the bucket of the call site may have been emptied by an earlier run of the test
+    std::this_thread::sleep_for(std::chrono::milliseconds(250));
+    for (int i = 0; i < 5; i++)
+        mdclog_write(MDCLOG_ERR, "rate limited entry %d", i);
+    ASSERT_EQ(0, mdclog_rate_limit_set(0, 0));
+    mdclog_summary_interval_set(10000);
+    ASSERT_EQ(0, mdclog_stats_get(&after));
+
+    ASSERT_EQ(5U, written.size());
+    EXPECT_THAT(written[0], HasSubstr("rate limited entry 0"));
+    EXPECT_THAT(written[1], HasSubstr("rate limited entry 1"));
+    for (int i = 2; i < 5; i++)
+    {
+        EXPECT_THAT(written[i], HasSubstr("suppressed 1 log entries: 1 by rate limiting, 0 by sampling"));
+        EXPECT_THAT(written[i], HasSubstr("ERROR"));
+    }
+    EXPECT_EQ(before.rate_limited + 3, after.rate_limited);
+}
+
+TEST_F(APITest, WriteMacroCallSitesAreRateLimitedSeparately)
+{
+    collectWrites();
+    mdclog_summary_interval_set(0);
+    ASSERT_EQ(0, mdclog_rate_limit_set(10, 1));
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    for (int i = 0; i < 3; i++)
+    {
+        MDCLOG_ERR_WRITE("first site");
+        MDCLOG_ERR_WRITE("second site");
+    }
+    ASSERT_EQ(0, mdclog_rate_limit_set(0, 0));
+    mdclog_summary_interval_set(10000);
+    EXPECT_EQ(1, std::count_if(written.begin(), written.end(),
+                               [](const std::string& entry) { return entry.find("first site") != std::string::npos; }));
+    EXPECT_EQ(1, std::count_if(written.begin(), written.end(),
+                               [](const std::string& entry) { return entry.find("second site") != std::string::npos; }));
+}
+
+TEST_F(APITest, SampledOutEntriesAreReportedInSummary)
+{
+    mdclog_stats_t before, after;
+
+    collectWrites();
+    ASSERT_EQ(0, mdclog_stats_get(&before));
+    mdclog_summary_interval_set(0);
+    ASSERT_EQ(0, mdclog_sampling_set(MDCLOG_WARN, 0.0));
+    mdclog_level_set(MDCLOG_WARN);
+    mdclog_write(MDCLOG_WARN, "warning");
+    mdclog_write(MDCLOG_ERR, "error");
+    mdclog_level_set(MDCLOG_ERR);
+    ASSERT_EQ(0, mdclog_sampling_set(MDCLOG_WARN, 1.0));
+    mdclog_summary_interval_set(10000);
+    ASSERT_EQ(0, mdclog_stats_get(&after));
+    EXPECT_THAT(written, ElementsAre(AllOf(HasSubstr("suppressed 1 log entries: 0 by rate limiting, 1 by sampling"),
+                                           HasSubstr("WARNING")),
+                                     HasSubstr("error")));
+    EXPECT_EQ(before.sampled_out + 1, after.sampled_out);
+    EXPECT_EQ(-1, mdclog_sampling_set(MDCLOG_WARN, 2.0));
+    EXPECT_EQ(errno, EINVAL);
+}
+
 TEST_F(APITest, UserCanReadSetMDCValue)
 {
     EXPECT_EQ(0, mdclog_mdc_add("foo", "bar"));
@@ -280,6 +780,33 @@ TEST_F(APITest, SpecialCharactersInMDCKeyAreNotAccepted)
     EXPECT_EQ(errno, EINVAL);
 }
 
+TEST_F(APITest, MDCSnapshotIsIncludedInLogOfAdoptingThread)
+{
+    mdclog_mdc_snapshot_t *snapshot;
+
+    collectWrites();
+    ASSERT_EQ(0, mdclog_mdc_add("request", "17"));
+    snapshot = mdclog_mdc_snapshot();
+    ASSERT_THAT(snapshot, NotNull());
+    std::thread thread([snapshot]()
+            {
+                EXPECT_EQ(0, mdclog_mdc_adopt(snapshot));
+                mdclog_write(MDCLOG_ERR, "worker");
+                mdclog_mdc_clean();
+            });
+    thread.join();
+    mdclog_mdc_snapshot_release(snapshot);
+    ASSERT_EQ(1U, written.size());
+    EXPECT_THAT(written[0], AllOf(HasSubstr("\"request\":\"17\""), HasSubstr("worker")));
+}
+
+TEST_F(APITest, NullMDCSnapshotIsNotAdopted)
+{
+    EXPECT_EQ(-1, mdclog_mdc_adopt(NULL));
+    EXPECT_EQ(errno, EINVAL);
+    mdclog_mdc_snapshot_release(NULL);
+}
+
 TEST_F(APITest, CleanMDC)
 {
 	mdclog_mdc_clean();
@@ -297,6 +824,14 @@ TEST_F(APITest, SetMDCLogLevel)
 	update_mdc_log_level_severity(loglevel);
 	strcpy(loglevel,"INFO");
 	update_mdc_log_level_severity(loglevel);
+	EXPECT_EQ(MDCLOG_INFO, mdclog_level_get());
+	strcpy(loglevel,"TRACE");
+	update_mdc_log_level_severity(loglevel);
+	EXPECT_EQ(MDCLOG_TRACE, mdclog_level_get());
+	strcpy(loglevel,"FATAL");
+	update_mdc_log_level_severity(loglevel);
+	EXPECT_EQ(MDCLOG_FATAL, mdclog_level_get());
+	mdclog_level_set(MDCLOG_ERR);
 }
 
 TEST_F(APITest, ParseConfigFile)
@@ -0,0 +1,291 @@
+/*
+ * Tests for asynchronous logging
+ *
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ */
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <semaphore.h>
+
+#include "private/async.h"
+#include "system_mock.hpp"
+
+using namespace testing;
+using namespace mdclogtest;
+
+class AsyncTest: public testing::Test
+{
+public:
+    NiceMock<SystemMock>     systemMock;
+    std::mutex               mutex;
+    std::vector<std::string> written;
+    std::vector<size_t>      writeLengths;
+    std::thread::id          writer;
+    sem_t                    release;
+    std::atomic<bool>        blockWrites;
+
+    void SetUp()
+    {
+        setSystemMock(&systemMock);
+        sem_init(&release, 0, 0);
+        blockWrites = false;
+        ON_CALL(systemMock, write(STDOUT_FILENO, NotNull(), _))
+            .WillByDefault(Invoke([this] (int, const void* buffer, size_t len)
+            {
+                if (blockWrites)
+                    sem_wait(&release);
+                std::lock_guard<std::mutex> guard(mutex);
+                std::string batch(static_cast<const char*>(buffer), len);
+                for (size_t start = 0, end; start < len; start = end + 1)
+                {
+                    end = batch.find('\n', start);
+                    written.push_back(batch.substr(start, end - start + 1));
+                }
+                writeLengths.push_back(len);
+                writer = std::this_thread::get_id();
+                return len;
+            }));
+    }
+
+    void TearDown()
+    {
+        mdclog_internal_async_stop();
+        sem_destroy(&release);
+    }
+
+    int start(size_t capacity, mdclog_overflow_policy_t policy, async_format_fn_t format = NULL,
+              size_t batchSize = ASYNC_DEFAULT_BATCH_SIZE, unsigned flushIntervalMs = 0)
+    {
+        struct async_config config;
+        config.capacity = capacity;
+        config.policy = policy;
+        config.batch_size = batchSize;
+        config.flush_interval_ms = flushIntervalMs;
+        config.format = format;
+        return mdclog_internal_async_start(&config);
+    }
+
+    void push(const std::string& entry)
+    {
+        EXPECT_EQ(0, mdclog_internal_async_push(entry.c_str(), entry.length()));
+    }
+
+    mdclog_stats_t stats()
+    {
+        mdclog_stats_t stats;
+        mdclog_internal_async_stats(&stats);
+        return stats;
+    }
+};
+
+TEST_F(AsyncTest, PushFailsWhenAsyncModeIsNotRunning)
+{
+    EXPECT_EQ(-1, mdclog_internal_async_push("entry\n", 6));
+}
+
+TEST_F(AsyncTest, QueuedEntriesAreWrittenInOrderByBackgroundThread)
+{
+    ASSERT_EQ(0, start(0, MDCLOG_OVERFLOW_BLOCK));
+    push("first\n");
+    push("second\n");
+    push("third\n");
+    mdclog_internal_async_stop();
+    EXPECT_THAT(written, ElementsAre("first\n", "second\n", "third\n"));
+    EXPECT_NE(writer, std::this_thread::get_id());
+}
+
+TEST_F(AsyncTest, EntriesOfExitedThreadAreWritten)
+{
+    ASSERT_EQ(0, start(0, MDCLOG_OVERFLOW_BLOCK));
+    std::thread thread([this]() { push("from thread\n"); });
+    thread.join();
+    mdclog_internal_async_stop();
+    EXPECT_THAT(written, Contains("from thread\n"));
+}
+
+TEST_F(AsyncTest, BlockPolicyDoesNotLoseEntries)
+{
+    const int count = 5000;
+    auto before = stats();
+
+    ASSERT_EQ(0, start(ASYNC_MIN_CAPACITY, MDCLOG_OVERFLOW_BLOCK));
+    std::thread thread([this]()
+    {
+        for (int i = 0; i < count; i++)
+            push(std::string(100, 'a') + std::to_string(i) + "\n");
+    });
+    thread.join();
+    mdclog_internal_async_stop();
+    ASSERT_EQ(count, (int)written.size());
+    EXPECT_EQ(written.back(), std::string(100, 'a') + std::to_string(count - 1) + "\n");
+    EXPECT_EQ(before.dropped, stats().dropped);
+    EXPECT_EQ(before.written + count, stats().written);
+}
+
+TEST_F(AsyncTest, DropNewestPolicyDiscardsEntriesWhenBufferIsFull)
+{
+    const int count = 1000;
+    auto before = stats();
+
+    blockWrites = true;
+    ASSERT_EQ(0, start(ASYNC_MIN_CAPACITY, MDCLOG_OVERFLOW_DROP_NEWEST));
+    std::thread thread([this]()
+    {
+        for (int i = 0; i < count; i++)
+            push(std::to_string(i) + std::string(100, 'b') + "\n");
+    });
+    thread.join();
+    blockWrites = false;
+    sem_post(&release);
+    mdclog_internal_async_stop();
+
+    auto after = stats();
+    EXPECT_GT(after.dropped, before.dropped);
+    EXPECT_EQ(count, (int)(after.dropped - before.dropped + written.size()));
+    EXPECT_EQ(written.front(), "0" + std::string(100, 'b') + "\n");
+}
+
+TEST_F(AsyncTest, DropOldestPolicyKeepsTheLatestEntries)
+{
+    const int count = 1000;
+    auto before = stats();
+
+    blockWrites = true;
+    ASSERT_EQ(0, start(ASYNC_MIN_CAPACITY, MDCLOG_OVERFLOW_DROP_OLDEST));
+    std::thread thread([this]()
+    {
+        for (int i = 0; i < count; i++)
+            push(std::to_string(i) + std::string(100, 'c') + "\n");
+    });
+    thread.join();
+    blockWrites = false;
+    sem_post(&release);
+    mdclog_internal_async_stop();
+
+    auto after = stats();
+    EXPECT_GT(after.dropped, before.dropped);
+    EXPECT_EQ(count, (int)(after.dropped - before.dropped + written.size()));
+    EXPECT_EQ(written.back(), std::to_string(count - 1) + std::string(100, 'c') + "\n");
+}
+
+TEST_F(AsyncTest, TooLongEntryIsNotQueued)
+{
+    std::string entry(PIPE_BUF + 1, 'd');
+
+    ASSERT_EQ(0, start(0, MDCLOG_OVERFLOW_BLOCK));
+    EXPECT_EQ(-1, mdclog_internal_async_push(entry.c_str(), entry.length()));
+}
+
+static size_t formatDeferred(char *buffer, size_t len, const char *record, size_t record_len)
+{
+    return snprintf(buffer, len, "formatted %.*s\n", (int)record_len, record);
+}
+
+TEST_F(AsyncTest, DeferredEntriesAreFormattedByBackgroundThread)
+{
+    ASSERT_EQ(0, start(0, MDCLOG_OVERFLOW_BLOCK, formatDeferred));
+    push("plain\n");
+    EXPECT_EQ(0, mdclog_internal_async_push_deferred("record", 6));
+    mdclog_internal_async_stop();
+    EXPECT_THAT(written, ElementsAre("plain\n", "formatted record\n"));
+}
+
+TEST_F(AsyncTest, PushDeferredFailsWhenAsyncModeIsNotRunning)
+{
+    EXPECT_EQ(-1, mdclog_internal_async_push_deferred("record", 6));
+}
+
+TEST_F(AsyncTest, QueuedEntriesAreWrittenWithOneSystemCall)
+{
+    auto before = stats();
+
+    ASSERT_EQ(0, start(0, MDCLOG_OVERFLOW_BLOCK, NULL, ASYNC_DEFAULT_BATCH_SIZE, 60000));
+    push("first\n");
+    push("second\n");
+    push("third\n");
+    mdclog_internal_async_stop();
+    EXPECT_THAT(written, ElementsAre("first\n", "second\n", "third\n"));
+    EXPECT_THAT(writeLengths, ElementsAre(19U));
+    EXPECT_EQ(before.written + 3, stats().written);
+    EXPECT_EQ(before.syscalls + 1, stats().syscalls);
+}
+
+TEST_F(AsyncTest, BatchSizeLimitsBytesWrittenWithOneSystemCall)
+{
+    const std::string entry(99, 'e');
+
+    ASSERT_EQ(0, start(0, MDCLOG_OVERFLOW_BLOCK, NULL, 250, 60000));
+    for (int i = 0; i < 10; i++)
+        push(entry + "\n");
+    mdclog_internal_async_stop();
+    EXPECT_EQ(10U, written.size());
+    EXPECT_THAT(writeLengths, Each(200U));
+}
+
+TEST_F(AsyncTest, ZeroBatchSizeWritesEveryEntrySeparately)
+{
+    ASSERT_EQ(0, start(0, MDCLOG_OVERFLOW_BLOCK, NULL, 0, 60000));
+    push("first\n");
+    push("second\n");
+    mdclog_internal_async_stop();
+    EXPECT_THAT(written, ElementsAre("first\n", "second\n"));
+    EXPECT_THAT(writeLengths, ElementsAre(6U, 7U));
+}
+
+TEST_F(AsyncTest, PartialBatchIsWrittenAfterFlushInterval)
+{
+    ASSERT_EQ(0, start(0, MDCLOG_OVERFLOW_BLOCK, NULL, ASYNC_DEFAULT_BATCH_SIZE, 10));
+    push("entry\n");
+    for (int i = 0; i < 500; i++)
+    {
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            if (!written.empty())
+                break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    std::lock_guard<std::mutex> guard(mutex);
+    EXPECT_THAT(written, ElementsAre("entry\n"));
+}
+
+extern "C" size_t get_batch_limit(int fd, size_t batch_size);
+
+TEST(AsyncBatchLimitTest, BatchToPipeIsLimitedToPipeBuf)
+{
+    int fds[2];
+
+    ASSERT_EQ(0, pipe(fds));
+    EXPECT_EQ((size_t)PIPE_BUF, get_batch_limit(fds[1], ASYNC_DEFAULT_BATCH_SIZE));
+    EXPECT_EQ(100U, get_batch_limit(fds[1], 100));
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(AsyncBatchLimitTest, BatchToRegularFileIsNotLimited)
+{
+    FILE *file = tmpfile();
+
+    ASSERT_NE(nullptr, file);
+    EXPECT_EQ((size_t)ASYNC_DEFAULT_BATCH_SIZE, get_batch_limit(fileno(file), ASYNC_DEFAULT_BATCH_SIZE));
+    fclose(file);
+}
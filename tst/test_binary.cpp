@@ -0,0 +1,476 @@
+/*
+ * Tests for the binary log encoding
+ *
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ */
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "private/binary.h"
+#include "private/epoch.h"
+#include "private/json_format.h"
+#include "private/mdc.h"
+#include "private/timestamp.h"
+#include "mdclog/mdclog.h"
+#include "system_mock.hpp"
+
+using namespace testing;
+
+extern "C" {
+void mdclog_lib_clean(void);
+}
+
+static void collect_entry(const char *entry, size_t len, void *arg)
+{
+    static_cast<std::vector<std::string>*>(arg)->push_back(std::string(entry, len));
+}
+
+TEST(VarintTest, ValuesAreReadAsWritten)
+{
+    const uint64_t values[] = { 0, 1, 127, 128, 300, 16383, 16384, UINT32_MAX, UINT64_MAX };
+    const int64_t svalues[] = { 0, -1, 1, -64, 64, INT32_MIN, INT64_MIN, INT64_MAX };
+    char buffer[VARINT_MAX_LENGTH];
+    uint64_t value;
+    int64_t svalue;
+    size_t len;
+
+    for (uint64_t expected: values)
+    {
+        len = mdclog_internal_put_varint(buffer, sizeof(buffer), expected);
+        ASSERT_GT(len, 0U);
+        EXPECT_EQ(len, mdclog_internal_get_varint(buffer, len, &value));
+        EXPECT_EQ(expected, value);
+        EXPECT_EQ(0U, mdclog_internal_get_varint(buffer, len - 1, &value));
+    }
+    for (int64_t expected: svalues)
+    {
+        len = mdclog_internal_put_svarint(buffer, sizeof(buffer), expected);
+        ASSERT_GT(len, 0U);
+        EXPECT_EQ(len, mdclog_internal_get_svarint(buffer, len, &svalue));
+        EXPECT_EQ(expected, svalue);
+    }
+    EXPECT_EQ(1U, mdclog_internal_put_svarint(buffer, sizeof(buffer), -1));
+    EXPECT_EQ((size_t)VARINT_MAX_LENGTH, mdclog_internal_put_varint(buffer, sizeof(buffer), UINT64_MAX));
+}
+
+TEST(VarintTest, VarintIsNotWrittenToTooShortBuffer)
+{
+    char buffer[VARINT_MAX_LENGTH];
+
+    EXPECT_EQ(0U, mdclog_internal_put_varint(buffer, 1, 128));
+    EXPECT_EQ(2U, mdclog_internal_put_varint(buffer, 2, 128));
+}
+
+TEST(VarintTest, TooLongVarintIsNotRead)
+{
+    char buffer[VARINT_MAX_LENGTH + 1];
+    uint64_t value;
+
+    memset(buffer, 0x80, sizeof(buffer));
+    buffer[VARINT_MAX_LENGTH] = 0x01;
+    EXPECT_EQ(0U, mdclog_internal_get_varint(buffer, sizeof(buffer), &value));
+}
+
+class BinaryTest: public testing::Test
+{
+public:
+    struct binary_stream stream;
+    struct binary_encoder* encoder;
+    struct binary_decoder* decoder;
+    struct json_schema schema;
+    struct timeval tv = {1550667066, 123456};
+    std::string data;
+    std::vector<std::string> entries;
+    std::vector<std::string> expected;
+
+    void SetUp()
+    {
+        ASSERT_EQ(0, mdclog_internal_init_mdc());
+        memset(&stream, 0, sizeof(stream));
+        mdclog_internal_default_layout(&stream.layout);
+        snprintf(stream.identity, sizeof(stream.identity), "%s", "Mickey Mouse");
+        stream.timestamp_format = MDCLOG_TIMESTAMP_EPOCH_MS;
+        stream.max_entry_size = PIPE_BUF;
+        encoder = mdclog_internal_binary_encoder_create();
+        decoder = mdclog_internal_binary_decoder_create();
+        ASSERT_NE(nullptr, encoder);
+        ASSERT_NE(nullptr, decoder);
+        reset();
+    }
+
+    void TearDown()
+    {
+        mdclog_internal_binary_encoder_destroy(encoder);
+        mdclog_internal_binary_decoder_destroy(decoder);
+        mdclog_internal_destroy_mdclist();
+        mdclog_internal_clean_global_mdcs();
+    }
+
+    void reset()
+    {
+        mdclog_internal_binary_encoder_reset(encoder, &stream);
+        mdclog_internal_compile_schema(&schema, &stream.layout, stream.identity);
+        schema.timestamp_format = stream.timestamp_format;
+    }
+
+    /*
+     * Encode an entry, and format the json entry the library would write
+     */
+    long encode(mdclog_severity_t severity, const char* fmt, ...)
+    {
+        std::vector<char> buffer(stream.max_entry_size);
+        struct json_info info;
+        const char* records;
+        va_list arglist;
+        long len;
+        int ret;
+
+        mdclog_internal_epoch_enter();
+        va_start(arglist, fmt);
+        len = mdclog_internal_binary_encode(encoder, &tv, severity, mdclog_internal_get_first_mdc(), fmt, arglist, &records);
+        va_end(arglist);
+        if (len > 0)
+            data.append(records, (size_t)len);
+
+        va_start(arglist, fmt);
+        ret = mdclog_internal_format_to_json_str(buffer.data(), PIPE_BUF - 1, &tv, &schema, severity,
+                                                 mdclog_internal_get_first_mdc(), &info, fmt, arglist);
+        va_end(arglist);
+        if (info.truncated && stream.max_entry_size > PIPE_BUF)
+        {
+            va_start(arglist, fmt);
+            ret = mdclog_internal_format_to_json_str(buffer.data(), stream.max_entry_size - 1, &tv, &schema, severity,
+                                                     mdclog_internal_get_first_mdc(), &info, fmt, arglist);
+            va_end(arglist);
+        }
+        mdclog_internal_epoch_leave();
+        if (len > 0 && ret > 0)
+            expected.push_back(std::string(buffer.data(), (size_t)ret));
+        return len;
+    }
+
+    long decode()
+    {
+        return mdclog_internal_binary_decode(decoder, data.data(), data.size(), collect_entry, &entries);
+    }
+
+    void expect_round_trip()
+    {
+        EXPECT_EQ((long)data.size(), decode());
+        EXPECT_THAT(entries, ContainerEq(expected));
+    }
+};
+
+TEST_F(BinaryTest, EntriesAreDecodedToTheJsonOfTheLibrary)
+{
+    const char* null_str = NULL;
+
+    ASSERT_GT(encode(MDCLOG_ERR, "Test log %d", 999), 0);
+    ASSERT_GT(encode(MDCLOG_INFO, "%s %s %c%%", "a \"quoted\" string", null_str, 'x'), 0);
+    ASSERT_GT(encode(MDCLOG_DEBUG, "%ld %lld %hd %hhu %zu %u %x", -1L, LLONG_MIN, (short)-2, 255, (size_t)77, 3U, 0xabcU), 0);
+    ASSERT_GT(encode(MDCLOG_WARN, "%.3f %e %Lg %p", 3.14159, -2.5e-10, (long double)1.5, (void*)0x1234), 0);
+    ASSERT_GT(encode(MDCLOG_TRACE, "%-10s|%*d|%.*s", "left", 5, 42, 2, "abc"), 0);
+    ASSERT_GT(encode(MDCLOG_FATAL, "no arguments"), 0);
+    expect_round_trip();
+}
+
+TEST_F(BinaryTest, FormatIsDefinedOnlyOnce)
+{
+    long first = encode(MDCLOG_ERR, "Test log %d", 1);
+    long second = encode(MDCLOG_ERR, "Test log %d", 2);
+
+    ASSERT_GT(first, 0);
+    ASSERT_GT(second, 0);
+    EXPECT_EQ(BINARY_RECORD_HEADER, data[0]);
+    EXPECT_NE(std::string::npos, data.find("Test log %d"));
+    EXPECT_EQ(data.find("Test log %d"), data.rfind("Test log %d"));
+    EXPECT_EQ(BINARY_RECORD_ENTRY, data[(size_t)first]);
+    EXPECT_LT(second, 16);
+    expect_round_trip();
+}
+
+TEST_F(BinaryTest, ThreadAndGlobalMdcsAreDecoded)
+{
+    const char* keys[] = { "g1", "g2" };
+    const char* values[] = { "v1", "v2" };
+
+    ASSERT_EQ(0, mdclog_internal_set_global_mdcs(keys, values, 2));
+    ASSERT_EQ(0, mdclog_internal_put_mdc("key1", "value1"));
+    ASSERT_GT(encode(MDCLOG_ERR, "with globals"), 0);
+    ASSERT_EQ(0, mdclog_internal_put_mdc("g1", "thread \"quoted\""));
+    ASSERT_GT(encode(MDCLOG_ERR, "with an overridden global"), 0);
+    mdclog_internal_clean_mdclist();
+    ASSERT_GT(encode(MDCLOG_ERR, "only globals"), 0);
+    expect_round_trip();
+}
+
+TEST_F(BinaryTest, CustomLayoutIsDecoded)
+{
+    const mdclog_field_t order[] = { MDCLOG_FIELD_SEVERITY, MDCLOG_FIELD_TIMESTAMP, MDCLOG_FIELD_MESSAGE };
+
+    ASSERT_EQ(0, mdclog_internal_set_layout_key(&stream.layout, MDCLOG_FIELD_MESSAGE, "message"));
+    ASSERT_EQ(0, mdclog_internal_set_layout_order(&stream.layout, order, 3));
+    stream.timestamp_format = MDCLOG_TIMESTAMP_RFC3339;
+    reset();
+    ASSERT_GT(encode(MDCLOG_INFO, "custom %s", "layout"), 0);
+    expect_round_trip();
+    ASSERT_EQ(1U, entries.size());
+    EXPECT_THAT(entries[0], StartsWith("{\"crit\":\"INFO\",\"ts\":\"2019-02-20T12:51:06.123Z\",\"message\""));
+}
+
+TEST_F(BinaryTest, UnsupportedFormatIsRenderedWhenEncoded)
+{
+    errno = ENOENT;
+    ASSERT_GT(encode(MDCLOG_ERR, "error: %m"), 0);
+    ASSERT_GT(encode(MDCLOG_ERR, "%2$s %1$s", "world", "hello"), 0);
+    expect_round_trip();
+    ASSERT_EQ(2U, entries.size());
+    EXPECT_THAT(entries[1], HasSubstr("\"msg\":\"hello world\""));
+}
+
+TEST_F(BinaryTest, TooLongMessageIsTruncatedLikeByTheLibrary)
+{
+    std::string msg(2 * PIPE_BUF, 'a');
+
+    ASSERT_GT(encode(MDCLOG_ERR, "%s", msg.c_str()), 0);
+    EXPECT_LT(data.size(), (size_t)PIPE_BUF + 256);
+    stream.max_entry_size = 4 * PIPE_BUF;
+    reset();
+    ASSERT_GT(encode(MDCLOG_ERR, "%s", msg.c_str()), 0);
+    ASSERT_GT(encode(MDCLOG_ERR, "%s%s%s", msg.c_str(), msg.c_str(), msg.c_str()), 0);
+    expect_round_trip();
+    ASSERT_EQ(3U, entries.size());
+    EXPECT_LT(entries[0].size(), (size_t)PIPE_BUF);
+    EXPECT_GT(entries[1].size(), msg.size());
+}
+
+TEST_F(BinaryTest, UnknownSeverityAndTimeGoingBackwardsAreDecoded)
+{
+    ASSERT_GT(encode(static_cast<mdclog_severity_t>(42), "unknown severity"), 0);
+    tv = {1550667000, 999999};
+    ASSERT_GT(encode(MDCLOG_ERR, "earlier"), 0);
+    tv = {0, 1};
+    ASSERT_GT(encode(MDCLOG_ERR, "epoch"), 0);
+    expect_round_trip();
+}
+
+TEST_F(BinaryTest, StreamIsDecodedInPieces)
+{
+    std::string all;
+
+    ASSERT_GT(encode(MDCLOG_ERR, "first %d %s", 1, "one"), 0);
+    ASSERT_EQ(0, mdclog_internal_put_mdc("key1", "value1"));
+    ASSERT_GT(encode(MDCLOG_ERR, "second %f", 2.0), 0);
+    all = data;
+    data.clear();
+    for (char c: all)
+    {
+        long decoded;
+
+        data.push_back(c);
+        decoded = decode();
+        ASSERT_GE(decoded, 0);
+        data.erase(0, (size_t)decoded);
+    }
+    EXPECT_TRUE(data.empty());
+    EXPECT_THAT(entries, ContainerEq(expected));
+}
+
+TEST_F(BinaryTest, NewStreamStartsWithHeader)
+{
+    long first = encode(MDCLOG_ERR, "Test log %d", 1);
+
+    reset();
+    ASSERT_GT(first, 0);
+    ASSERT_GT(encode(MDCLOG_ERR, "Test log %d", 2), 0);
+    EXPECT_EQ(BINARY_RECORD_HEADER, data[(size_t)first]);
+    expect_round_trip();
+}
+
+TEST_F(BinaryTest, FormatsBeyondTheDictionaryAreWrittenToEntries)
+{
+    char fmt[32];
+
+    for (int i = 0; i < BINARY_MAX_DEFINITIONS + 10; i++)
+    {
+        snprintf(fmt, sizeof(fmt), "format %d %%d", i);
+        ASSERT_GT(encode(MDCLOG_ERR, fmt, i), 0);
+    }
+    expect_round_trip();
+}
+
+TEST_F(BinaryTest, InvalidStreamIsNotDecoded)
+{
+    ASSERT_GT(encode(MDCLOG_ERR, "Test log %d", 1), 0);
+    std::string valid = data;
+
+    data = valid.substr(valid.find(BINARY_RECORD_ENTRY, 1));
+    errno = 0;
+    EXPECT_EQ(-1, decode());
+    EXPECT_EQ(EINVAL, errno);
+
+    data = valid;
+    data[1] = 'X';
+    EXPECT_EQ(-1, decode());
+    EXPECT_EQ(EINVAL, errno);
+
+    data = "Z";
+    EXPECT_EQ(-1, decode());
+    EXPECT_EQ(EINVAL, errno);
+    EXPECT_TRUE(entries.empty());
+}
+
+class BinaryApiTest: public testing::Test
+{
+public:
+    NiceMock<mdclogtest::SystemMock> systemMock;
+    std::string dir;
+    std::string path;
+    mdclog_attr_t* attr;
+
+    void SetUp()
+    {
+        char name[] = "/tmp/mdclog_binary_XXXXXX";
+
+        ASSERT_NE(nullptr, mkdtemp(name));
+        dir = name;
+        path = dir + "/test.log";
+        // the entries are expected with only the MDCs the tests add
+        mdclog_mdc_clean();
+        mdclogtest::setSystemMock(&systemMock);
+        ON_CALL(systemMock, write(_, NotNull(), _))
+            .WillByDefault(Invoke([] (int fd, const void* buffer, size_t len)
+            {
+                return ::write(fd, buffer, len);
+            }));
+        ASSERT_EQ(0, mdclog_attr_init(&attr));
+        ASSERT_EQ(0, mdclog_attr_set_ident(attr, "binary"));
+        ASSERT_EQ(0, mdclog_attr_set_output_format(attr, MDCLOG_OUTPUT_BINARY));
+    }
+
+    void TearDown()
+    {
+        mdclog_attr_destroy(attr);
+        mdclog_lib_clean();
+        for (const char* suffix: { "", ".1", ".2" })
+            unlink((path + suffix).c_str());
+        rmdir(dir.c_str());
+    }
+
+    std::vector<std::string> decode_file(const std::string& name)
+    {
+        std::vector<std::string> entries;
+        struct binary_decoder* decoder = mdclog_internal_binary_decoder_create();
+        std::string content;
+        char buffer[4096];
+        ssize_t n;
+        int fd = open(name.c_str(), O_RDONLY);
+
+        EXPECT_GE(fd, 0) << name;
+        while (fd >= 0 && (n = read(fd, buffer, sizeof(buffer))) > 0)
+            content.append(buffer, (size_t)n);
+        if (fd >= 0)
+            close(fd);
+        EXPECT_EQ((long)content.size(), mdclog_internal_binary_decode(decoder, content.data(), content.size(),
+                                                                      collect_entry, &entries)) << name;
+        mdclog_internal_binary_decoder_destroy(decoder);
+        return entries;
+    }
+};
+
+TEST_F(BinaryApiTest, InvalidOutputFormatIsNotAccepted)
+{
+    EXPECT_EQ(-1, mdclog_attr_set_output_format(attr, static_cast<mdclog_output_format_t>(2)));
+    EXPECT_EQ(EINVAL, errno);
+}
+
+TEST_F(BinaryApiTest, EachRotatedFileIsDecodedOnItsOwn)
+{
+    std::vector<std::string> entries;
+
+    ASSERT_EQ(0, mdclog_attr_set_file(attr, path.c_str()));
+    ASSERT_EQ(0, mdclog_attr_set_file_rotation(attr, 512, 0));
+    ASSERT_EQ(0, mdclog_attr_set_file_retention(attr, 2));
+    ASSERT_EQ(0, mdclog_init(attr));
+    mdclog_mdc_add("key", "value");
+    for (int i = 0; i < 40; i++)
+        mdclog_write(MDCLOG_ERR, "binary entry %d of %s", i, "the test");
+    mdclog_mdc_clean();
+    mdclog_lib_clean();
+
+    for (const char* suffix: { ".2", ".1", "" })
+    {
+        std::vector<std::string> file_entries = decode_file(path + suffix);
+        if (*suffix)
+        {
+            EXPECT_FALSE(file_entries.empty()) << suffix;
+        }
+        entries.insert(entries.end(), file_entries.begin(), file_entries.end());
+    }
+    ASSERT_FALSE(entries.empty());
+    EXPECT_THAT(entries.back(), HasSubstr("\"msg\":\"binary entry 39 of the test\""));
+    EXPECT_THAT(entries.back(), HasSubstr("\"id\":\"binary\""));
+    EXPECT_THAT(entries.back(), HasSubstr("\"mdc\":{\"key\":\"value\"}"));
+}
+
+TEST_F(BinaryApiTest, DecodingDoesNotChangeTheTimestampFormatOfTheLogger)
+{
+    std::vector<std::string> entries;
+    std::string json_path = path + ".1";
+    mdclog_attr_t* json_attr;
+    char buffer[4096];
+    ssize_t n;
+    int fd;
+
+    ASSERT_EQ(0, mdclog_attr_set_file(attr, path.c_str()));
+    ASSERT_EQ(0, mdclog_attr_set_timestamp_format(attr, MDCLOG_TIMESTAMP_RFC3339));
+    ASSERT_EQ(0, mdclog_init(attr));
+    mdclog_write(MDCLOG_ERR, "binary entry");
+    mdclog_lib_clean();
+
+    ASSERT_EQ(0, mdclog_attr_init(&json_attr));
+    ASSERT_EQ(0, mdclog_attr_set_file(json_attr, json_path.c_str()));
+    ASSERT_EQ(0, mdclog_init(json_attr));
+    mdclog_attr_destroy(json_attr);
+    entries = decode_file(path);
+    mdclog_write(MDCLOG_ERR, "json entry");
+    mdclog_lib_clean();
+
+    ASSERT_EQ(1U, entries.size());
+    EXPECT_THAT(entries[0], HasSubstr("\"ts\":\"2"));
+    fd = open(json_path.c_str(), O_RDONLY);
+    ASSERT_GE(fd, 0);
+    n = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+    ASSERT_GT(n, 0);
+    buffer[n] = '\0';
+    EXPECT_THAT(buffer, HasSubstr("\"msg\":\"json entry\""));
+    EXPECT_THAT(buffer, ContainsRegex("\"ts\":[0-9]+,"));
+}
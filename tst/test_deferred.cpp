@@ -0,0 +1,209 @@
+/*
+ * Tests for deferred formatting of printf style arguments
+ *
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ */
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <wchar.h>
+
+#include "private/deferred.h"
+
+using namespace testing;
+
+class DeferredTest: public testing::Test
+{
+public:
+    char args[1024];
+    char buffer[1024];
+    char expected[1024];
+
+    int captureTo(size_t len, const char* format, ...)
+    {
+        int ret;
+        va_list arglist;
+        va_start(arglist, format);
+        ret = mdclog_internal_capture_args(args, len, format, arglist);
+        va_end(arglist);
+        return ret;
+    }
+
+    template <typename... Args>
+    int capture(const char* format, Args... arguments)
+    {
+        return captureTo(sizeof(args), format, arguments...);
+    }
+
+    /*
+     * Capture and render the arguments, and compare the result to vsnprintf()
+     */
+    void expectSameAsPrintf(const char* format, ...)
+    {
+        int args_len;
+        int expected_len;
+        va_list arglist;
+
+        va_start(arglist, format);
+        args_len = mdclog_internal_capture_args(args, sizeof(args), format, arglist);
+        va_end(arglist);
+        va_start(arglist, format);
+        expected_len = vsnprintf(expected, sizeof(expected), format, arglist);
+        va_end(arglist);
+
+        ASSERT_GE(args_len, 0) << format;
+        EXPECT_EQ(expected_len, mdclog_internal_render_args(buffer, sizeof(buffer), format, args, args_len)) << format;
+        EXPECT_THAT(buffer, StrEq(expected)) << format;
+
+        // the packed arguments are rendered the same after unpacking them
+        va_start(arglist, format);
+        packed_len = mdclog_internal_pack_args(packed, sizeof(packed), format, arglist);
+        va_end(arglist);
+        ASSERT_GE(packed_len, 0) << format;
+        args_len = mdclog_internal_unpack_args(args, sizeof(args), format, packed, packed_len);
+        ASSERT_GE(args_len, 0) << format;
+        EXPECT_EQ(expected_len, mdclog_internal_render_args(buffer, sizeof(buffer), format, args, args_len)) << format;
+        EXPECT_THAT(buffer, StrEq(expected)) << format;
+    }
+
+    int pack(const char* format, ...)
+    {
+        int ret;
+        va_list arglist;
+        va_start(arglist, format);
+        ret = mdclog_internal_pack_args(packed, sizeof(packed), format, arglist);
+        va_end(arglist);
+        return ret;
+    }
+
+    char packed[1024];
+    int  packed_len;
+};
+
+TEST_F(DeferredTest, IntegersAreFormattedLikePrintf)
+{
+    expectSameAsPrintf("%d %i %u %x %X %o", -1, 2, 3U, 0xabU, 0xcdU, 8U);
+    expectSameAsPrintf("%hd %hhu %c", (short)-5, (unsigned char)250, 'z');
+    expectSameAsPrintf("%ld %lu %lld %llx", -1234567890L, 1234567890UL, -12345678901234LL, 0xfedcba987654ULL);
+    expectSameAsPrintf("%zu %zd %jd %td", (size_t)123, (ssize_t)-123, (intmax_t)-9, (ptrdiff_t)77);
+    expectSameAsPrintf("%-8d|%08d|%+d|% d|%#x", 1, 2, 3, 4, 0x10U);
+}
+
+TEST_F(DeferredTest, FloatingPointNumbersAreFormattedLikePrintf)
+{
+    expectSameAsPrintf("%f %e %g %a", 1.5, -2.25e10, 0.0001, 3.0);
+    expectSameAsPrintf("%.2f %10.3E %Lf %Lg", 3.14159, 2.5, (long double)1.25, (long double)-7.5);
+}
+
+TEST_F(DeferredTest, StringsAreCopiedAndFormattedLikePrintf)
+{
+    char str[] = "changes";
+    int args_len = capture("<%s>", str);
+    ASSERT_GT(args_len, 0);
+    strcpy(str, "changed");
+    EXPECT_EQ(9, mdclog_internal_render_args(buffer, sizeof(buffer), "<%s>", args, args_len));
+    EXPECT_THAT(buffer, StrEq("<changes>"));
+
+    expectSameAsPrintf("%s|%10s|%-10s|%.3s", "abc", "right", "left", "truncated");
+}
+
+TEST_F(DeferredTest, PrecisionLimitsStringThatIsNotZeroTerminated)
+{
+    const char str[] = {'a', 'b', 'c', 'd'};
+    expectSameAsPrintf("%.3s", str);
+    expectSameAsPrintf("%.*s", 2, str);
+}
+
+TEST_F(DeferredTest, NullStringIsFormattedLikePrintf)
+{
+    const char* str = NULL;
+    expectSameAsPrintf("%s", str);
+}
+
+TEST_F(DeferredTest, WidthAndPrecisionArgumentsAreFormattedLikePrintf)
+{
+    expectSameAsPrintf("%*d|%-*d|%.*f|%*.*f", 5, 1, 6, 2, 3, 1.23456, 10, 2, 9.87654);
+    expectSameAsPrintf("%*s|%.*s", 8, "abc", 2, "abcdef");
+}
+
+TEST_F(DeferredTest, PercentAndPointerAreFormattedLikePrintf)
+{
+    int value = 0;
+    expectSameAsPrintf("100%% %p %%", (void*)&value);
+    expectSameAsPrintf("no arguments");
+}
+
+TEST_F(DeferredTest, UnsupportedConversionsCannotBeCaptured)
+{
+    int count;
+    EXPECT_EQ(-1, capture("%s%n", "abc", &count));
+    EXPECT_EQ(-1, capture("%m"));
+    EXPECT_EQ(-1, capture("%1$s", "abc"));
+    EXPECT_EQ(-1, capture("%ls", L"abc"));
+    EXPECT_EQ(-1, capture("%lc", (wint_t)L'a'));
+}
+
+TEST_F(DeferredTest, ArgumentsCannotBeCapturedToTooShortBuffer)
+{
+    EXPECT_EQ(-1, captureTo(4, "%s", "too long"));
+}
+
+TEST_F(DeferredTest, OutputIsTruncatedToFitToBuffer)
+{
+    int args_len = capture("%s %d", "abcdef", 12345);
+    ASSERT_GT(args_len, 0);
+    EXPECT_EQ(12, mdclog_internal_render_args(buffer, 8, "%s %d", args, args_len));
+    EXPECT_THAT(buffer, StrEq("abcdef "));
+}
+
+TEST_F(DeferredTest, TruncatedArgumentPayloadIsAnError)
+{
+    int args_len = capture("%s %d", "abcdef", 12345);
+    ASSERT_GT(args_len, 0);
+    EXPECT_EQ(-1, mdclog_internal_render_args(buffer, sizeof(buffer), "%s %d", args, args_len - 1));
+}
+
+TEST_F(DeferredTest, SmallIntegersArePackedToOneByte)
+{
+    EXPECT_EQ(3, pack("%d %ld %zu", -1, 63L, (size_t)127));
+    EXPECT_EQ(6, pack("%s", "abcde"));
+    EXPECT_EQ(1, pack("%s", (const char*)NULL));
+}
+
+TEST_F(DeferredTest, UnsupportedConversionsCannotBePacked)
+{
+    int count;
+    EXPECT_EQ(-1, pack("%s%n", "abc", &count));
+    EXPECT_EQ(-1, pack("%m"));
+    EXPECT_EQ(-1, pack("%1$s", "abc"));
+}
+
+TEST_F(DeferredTest, InvalidPackedArgumentsCannotBeUnpacked)
+{
+    packed_len = pack("%s %d", "abcdef", 12345);
+    ASSERT_GT(packed_len, 0);
+    EXPECT_EQ(-1, mdclog_internal_unpack_args(args, sizeof(args), "%s %d", packed, packed_len - 1));
+    EXPECT_EQ(-1, mdclog_internal_unpack_args(args, sizeof(args), "%s", packed, packed_len));
+    EXPECT_EQ(-1, mdclog_internal_unpack_args(args, sizeof(args), "%s %d %d", packed, packed_len));
+    EXPECT_EQ(-1, mdclog_internal_unpack_args(args, 8, "%s %d", packed, packed_len));
+    EXPECT_EQ(-1, mdclog_internal_unpack_args(args, sizeof(args), "%m", packed, packed_len));
+}
@@ -0,0 +1,148 @@
+/*
+ * Tests for the epoch based reclamation
+ *
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ */
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "private/epoch.h"
+
+using namespace testing;
+
+class EpochTest: public testing::Test
+{
+public:
+    std::atomic<bool> entered;
+    std::atomic<bool> leave;
+    std::atomic<bool> synchronized;
+
+    void SetUp()
+    {
+        entered = false;
+        leave = false;
+        synchronized = false;
+    }
+
+    std::thread startReader(int depth)
+    {
+        return std::thread([this, depth]()
+        {
+            for (int i = 0; i < depth; i++)
+                mdclog_internal_epoch_enter();
+            entered = true;
+            while (!leave)
+                std::this_thread::yield();
+            for (int i = 0; i < depth; i++)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                EXPECT_FALSE(synchronized);
+                mdclog_internal_epoch_leave();
+            }
+        });
+    }
+
+    void waitUntilEntered()
+    {
+        while (!entered)
+            std::this_thread::yield();
+    }
+};
+
+TEST_F(EpochTest, SynchronizeReturnsWhenThereAreNoReaders)
+{
+    mdclog_internal_epoch_enter();
+    mdclog_internal_epoch_leave();
+    mdclog_internal_epoch_synchronize();
+}
+
+TEST_F(EpochTest, SynchronizeWaitsUntilReaderHasLeftNestedCriticalSections)
+{
+    std::thread reader(startReader(3));
+    waitUntilEntered();
+    std::thread writer([this]()
+    {
+        mdclog_internal_epoch_synchronize();
+        synchronized = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_FALSE(synchronized);
+    leave = true;
+    reader.join();
+    writer.join();
+    EXPECT_TRUE(synchronized);
+}
+
+namespace
+{
+    struct Data
+    {
+        std::atomic<int> magic;
+    };
+}
+
+TEST_F(EpochTest, ReadersNeverSeeFreedData)
+{
+    const int magic = 0x12345678;
+    std::atomic<Data*> published(new Data{ {magic} });
+    std::atomic<bool> stop(false);
+    std::vector<std::thread> readers;
+
+    for (int i = 0; i < 4; i++)
+        readers.emplace_back([&]()
+        {
+            while (!stop)
+            {
+                mdclog_internal_epoch_enter();
+                Data* data = published.load(std::memory_order_acquire);
+                for (int j = 0; j < 10; j++)
+                    ASSERT_EQ(magic, data->magic.load(std::memory_order_relaxed));
+                mdclog_internal_epoch_leave();
+            }
+        });
+    for (int i = 0; i < 2000; i++)
+    {
+        Data* old = published.exchange(new Data{ {magic} });
+        mdclog_internal_epoch_synchronize();
+        old->magic = 0;
+        delete old;
+    }
+    stop = true;
+    for (auto& reader: readers)
+        reader.join();
+    delete published.load();
+}
+
+TEST_F(EpochTest, RecordOfExitedThreadIsReused)
+{
+    for (int i = 0; i < 100; i++)
+    {
+        std::thread reader([]()
+        {
+            mdclog_internal_epoch_enter();
+            mdclog_internal_epoch_leave();
+        });
+        reader.join();
+    }
+    mdclog_internal_epoch_synchronize();
+}
@@ -0,0 +1,305 @@
+/*
+ * Tests for the rotated log file output
+ *
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ */
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <chrono>
+#include <errno.h>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <stdlib.h>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "mdclog/mdclog.h"
+#include "private/filesink.h"
+#include "system_mock.hpp"
+
+using namespace testing;
+using namespace mdclogtest;
+
+extern "C" {
+void mdclog_lib_clean(void);
+}
+
+class FileSinkTest: public testing::Test
+{
+public:
+    NiceMock<SystemMock>    systemMock;
+    std::string             dir;
+    std::string             path;
+    struct file_sink_config config;
+
+    void SetUp()
+    {
+        char name[] = "/tmp/mdclog_filesink_XXXXXX";
+
+        ASSERT_NE(nullptr, mkdtemp(name));
+        dir = name;
+        path = dir + "/test.log";
+        config = {};
+        config.retention = 3;
+        setSystemMock(&systemMock);
+        ON_CALL(systemMock, write(_, NotNull(), _))
+            .WillByDefault(Invoke([] (int fd, const void* buffer, size_t len)
+            {
+                return ::write(fd, buffer, len);
+            }));
+    }
+
+    void TearDown()
+    {
+        mdclog_internal_file_sink_set(NULL);
+        mdclog_lib_clean();
+        for (int i = 0; i <= 10; i++)
+            unlink(fileName(i).c_str());
+        rmdir(dir.c_str());
+    }
+
+    std::string fileName(int index)
+    {
+        return index ? path + "." + std::to_string(index) : path;
+    }
+
+    bool exists(int index)
+    {
+        struct stat st;
+
+        return stat(fileName(index).c_str(), &st) == 0;
+    }
+
+    std::string read(int index)
+    {
+        std::ifstream     file(fileName(index));
+        std::stringstream content;
+
+        content << file.rdbuf();
+        return content.str();
+    }
+
+    void open()
+    {
+        struct file_sink *sink = mdclog_internal_file_sink_open(path.c_str(), &config);
+
+        ASSERT_NE(nullptr, sink);
+        mdclog_internal_file_sink_set(sink);
+    }
+
+    void write(const std::string& line)
+    {
+        EXPECT_EQ((ssize_t)line.size(), mdclog_internal_output_write(line.data(), line.size()));
+    }
+};
+
+TEST_F(FileSinkTest, OutputIsWrittenToStdoutWithoutSink)
+{
+    EXPECT_CALL(systemMock, write(STDOUT_FILENO, NotNull(), 6)).WillOnce(Return(6));
+    EXPECT_FALSE(mdclog_internal_file_sink_active());
+    write("entry\n");
+}
+
+TEST_F(FileSinkTest, OutputFdIsTheCurrentFile)
+{
+    struct stat output;
+    struct stat file;
+    unsigned long generation = mdclog_internal_output_generation();
+
+    EXPECT_EQ(STDOUT_FILENO, mdclog_internal_output_fd());
+    open();
+    EXPECT_NE(generation, mdclog_internal_output_generation());
+    ASSERT_EQ(0, fstat(mdclog_internal_output_fd(), &output));
+    ASSERT_EQ(0, stat(path.c_str(), &file));
+    EXPECT_EQ(file.st_ino, output.st_ino);
+    mdclog_internal_file_sink_set(NULL);
+    EXPECT_EQ(STDOUT_FILENO, mdclog_internal_output_fd());
+}
+
+TEST_F(FileSinkTest, OutputIsAppendedToFile)
+{
+    {
+        std::ofstream existing(path);
+        existing << "old\n";
+    }
+    open();
+    EXPECT_TRUE(mdclog_internal_file_sink_active());
+    write("first\n");
+    write("second\n");
+    mdclog_internal_file_sink_set(NULL);
+    EXPECT_FALSE(mdclog_internal_file_sink_active());
+    EXPECT_EQ("old\nfirst\nsecond\n", read(0));
+}
+
+TEST_F(FileSinkTest, PreallocatedBlocksAreNotVisibleInTheFileSize)
+{
+    struct stat st;
+
+    config.max_size = 1024 * 1024;
+    open();
+    write("entry\n");
+    ASSERT_EQ(0, stat(path.c_str(), &st));
+    EXPECT_EQ(6, st.st_size);
+    mdclog_internal_file_sink_set(NULL);
+    ASSERT_EQ(0, stat(path.c_str(), &st));
+    EXPECT_EQ(6, st.st_size);
+}
+
+TEST_F(FileSinkTest, FileIsRotatedWhenTheSizeIsReached)
+{
+    config.max_size = 10;
+    open();
+    write("12345\n");
+    EXPECT_FALSE(exists(1));
+    write("67890\n");
+    EXPECT_EQ("12345\n67890\n", read(1));
+    write("abc\n");
+    EXPECT_EQ("abc\n", read(0));
+}
+
+TEST_F(FileSinkTest, OnlyTheRetainedNumberOfRotatedFilesIsKept)
+{
+    config.max_size = 1;
+    open();
+    for (int i = 0; i < 6; i++)
+        write(std::to_string(i) + "\n");
+    // every write fills the file, and the file is rotated after it
+    EXPECT_EQ("", read(0));
+    EXPECT_EQ("5\n", read(1));
+    EXPECT_EQ("4\n", read(2));
+    EXPECT_EQ("3\n", read(3));
+    EXPECT_FALSE(exists(4));
+}
+
+TEST_F(FileSinkTest, RotatedFileIsRemovedWithZeroRetention)
+{
+    config.max_size = 1;
+    config.retention = 0;
+    open();
+    write("first\n");
+    EXPECT_EQ("", read(0));
+    EXPECT_FALSE(exists(1));
+}
+
+TEST_F(FileSinkTest, FileIsRotatedWhenTheIntervalElapses)
+{
+    config.interval_ns = 50000000ULL;
+    open();
+    write("first\n");
+    EXPECT_FALSE(exists(1));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    write("second\n");
+    write("third\n");
+    EXPECT_EQ("first\nsecond\n", read(1));
+    EXPECT_EQ("third\n", read(0));
+}
+
+TEST_F(FileSinkTest, NoEntryIsLostWhenThreadsWriteDuringRotation)
+{
+    const int                threads = 4;
+    const int                entries = 2000;
+    std::vector<std::thread> writers;
+    std::set<std::string>    lines;
+    std::string              line;
+    int                      files = 0;
+
+    config.max_size = 4096;
+    config.retention = MDCLOG_MAX_FILE_RETENTION;
+    open();
+    for (int t = 0; t < threads; t++)
+        writers.emplace_back([t]()
+        {
+            for (int i = 0; i < entries; i++)
+            {
+                std::string entry = std::to_string(t) + ":" + std::to_string(i) + "\n";
+                mdclog_internal_output_write(entry.data(), entry.size());
+            }
+        });
+    for (auto& writer: writers)
+        writer.join();
+    mdclog_internal_file_sink_set(NULL);
+    for (int i = 0; i <= MDCLOG_MAX_FILE_RETENTION && exists(i); i++, files++)
+    {
+        std::istringstream content(read(i));
+
+        while (std::getline(content, line))
+            EXPECT_TRUE(lines.insert(line).second) << line;
+        unlink(fileName(i).c_str());
+    }
+    EXPECT_LT(1, files);
+    EXPECT_EQ((size_t)(threads * entries), lines.size());
+}
+
+TEST_F(FileSinkTest, FileCannotBeOpenedInMissingDirectory)
+{
+    errno = 0;
+    EXPECT_EQ(nullptr, mdclog_internal_file_sink_open((dir + "/missing/test.log").c_str(), &config));
+    EXPECT_EQ(ENOENT, errno);
+}
+
+TEST_F(FileSinkTest, LogEntriesAreWrittenToTheConfiguredFile)
+{
+    mdclog_attr_t *attr;
+
+    ASSERT_EQ(0, mdclog_attr_init(&attr));
+    EXPECT_EQ(0, mdclog_attr_set_file(attr, path.c_str()));
+    EXPECT_EQ(0, mdclog_attr_set_file_rotation(attr, 1024 * 1024, 3600));
+    EXPECT_EQ(0, mdclog_init(attr));
+    mdclog_attr_destroy(attr);
+    mdclog_write(MDCLOG_ERR, "to file");
+    EXPECT_EQ(0, mdclog_init(NULL));
+    EXPECT_FALSE(mdclog_internal_file_sink_active());
+    EXPECT_THAT(read(0), EndsWith(",\"msg\":\"to file\"}\n"));
+}
+
+TEST_F(FileSinkTest, InitFailsIfTheFileCannotBeOpened)
+{
+    mdclog_attr_t *attr;
+
+    ASSERT_EQ(0, mdclog_attr_init(&attr));
+    EXPECT_EQ(0, mdclog_attr_set_file(attr, (dir + "/missing/test.log").c_str()));
+    EXPECT_EQ(-1, mdclog_init(attr));
+    EXPECT_EQ(ENOENT, errno);
+    mdclog_attr_destroy(attr);
+    EXPECT_FALSE(mdclog_internal_file_sink_active());
+}
+
+TEST_F(FileSinkTest, InvalidFileAttributesAreNotAccepted)
+{
+    mdclog_attr_t *attr;
+
+    EXPECT_EQ(-1, mdclog_attr_set_file(NULL, "test.log"));
+    EXPECT_EQ(EINVAL, errno);
+    EXPECT_EQ(-1, mdclog_attr_set_file_rotation(NULL, 1024, 0));
+    EXPECT_EQ(EINVAL, errno);
+    EXPECT_EQ(-1, mdclog_attr_set_file_retention(NULL, 1));
+    EXPECT_EQ(EINVAL, errno);
+    ASSERT_EQ(0, mdclog_attr_init(&attr));
+    EXPECT_EQ(-1, mdclog_attr_set_file(attr, ""));
+    EXPECT_EQ(EINVAL, errno);
+    EXPECT_EQ(-1, mdclog_attr_set_file_retention(attr, MDCLOG_MAX_FILE_RETENTION + 1));
+    EXPECT_EQ(EINVAL, errno);
+    EXPECT_EQ(0, mdclog_attr_set_file(attr, "test.log"));
+    EXPECT_EQ(0, mdclog_attr_set_file(attr, NULL));
+    mdclog_attr_destroy(attr);
+}
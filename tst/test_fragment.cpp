@@ -0,0 +1,127 @@
+/*
+ * Tests for the fragmentation of large log entries
+ *
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ */
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <limits.h>
+#include <regex>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "private/fragment.h"
+
+using namespace testing;
+
+static std::vector<std::string> fragments;
+
+static void collect(const char *fragment, size_t len)
+{
+    fragments.push_back(std::string(fragment, len));
+}
+
+class FragmentTest: public testing::Test
+{
+public:
+    void SetUp()
+    {
+        fragments.clear();
+    }
+
+    /*
+     * Check the fragments and reassemble the entry from their data strings
+     */
+    std::string reassemble()
+    {
+        const std::regex header("\\{\"fragment\":\\{\"pid\":([0-9]+),\"id\":([0-9]+),\"seq\":([0-9]+),"
+                                "\"last\":(true|false)\\},\"data\":\"");
+        std::string      entry;
+        std::string      id;
+        std::smatch      match;
+
+        for (size_t i = 0; i < fragments.size(); i++)
+        {
+            const std::string& fragment = fragments[i];
+
+            EXPECT_GE(static_cast<size_t>(PIPE_BUF), fragment.size());
+            EXPECT_THAT(fragment, EndsWith("\"}\n"));
+            if (!std::regex_search(fragment, match, header, std::regex_constants::match_continuous))
+            {
+                ADD_FAILURE() << "invalid fragment: " << fragment;
+                return entry;
+            }
+            EXPECT_EQ(std::to_string(getpid()), match[1].str());
+            if (i == 0)
+                id = match[2].str();
+            EXPECT_EQ(id, match[2].str());
+            EXPECT_EQ(std::to_string(i), match[3].str());
+            EXPECT_EQ(i + 1 == fragments.size() ? "true" : "false", match[4].str());
+            for (size_t j = match.length(0); j < fragment.size() - 3; j++)
+            {
+                if (fragment[j] == '\\')
+                    j++;
+                entry.push_back(fragment[j]);
+            }
+        }
+        return entry;
+    }
+};
+
+TEST_F(FragmentTest, SmallEntryIsWrittenAsOneFragment)
+{
+    const std::string entry("{\"ts\":1550667066123,\"msg\":\"small\"}");
+
+    EXPECT_EQ(1U, mdclog_internal_write_fragments(entry.data(), entry.size(), collect));
+    ASSERT_EQ(1U, fragments.size());
+    EXPECT_EQ(entry, reassemble());
+}
+
+TEST_F(FragmentTest, LargeEntryIsReassembledFromFragments)
+{
+    std::string entry;
+
+    for (int i = 0; entry.size() < 5 * PIPE_BUF; i++)
+        entry += "{\"n\":" + std::to_string(i) + "},";
+    EXPECT_EQ(fragments.size(), mdclog_internal_write_fragments(entry.data(), entry.size(), collect));
+    EXPECT_LT(5U, fragments.size());
+    EXPECT_EQ(entry, reassemble());
+}
+
+TEST_F(FragmentTest, EscapeSequenceIsNotSplitBetweenFragments)
+{
+    std::string entry(3 * PIPE_BUF, '"');
+
+    entry += std::string(PIPE_BUF, '\\') + "x";
+    EXPECT_EQ(fragments.size(), mdclog_internal_write_fragments(entry.data(), entry.size(), collect));
+    EXPECT_LT(6U, fragments.size());
+    EXPECT_EQ(entry, reassemble());
+}
+
+TEST_F(FragmentTest, EveryEntryHasItsOwnId)
+{
+    const std::string entry("entry");
+
+    mdclog_internal_write_fragments(entry.data(), entry.size(), collect);
+    mdclog_internal_write_fragments(entry.data(), entry.size(), collect);
+    ASSERT_EQ(2U, fragments.size());
+    EXPECT_NE(fragments[0].substr(0, fragments[0].find(",\"seq\"")),
+              fragments[1].substr(0, fragments[1].find(",\"seq\"")));
+}
@@ -0,0 +1,279 @@
+/*
+ * Tests for the C++ front end
+ *
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ */
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "mdclog/mdclog.hpp"
+#include "system_mock.hpp"
+
+using namespace testing;
+using namespace mdclogtest;
+
+extern "C" {
+void mdclog_lib_clean(void);
+}
+
+namespace {
+
+struct point
+{
+    int x;
+    int y;
+};
+
+int formatted_points;
+
+} // namespace
+
+namespace mdclog {
+
+template <>
+struct formatter<point>
+{
+    static void format(writer& out, const point& value)
+    {
+        formatted_points++;
+        out.put('(');
+        formatter<int>::format(out, value.x);
+        out.put(',');
+        formatter<int>::format(out, value.y);
+        out.put(')');
+    }
+};
+
+} // namespace mdclog
+
+namespace {
+
+struct nested
+{
+};
+
+} // namespace
+
+namespace mdclog {
+
+template <>
+struct formatter<nested>
+{
+    static void format(writer& out, const nested&)
+    {
+        mdclog::error("logged while formatting");
+        out.put("nested", 6);
+    }
+};
+
+} // namespace mdclog
+
+static_assert(mdclog::detail::count_placeholders("", 0) == 0, "empty");
+static_assert(mdclog::detail::count_placeholders("a {} b {}", 0) == 2, "two placeholders");
+static_assert(mdclog::detail::count_placeholders("{{}} {{{}}}", 0) == 1, "escaped braces");
+static_assert(mdclog::detail::count_placeholders("a { b", 0) == -1, "lone brace");
+static_assert(mdclog::detail::count_placeholders("a } b", 0) == -1, "lone brace");
+
+class HppTest: public testing::Test
+{
+public:
+    NiceMock<SystemMock>     systemMock;
+    std::vector<std::string> written;
+
+    void SetUp()
+    {
+        setSystemMock(&systemMock);
+        ON_CALL(systemMock, write(STDOUT_FILENO, _, _))
+            .WillByDefault(Invoke([this] (int, const void* buffer, size_t len)
+            {
+                written.push_back(std::string(static_cast<const char*>(buffer), len));
+                return len;
+            }));
+        formatted_points = 0;
+    }
+
+    void TearDown()
+    {
+        mdclog_lib_clean();
+        mdclog_level_set(MDCLOG_ERR);
+    }
+};
+
+TEST_F(HppTest, FormatStringIsCheckedAtCompileTime)
+{
+    constexpr mdclog::basic_format_string<int, const char*> format("value {} of {}");
+
+    static_assert(format.placeholders() == 2, "placeholders");
+    EXPECT_STREQ("value {} of {}", format.get());
+}
+
+TEST_F(HppTest, ArgumentsAreFormatted)
+{
+    mdclog::error("{} {} {} {} {} {} {}", 42, -7, LLONG_MIN, ULLONG_MAX, (short)-3, (unsigned char)200, 0U);
+    mdclog::error("{} {} {} {} {}", true, false, 'x', 1.5, 0.1f);
+    mdclog::error("{} {} {} {}", "literal", std::string("string"), (const char*)nullptr, (char*)nullptr);
+    ASSERT_EQ(3U, written.size());
+    EXPECT_THAT(written[0], EndsWith("\"msg\":\"42 -7 -9223372036854775808 18446744073709551615 -3 200 0\"}\n"));
+    EXPECT_THAT(written[1], EndsWith("\"msg\":\"true false x 1.5 0.1\"}\n"));
+    EXPECT_THAT(written[2], EndsWith("\"msg\":\"literal string (null) (null)\"}\n"));
+}
+
+TEST_F(HppTest, FloatingPointArgumentsReadBackToTheSameValue)
+{
+    mdclog::error("{} {} {} {}", 0.1 + 0.2, 1.0 / 3, 0.1L, 1e300);
+    ASSERT_EQ(1U, written.size());
+    EXPECT_THAT(written[0], EndsWith("\"msg\":\"0.30000000000000004 0.3333333333333333 0.1 1e+300\"}\n"));
+}
+
+TEST_F(HppTest, PointersAreFormattedLikePrintf)
+{
+    int  value;
+    char expected[64];
+
+    snprintf(expected, sizeof(expected), "\"msg\":\"%p (nil)\"}\n", (void*)&value);
+    mdclog::error("{} {}", &value, nullptr);
+    ASSERT_EQ(1U, written.size());
+    EXPECT_THAT(written[0], EndsWith(expected));
+}
+
+TEST_F(HppTest, MessageIsEscaped)
+{
+    mdclog::error("quote \" {} backslash \\ {}", "arg \"quoted\"", std::string("new\nline"));
+    ASSERT_EQ(1U, written.size());
+    EXPECT_THAT(written[0], EndsWith("\"msg\":\"quote \\\" arg \\\"quoted\\\" backslash \\\\ new line\"}\n"));
+}
+
+TEST_F(HppTest, MessageIsNotAPrintfFormatString)
+{
+    mdclog::error("100% {} %d", "%s");
+    ASSERT_EQ(1U, written.size());
+    EXPECT_THAT(written[0], EndsWith("\"msg\":\"100% %s %d\"}\n"));
+}
+
+TEST_F(HppTest, DoubledBracesAreWrittenAsOne)
+{
+    mdclog::error("{{{}}} {{}}", 1);
+    ASSERT_EQ(1U, written.size());
+    EXPECT_THAT(written[0], EndsWith("\"msg\":\"{1} {}\"}\n"));
+}
+
+TEST_F(HppTest, SeverityFunctionsUseTheirLevels)
+{
+    mdclog_level_set(MDCLOG_INFO);
+    mdclog::fatal("fatal");
+    mdclog::error("error");
+    mdclog::warn("warn");
+    mdclog::info("info");
+    mdclog::debug("debug");
+    mdclog::trace("trace");
+    mdclog::log(MDCLOG_INFO, "log {}", 1);
+    ASSERT_EQ(5U, written.size());
+    EXPECT_THAT(written[0], AllOf(HasSubstr("\"crit\":\"FATAL\""), EndsWith("\"msg\":\"fatal\"}\n")));
+    EXPECT_THAT(written[3], AllOf(HasSubstr("\"crit\":\"INFO\""), EndsWith("\"msg\":\"info\"}\n")));
+    EXPECT_THAT(written[4], EndsWith("\"msg\":\"log 1\"}\n"));
+}
+
+TEST_F(HppTest, ArgumentsAreNotFormattedBelowTheLevel)
+{
+    point p = { 1, 2 };
+
+    mdclog::debug("point {}", p);
+    EXPECT_EQ(0, formatted_points);
+    EXPECT_TRUE(written.empty());
+
+    mdclog::error("point {}", p);
+    EXPECT_EQ(1, formatted_points);
+    ASSERT_EQ(1U, written.size());
+    EXPECT_THAT(written[0], EndsWith("\"msg\":\"point (1,2)\"}\n"));
+}
+
+TEST_F(HppTest, EntryLoggedWhileFormattingIsDiscarded)
+{
+    mdclog::error("outer {}", nested());
+    ASSERT_EQ(1U, written.size());
+    EXPECT_THAT(written[0], EndsWith("\"msg\":\"outer nested\"}\n"));
+}
+
+TEST_F(HppTest, LongMessageIsCut)
+{
+    std::string long_string(2 * MDCLOG_MESSAGE_BUFFER_SIZE, 'x');
+
+    mdclog::error("{} {}", long_string, "end");
+    ASSERT_EQ(1U, written.size());
+    EXPECT_THAT(written[0], AllOf(HasSubstr("xxxx"), Not(HasSubstr("end"))));
+    EXPECT_GE((size_t)PIPE_BUF, written[0].size());
+}
+
+TEST_F(HppTest, MDCScopeRemovesItsMDCsWhenDestroyed)
+{
+    ASSERT_EQ(0, mdclog_mdc_add("key", "outer"));
+    {
+        mdclog::mdc_scope scope;
+
+        ASSERT_TRUE(static_cast<bool>(scope));
+        EXPECT_EQ(0, scope.add("key", "inner"));
+        EXPECT_EQ(0, scope.add("request", std::string("42")));
+        mdclog::error("in scope");
+    }
+    mdclog::error("after scope");
+    ASSERT_EQ(2U, written.size());
+    EXPECT_THAT(written[0], AllOf(HasSubstr("\"key\":\"inner\""), HasSubstr("\"request\":\"42\"")));
+    EXPECT_THAT(written[1], AllOf(HasSubstr("\"key\":\"outer\""), Not(HasSubstr("request"))));
+    mdclog_mdc_clean();
+}
+
+TEST_F(HppTest, MovedMDCScopeIsEndedOnce)
+{
+    mdclog::mdc_scope outer;
+    mdclog::mdc_scope moved(std::move(outer));
+
+    EXPECT_FALSE(static_cast<bool>(outer));
+    moved.add("outer", "1");
+    {
+        mdclog::mdc_scope inner;
+        inner.add("inner", "2");
+        moved = std::move(inner);
+        EXPECT_FALSE(static_cast<bool>(inner));
+    }
+    char *value = mdclog_mdc_get("outer");
+    EXPECT_THAT(value, IsNull());
+    free(value);
+    moved.end();
+    EXPECT_FALSE(static_cast<bool>(moved));
+    EXPECT_EQ(1, mdclog_mdc_scope_push());
+    EXPECT_EQ(0, mdclog_mdc_scope_pop(1));
+}
+
+#if !defined(__cpp_consteval)
+TEST_F(HppTest, MismatchingArgumentsAreHandledAtRunTimeBeforeCpp20)
+{
+    mdclog::error("{} {}", 1);
+    mdclog::error("{}", 1, 2);
+    mdclog::error("lone { brace }", 1);
+    ASSERT_EQ(3U, written.size());
+    EXPECT_THAT(written[0], EndsWith("\"msg\":\"1 {}\"}\n"));
+    EXPECT_THAT(written[1], EndsWith("\"msg\":\"1\"}\n"));
+    EXPECT_THAT(written[2], EndsWith("\"msg\":\"lone { brace }\"}\n"));
+}
+#endif
@@ -22,6 +22,7 @@
 
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
+#include <thread>
 
 #if HAVE_JSONCPP
 #include <json/json.h>
@@ -30,11 +31,12 @@
 #include <stdarg.h>
 
 #include "private/json_format.h"
+#include "private/timestamp.h"
 
 using namespace testing;
 
 extern "C" {
-size_t format_timestamp(char* buffer, size_t len, struct timeval* tv);
+size_t format_timestamp(char* buffer, size_t len, struct timeval* tv, mdclog_timestamp_format_t format);
 size_t format_severity(char* buffer, size_t len, mdclog_severity_t severity);
 size_t format_identity(char* buffer, size_t len, const char* identity);
 size_t format_message(char* buffer, size_t len, const char* msg, va_list arglist);
@@ -60,14 +62,28 @@ class FormatTimestampTest: public testing::Test
 
 TEST_F(FormatTimestampTest, TimestampIsFormattedCorrectly)
 {
-    len = format_timestamp(buffer, strlen(expected_str) + 1, &tv);  // +1 for the NULL char
+    len = format_timestamp(buffer, strlen(expected_str) + 1, &tv, MDCLOG_TIMESTAMP_EPOCH_MS);  // +1 for the NULL char
     EXPECT_EQ(len, strlen(expected_str));
     EXPECT_THAT(buffer, StrEq(expected_str));
 }
 
 TEST_F(FormatTimestampTest, TimestampCannotBeFormattedToTooShortBuffer)
 {
-    len = format_timestamp(buffer, strlen(expected_str), &tv);
+    len = format_timestamp(buffer, strlen(expected_str), &tv, MDCLOG_TIMESTAMP_EPOCH_MS);
+    EXPECT_EQ(len, 0U);
+    EXPECT_EQ(strlen(buffer), 0U);
+}
+
+TEST_F(FormatTimestampTest, TimestampIsFormattedInRfc3339Format)
+{
+    len = format_timestamp(buffer, sizeof(buffer), &tv, MDCLOG_TIMESTAMP_RFC3339);
+    EXPECT_EQ(len, strlen("\"ts\":\"2019-02-20T12:51:06.123Z\""));
+    EXPECT_THAT(buffer, StrEq("\"ts\":\"2019-02-20T12:51:06.123Z\""));
+}
+
+TEST_F(FormatTimestampTest, TimestampCannotBeFormattedToBufferShorterThanTheKey)
+{
+    len = format_timestamp(buffer, strlen("\"ts\":"), &tv, MDCLOG_TIMESTAMP_EPOCH_MS);
     EXPECT_EQ(len, 0U);
     EXPECT_EQ(strlen(buffer), 0U);
 }
@@ -81,6 +97,8 @@ class FormatSeverityTest: public testing::Test
     const char* expected_warn_str = "\"crit\":\"WARNING\"";
     const char* expected_info_str = "\"crit\":\"INFO\"";
     const char* expected_debug_str = "\"crit\":\"DEBUG\"";
+    const char* expected_fatal_str = "\"crit\":\"FATAL\"";
+    const char* expected_trace_str = "\"crit\":\"TRACE\"";
 };
 
 TEST_F(FormatSeverityTest, SeverityIsFormattedCorrectly)
@@ -100,11 +118,19 @@ TEST_F(FormatSeverityTest, SeverityIsFormattedCorrectly)
     len = format_severity(buffer, strlen(expected_debug_str) + 1, MDCLOG_DEBUG);
     EXPECT_EQ(len, strlen(expected_debug_str));
     EXPECT_THAT(buffer, StrEq(expected_debug_str));
+
+    len = format_severity(buffer, strlen(expected_fatal_str) + 1, MDCLOG_FATAL);
+    EXPECT_EQ(len, strlen(expected_fatal_str));
+    EXPECT_THAT(buffer, StrEq(expected_fatal_str));
+
+    len = format_severity(buffer, strlen(expected_trace_str) + 1, MDCLOG_TRACE);
+    EXPECT_EQ(len, strlen(expected_trace_str));
+    EXPECT_THAT(buffer, StrEq(expected_trace_str));
 }
 
 TEST_F(FormatSeverityTest, InvalidSeverityValueIsNotFormaated)
 {
-    len = format_severity(buffer, sizeof(buffer), static_cast<mdclog_severity_t>(5));
+    len = format_severity(buffer, sizeof(buffer), static_cast<mdclog_severity_t>(6));
     EXPECT_EQ(len, 0U);
     EXPECT_EQ(strlen(buffer), 0U);
 }
@@ -320,6 +346,82 @@ TEST_F(FormatMdcTest, MdcIsTruncatedIfBufferIsTooShortForAllMdcs)
     EXPECT_THAT(buffer, StrEq(expected_one_mdc_str));
 }
 
+TEST_F(FormatMdcTest, MdcIsFormattedCorrectlyAfterMdcsChange)
+{
+    len = format_mdc(buffer, sizeof(buffer), mdclog_internal_get_first_mdc());
+    EXPECT_THAT(buffer, StrEq(expected_str));
+    mdclog_internal_rm_mdc("key1");
+    len = format_mdc(buffer, sizeof(buffer), mdclog_internal_get_first_mdc());
+    EXPECT_EQ(len, strlen(expected_one_mdc_str));
+    EXPECT_THAT(buffer, StrEq(expected_one_mdc_str));
+    ASSERT_EQ(0, mdclog_internal_put_mdc("key1", "value1"));
+    ASSERT_EQ(0, mdclog_internal_put_mdc("key2", "value2"));
+    len = format_mdc(buffer, sizeof(buffer), mdclog_internal_get_first_mdc());
+    EXPECT_THAT(buffer, StrEq("\"mdc\":{\"key1\":\"value1\",\"key2\":\"value2\"}"));
+}
+
+class FormatGlobalMdcTest: public FormatMdcTest
+{
+public:
+    const char* expected_global_str = "\"mdc\":{\"g1\":\"v1\",\"g2\":\"v2\",\"key2\":\"value2\",\"key1\":\"value1\"}";
+
+    void SetUp()
+    {
+        const char* keys[] = { "g1", "g2" };
+        const char* values[] = { "v1", "v2" };
+
+        FormatMdcTest::SetUp();
+        ASSERT_EQ(0, mdclog_internal_set_global_mdcs(keys, values, 2));
+    }
+
+    void TearDown()
+    {
+        FormatMdcTest::TearDown();
+        mdclog_internal_clean_global_mdcs();
+    }
+};
+
+TEST_F(FormatGlobalMdcTest, GlobalMdcsAreFormattedBeforeThreadMdcs)
+{
+    len = format_mdc(buffer, sizeof(buffer), mdclog_internal_get_first_mdc());
+    EXPECT_EQ(len, strlen(expected_global_str));
+    EXPECT_THAT(buffer, StrEq(expected_global_str));
+}
+
+TEST_F(FormatGlobalMdcTest, GlobalMdcsAreFormattedWithoutThreadMdcs)
+{
+    mdclog_internal_clean_mdclist();
+    len = format_mdc(buffer, sizeof(buffer), mdclog_internal_get_first_mdc());
+    EXPECT_THAT(buffer, StrEq("\"mdc\":{\"g1\":\"v1\",\"g2\":\"v2\"}"));
+}
+
+TEST_F(FormatGlobalMdcTest, ThreadMdcOverridesGlobalMdc)
+{
+    ASSERT_EQ(0, mdclog_internal_put_mdc("g1", "thread"));
+    len = format_mdc(buffer, sizeof(buffer), mdclog_internal_get_first_mdc());
+    EXPECT_THAT(buffer, StrEq("\"mdc\":{\"g2\":\"v2\",\"g1\":\"thread\",\"key2\":\"value2\",\"key1\":\"value1\"}"));
+}
+
+TEST_F(FormatGlobalMdcTest, MdcsAreTruncatedIfBufferIsTooShortForAllMdcs)
+{
+    len = format_mdc(buffer, strlen(expected_global_str), mdclog_internal_get_first_mdc());
+    EXPECT_THAT(buffer, StrEq("\"mdc\":{\"g1\":\"v1\",\"g2\":\"v2\",\"key2\":\"value2\"}"));
+    ASSERT_EQ(0, mdclog_internal_put_mdc("g1", "thread"));
+    len = format_mdc(buffer, strlen("\"mdc\":{\"g2\":\"v2\"}") + 1, mdclog_internal_get_first_mdc());
+    EXPECT_THAT(buffer, StrEq("\"mdc\":{\"g2\":\"v2\"}"));
+}
+
+TEST_F(FormatGlobalMdcTest, GlobalMdcsAreFormattedInOtherThreads)
+{
+    std::thread thread([this]()
+    {
+        len = format_mdc(buffer, sizeof(buffer), mdclog_internal_get_first_mdc());
+        mdclog_internal_destroy_mdclist();
+    });
+    thread.join();
+    EXPECT_THAT(buffer, StrEq("\"mdc\":{\"g1\":\"v1\",\"g2\":\"v2\"}"));
+}
+
 class FormatToJsonStrTest: public testing::Test
 {
 public:
@@ -329,11 +431,16 @@ class FormatToJsonStrTest: public testing::Test
     struct timeval tv = {1550667066, 123456};
     const char* expected_str = "{\"ts\":1550667066123,\"crit\":\"ERROR\",\"id\""
             ":\"Mickey Mouse\",\"mdc\":{\"key1\":\"value1\"},\"msg\":\"Test log 999\"}";
+    struct json_layout layout;
+    struct json_schema schema;
+    struct json_info info;
 
     void SetUp()
     {
         ASSERT_EQ(0, mdclog_internal_init_mdc());
         ASSERT_EQ(0, mdclog_internal_put_mdc("key1", "value1"));
+        mdclog_internal_default_layout(&layout);
+        mdclog_internal_compile_schema(&schema, &layout, "Mickey Mouse");
     }
 
     void TearDown()
@@ -353,7 +460,8 @@ class FormatToJsonStrTest: public testing::Test
         int ret;
         va_list arglist;
         va_start(arglist, fmt);
-        ret = mdclog_internal_format_to_json_str(buffer, len, timestamp, identity, severity, mdc, fmt, arglist);
+        mdclog_internal_compile_schema(&schema, &layout, identity);
+        ret = mdclog_internal_format_to_json_str(buffer, len, timestamp, &schema, severity, mdc, &info, fmt, arglist);
         va_end(arglist);
         return ret;
     }
@@ -391,6 +499,166 @@ TEST_F(FormatToJsonStrTest, LogEntryIsValidJSONAndCanBeParsedWithJSONCPP)
 }
 #endif
 
+TEST_F(FormatToJsonStrTest, TimestampSpanIsReturned)
+{
+    ret = test_format_to_json_str(buffer, sizeof(buffer), &tv, "Mickey Mouse", MDCLOG_ERR, mdclog_internal_get_first_mdc(),
+            "%s %d", "Test log", 999);
+    EXPECT_EQ(1U, info.timestamp_start);
+    EXPECT_EQ(strlen("{\"ts\":1550667066123,"), info.timestamp_end);
+    EXPECT_EQ(0, info.truncated);
+}
+
+TEST_F(FormatToJsonStrTest, TruncationIsReported)
+{
+    std::string message(sizeof(buffer), 'a');
+
+    ret = test_format_to_json_str(buffer, sizeof(buffer), &tv, "Mickey Mouse", MDCLOG_ERR,
+            mdclog_internal_get_first_mdc(), "%s", message.c_str());
+    EXPECT_THAT(buffer, EndsWith("[truncated]\"}"));
+    EXPECT_EQ(1, info.truncated);
+}
+
+TEST_F(FormatToJsonStrTest, AllSeveritiesHaveTheirOwnTemplate)
+{
+    const char* values[] = { "FATAL", "ERROR", "WARNING", "INFO", "DEBUG", "TRACE" };
+
+    for (int severity = MDCLOG_FATAL; severity <= MDCLOG_TRACE; severity++)
+    {
+        ret = test_format_to_json_str(buffer, sizeof(buffer), &tv, "Mickey Mouse", (mdclog_severity_t)severity,
+                mdclog_internal_get_first_mdc(), "log");
+        EXPECT_THAT(buffer, StrEq(std::string("{\"ts\":1550667066123,\"crit\":\"") + values[severity] +
+                "\",\"id\":\"Mickey Mouse\",\"mdc\":{\"key1\":\"value1\"},\"msg\":\"log\"}"));
+    }
+    ret = test_format_to_json_str(buffer, sizeof(buffer), &tv, "Mickey Mouse", (mdclog_severity_t)6,
+            mdclog_internal_get_first_mdc(), "log");
+    EXPECT_THAT(buffer, StrEq("{\"ts\":1550667066123,\"id\":\"Mickey Mouse\",\"mdc\":{\"key1\":\"value1\"},\"msg\":\"log\"}"));
+}
+
+TEST_F(FormatToJsonStrTest, FieldKeysCanBeChanged)
+{
+    ASSERT_EQ(0, mdclog_internal_set_layout_key(&layout, MDCLOG_FIELD_TIMESTAMP, "time"));
+    ASSERT_EQ(0, mdclog_internal_set_layout_key(&layout, MDCLOG_FIELD_SEVERITY, "level"));
+    ASSERT_EQ(0, mdclog_internal_set_layout_key(&layout, MDCLOG_FIELD_IDENTITY, "logger"));
+    ASSERT_EQ(0, mdclog_internal_set_layout_key(&layout, MDCLOG_FIELD_MDC, "context"));
+    ASSERT_EQ(0, mdclog_internal_set_layout_key(&layout, MDCLOG_FIELD_MESSAGE, "message"));
+    ret = test_format_to_json_str(buffer, sizeof(buffer), &tv, "Mickey Mouse", MDCLOG_ERR, mdclog_internal_get_first_mdc(),
+            "%s %d", "Test log", 999);
+    EXPECT_THAT(buffer, StrEq("{\"time\":1550667066123,\"level\":\"ERROR\",\"logger\":\"Mickey Mouse\","
+            "\"context\":{\"key1\":\"value1\"},\"message\":\"Test log 999\"}"));
+    EXPECT_EQ(ret, (int)strlen(buffer));
+}
+
+TEST_F(FormatToJsonStrTest, FieldsCanBeReorderedAndLeftOut)
+{
+    const mdclog_field_t order[] = { MDCLOG_FIELD_SEVERITY, MDCLOG_FIELD_MDC, MDCLOG_FIELD_TIMESTAMP, MDCLOG_FIELD_MESSAGE };
+    const char*          expected = "{\"crit\":\"ERROR\",\"mdc\":{\"key1\":\"value1\"},\"ts\":1550667066123,"
+                                    "\"msg\":\"Test log 999\"}";
+
+    ASSERT_EQ(0, mdclog_internal_set_layout_order(&layout, order, 4));
+    ret = test_format_to_json_str(buffer, sizeof(buffer), &tv, "Mickey Mouse", MDCLOG_ERR, mdclog_internal_get_first_mdc(),
+            "%s %d", "Test log", 999);
+    EXPECT_THAT(buffer, StrEq(expected));
+    EXPECT_EQ(strlen("{\"crit\":\"ERROR\",\"mdc\":{\"key1\":\"value1\"},"), info.timestamp_start);
+    EXPECT_EQ(strlen("{\"crit\":\"ERROR\",\"mdc\":{\"key1\":\"value1\"},\"ts\":1550667066123,"), info.timestamp_end);
+}
+
+TEST_F(FormatToJsonStrTest, MessageOnlyLayoutHasNoTimestampSpan)
+{
+    const mdclog_field_t order[] = { MDCLOG_FIELD_MESSAGE };
+
+    ASSERT_EQ(0, mdclog_internal_set_layout_order(&layout, order, 1));
+    ret = test_format_to_json_str(buffer, sizeof(buffer), &tv, "Mickey Mouse", MDCLOG_ERR, NULL, "only");
+    EXPECT_THAT(buffer, StrEq("{\"msg\":\"only\"}"));
+    EXPECT_EQ(info.timestamp_start, info.timestamp_end);
+}
+
+TEST_F(FormatToJsonStrTest, InvalidLayoutIsNotAccepted)
+{
+    const mdclog_field_t message_not_last[] = { MDCLOG_FIELD_MESSAGE, MDCLOG_FIELD_TIMESTAMP };
+    const mdclog_field_t duplicate[] = { MDCLOG_FIELD_TIMESTAMP, MDCLOG_FIELD_TIMESTAMP, MDCLOG_FIELD_MESSAGE };
+    const mdclog_field_t unknown[] = { (mdclog_field_t)5, MDCLOG_FIELD_MESSAGE };
+    std::string          long_key(MDCLOG_FIELD_KEY_MAX_LENGTH + 1, 'k');
+
+    EXPECT_EQ(-1, mdclog_internal_set_layout_order(&layout, message_not_last, 2));
+    EXPECT_EQ(-1, mdclog_internal_set_layout_order(&layout, duplicate, 3));
+    EXPECT_EQ(-1, mdclog_internal_set_layout_order(&layout, unknown, 2));
+    EXPECT_EQ(-1, mdclog_internal_set_layout_order(&layout, message_not_last, 0));
+    EXPECT_EQ(-1, mdclog_internal_set_layout_key(&layout, MDCLOG_FIELD_MDC, ""));
+    EXPECT_EQ(-1, mdclog_internal_set_layout_key(&layout, MDCLOG_FIELD_MDC, "\"quoted\""));
+    EXPECT_EQ(-1, mdclog_internal_set_layout_key(&layout, MDCLOG_FIELD_MDC, long_key.c_str()));
+    EXPECT_EQ(-1, mdclog_internal_set_layout_key(&layout, (mdclog_field_t)5, "key"));
+    EXPECT_EQ(0, mdclog_internal_set_layout_key(&layout, MDCLOG_FIELD_MDC, long_key.substr(1).c_str()));
+}
+
+class FormatDeferredTest: public FormatToJsonStrTest
+{
+public:
+    char record[PIPE_BUF];
+
+    int test_capture_deferred(char* buffer,
+                            size_t len,
+                            struct timeval* timestamp,
+                            mdclog_severity_t severity,
+                            mdc_t* mdc,
+                            const char* fmt,
+                            ...)
+    {
+        int ret;
+        va_list arglist;
+        va_start(arglist, fmt);
+        ret = mdclog_internal_capture_deferred(buffer, len, timestamp, severity, mdc, fmt, arglist);
+        va_end(arglist);
+        return ret;
+    }
+};
+
+TEST_F(FormatDeferredTest, DeferredLogIsFormattedLikeImmediateLog)
+{
+    char name[] = "Test log";
+    int record_len = test_capture_deferred(record, sizeof(record), &tv, MDCLOG_ERR,
+            mdclog_internal_get_first_mdc(), "%s %d", name, 999);
+    ASSERT_GT(record_len, 0);
+    // the arguments are copied, not referenced
+    strcpy(name, "Changed!");
+    ret = mdclog_internal_format_deferred_to_json_str(buffer, sizeof(buffer), &schema, record, record_len);
+    EXPECT_EQ(ret, (int)strlen(expected_str));
+    EXPECT_THAT(buffer, StrEq(expected_str));
+}
+
+TEST_F(FormatDeferredTest, DeferredLogMdcIsCapturedAtLoggingTime)
+{
+    int record_len = test_capture_deferred(record, sizeof(record), &tv, MDCLOG_ERR,
+            mdclog_internal_get_first_mdc(), "%s %d", "Test log", 999);
+    ASSERT_GT(record_len, 0);
+    ASSERT_EQ(0, mdclog_internal_put_mdc("key2", "value2"));
+    ret = mdclog_internal_format_deferred_to_json_str(buffer, sizeof(buffer), &schema, record, record_len);
+    EXPECT_THAT(buffer, StrEq(expected_str));
+}
+
+TEST_F(FormatDeferredTest, UnsupportedFormatCannotBeCaptured)
+{
+    int count;
+    EXPECT_EQ(-1, test_capture_deferred(record, sizeof(record), &tv, MDCLOG_ERR,
+            mdclog_internal_get_first_mdc(), "%s%n", "Test log", &count));
+    EXPECT_EQ(-1, test_capture_deferred(record, sizeof(record), &tv, MDCLOG_ERR,
+            mdclog_internal_get_first_mdc(), "%1$s", "Test log"));
+}
+
+TEST_F(FormatDeferredTest, DeferredLogCannotBeCapturedToTooShortBuffer)
+{
+    EXPECT_EQ(-1, test_capture_deferred(record, 64, &tv, MDCLOG_ERR,
+            mdclog_internal_get_first_mdc(), "%s %d", "Test log", 999));
+}
+
+TEST_F(FormatDeferredTest, FormattingReturnsErrorWhenTheBufferIsTooShort)
+{
+    int record_len = test_capture_deferred(record, sizeof(record), &tv, MDCLOG_ERR,
+            mdclog_internal_get_first_mdc(), "%s %d", "Test log", 999);
+    ASSERT_GT(record_len, 0);
+    ret = mdclog_internal_format_deferred_to_json_str(buffer, strlen(expected_str), &schema, record, record_len);
+    EXPECT_EQ(ret, -1);
+}
+
 class FormatLogEntryTest: public testing::Test
 {
 public:
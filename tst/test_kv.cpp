@@ -0,0 +1,333 @@
+/*
+ * Tests for the typed fields of the structured log entries
+ *
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ */
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <random>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "mdclog/mdclog.h"
+#include "private/kv.h"
+#include "system_mock.hpp"
+
+using namespace testing;
+using namespace mdclogtest;
+
+extern "C" {
+void mdclog_lib_clean(void);
+}
+
+static std::string uint64_str(uint64_t value)
+{
+    char buffer[KV_NUMBER_MAX_LENGTH];
+
+    return std::string(buffer, mdclog_internal_format_uint64(buffer, value));
+}
+
+static std::string int64_str(int64_t value)
+{
+    char buffer[KV_NUMBER_MAX_LENGTH];
+
+    return std::string(buffer, mdclog_internal_format_int64(buffer, value));
+}
+
+static std::string double_str(double value)
+{
+    char buffer[KV_NUMBER_MAX_LENGTH];
+
+    return std::string(buffer, mdclog_internal_format_double(buffer, value));
+}
+
+static std::string fields_str(const std::vector<mdclog_kv_t>& fields, size_t len = 1024)
+{
+    std::vector<char> buffer(len);
+    size_t            ret = mdclog_internal_format_kv_fields(buffer.data(), len, fields.data(), fields.size());
+
+    EXPECT_EQ(ret, strlen(buffer.data()));
+    return std::string(buffer.data(), ret);
+}
+
+TEST(KvTest, UnsignedIntegersAreFormattedInDecimal)
+{
+    EXPECT_EQ("0", uint64_str(0));
+    EXPECT_EQ("9", uint64_str(9));
+    EXPECT_EQ("10", uint64_str(10));
+    EXPECT_EQ("99", uint64_str(99));
+    EXPECT_EQ("100", uint64_str(100));
+    EXPECT_EQ("1234567", uint64_str(1234567));
+    EXPECT_EQ("18446744073709551615", uint64_str(UINT64_MAX));
+}
+
+TEST(KvTest, SignedIntegersAreFormattedInDecimal)
+{
+    EXPECT_EQ("0", int64_str(0));
+    EXPECT_EQ("-1", int64_str(-1));
+    EXPECT_EQ("-42", int64_str(-42));
+    EXPECT_EQ("9223372036854775807", int64_str(INT64_MAX));
+    EXPECT_EQ("-9223372036854775808", int64_str(INT64_MIN));
+}
+
+TEST(KvTest, DoublesAreFormattedWithTheFewestDigits)
+{
+    EXPECT_EQ("0.1", double_str(0.1));
+    EXPECT_EQ("1.5", double_str(1.5));
+    EXPECT_EQ("5", double_str(5.0));
+    EXPECT_EQ("-0.25", double_str(-0.25));
+    EXPECT_EQ("0.30000000000000004", double_str(0.1 + 0.2));
+    EXPECT_EQ("1e+300", double_str(1e300));
+    EXPECT_EQ("2.2250738585072014e-308", double_str(2.2250738585072014e-308));
+    EXPECT_EQ("1.7976931348623157e+308", double_str(1.7976931348623157e308));
+}
+
+TEST(KvTest, NotFiniteDoublesAreNull)
+{
+    EXPECT_EQ("null", double_str(NAN));
+    EXPECT_EQ("null", double_str(INFINITY));
+    EXPECT_EQ("null", double_str(-INFINITY));
+}
+
+static int significant_digits(const std::string& str)
+{
+    int digits = 0;
+
+    // the leading zeros are not significant
+    for (size_t i = 0; i < str.size() && str[i] != 'e'; i++)
+        if (isdigit((unsigned char)str[i]) && (digits > 0 || str[i] != '0'))
+            digits++;
+    return digits;
+}
+
+TEST(KvTest, RandomDoublesAreReadBackToTheSameValueWithTheFewestDigits)
+{
+    std::mt19937_64 random(1);
+    char            shorter[512];
+
+    for (int i = 0; i < 100000; i++)
+    {
+        uint64_t    bits = random();
+        double      value;
+        std::string str;
+        int         digits;
+
+        memcpy(&value, &bits, sizeof(value));
+        if (!isfinite(value))
+            continue;
+        str = double_str(value);
+        ASSERT_EQ(value, strtod(str.c_str(), NULL)) << str;
+        digits = significant_digits(str);
+        ASSERT_GE(17, digits) << str;
+        if (digits > 15)
+        {
+            snprintf(shorter, sizeof(shorter), "%.*g", digits - 1, value);
+            ASSERT_NE(value, strtod(shorter, NULL)) << str;
+        }
+    }
+}
+
+TEST(KvTest, FieldsAreFormattedAsJsonMembers)
+{
+    std::vector<mdclog_kv_t> fields {
+        mdclog_kv_int64("int", -7),
+        mdclog_kv_uint64("uint", 7),
+        mdclog_kv_double("double", 0.5),
+        mdclog_kv_bool("true", 1),
+        mdclog_kv_bool("false", 0),
+        mdclog_kv_string("string", "value", 5),
+    };
+
+    EXPECT_EQ("\"int\":-7,\"uint\":7,\"double\":0.5,\"true\":true,\"false\":false,\"string\":\"value\",",
+              fields_str(fields));
+}
+
+TEST(KvTest, StringsAndKeysAreEscaped)
+{
+    std::vector<mdclog_kv_t> fields {
+        mdclog_kv_string("a\"b", "c\\d\"e\n", 6),
+        mdclog_kv_string("nul", "x\0y", 3),
+        mdclog_kv_string("prefix", "abcdef", 3),
+    };
+
+    EXPECT_EQ("\"a\\\"b\":\"c\\\\d\\\"e \",\"nul\":\"x y\",\"prefix\":\"abc\",", fields_str(fields));
+}
+
+TEST(KvTest, NullStringIsNullAndFieldWithoutKeyIsSkipped)
+{
+    std::vector<mdclog_kv_t> fields {
+        mdclog_kv_string("string", NULL, 0),
+        mdclog_kv_int64(NULL, 1),
+        mdclog_kv_int64("int", 2),
+    };
+
+    EXPECT_EQ("\"string\":null,\"int\":2,", fields_str(fields));
+}
+
+TEST(KvTest, FieldsAreLeftOutFromTheFirstOneNotFitting)
+{
+    std::vector<mdclog_kv_t> fields {
+        mdclog_kv_int64("a", 1),
+        mdclog_kv_string("b", "12345678", 8),
+        mdclog_kv_int64("c", 3),
+    };
+
+    EXPECT_EQ("\"a\":1,\"b\":\"12345678\",\"c\":3,", fields_str(fields, 28));
+    EXPECT_EQ("\"a\":1,\"b\":\"12345678\",", fields_str(fields, 27));
+    EXPECT_EQ("\"a\":1,\"b\":\"12345678\",", fields_str(fields, 22));
+    EXPECT_EQ("\"a\":1,", fields_str(fields, 21));
+    EXPECT_EQ("\"a\":1,", fields_str(fields, 7));
+    EXPECT_EQ("", fields_str(fields, 6));
+    EXPECT_EQ("", fields_str(fields, 1));
+}
+
+class KvApiTest: public testing::Test
+{
+public:
+    NiceMock<SystemMock>     systemMock;
+    std::vector<std::string> written;
+
+    void SetUp()
+    {
+        // the entries are expected without the MDCs other tests may have left to the thread
+        mdclog_mdc_clean();
+        setSystemMock(&systemMock);
+        ON_CALL(systemMock, write(STDOUT_FILENO, _, _))
+            .WillByDefault(Invoke([this] (int, const void* buffer, size_t len)
+            {
+                written.push_back(std::string(static_cast<const char*>(buffer), len));
+                return len;
+            }));
+    }
+
+    void TearDown()
+    {
+        mdclog_lib_clean();
+        mdclog_level_set(MDCLOG_ERR);
+    }
+};
+
+TEST_F(KvApiTest, FieldsAreWrittenBeforeTheMessage)
+{
+    mdclog_kv_t fields[] = {
+        mdclog_kv_uint64("cell", 7),
+        mdclog_kv_double("throughput", 12.5),
+        mdclog_kv_bool("up", 1),
+        mdclog_kv_string("name", "a\"b", 3),
+    };
+
+    mdclog_write_kv(MDCLOG_ERR, "cell stats", fields, sizeof(fields) / sizeof(fields[0]));
+    ASSERT_EQ(1U, written.size());
+    EXPECT_THAT(written[0], AllOf(StartsWith("{\"ts\":"), HasSubstr("\"mdc\":{},"),
+                                  EndsWith(",\"cell\":7,\"throughput\":12.5,\"up\":true,\"name\":\"a\\\"b\","
+                                           "\"msg\":\"cell stats\"}\n")));
+}
+
+TEST_F(KvApiTest, MessageIsNotAFormatString)
+{
+    mdclog_write_kv(MDCLOG_ERR, "100% %s \"done\"", NULL, 0);
+    ASSERT_EQ(1U, written.size());
+    EXPECT_THAT(written[0], EndsWith("\"mdc\":{},\"msg\":\"100% %s \\\"done\\\"\"}\n"));
+}
+
+TEST_F(KvApiTest, EntryBelowTheLevelIsNotWritten)
+{
+    mdclog_kv_t field = mdclog_kv_int64("value", 1);
+
+    mdclog_write_kv(MDCLOG_INFO, "info", &field, 1);
+    EXPECT_TRUE(written.empty());
+}
+
+TEST_F(KvApiTest, FieldsNotFittingToTheEntryAreLeftOut)
+{
+    std::string long_value(PIPE_BUF, 'x');
+    mdclog_kv_t fields[] = {
+        mdclog_kv_int64("first", 1),
+        mdclog_kv_string("long", long_value.c_str(), long_value.size()),
+        mdclog_kv_int64("last", 3),
+    };
+
+    mdclog_write_kv(MDCLOG_ERR, "message", fields, 3);
+    ASSERT_EQ(1U, written.size());
+    EXPECT_THAT(written[0], AllOf(EndsWith("\"first\":1,\"msg\":\"message\"}\n"), Not(HasSubstr("last"))));
+    EXPECT_GE((size_t)PIPE_BUF, written[0].size());
+}
+
+TEST_F(KvApiTest, BuilderWritesTheAddedFields)
+{
+    mdclog_kv_builder_t builder;
+
+    EXPECT_FALSE(mdclog_kv_begin(&builder, MDCLOG_DEBUG, "debug"));
+    ASSERT_TRUE(mdclog_kv_begin(&builder, MDCLOG_ERR, "built"));
+    EXPECT_EQ(0, mdclog_kv_add_int64(&builder, "a", -1));
+    EXPECT_EQ(0, mdclog_kv_add_uint64(&builder, "b", 2));
+    EXPECT_EQ(0, mdclog_kv_add_double(&builder, "c", 0.25));
+    EXPECT_EQ(0, mdclog_kv_add_bool(&builder, "d", 0));
+    EXPECT_EQ(0, mdclog_kv_add_string(&builder, "e", "str", 3));
+    mdclog_kv_end(&builder);
+    ASSERT_EQ(1U, written.size());
+    EXPECT_THAT(written[0], EndsWith("\"a\":-1,\"b\":2,\"c\":0.25,\"d\":false,\"e\":\"str\",\"msg\":\"built\"}\n"));
+}
+
+TEST_F(KvApiTest, BuilderHasRoomForTheMaximumNumberOfFields)
+{
+    mdclog_kv_builder_t builder;
+
+    mdclog_kv_begin(&builder, MDCLOG_ERR, "full");
+    for (int i = 0; i < MDCLOG_KV_BUILDER_MAX_FIELDS; i++)
+        EXPECT_EQ(0, mdclog_kv_add_int64(&builder, "i", i));
+    EXPECT_EQ(-1, mdclog_kv_add_int64(&builder, "i", 0));
+    EXPECT_EQ(ENOSPC, errno);
+    mdclog_kv_end(&builder);
+    ASSERT_EQ(1U, written.size());
+    EXPECT_THAT(written[0], HasSubstr("\"i\":31,\"msg\":\"full\"}"));
+}
+
+static void collect_record(void *arg, const mdclog_record_t *record)
+{
+    std::string *received = static_cast<std::string*>(arg);
+    char         buffer[256];
+
+    *received = std::string(record->message, record->message_len);
+    ASSERT_EQ(1U, record->field_count);
+    mdclog_internal_format_kv_fields(buffer, sizeof(buffer), record->fields, record->field_count);
+    *received += " ";
+    *received += buffer;
+}
+
+TEST_F(KvApiTest, RecordSinkGetsTheTypedFields)
+{
+    std::string   received;
+    mdclog_sink_t sink = { MDCLOG_SINK_RECORD, MDCLOG_INFO, NULL, collect_record, &received };
+    mdclog_kv_t   field = mdclog_kv_double("ratio", 0.75);
+
+    EXPECT_LT(0, mdclog_sink_add(&sink));
+    mdclog_write_kv(MDCLOG_INFO, "50% done", &field, 1);
+    EXPECT_EQ("50% done \"ratio\":0.75,", received);
+    EXPECT_TRUE(written.empty());
+}
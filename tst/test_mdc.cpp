@@ -21,7 +21,10 @@
  */
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
+#include <errno.h>
+#include <string>
 #include <thread>
+#include <vector>
 #include <semaphore.h>
 
 #include "private/mdc.h"
@@ -60,6 +63,14 @@ class MDCTest: public testing::Test
         EXPECT_THAT(mdclog_internal_get_mdc_key(mdc), StrEq(key));
         EXPECT_THAT(mdclog_internal_get_mdc_val(mdc), StrEq(value));
     }
+
+    std::vector<std::string> keys()
+    {
+        std::vector<std::string> keys;
+        for (auto mdc(mdclog_internal_get_first_mdc()); mdc; mdc = mdclog_internal_get_next_mdc(mdc))
+            keys.push_back(mdclog_internal_get_mdc_key(mdc));
+        return keys;
+    }
 };
 
 TEST_F(MDCTest, ItIsPossibleToAddDMC)
@@ -178,6 +189,424 @@ TEST_F(MDCTest, SpecialCharactersInValueAreEscaped)
     addAndCheck("foo", "\r\n", "  ");
 }
 
+TEST_F(MDCTest, IterationSkipsRemovedMDCs)
+{
+    addAndCheck("first", "1");
+    addAndCheck("second", "2");
+    addAndCheck("third", "3");
+    mdclog_internal_rm_mdc("second");
+    EXPECT_THAT(keys(), ElementsAre("third", "first"));
+    mdclog_internal_rm_mdc("third");
+    EXPECT_THAT(keys(), ElementsAre("first"));
+}
+
+TEST_F(MDCTest, ValueCanBeReplacedWithLongerAndShorterValue)
+{
+    addAndCheck("first", "1");
+    addAndCheck("second", "2");
+    addAndCheck("first", std::string(1000, 'x').c_str());
+    addAndCheck("first", "short");
+    findAndCheck("second", "2");
+    EXPECT_THAT(keys(), ElementsAre("second", "first"));
+}
+
+TEST_F(MDCTest, ManyMDCsCanBeAddedAndRemoved)
+{
+    const int count = 1000;
+
+    for (int i = 0; i < count; i++)
+        addAndCheck(("key" + std::to_string(i)).c_str(), ("value" + std::to_string(i)).c_str());
+    for (int i = 0; i < count; i += 2)
+        mdclog_internal_rm_mdc(("key" + std::to_string(i)).c_str());
+    for (int i = 0; i < count; i++)
+    {
+        auto mdc(mdclog_internal_search_mdc(("key" + std::to_string(i)).c_str()));
+        if (i % 2)
+            EXPECT_THAT(mdclog_internal_get_mdc_val(mdc), StrEq("value" + std::to_string(i)));
+        else
+            EXPECT_THAT(mdc, IsNull());
+    }
+    auto list(keys());
+    ASSERT_EQ(count / 2U, list.size());
+    EXPECT_EQ("key" + std::to_string(count - 1), list.front());
+    EXPECT_EQ("key1", list.back());
+}
+
+TEST_F(MDCTest, RepeatedAddAndRemoveKeepsOtherMDCs)
+{
+    addAndCheck("first", "1");
+    addAndCheck("second", "2");
+    for (int i = 0; i < 10000; i++)
+    {
+        std::string key("temporary" + std::to_string(i % 100));
+        addAndCheck(key.c_str(), "value");
+        if (i % 7 == 0)
+            addAndCheck("second", std::string(i % 50, 'y').c_str());
+        mdclog_internal_rm_mdc(key.c_str());
+    }
+    addAndCheck("third", "3");
+    findAndCheck("first", "1");
+    EXPECT_THAT(keys(), ElementsAre("third", "second", "first"));
+}
+
+TEST_F(MDCTest, ClearedListCanBeReused)
+{
+    for (int round = 0; round < 3; round++)
+    {
+        addAndCheck("first", "1");
+        addAndCheck("second", "2");
+        EXPECT_THAT(keys(), ElementsAre("second", "first"));
+        mdclog_internal_clean_mdclist();
+        EXPECT_THAT(mdclog_internal_search_mdc("first"), IsNull());
+    }
+}
+
+TEST_F(MDCTest, ScopeEndRemovesMDCsAddedInIt)
+{
+    addAndCheck("first", "1");
+    auto scope(mdclog_internal_push_mdc_scope());
+    EXPECT_EQ(1, scope);
+    addAndCheck("second", "2");
+    addAndCheck("third", "3");
+    EXPECT_EQ(0, mdclog_internal_pop_mdc_scope(scope));
+    EXPECT_THAT(mdclog_internal_search_mdc("second"), IsNull());
+    EXPECT_THAT(keys(), ElementsAre("first"));
+}
+
+TEST_F(MDCTest, MDCAddedInScopeHidesOuterValueUntilScopeEnds)
+{
+    addAndCheck("key", "outer");
+    addAndCheck("other", "1");
+    auto outer(mdclog_internal_push_mdc_scope());
+    addAndCheck("key", "middle");
+    addAndCheck("key", "middle replaced");
+    auto inner(mdclog_internal_push_mdc_scope());
+    EXPECT_EQ(2, inner);
+    addAndCheck("key", "inner");
+    EXPECT_THAT(keys(), ElementsAre("key", "other"));
+    EXPECT_EQ(0, mdclog_internal_pop_mdc_scope(inner));
+    findAndCheck("key", "middle replaced");
+    EXPECT_THAT(keys(), ElementsAre("key", "other"));
+    EXPECT_EQ(0, mdclog_internal_pop_mdc_scope(outer));
+    findAndCheck("key", "outer");
+    EXPECT_THAT(keys(), ElementsAre("other", "key"));
+}
+
+TEST_F(MDCTest, EndingScopeEndsScopesInsideIt)
+{
+    auto outer(mdclog_internal_push_mdc_scope());
+    addAndCheck("first", "1");
+    mdclog_internal_push_mdc_scope();
+    addAndCheck("second", "2");
+    EXPECT_EQ(0, mdclog_internal_pop_mdc_scope(outer));
+    EXPECT_TRUE(keys().empty());
+    EXPECT_EQ(1, mdclog_internal_push_mdc_scope());
+}
+
+TEST_F(MDCTest, EndingScopeThatIsNotOpenFails)
+{
+    EXPECT_EQ(-1, mdclog_internal_pop_mdc_scope(1));
+    EXPECT_EQ(EINVAL, errno);
+    auto scope(mdclog_internal_push_mdc_scope());
+    EXPECT_EQ(-1, mdclog_internal_pop_mdc_scope(scope + 1));
+    EXPECT_EQ(-1, mdclog_internal_pop_mdc_scope(0));
+    EXPECT_EQ(0, mdclog_internal_pop_mdc_scope(scope));
+    EXPECT_EQ(-1, mdclog_internal_pop_mdc_scope(scope));
+}
+
+TEST_F(MDCTest, MDCRemovedInScopeIsRemovedFromOuterScopes)
+{
+    addAndCheck("first", "1");
+    addAndCheck("second", "2");
+    auto scope(mdclog_internal_push_mdc_scope());
+    addAndCheck("first", "scope");
+    mdclog_internal_rm_mdc("first");
+    mdclog_internal_rm_mdc("second");
+    EXPECT_THAT(mdclog_internal_search_mdc("first"), IsNull());
+    EXPECT_EQ(0, mdclog_internal_pop_mdc_scope(scope));
+    EXPECT_THAT(mdclog_internal_search_mdc("first"), IsNull());
+    EXPECT_THAT(mdclog_internal_search_mdc("second"), IsNull());
+    EXPECT_TRUE(keys().empty());
+}
+
+TEST_F(MDCTest, ScopeSurvivesCleaningTheList)
+{
+    addAndCheck("first", "1");
+    auto scope(mdclog_internal_push_mdc_scope());
+    mdclog_internal_clean_mdclist();
+    addAndCheck("second", "2");
+    EXPECT_EQ(0, mdclog_internal_pop_mdc_scope(scope));
+    EXPECT_TRUE(keys().empty());
+}
+
+TEST_F(MDCTest, ScopesSurviveCompactionOfRemovedMDCs)
+{
+    addAndCheck("key", "outer");
+    for (int i = 0; i < 100; i++)
+        addAndCheck(("outer" + std::to_string(i)).c_str(), "value");
+    auto scope(mdclog_internal_push_mdc_scope());
+    addAndCheck("key", "inner");
+    for (int round = 0; round < 100; round++)
+    {
+        for (int i = 0; i < 50; i++)
+            addAndCheck(("inner" + std::to_string(round) + "_" + std::to_string(i)).c_str(), "value");
+        for (int i = 0; i < 49; i++)
+            mdclog_internal_rm_mdc(("inner" + std::to_string(round) + "_" + std::to_string(i)).c_str());
+        mdclog_internal_rm_mdc(("outer" + std::to_string(round)).c_str());
+    }
+    findAndCheck("key", "inner");
+    EXPECT_EQ(0, mdclog_internal_pop_mdc_scope(scope));
+    findAndCheck("key", "outer");
+    EXPECT_THAT(keys(), ElementsAre("key"));
+}
+
+TEST_F(MDCTest, ScopeEndTimeDoesNotDependOnOuterMDCs)
+{
+    for (int i = 0; i < 10000; i++)
+        addAndCheck(("outer" + std::to_string(i)).c_str(), "value");
+    for (int round = 0; round < 10000; round++)
+    {
+        auto scope(mdclog_internal_push_mdc_scope());
+        EXPECT_EQ(0, mdclog_internal_put_mdc("request", "id"));
+        EXPECT_EQ(0, mdclog_internal_put_mdc("outer0", "shadow"));
+        EXPECT_EQ(0, mdclog_internal_pop_mdc_scope(scope));
+    }
+    findAndCheck("outer0", "value");
+    EXPECT_THAT(mdclog_internal_search_mdc("request"), IsNull());
+    EXPECT_EQ(10000U, keys().size());
+}
+
+class MDCJsonTest: public MDCTest
+{
+public:
+    void TearDown()
+    {
+        MDCTest::TearDown();
+        mdclog_internal_clean_global_mdcs();
+    }
+
+    std::string json()
+    {
+        struct mdc_json json;
+        if (mdclog_internal_get_mdc_json(mdclog_internal_get_first_mdc(), &json))
+            return "NULL";
+        EXPECT_EQ(strlen(json.global), json.global_len);
+        EXPECT_EQ(strlen(json.thread), json.thread_len);
+        return std::string(json.global) + "|" + json.thread;
+    }
+
+    void setGlobal(std::vector<const char*> keys, std::vector<const char*> values)
+    {
+        ASSERT_EQ(0, mdclog_internal_set_global_mdcs(keys.data(), values.data(), keys.size()));
+    }
+};
+
+TEST_F(MDCJsonTest, EmptyListIsSerializedToEmptyString)
+{
+    EXPECT_EQ("|", json());
+}
+
+TEST_F(MDCJsonTest, MDCsAreSerializedInListOrder)
+{
+    addAndCheck("key1", "value1");
+    addAndCheck("key2", "value\"2", "value\\\"2");
+    EXPECT_EQ("|\"key2\":\"value\\\"2\",\"key1\":\"value1\"", json());
+}
+
+TEST_F(MDCJsonTest, SerializedMDCsAreUpdatedWhenMDCsChange)
+{
+    addAndCheck("key1", "value1");
+    EXPECT_EQ("|\"key1\":\"value1\"", json());
+    addAndCheck("key2", "value2");
+    EXPECT_EQ("|\"key2\":\"value2\",\"key1\":\"value1\"", json());
+    addAndCheck("key1", "a much longer value than before");
+    EXPECT_EQ("|\"key2\":\"value2\",\"key1\":\"a much longer value than before\"", json());
+    mdclog_internal_rm_mdc("key2");
+    EXPECT_EQ("|\"key1\":\"a much longer value than before\"", json());
+    mdclog_internal_clean_mdclist();
+    EXPECT_EQ("|", json());
+}
+
+TEST_F(MDCJsonTest, SerializedMDCsAreUpdatedWhenScopeEnds)
+{
+    addAndCheck("key1", "value1");
+    auto scope(mdclog_internal_push_mdc_scope());
+    addAndCheck("key1", "scope");
+    addAndCheck("key2", "value2");
+    EXPECT_EQ("|\"key2\":\"value2\",\"key1\":\"scope\"", json());
+    EXPECT_EQ(0, mdclog_internal_pop_mdc_scope(scope));
+    EXPECT_EQ("|\"key1\":\"value1\"", json());
+}
+
+TEST_F(MDCJsonTest, SerializedMDCsAreNotReturnedForOtherThanFirstMDC)
+{
+    struct mdc_json json;
+    addAndCheck("key1", "value1");
+    addAndCheck("key2", "value2");
+    EXPECT_EQ(-1, mdclog_internal_get_mdc_json(mdclog_internal_search_mdc("key1"), &json));
+}
+
+TEST_F(MDCJsonTest, GlobalMDCsAreSerializedInGivenOrder)
+{
+    setGlobal({"g1", "g2", "g1"}, {"v1", "v\"2", "duplicate"});
+    EXPECT_EQ("\"g1\":\"v1\",\"g2\":\"v\\\"2\"|", json());
+    addAndCheck("key1", "value1");
+    EXPECT_EQ("\"g1\":\"v1\",\"g2\":\"v\\\"2\"|\"key1\":\"value1\"", json());
+}
+
+TEST_F(MDCJsonTest, ThreadMDCOverridesGlobalMDC)
+{
+    setGlobal({"g1", "g2", "g3"}, {"v1", "v2", "v3"});
+    addAndCheck("g2", "thread");
+    EXPECT_EQ("|\"g1\":\"v1\",\"g3\":\"v3\",\"g2\":\"thread\"", json());
+    mdclog_internal_rm_mdc("g2");
+    EXPECT_EQ("\"g1\":\"v1\",\"g2\":\"v2\",\"g3\":\"v3\"|", json());
+}
+
+TEST_F(MDCJsonTest, SerializedMDCsAreUpdatedWhenGlobalMDCsAreReplaced)
+{
+    setGlobal({"g1"}, {"v1"});
+    addAndCheck("g1", "thread");
+    EXPECT_EQ("|\"g1\":\"thread\"", json());
+    setGlobal({"g2"}, {"v2"});
+    EXPECT_EQ("\"g2\":\"v2\"|\"g1\":\"thread\"", json());
+    mdclog_internal_clean_global_mdcs();
+    EXPECT_EQ("|\"g1\":\"thread\"", json());
+}
+
+TEST_F(MDCJsonTest, GlobalMDCsCanBeSearchedAndIterated)
+{
+    setGlobal({"g1", "g2"}, {"v1", "v\n2"});
+    auto mdc(mdclog_internal_search_global_mdc("g2"));
+    ASSERT_THAT(mdc, NotNull());
+    EXPECT_THAT(mdclog_internal_get_mdc_val(mdc), StrEq("v 2"));
+    EXPECT_THAT(mdclog_internal_search_global_mdc("g3"), IsNull());
+    EXPECT_THAT(mdclog_internal_search_mdc("g1"), IsNull());
+    mdc = mdclog_internal_get_first_global_mdc();
+    ASSERT_THAT(mdc, NotNull());
+    EXPECT_THAT(mdclog_internal_get_mdc_key(mdc), StrEq("g1"));
+    mdc = mdclog_internal_get_next_mdc(mdc);
+    EXPECT_THAT(mdclog_internal_get_mdc_key(mdc), StrEq("g2"));
+    EXPECT_THAT(mdclog_internal_get_next_mdc(mdc), IsNull());
+}
+
+TEST_F(MDCJsonTest, GlobalMDCsAreVisibleToAllThreads)
+{
+    setGlobal({"g1"}, {"v1"});
+    std::thread thread([this]()
+            {
+                EXPECT_EQ("\"g1\":\"v1\"|", json());
+                mdclog_internal_destroy_mdclist();
+            });
+    thread.join();
+}
+
+TEST_F(MDCJsonTest, SnapshotIsAdoptedByAnotherThread)
+{
+    addAndCheck("key1", "value1");
+    addAndCheck("key2", "value\"2", "value\\\"2");
+    auto snapshot(mdclog_internal_snapshot_mdcs());
+    ASSERT_THAT(snapshot, NotNull());
+    mdclog_internal_clean_mdclist();
+    std::thread thread([this, snapshot]()
+            {
+                EXPECT_EQ(0, mdclog_internal_adopt_mdcs(snapshot));
+                findAndCheck("key2", "value\\\"2");
+                EXPECT_THAT(keys(), ElementsAre("key2", "key1"));
+                EXPECT_EQ("|\"key2\":\"value\\\"2\",\"key1\":\"value1\"", json());
+                mdclog_internal_destroy_mdclist();
+            });
+    thread.join();
+    EXPECT_TRUE(keys().empty());
+    mdclog_internal_release_mdc_snapshot(snapshot);
+}
+
+TEST_F(MDCJsonTest, SnapshotIsReusedUntilMDCsAreModified)
+{
+    addAndCheck("key1", "value1");
+    auto first(mdclog_internal_snapshot_mdcs());
+    auto second(mdclog_internal_snapshot_mdcs());
+    EXPECT_EQ(first, second);
+    addAndCheck("key2", "value2");
+    auto third(mdclog_internal_snapshot_mdcs());
+    EXPECT_NE(first, third);
+    EXPECT_EQ(0, mdclog_internal_adopt_mdcs(first));
+    auto adopted(mdclog_internal_snapshot_mdcs());
+    EXPECT_EQ(first, adopted);
+    EXPECT_THAT(keys(), ElementsAre("key1"));
+    for (auto snapshot: { first, second, third, adopted })
+        mdclog_internal_release_mdc_snapshot(snapshot);
+}
+
+TEST_F(MDCJsonTest, AdoptedMDCsAreCopiedWhenModified)
+{
+    addAndCheck("key1", "value1");
+    addAndCheck("key2", "value2");
+    auto snapshot(mdclog_internal_snapshot_mdcs());
+    mdclog_internal_clean_mdclist();
+    addAndCheck("own", "value");
+    EXPECT_EQ(0, mdclog_internal_adopt_mdcs(snapshot));
+    EXPECT_THAT(mdclog_internal_search_mdc("own"), IsNull());
+    mdclog_internal_rm_mdc("unknown");
+    addAndCheck("key1", "replaced");
+    addAndCheck("key3", "value3");
+    mdclog_internal_rm_mdc("key2");
+    EXPECT_THAT(keys(), ElementsAre("key3", "key1"));
+    EXPECT_EQ("|\"key3\":\"value3\",\"key1\":\"replaced\"", json());
+
+    EXPECT_EQ(0, mdclog_internal_adopt_mdcs(snapshot));
+    mdclog_internal_release_mdc_snapshot(snapshot);
+    EXPECT_EQ("|\"key2\":\"value2\",\"key1\":\"value1\"", json());
+    mdclog_internal_clean_mdclist();
+    EXPECT_TRUE(keys().empty());
+}
+
+TEST_F(MDCJsonTest, AdoptingSnapshotReplacesMDCsOfOpenScopes)
+{
+    addAndCheck("outer", "1");
+    auto snapshot(mdclog_internal_snapshot_mdcs());
+    auto scope(mdclog_internal_push_mdc_scope());
+    addAndCheck("inner", "2");
+    EXPECT_EQ(0, mdclog_internal_adopt_mdcs(snapshot));
+    mdclog_internal_release_mdc_snapshot(snapshot);
+    EXPECT_THAT(keys(), ElementsAre("outer"));
+    EXPECT_EQ(0, mdclog_internal_pop_mdc_scope(scope));
+    EXPECT_TRUE(keys().empty());
+}
+
+TEST_F(MDCJsonTest, SnapshotOfThreadOverridingGlobalMDCsIsMergedWithThem)
+{
+    setGlobal({"g1", "g2"}, {"v1", "v2"});
+    addAndCheck("g2", "thread");
+    auto snapshot(mdclog_internal_snapshot_mdcs());
+    std::thread thread([this, snapshot]()
+            {
+                EXPECT_EQ(0, mdclog_internal_adopt_mdcs(snapshot));
+                EXPECT_EQ("|\"g1\":\"v1\",\"g2\":\"thread\"", json());
+                setGlobal({"g3"}, {"v3"});
+                EXPECT_EQ("\"g3\":\"v3\"|\"g2\":\"thread\"", json());
+                mdclog_internal_destroy_mdclist();
+            });
+    thread.join();
+    mdclog_internal_release_mdc_snapshot(snapshot);
+}
+
+TEST_F(MDCJsonTest, SnapshotOutlivesThreadThatTookIt)
+{
+    struct mdclog_mdc_snapshot *snapshot = nullptr;
+    std::thread thread([this, &snapshot]()
+            {
+                addAndCheck("key", "value");
+                snapshot = mdclog_internal_snapshot_mdcs();
+                mdclog_internal_destroy_mdclist();
+            });
+    thread.join();
+    ASSERT_THAT(snapshot, NotNull());
+    EXPECT_EQ(0, mdclog_internal_adopt_mdcs(snapshot));
+    mdclog_internal_release_mdc_snapshot(snapshot);
+    findAndCheck("key", "value");
+    EXPECT_EQ("|\"key\":\"value\"", json());
+}
 
 class MDCTestWithThreads: public MDCTest
 {
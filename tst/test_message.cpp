@@ -0,0 +1,198 @@
+/*
+ * Tests for the fused formatting and escaping of the log messages
+ *
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ */
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <thread>
+
+#include "private/message.h"
+#include "private/json_format.h"
+
+using namespace testing;
+
+#define BUFFER_LENGTH 1024
+
+/*
+ * Format with the fused formatter and with vsnprintf followed by escaping,
+ * as the messages were formatted before, and compare the results
+ */
+static void expect_same(size_t len, const char* format, ...)
+{
+    char    fused[BUFFER_LENGTH];
+    char    raw[BUFFER_LENGTH];
+    char    escaped[BUFFER_LENGTH];
+    int     fused_truncated = -1;
+    int     escape_truncated;
+    int     ret;
+    int     raw_len;
+    va_list va;
+
+    ASSERT_LT(len, (size_t)BUFFER_LENGTH);
+    va_start(va, format);
+    ret = mdclog_internal_format_message(fused, len, format, va, &fused_truncated);
+    va_end(va);
+    ASSERT_GE(ret, 0) << format;
+
+    va_start(va, format);
+    raw_len = vsnprintf(raw, len + 1, format, va);
+    va_end(va);
+    mdclog_internal_escape(escaped, len, raw, &escape_truncated);
+
+    EXPECT_STREQ(escaped, fused) << format;
+    EXPECT_EQ(strlen(fused), (size_t)ret) << format;
+    EXPECT_EQ((size_t)raw_len >= len || escape_truncated, fused_truncated) << format;
+}
+
+static int format_message(char* buffer, size_t len, int* truncated, const char* format, ...)
+{
+    va_list va;
+    int     ret;
+
+    va_start(va, format);
+    ret = mdclog_internal_format_message(buffer, len, format, va, truncated);
+    va_end(va);
+    return ret;
+}
+
+TEST(MessageTest, LiteralMessagesAreCopiedOrEscaped)
+{
+    expect_same(100, "");
+    expect_same(100, "plain text");
+    expect_same(100, "quote \" backslash \\ tab \t newline \n");
+    expect_same(100, "100%% done %%");
+    expect_same(100, "utf-8 \xc3\xa4");
+}
+
+TEST(MessageTest, StringsAreEscapedWhileCopied)
+{
+    expect_same(100, "a %s b", "text");
+    expect_same(100, "a %s b %s", "\"quoted\"", "back\\slash\n");
+    expect_same(100, "[%10s][%-10s]", "ab\"c", "d\\e");
+    expect_same(100, "[%.3s][%.*s][%*s][%-*s]", "abcdef", 2, "a\"bc", 6, "x\"", -6, "y");
+    expect_same(100, "[%s][%.3s][%.6s][%10s]", (char*)NULL, (char*)NULL, (char*)NULL, (char*)NULL);
+    expect_same(100, "[%c][%3c][%-3c]", 'a', '"', '\\');
+    expect_same(100, "%s", "");
+}
+
+TEST(MessageTest, NumbersAreFormattedLikePrintf)
+{
+    expect_same(200, "%d %i %u %ld %lu %lld %llu %zu %zd %jd %td",
+                INT_MIN, INT_MAX, UINT_MAX, LONG_MIN, ULONG_MAX, LLONG_MIN, ULLONG_MAX,
+                SIZE_MAX, (ssize_t)-1, INTMAX_MIN, (ptrdiff_t)-5);
+    expect_same(200, "%5d|%-5d|%05d|%+d|% d|%.3d|%*d|%.*d", 1, 2, 3, 4, 5, 6, 4, 7, 3, 8);
+    expect_same(200, "%hd %hhu %x %X %#o %lx", 70000, 300, 255U, 255U, 8U, 0xdeadbeefUL);
+    expect_same(200, "%f %.2f %10.3e %g %G %a %Lf", 1.5, 3.14159, 12345.678, 1e-10, 1e20, 0.5, (long double)2.25);
+    expect_same(200, "%p %p", (void*)0x1234, (void*)NULL);
+}
+
+TEST(MessageTest, ErrnoIsFormattedFromTheCallTime)
+{
+    errno = ENOENT;
+    expect_same(200, "open failed: %m");
+    errno = ENOENT;
+    expect_same(200, "%m %d %m", 5);
+}
+
+TEST(MessageTest, OutputIsTruncatedLikeBefore)
+{
+    size_t len;
+
+    for (len = 1; len < 40; len++)
+    {
+        expect_same(len, "literal text without conversions");
+        expect_same(len, "literal \"text\" that \\needs\\ escaping");
+        expect_same(len, "%s and %s", "\"string\"", "another \\ string");
+        expect_same(len, "%d-%u-%f-%20s-%c", -123456, 7890U, 1.25, "padded", 'z');
+        expect_same(len, "%%%-8s%%", "\"");
+    }
+}
+
+TEST(MessageTest, ZeroCharacterEndsTheMessage)
+{
+    expect_same(100, "before %c after %s", '\0', "string");
+    expect_same(100, "before %5c after", '\0');
+}
+
+TEST(MessageTest, UnsupportedFormatsAreRejected)
+{
+    char buffer[100];
+    int  truncated;
+
+    EXPECT_EQ(-1, format_message(buffer, sizeof(buffer), &truncated, "%1$s", "positional"));
+    EXPECT_EQ(-1, format_message(buffer, sizeof(buffer), &truncated, "%ls", L"wide"));
+    EXPECT_EQ(-1, format_message(buffer, sizeof(buffer), &truncated, "%+s", "flag"));
+    EXPECT_EQ(-1, format_message(buffer, sizeof(buffer), &truncated, "%-20m"));
+    EXPECT_EQ(-1, format_message(buffer, sizeof(buffer), &truncated, "trailing %"));
+    // the result is cached too
+    EXPECT_EQ(-1, format_message(buffer, sizeof(buffer), &truncated, "%1$s", "positional"));
+}
+
+TEST(MessageTest, ChangedFormatBufferIsCompiledAgain)
+{
+    char format[32];
+    char buffer[100];
+    int  truncated;
+
+    strcpy(format, "number %d");
+    EXPECT_EQ(8, format_message(buffer, sizeof(buffer), &truncated, format, 1));
+    EXPECT_STREQ("number 1", buffer);
+    EXPECT_EQ(8, format_message(buffer, sizeof(buffer), &truncated, format, 2));
+    EXPECT_STREQ("number 2", buffer);
+
+    strcpy(format, "string \"%s\"");
+    format_message(buffer, sizeof(buffer), &truncated, format, "text");
+    EXPECT_STREQ("string \\\"text\\\"", buffer);
+
+    strcpy(format, "%1$s");
+    EXPECT_EQ(-1, format_message(buffer, sizeof(buffer), &truncated, format, "text"));
+}
+
+TEST(MessageTest, ThreadsHaveTheirOwnCaches)
+{
+    std::thread threads[4];
+    int         i;
+
+    for (i = 0; i < 4; i++)
+    {
+        threads[i] = std::thread([i]() {
+            char buffer[100];
+            char expected[100];
+            int  truncated;
+            int  j;
+
+            for (j = 0; j < 1000; j++)
+            {
+                snprintf(expected, sizeof(expected), "thread %d round %d", i, j);
+                format_message(buffer, sizeof(buffer), &truncated, "thread %d round %d", i, j);
+                EXPECT_STREQ(expected, buffer);
+            }
+        });
+    }
+    for (i = 0; i < 4; i++)
+        threads[i].join();
+}
@@ -0,0 +1,236 @@
+/*
+ * Tests for the rate limiting and sampling
+ *
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ */
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <errno.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "private/ratelimit.h"
+
+using namespace testing;
+
+class RateLimitTest: public testing::Test
+{
+public:
+    const uint64_t second = 1000000000ULL;
+    uint64_t start;
+    mdclog_site_t site;
+
+    void SetUp()
+    {
+        // the buckets of the format strings outlive a test, so every test starts later
+        static uint64_t nextStart;
+        nextStart += 1000 * second;
+        start = nextStart;
+        memset(&site, 0, sizeof(site));
+        reset();
+    }
+
+    void TearDown()
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        struct suppression_summary summary;
+
+        mdclog_internal_set_rate_limit(0, 0);
+        for (int severity = MDCLOG_FATAL; severity <= MDCLOG_TRACE; severity++)
+            mdclog_internal_set_sampling(static_cast<mdclog_severity_t>(severity), 1.0);
+        mdclog_internal_set_summary_interval(SUPPRESSION_DEFAULT_SUMMARY_INTERVAL_MS);
+        mdclog_internal_take_summary(0, 1, &summary);
+    }
+
+    int admitted(mdclog_site_t* site, const char* format, int count, uint64_t now)
+    {
+        int ret = 0;
+
+        for (int i = 0; i < count; i++)
+            ret += mdclog_internal_admit(site, format, MDCLOG_ERR, now);
+        return ret;
+    }
+};
+
+TEST_F(RateLimitTest, AllEntriesAreAdmittedByDefault)
+{
+    EXPECT_FALSE(mdclog_internal_suppression_active());
+    EXPECT_EQ(1000, admitted(&site, "entry", 1000, start));
+}
+
+TEST_F(RateLimitTest, BurstIsAdmittedAndTheRestDiscarded)
+{
+    ASSERT_EQ(0, mdclog_internal_set_rate_limit(10, 5));
+    EXPECT_TRUE(mdclog_internal_suppression_active());
+    EXPECT_EQ(5, admitted(&site, "entry", 100, start));
+}
+
+TEST_F(RateLimitTest, TokensAreRefilledAtTheConfiguredRate)
+{
+    ASSERT_EQ(0, mdclog_internal_set_rate_limit(10, 5));
+    EXPECT_EQ(5, admitted(&site, "entry", 100, start));
+    EXPECT_EQ(0, admitted(&site, "entry", 100, start + second / 10 - 1));
+    EXPECT_EQ(1, admitted(&site, "entry", 100, start + second / 10));
+    EXPECT_EQ(5, admitted(&site, "entry", 100, start + 10 * second));
+}
+
+TEST_F(RateLimitTest, ZeroBurstIsOneSecondOfEntries)
+{
+    ASSERT_EQ(0, mdclog_internal_set_rate_limit(20, 0));
+    EXPECT_EQ(20, admitted(&site, "entry", 100, start));
+}
+
+TEST_F(RateLimitTest, CallSitesHaveBucketsOfTheirOwn)
+{
+    mdclog_site_t other = {};
+
+    ASSERT_EQ(0, mdclog_internal_set_rate_limit(1, 1));
+    EXPECT_EQ(1, admitted(&site, "entry", 10, start));
+    EXPECT_EQ(1, admitted(&other, "entry", 10, start));
+}
+
+TEST_F(RateLimitTest, FormatStringIdentifiesTheCallSiteWithoutSiteObject)
+{
+    static const char first[] = "first format";
+    static const char second[] = "second format";
+
+    ASSERT_EQ(0, mdclog_internal_set_rate_limit(1, 2));
+    EXPECT_EQ(2, admitted(NULL, first, 10, start));
+    EXPECT_EQ(2, admitted(NULL, second, 10, start));
+    EXPECT_EQ(0, admitted(NULL, first, 10, start));
+}
+
+TEST_F(RateLimitTest, RateLimitingCanBeDisabled)
+{
+    ASSERT_EQ(0, mdclog_internal_set_rate_limit(1, 1));
+    EXPECT_EQ(1, admitted(&site, "entry", 10, start));
+    ASSERT_EQ(0, mdclog_internal_set_rate_limit(0, 0));
+    EXPECT_EQ(10, admitted(&site, "entry", 10, start));
+}
+
+TEST_F(RateLimitTest, ConcurrentThreadsShareTheBucketOfACallSite)
+{
+    std::atomic<int> total(0);
+    std::vector<std::thread> threads;
+
+    ASSERT_EQ(0, mdclog_internal_set_rate_limit(1000, 1000));
+    for (int i = 0; i < 4; i++)
+        threads.emplace_back([&]() { total += admitted(&site, "entry", 1000, start); });
+    for (auto& thread: threads)
+        thread.join();
+    EXPECT_EQ(1000, total);
+}
+
+TEST_F(RateLimitTest, ProbabilityZeroDiscardsAllAndOneAdmitsAllEntries)
+{
+    ASSERT_EQ(0, mdclog_internal_set_sampling(MDCLOG_ERR, 0.0));
+    EXPECT_TRUE(mdclog_internal_suppression_active());
+    EXPECT_EQ(0, admitted(&site, "entry", 1000, start));
+    ASSERT_EQ(0, mdclog_internal_set_sampling(MDCLOG_ERR, 1.0));
+    EXPECT_EQ(1000, admitted(&site, "entry", 1000, start));
+}
+
+TEST_F(RateLimitTest, SamplingAdmitsTheGivenShareOfEntries)
+{
+    ASSERT_EQ(0, mdclog_internal_set_sampling(MDCLOG_ERR, 0.25));
+    int count = admitted(&site, "entry", 10000, start);
+    EXPECT_GT(count, 2200);
+    EXPECT_LT(count, 2800);
+}
+
+TEST_F(RateLimitTest, SamplingAppliesOnlyToTheGivenSeverity)
+{
+    ASSERT_EQ(0, mdclog_internal_set_sampling(MDCLOG_DEBUG, 0.0));
+    EXPECT_EQ(0, mdclog_internal_admit(&site, "entry", MDCLOG_DEBUG, start));
+    EXPECT_EQ(1, mdclog_internal_admit(&site, "entry", MDCLOG_INFO, start));
+}
+
+TEST_F(RateLimitTest, InvalidArgumentsAreNotAccepted)
+{
+    EXPECT_EQ(-1, mdclog_internal_set_rate_limit(1000000001U, 0));
+    EXPECT_EQ(EINVAL, errno);
+    EXPECT_EQ(-1, mdclog_internal_set_sampling(MDCLOG_ERR, 1.5));
+    EXPECT_EQ(EINVAL, errno);
+    EXPECT_EQ(-1, mdclog_internal_set_sampling(MDCLOG_ERR, -0.1));
+    EXPECT_EQ(EINVAL, errno);
+    EXPECT_EQ(-1, mdclog_internal_set_sampling(static_cast<mdclog_severity_t>(6), 0.5));
+    EXPECT_EQ(EINVAL, errno);
+}
+
+TEST_F(RateLimitTest, SummaryIsTakenAfterTheSummaryIntervalFromTheFirstDiscardedEntry)
+{
+    struct suppression_summary summary;
+
+    mdclog_internal_set_summary_interval(1000);
+    ASSERT_EQ(0, mdclog_internal_set_rate_limit(1, 1));
+    ASSERT_EQ(0, mdclog_internal_set_sampling(MDCLOG_INFO, 0.0));
+    EXPECT_EQ(0, mdclog_internal_take_summary(start, 0, &summary));
+    EXPECT_EQ(1, admitted(&site, "entry", 4, start));
+    EXPECT_EQ(0, mdclog_internal_admit(&site, "entry", MDCLOG_INFO, start));
+    EXPECT_EQ(0, mdclog_internal_take_summary(start, 0, &summary));
+    EXPECT_EQ(0, mdclog_internal_take_summary(start + second - 1, 0, &summary));
+    ASSERT_EQ(1, mdclog_internal_take_summary(start + second, 0, &summary));
+    EXPECT_EQ(3U, summary.rate_limited);
+    EXPECT_EQ(1U, summary.sampled_out);
+    EXPECT_EQ(MDCLOG_ERR, summary.severity);
+    EXPECT_EQ(0, mdclog_internal_take_summary(start + 3 * second, 0, &summary));
+}
+
+TEST_F(RateLimitTest, ForcedSummaryIgnoresTheInterval)
+{
+    struct suppression_summary summary;
+
+    ASSERT_EQ(0, mdclog_internal_set_sampling(MDCLOG_WARN, 0.0));
+    EXPECT_EQ(0, mdclog_internal_admit(&site, "entry", MDCLOG_WARN, start));
+    ASSERT_EQ(1, mdclog_internal_take_summary(start, 1, &summary));
+    EXPECT_EQ(0U, summary.rate_limited);
+    EXPECT_EQ(1U, summary.sampled_out);
+    EXPECT_EQ(MDCLOG_WARN, summary.severity);
+}
+
+TEST_F(RateLimitTest, SuppressionIsActiveUntilDiscardedEntriesAreReported)
+{
+    struct suppression_summary summary;
+
+    ASSERT_EQ(0, mdclog_internal_set_rate_limit(1, 1));
+    EXPECT_EQ(1, admitted(&site, "entry", 2, start));
+    ASSERT_EQ(0, mdclog_internal_set_rate_limit(0, 0));
+    EXPECT_TRUE(mdclog_internal_suppression_active());
+    ASSERT_EQ(1, mdclog_internal_take_summary(start, 1, &summary));
+    EXPECT_FALSE(mdclog_internal_suppression_active());
+}
+
+TEST_F(RateLimitTest, StatisticsAreCumulative)
+{
+    mdclog_stats_t before, after;
+
+    mdclog_internal_suppression_stats(&before);
+    ASSERT_EQ(0, mdclog_internal_set_rate_limit(1, 1));
+    ASSERT_EQ(0, mdclog_internal_set_sampling(MDCLOG_DEBUG, 0.0));
+    EXPECT_EQ(1, admitted(&site, "entry", 3, start));
+    EXPECT_EQ(0, mdclog_internal_admit(&site, "entry", MDCLOG_DEBUG, start));
+    mdclog_internal_suppression_stats(&after);
+    EXPECT_EQ(before.rate_limited + 2, after.rate_limited);
+    EXPECT_EQ(before.sampled_out + 1, after.sampled_out);
+}
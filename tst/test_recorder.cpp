@@ -0,0 +1,307 @@
+/*
+ * Tests for the flight recorder
+ *
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ */
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <errno.h>
+#include <fstream>
+#include <sstream>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "mdclog/mdclog.h"
+#include "private/recorder.h"
+#include "system_mock.hpp"
+
+using namespace testing;
+using namespace mdclogtest;
+
+extern "C" {
+void mdclog_lib_clean(void);
+}
+
+struct Entry
+{
+    std::string text;
+    uint64_t    sequence;
+};
+
+static void collect(const char *entry, size_t len, uint64_t sequence, void *arg)
+{
+    static_cast<std::vector<Entry>*>(arg)->push_back({ std::string(entry, len), sequence });
+}
+
+class RecorderTest: public testing::Test
+{
+public:
+    NiceMock<SystemMock> systemMock;
+    std::string          path;
+    const size_t         capacity = 4096;
+
+    void SetUp()
+    {
+        char name[] = "/tmp/mdclog_recorder_XXXXXX";
+        int  fd = mkstemp(name);
+
+        ASSERT_LE(0, fd);
+        close(fd);
+        unlink(name);
+        path = name;
+        setSystemMock(&systemMock);
+    }
+
+    void TearDown()
+    {
+        mdclog_internal_recorder_set(NULL);
+        mdclog_lib_clean();
+        mdclog_level_set(MDCLOG_ERR);
+        unlink(path.c_str());
+    }
+
+    void open(size_t size)
+    {
+        struct recorder *recorder = mdclog_internal_recorder_open(path.c_str(), size);
+
+        ASSERT_NE(nullptr, recorder);
+        mdclog_internal_recorder_set(recorder);
+    }
+
+    void record(const std::string& entry)
+    {
+        mdclog_internal_recorder_write(entry.data(), entry.size());
+    }
+
+    std::string file()
+    {
+        std::ifstream     file(path);
+        std::stringstream content;
+
+        content << file.rdbuf();
+        return content.str();
+    }
+
+    std::vector<Entry> read(const std::string& content)
+    {
+        std::vector<Entry> entries;
+
+        EXPECT_LE(0, mdclog_internal_recorder_read(content.data(), content.size(), collect, &entries));
+        return entries;
+    }
+
+    std::vector<Entry> read()
+    {
+        return read(file());
+    }
+};
+
+TEST_F(RecorderTest, EntriesAreReadInOrder)
+{
+    std::vector<Entry> entries;
+
+    open(capacity);
+    record("first");
+    record("second entry");
+    record("");
+    entries = read();
+    ASSERT_EQ(3U, entries.size());
+    EXPECT_EQ("first", entries[0].text);
+    EXPECT_EQ("second entry", entries[1].text);
+    EXPECT_EQ("", entries[2].text);
+    EXPECT_EQ(0U, entries[0].sequence);
+    EXPECT_LT(entries[0].sequence, entries[1].sequence);
+    EXPECT_LT(entries[1].sequence, entries[2].sequence);
+}
+
+TEST_F(RecorderTest, OnlyTheLatestEntriesAreKeptAfterTheRingWraps)
+{
+    std::vector<Entry> entries;
+
+    open(capacity);
+    for (int i = 0; i < 1000; i++)
+        record("entry number " + std::to_string(i));
+    entries = read();
+    ASSERT_LT(100U, entries.size());
+    // the oldest entry can be the one partly overwritten at the start of the ring
+    EXPECT_THAT(entries.size(), AnyOf(Eq(capacity / 32), Eq(capacity / 32 - 1)));
+    for (size_t i = 0; i < entries.size(); i++)
+        EXPECT_EQ("entry number " + std::to_string(1000 - entries.size() + i), entries[i].text);
+}
+
+TEST_F(RecorderTest, EntriesWrappingAroundTheEndOfTheRingAreIntact)
+{
+    std::vector<Entry> entries;
+    std::string        entry(1000, 'x');
+
+    open(capacity);
+    for (int i = 0; i < 20; i++)
+    {
+        entry[0] = (char)('a' + i);
+        record(entry);
+        entries = read();
+        ASSERT_FALSE(entries.empty());
+        EXPECT_EQ(entry, entries.back().text);
+    }
+}
+
+TEST_F(RecorderTest, TooLongEntryIsNotRecorded)
+{
+    open(capacity);
+    record(std::string(capacity, 'x'));
+    record("short");
+    ASSERT_EQ(1U, read().size());
+    EXPECT_EQ("short", read()[0].text);
+}
+
+TEST_F(RecorderTest, RecordBeingWrittenAndCorruptedRecordAreSkipped)
+{
+    std::vector<Entry>      entries;
+    std::string             content;
+    struct recorder_header *header;
+
+    open(capacity);
+    record("first");
+    record("second");
+    record("third");
+    mdclog_internal_recorder_set(NULL);
+    content = file();
+    // corrupt the stamp of the second record, and reserve a record that was never written
+    content[RECORDER_HEADER_SIZE + 24] ^= 1;
+    header = reinterpret_cast<struct recorder_header*>(&content[0]);
+    header->head += 64;
+    entries = read(content);
+    ASSERT_EQ(2U, entries.size());
+    EXPECT_EQ("first", entries[0].text);
+    EXPECT_EQ("third", entries[1].text);
+}
+
+TEST_F(RecorderTest, FileWithTheSameSizeIsContinued)
+{
+    open(capacity);
+    record("first");
+    open(capacity);
+    record("second");
+    ASSERT_EQ(2U, read().size());
+    open(2 * capacity);
+    record("third");
+    ASSERT_EQ(1U, read().size());
+    EXPECT_EQ("third", read()[0].text);
+}
+
+TEST_F(RecorderTest, EntriesAreNotRecordedWithoutRecorder)
+{
+    open(capacity);
+    mdclog_internal_recorder_set(NULL);
+    record("lost");
+    EXPECT_TRUE(read().empty());
+}
+
+TEST_F(RecorderTest, InvalidFileIsNotRead)
+{
+    std::string        content(RECORDER_HEADER_SIZE + capacity, 'x');
+    std::vector<Entry> entries;
+
+    EXPECT_EQ(-1, mdclog_internal_recorder_read(content.data(), content.size(), collect, &entries));
+    EXPECT_EQ(EINVAL, errno);
+    open(capacity);
+    content = file();
+    EXPECT_EQ(-1, mdclog_internal_recorder_read(content.data(), content.size() - 1, collect, &entries));
+    EXPECT_EQ(EINVAL, errno);
+}
+
+TEST_F(RecorderTest, EntriesOfConcurrentWritersAreIntact)
+{
+    std::vector<std::thread> writers;
+    std::vector<Entry>       entries;
+
+    open(64 * 1024);
+    for (int t = 0; t < 4; t++)
+        writers.emplace_back([t, this]()
+        {
+            for (int i = 0; i < 10000; i++)
+                record(std::to_string(t) + ":" + std::string(i % 50, 'x') + ":" + std::to_string(i));
+        });
+    for (auto& writer: writers)
+        writer.join();
+    entries = read();
+    ASSERT_LT(1000U, entries.size());
+    for (auto& entry: entries)
+    {
+        int t = atoi(entry.text.c_str());
+        int i = atoi(entry.text.substr(entry.text.rfind(':') + 1).c_str());
+
+        EXPECT_EQ(std::to_string(t) + ":" + std::string(i % 50, 'x') + ":" + std::to_string(i), entry.text);
+    }
+}
+
+TEST_F(RecorderTest, DebugEntriesAreRecordedButNotWrittenWithErrorLevel)
+{
+    mdclog_attr_t     *attr;
+    std::vector<Entry> entries;
+
+    EXPECT_CALL(systemMock, write(STDOUT_FILENO, _, _))
+        .WillOnce(Invoke([] (int, const void* buffer, size_t len)
+        {
+            EXPECT_THAT(std::string(static_cast<const char*>(buffer), len), HasSubstr("error entry"));
+            return len;
+        }));
+    ASSERT_EQ(0, mdclog_attr_init(&attr));
+    EXPECT_EQ(0, mdclog_attr_set_flight_recorder(attr, path.c_str(), 1, MDCLOG_DEBUG));
+    EXPECT_EQ(0, mdclog_init(attr));
+    mdclog_attr_destroy(attr);
+    EXPECT_EQ(MDCLOG_ERR, mdclog_level_get());
+    EXPECT_TRUE(mdclog_level_enabled(MDCLOG_DEBUG));
+    EXPECT_FALSE(mdclog_level_enabled(MDCLOG_TRACE));
+    mdclog_write(MDCLOG_DEBUG, "debug entry");
+    MDCLOG_DEBUG_WRITE("debug macro entry");
+    mdclog_write(MDCLOG_ERR, "error entry");
+    mdclog_write(MDCLOG_TRACE, "trace entry");
+    entries = read();
+    ASSERT_EQ(3U, entries.size());
+    EXPECT_THAT(entries[0].text, AllOf(HasSubstr("\"crit\":\"DEBUG\""), EndsWith("\"msg\":\"debug entry\"}")));
+    EXPECT_THAT(entries[1].text, EndsWith("\"msg\":\"debug macro entry\"}"));
+    EXPECT_THAT(entries[2].text, EndsWith("\"msg\":\"error entry\"}"));
+    EXPECT_EQ(file().size(), RECORDER_HEADER_SIZE + (size_t)MDCLOG_MIN_RECORDER_SIZE);
+    EXPECT_EQ(0, mdclog_init(NULL));
+    EXPECT_FALSE(mdclog_level_enabled(MDCLOG_DEBUG));
+}
+
+TEST_F(RecorderTest, InvalidRecorderAttributesAreNotAccepted)
+{
+    mdclog_attr_t *attr;
+
+    EXPECT_EQ(-1, mdclog_attr_set_flight_recorder(NULL, path.c_str(), capacity, MDCLOG_DEBUG));
+    EXPECT_EQ(EINVAL, errno);
+    ASSERT_EQ(0, mdclog_attr_init(&attr));
+    EXPECT_EQ(-1, mdclog_attr_set_flight_recorder(attr, "", capacity, MDCLOG_DEBUG));
+    EXPECT_EQ(EINVAL, errno);
+    EXPECT_EQ(-1, mdclog_attr_set_flight_recorder(attr, path.c_str(), MDCLOG_MAX_RECORDER_SIZE + 1, MDCLOG_DEBUG));
+    EXPECT_EQ(EINVAL, errno);
+    EXPECT_EQ(-1, mdclog_attr_set_flight_recorder(attr, path.c_str(), capacity, (mdclog_severity_t)6));
+    EXPECT_EQ(EINVAL, errno);
+    EXPECT_EQ(0, mdclog_attr_set_flight_recorder(attr, NULL, 0, MDCLOG_DEBUG));
+    EXPECT_EQ(0, mdclog_attr_set_flight_recorder(attr, "/nonexistent/dir/recorder", capacity, MDCLOG_DEBUG));
+    EXPECT_EQ(-1, mdclog_init(attr));
+    EXPECT_EQ(ENOENT, errno);
+    mdclog_attr_destroy(attr);
+}
@@ -0,0 +1,223 @@
+/*
+ * Tests for the suppression of repeated log entries
+ *
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ */
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <chrono>
+#include <limits.h>
+#include <mutex>
+#include <semaphore.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <time.h>
+#include <vector>
+
+#include "private/repeat.h"
+
+using namespace testing;
+
+static std::vector<std::string> written;
+static std::mutex               writtenMutex;     // the timer thread writes too
+
+static void writeEntry(const char* entry, size_t len)
+{
+    std::lock_guard<std::mutex> guard(writtenMutex);
+    written.push_back(std::string(entry, len));
+}
+
+static uint64_t monotonicNs()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+class RepeatTest: public testing::Test
+{
+public:
+    const uint64_t timeout = 1000;
+
+    void SetUp()
+    {
+        mdclog_internal_repeat_flush();
+        written.clear();
+    }
+
+    void TearDown()
+    {
+        mdclog_internal_repeat_flush();
+        written.clear();
+    }
+
+    int filter(const std::string& entry, uint64_t now = 0)
+    {
+        size_t end = entry.find(',') + 1;
+
+        // the timestamp is the first field
+        return mdclog_internal_repeat_filter(entry.c_str(), entry.length(), 1, end, timeout, now, writeEntry);
+    }
+
+    std::string entry(int timestamp, const std::string& msg)
+    {
+        return "{\"ts\":" + std::to_string(timestamp) + ",\"crit\":\"ERROR\",\"msg\":\"" + msg + "\"}";
+    }
+};
+
+TEST_F(RepeatTest, TimestampIsSkippedInTheMiddleOfTheEntry)
+{
+    std::string first = "{\"crit\":\"ERROR\",\"ts\":1,\"msg\":\"polling\"}";
+    std::string second = "{\"crit\":\"ERROR\",\"ts\":22,\"msg\":\"polling\"}";
+    std::string other = "{\"crit\":\"INFO\",\"ts\":333,\"msg\":\"polling\"}";
+    size_t      start = strlen("{\"crit\":\"ERROR\",");
+
+    EXPECT_EQ(0, mdclog_internal_repeat_filter(first.c_str(), first.length(), start, first.find(",\"msg") + 1,
+                                               timeout, 0, writeEntry));
+    EXPECT_EQ(1, mdclog_internal_repeat_filter(second.c_str(), second.length(), start, second.find(",\"msg") + 1,
+                                               timeout, 0, writeEntry));
+    start = strlen("{\"crit\":\"INFO\",");
+    EXPECT_EQ(0, mdclog_internal_repeat_filter(other.c_str(), other.length(), start, other.find(",\"msg") + 1,
+                                               timeout, 0, writeEntry));
+    ASSERT_EQ(1U, written.size());
+    EXPECT_EQ("{\"crit\":\"ERROR\",\"ts\":22,\"msg\":\"polling\",\"repeated\":1}\n", written[0]);
+}
+
+TEST_F(RepeatTest, DifferentEntriesAreWritten)
+{
+    EXPECT_EQ(0, filter(entry(1, "first")));
+    EXPECT_EQ(0, filter(entry(2, "second")));
+    EXPECT_EQ(0, filter(entry(3, "first")));
+    EXPECT_THAT(written, IsEmpty());
+}
+
+TEST_F(RepeatTest, RepetitionsAreCountedAndWrittenWhenEntryChanges)
+{
+    EXPECT_EQ(0, filter(entry(1, "polling")));
+    EXPECT_EQ(1, filter(entry(2, "polling")));
+    EXPECT_EQ(1, filter(entry(3, "polling")));
+    EXPECT_EQ(1, filter(entry(4, "polling")));
+    EXPECT_THAT(written, IsEmpty());
+    EXPECT_EQ(0, filter(entry(5, "changed")));
+    EXPECT_THAT(written, ElementsAre("{\"ts\":4,\"crit\":\"ERROR\",\"msg\":\"polling\",\"repeated\":3}\n"));
+}
+
+TEST_F(RepeatTest, RepetitionsAreWrittenWhenTimeoutElapses)
+{
+    EXPECT_EQ(0, filter(entry(1, "polling"), 0));
+    EXPECT_EQ(1, filter(entry(2, "polling"), 100));
+    EXPECT_EQ(1, filter(entry(3, "polling"), 100 + timeout - 1));
+    EXPECT_THAT(written, IsEmpty());
+    EXPECT_EQ(1, filter(entry(4, "polling"), 100 + timeout));
+    EXPECT_THAT(written, ElementsAre("{\"ts\":4,\"crit\":\"ERROR\",\"msg\":\"polling\",\"repeated\":3}\n"));
+    EXPECT_EQ(1, filter(entry(5, "polling"), 100 + timeout + 1));
+    EXPECT_EQ(0, filter(entry(6, "changed"), 100 + timeout + 2));
+    EXPECT_THAT(written, ElementsAre(_, "{\"ts\":5,\"crit\":\"ERROR\",\"msg\":\"polling\",\"repeated\":1}\n"));
+}
+
+TEST_F(RepeatTest, FlushWritesCountedRepetitions)
+{
+    EXPECT_EQ(0, filter(entry(1, "polling")));
+    EXPECT_EQ(1, filter(entry(2, "polling")));
+    mdclog_internal_repeat_flush();
+    EXPECT_THAT(written, ElementsAre("{\"ts\":2,\"crit\":\"ERROR\",\"msg\":\"polling\",\"repeated\":1}\n"));
+    EXPECT_EQ(0, filter(entry(3, "polling")));
+}
+
+TEST_F(RepeatTest, RepetitionsAreWrittenWhenThreadExits)
+{
+    std::thread thread([this]()
+    {
+        EXPECT_EQ(0, filter(entry(1, "polling")));
+        EXPECT_EQ(1, filter(entry(2, "polling")));
+    });
+    thread.join();
+    EXPECT_THAT(written, ElementsAre("{\"ts\":2,\"crit\":\"ERROR\",\"msg\":\"polling\",\"repeated\":1}\n"));
+}
+
+TEST_F(RepeatTest, ThreadsHaveTheirOwnPreviousEntry)
+{
+    EXPECT_EQ(0, filter(entry(1, "polling")));
+    std::thread thread([this]() { EXPECT_EQ(0, filter(entry(2, "polling"))); });
+    thread.join();
+    EXPECT_EQ(1, filter(entry(3, "polling")));
+}
+
+TEST_F(RepeatTest, EntryWithoutRoomForCountIsWrittenWithoutIt)
+{
+    std::string longEntry = entry(1, std::string(PIPE_BUF - 40, 'a'));
+
+    ASSERT_LT(longEntry.length(), (size_t)PIPE_BUF);
+    EXPECT_EQ(0, filter(longEntry));
+    EXPECT_EQ(1, filter(longEntry));
+    mdclog_internal_repeat_flush();
+    EXPECT_THAT(written, ElementsAre(longEntry + "\n"));
+}
+
+TEST_F(RepeatTest, TimerThreadWritesRepetitionsWhenThreadStopsLogging)
+{
+    std::string polling = entry(1, "polling");
+    uint64_t    timeout_ns = 20000000;
+    size_t      count = 0;
+
+    ASSERT_EQ(0, mdclog_internal_repeat_timer_start());
+    EXPECT_EQ(0, mdclog_internal_repeat_filter(polling.c_str(), polling.length(), 1, polling.find(',') + 1,
+                                               timeout_ns, monotonicNs(), writeEntry));
+    EXPECT_EQ(1, mdclog_internal_repeat_filter(polling.c_str(), polling.length(), 1, polling.find(',') + 1,
+                                               timeout_ns, monotonicNs(), writeEntry));
+    for (int i = 0; i < 500 && count == 0; i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        std::lock_guard<std::mutex> guard(writtenMutex);
+        count = written.size();
+    }
+    mdclog_internal_repeat_flush_all();
+    EXPECT_THAT(written, ElementsAre("{\"ts\":1,\"crit\":\"ERROR\",\"msg\":\"polling\",\"repeated\":1}\n"));
+}
+
+TEST_F(RepeatTest, FlushAllWritesRepetitionsOfAllThreads)
+{
+    sem_t counted;
+    sem_t flushed;
+
+    sem_init(&counted, 0, 0);
+    sem_init(&flushed, 0, 0);
+    std::thread thread([this, &counted, &flushed]()
+    {
+        EXPECT_EQ(0, filter(entry(1, "other thread")));
+        EXPECT_EQ(1, filter(entry(2, "other thread")));
+        sem_post(&counted);
+        sem_wait(&flushed);
+        EXPECT_EQ(0, filter(entry(3, "other thread")));
+    });
+    EXPECT_EQ(0, filter(entry(1, "polling")));
+    EXPECT_EQ(1, filter(entry(2, "polling")));
+    sem_wait(&counted);
+    mdclog_internal_repeat_flush_all();
+    EXPECT_THAT(written, UnorderedElementsAre(
+                "{\"ts\":2,\"crit\":\"ERROR\",\"msg\":\"polling\",\"repeated\":1}\n",
+                "{\"ts\":2,\"crit\":\"ERROR\",\"msg\":\"other thread\",\"repeated\":1}\n"));
+    sem_post(&flushed);
+    thread.join();
+    EXPECT_EQ(2U, written.size());
+    sem_destroy(&counted);
+    sem_destroy(&flushed);
+}
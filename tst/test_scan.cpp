@@ -0,0 +1,209 @@
+/*
+ * Tests for the string scanning kernels
+ *
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ */
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <ctype.h>
+#include <random>
+#include <string>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "private/scan.h"
+#include "private/json_format.h"
+
+using namespace testing;
+
+/*
+ * The byte by byte implementations the kernels replaced, used as the reference.
+ * isprint() is evaluated in the "C" locale.
+ */
+namespace reference
+{
+    size_t escape(char* buffer, size_t len, const char* str, int* truncated)
+    {
+        size_t s, d;
+        size_t ret;
+        int    tmp_truncated = 0;
+
+        for (s = 0, d = 0; d < len - 1 && str[s] != '\0'; s++, d++)
+        {
+            if (str[s] == '\\' || str[s] == '"' )
+                buffer[d++] = '\\';
+            if (isprint(str[s]))
+                buffer[d] = str[s];
+            else
+                buffer[d] = ' ';
+        }
+        if (d == len)
+        {
+            buffer[len - 2] = '\0';
+            tmp_truncated = 1;
+            ret = len - 2;
+        }
+        else
+        {
+            buffer[d] = '\0';
+            if (str[s] != '\0')
+                tmp_truncated = 1;
+            ret = d;
+        }
+        if (truncated)
+            *truncated = tmp_truncated;
+        return ret;
+    }
+
+    size_t escapedSize(const char* str)
+    {
+        size_t i, len;
+
+        for (i = 0, len = 0; str[i] != '\0'; i++, len++)
+        {
+            if (str[i] == '\\' || str[i] == '"')
+                len++;
+        }
+        return len + 1;
+    }
+
+    int containsSpecialCharacters(const char* str)
+    {
+        for (int i = 0; str[i] != '\0'; i++)
+            if (!isprint(str[i]) || str[i] == '\\' || str[i] == '"')
+                return 1;
+        return 0;
+    }
+}
+
+typedef size_t (*FindSpecialFn)(const char* str, size_t len);
+
+class ScanTest: public testing::Test
+{
+public:
+    std::mt19937 random;
+    std::vector<std::pair<const char*, FindSpecialFn>> kernels;
+
+    void SetUp()
+    {
+        random.seed(12345);
+        kernels.emplace_back("dispatched", mdclog_internal_find_special);
+        kernels.emplace_back("scalar", mdclog_internal_find_special_scalar);
+#if defined(__x86_64__)
+        kernels.emplace_back("sse2", mdclog_internal_find_special_sse2);
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            kernels.emplace_back("avx2", mdclog_internal_find_special_avx2);
+#endif
+    }
+
+    /*
+     * Random printable string where roughly every special_ratio'th char is a special one.
+     * Contains no zero bytes.
+     */
+    std::string randomString(size_t len, unsigned special_ratio)
+    {
+        static const char special[] = { '\\', '"', '\n', '\t', 0x1f, 0x7f, (char)0x80, (char)0xc3, (char)0xff };
+        std::string str;
+
+        for (size_t i = 0; i < len; i++)
+        {
+            if (special_ratio && random() % special_ratio == 0)
+                str += special[random() % sizeof(special)];
+            else
+                str += (char)(' ' + random() % ('~' - ' ' + 1));
+        }
+        return str;
+    }
+};
+
+TEST_F(ScanTest, EveryByteValueIsClassifiedLikeIsprint)
+{
+    for (int c = 1; c < 256; c++)
+    {
+        char str[] = { (char)c, '\0' };
+        for (auto& kernel: kernels)
+            EXPECT_EQ(kernel.second(str, 1) == 0, (bool)reference::containsSpecialCharacters(str))
+                << kernel.first << " char " << c;
+    }
+}
+
+TEST_F(ScanTest, KernelsFindTheFirstSpecialCharacterAtEveryPosition)
+{
+    for (size_t len = 0; len < 100; len++)
+    {
+        for (size_t pos = 0; pos <= len; pos++)
+        {
+            std::string str(len, 'a');
+            if (pos < len)
+                str[pos] = '"';
+            for (auto& kernel: kernels)
+                EXPECT_EQ(pos, kernel.second(str.data(), len)) << kernel.first << " len " << len;
+        }
+    }
+}
+
+TEST_F(ScanTest, KernelsAgreeOnRandomStringsAndAlignments)
+{
+    for (int round = 0; round < 2000; round++)
+    {
+        std::string str = randomString(random() % 300, 1 + random() % 200);
+        size_t offset = str.empty() ? 0 : random() % str.length();
+        size_t expected = mdclog_internal_find_special_scalar(&str[offset], str.length() - offset);
+        for (auto& kernel: kernels)
+            ASSERT_EQ(expected, kernel.second(&str[offset], str.length() - offset)) << kernel.first << " " << str;
+    }
+}
+
+TEST_F(ScanTest, KernelsDoNotReadPastTheEndOfTheString)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    char* pages = static_cast<char*>(mmap(NULL, 2 * page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    ASSERT_NE(MAP_FAILED, pages);
+    ASSERT_EQ(0, mprotect(&pages[page], page, PROT_NONE));
+    memset(pages, 'a', page);
+
+    for (size_t len = 0; len < 100; len++)
+        for (auto& kernel: kernels)
+            EXPECT_EQ(len, kernel.second(&pages[page - len], len)) << kernel.first;
+    munmap(pages, 2 * page);
+}
+
+TEST_F(ScanTest, EscapeMatchesTheReferenceImplementation)
+{
+    char buffer[400];
+    char expected[400];
+
+    for (int round = 0; round < 5000; round++)
+    {
+        std::string str = randomString(random() % 300, 1 + random() % 50);
+        size_t len = 2 + random() % 350;
+        int truncated = -1;
+        int expected_truncated = -1;
+
+        size_t expected_len = reference::escape(expected, len, str.c_str(), &expected_truncated);
+        ASSERT_EQ(expected_len, mdclog_internal_escape(buffer, len, str.c_str(), &truncated)) << str << " " << len;
+        ASSERT_THAT(buffer, StrEq(expected)) << str << " " << len;
+        ASSERT_EQ(expected_truncated, truncated) << str << " " << len;
+        ASSERT_EQ(reference::escapedSize(str.c_str()), mdclog_internal_escaped_size(str.c_str())) << str;
+        ASSERT_EQ(reference::containsSpecialCharacters(str.c_str()),
+                  mdclog_internal_contains_special_characters(str.c_str())) << str;
+    }
+}
@@ -0,0 +1,367 @@
+/*
+ * Tests for the user sinks
+ *
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ */
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <atomic>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "mdclog/mdclog.h"
+#include "private/sink.h"
+#include "system_mock.hpp"
+
+using namespace testing;
+using namespace mdclogtest;
+
+extern "C" {
+void mdclog_lib_clean(void);
+}
+
+typedef std::vector<std::pair<std::string, std::string>> Mdcs;
+
+struct Received
+{
+    std::string       text;
+    mdclog_severity_t severity;
+    std::string       identity;
+    size_t            len;
+    Mdcs              mdcs;
+};
+
+static void collect_json(void *arg, const char *entry, size_t len)
+{
+    static_cast<std::vector<Received>*>(arg)->push_back({ std::string(entry), MDCLOG_FATAL, "", len, {} });
+}
+
+static void collect_record(void *arg, const mdclog_record_t *record)
+{
+    Received          received { std::string(record->message), record->severity, record->identity,
+                                 record->message_len, {} };
+    mdclog_mdc_iter_t iter;
+    const char       *key;
+    const char       *value;
+
+    mdclog_mdc_iter_init(&iter, record);
+    while (mdclog_mdc_iter_next(&iter, &key, &value))
+        received.mdcs.push_back({ key, value });
+    static_cast<std::vector<Received>*>(arg)->push_back(received);
+}
+
+class SinkTest: public testing::Test
+{
+public:
+    NiceMock<SystemMock>  systemMock;
+    std::vector<Received> received;
+
+    void SetUp()
+    {
+        setSystemMock(&systemMock);
+    }
+
+    void TearDown()
+    {
+        mdclog_lib_clean();
+        mdclog_mdc_clean();
+        mdclog_level_set(MDCLOG_ERR);
+    }
+
+    int addJsonSink(mdclog_severity_t level)
+    {
+        mdclog_sink_t sink = { MDCLOG_SINK_JSON, level, collect_json, NULL, &received };
+
+        return mdclog_sink_add(&sink);
+    }
+
+    int addRecordSink(mdclog_severity_t level)
+    {
+        mdclog_sink_t sink = { MDCLOG_SINK_RECORD, level, NULL, collect_record, &received };
+
+        return mdclog_sink_add(&sink);
+    }
+};
+
+TEST_F(SinkTest, JsonSinkGetsEntriesBelowTheOutputLevel)
+{
+    EXPECT_CALL(systemMock, write(STDOUT_FILENO, _, _))
+        .Times(0);
+    EXPECT_FALSE(mdclog_level_enabled(MDCLOG_INFO));
+    EXPECT_LT(0, addJsonSink(MDCLOG_INFO));
+    EXPECT_TRUE(mdclog_level_enabled(MDCLOG_INFO));
+    EXPECT_FALSE(mdclog_level_enabled(MDCLOG_DEBUG));
+    mdclog_write(MDCLOG_INFO, "info %d", 5);
+    MDCLOG_DEBUG_WRITE("debug");
+    ASSERT_EQ(1U, received.size());
+    EXPECT_THAT(received[0].text, AllOf(StartsWith("{"), HasSubstr("\"crit\":\"INFO\""),
+                                        EndsWith("\"msg\":\"info 5\"}")));
+    EXPECT_EQ(received[0].text.size(), received[0].len);
+}
+
+TEST_F(SinkTest, JsonSinkGetsTheEntryWrittenToTheOutput)
+{
+    std::string written;
+
+    EXPECT_CALL(systemMock, write(STDOUT_FILENO, _, _))
+        .WillOnce(Invoke([&written] (int, const void* buffer, size_t len)
+        {
+            written.assign(static_cast<const char*>(buffer), len);
+            return len;
+        }));
+    EXPECT_LT(0, addJsonSink(MDCLOG_ERR));
+    mdclog_write(MDCLOG_ERR, "error \"%s\"", "quoted");
+    ASSERT_EQ(1U, received.size());
+    EXPECT_EQ(received[0].text + "\n", written);
+    EXPECT_THAT(received[0].text, EndsWith("\"msg\":\"error \\\"quoted\\\"\"}"));
+}
+
+TEST_F(SinkTest, RecordSinkGetsTheMessageWithoutEscaping)
+{
+    EXPECT_LT(0, addRecordSink(MDCLOG_DEBUG));
+    mdclog_write(MDCLOG_DEBUG, "debug \"%s\"\t%d", "quoted", 7);
+    ASSERT_EQ(1U, received.size());
+    EXPECT_EQ("debug \"quoted\"\t7", received[0].text);
+    EXPECT_EQ(received[0].text.size(), received[0].len);
+    EXPECT_EQ(MDCLOG_DEBUG, received[0].severity);
+    EXPECT_FALSE(received[0].identity.empty());
+    EXPECT_TRUE(received[0].mdcs.empty());
+}
+
+TEST_F(SinkTest, RecordSinkGetsTheMdcsOfTheThread)
+{
+    EXPECT_EQ(0, mdclog_mdc_add("first", "1"));
+    EXPECT_EQ(0, mdclog_mdc_add("second", "2"));
+    EXPECT_LT(0, addRecordSink(MDCLOG_ERR));
+    mdclog_write(MDCLOG_ERR, "error");
+    ASSERT_EQ(1U, received.size());
+    EXPECT_THAT(received[0].mdcs, UnorderedElementsAre(std::make_pair(std::string("first"), std::string("1")),
+                                                       std::make_pair(std::string("second"), std::string("2"))));
+}
+
+TEST_F(SinkTest, OverriddenGlobalMdcIsIteratedWithTheThreadMdcs)
+{
+    setenv("POD_NAME", "mypod", 1);
+    EXPECT_EQ(0, mdclog_format_initialize(0));
+    unsetenv("POD_NAME");
+    EXPECT_EQ(0, mdclog_mdc_add("POD_NAME", "override"));
+    EXPECT_EQ(0, mdclog_mdc_add("thread", "mdc"));
+    EXPECT_LT(0, addRecordSink(MDCLOG_ERR));
+    mdclog_write(MDCLOG_ERR, "error");
+    ASSERT_EQ(1U, received.size());
+    const auto &mdcs = received[0].mdcs;
+    ASSERT_LT(2U, mdcs.size());
+    EXPECT_THAT(Mdcs(mdcs.end() - 2, mdcs.end()),
+                UnorderedElementsAre(std::make_pair(std::string("POD_NAME"), std::string("override")),
+                                     std::make_pair(std::string("thread"), std::string("mdc"))));
+    for (auto it = mdcs.begin(); it != mdcs.end() - 2; it++)
+        EXPECT_NE("POD_NAME", it->first);
+}
+
+TEST_F(SinkTest, LongMessageIsPassedUpToTheMaximumEntrySize)
+{
+    mdclog_attr_t *attr;
+    std::string    message(3 * PIPE_BUF, 'x');
+
+    ASSERT_EQ(0, mdclog_attr_init(&attr));
+    EXPECT_EQ(0, mdclog_attr_set_max_entry_size(attr, 8 * PIPE_BUF));
+    EXPECT_EQ(0, mdclog_init(attr));
+    mdclog_attr_destroy(attr);
+    EXPECT_LT(0, addRecordSink(MDCLOG_ERR));
+    EXPECT_LT(0, addJsonSink(MDCLOG_ERR));
+    mdclog_write(MDCLOG_ERR, "%s", message.c_str());
+    mdclog_write(MDCLOG_ERR, "%s%s%s", message.c_str(), message.c_str(), message.c_str());
+    ASSERT_EQ(4U, received.size());
+    EXPECT_EQ(message, received[0].text);
+    EXPECT_THAT(received[1].text, EndsWith("\"msg\":\"" + message + "\"}"));
+    EXPECT_EQ((size_t)8 * PIPE_BUF - 1, received[2].len);
+    EXPECT_EQ(received[2].len, received[2].text.size());
+    EXPECT_GE((size_t)8 * PIPE_BUF - 1, received[3].len);
+}
+
+TEST_F(SinkTest, ErrnoIsKeptForTheOutput)
+{
+    std::string written;
+
+    EXPECT_CALL(systemMock, write(STDOUT_FILENO, _, _))
+        .WillOnce(Invoke([&written] (int, const void* buffer, size_t len)
+        {
+            written.assign(static_cast<const char*>(buffer), len);
+            return len;
+        }));
+    EXPECT_LT(0, addRecordSink(MDCLOG_ERR));
+    EXPECT_LT(0, addJsonSink(MDCLOG_ERR));
+    errno = ENOENT;
+    mdclog_write(MDCLOG_ERR, "failed: %m");
+    ASSERT_EQ(2U, received.size());
+    EXPECT_EQ(std::string("failed: ") + strerror(ENOENT), received[0].text);
+    EXPECT_THAT(received[1].text, HasSubstr(strerror(ENOENT)));
+    EXPECT_THAT(written, HasSubstr(strerror(ENOENT)));
+}
+
+TEST_F(SinkTest, CurrentLevelIncludesConcurrentChanges)
+{
+    for (int i = 0; i < 200; i++)
+    {
+        int id = 0;
+        std::thread adder([this, &id]() { id = addRecordSink(MDCLOG_DEBUG); });
+        std::thread setter([]() { mdclog_level_set(MDCLOG_INFO); });
+
+        adder.join();
+        setter.join();
+        ASSERT_TRUE(mdclog_level_enabled(MDCLOG_DEBUG));
+        EXPECT_EQ(0, mdclog_sink_remove(id));
+        EXPECT_FALSE(mdclog_level_enabled(MDCLOG_DEBUG));
+        EXPECT_TRUE(mdclog_level_enabled(MDCLOG_INFO));
+        mdclog_level_set(MDCLOG_ERR);
+    }
+}
+
+TEST_F(SinkTest, RecordOfPreformattedMessageHasNoFields)
+{
+    mdclog_kv_t        unset = mdclog_kv_int64("unset", 0);
+    const mdclog_kv_t* fields = &unset;
+    mdclog_sink_t      sink = { MDCLOG_SINK_RECORD, MDCLOG_ERR, NULL,
+                                [](void* arg, const mdclog_record_t* record)
+                                {
+                                    *static_cast<const mdclog_kv_t**>(arg) = record->fields;
+                                },
+                                &fields };
+
+    EXPECT_LT(0, mdclog_sink_add(&sink));
+    mdclog_write_formatted(MDCLOG_ERR, "value {}", "value 100%");
+    EXPECT_EQ(nullptr, fields);
+}
+
+TEST_F(SinkTest, SinksAreCalledInTheOrderTheyWereAdded)
+{
+    EXPECT_LT(0, addRecordSink(MDCLOG_ERR));
+    EXPECT_LT(0, addJsonSink(MDCLOG_ERR));
+    EXPECT_LT(0, addRecordSink(MDCLOG_ERR));
+    mdclog_write(MDCLOG_ERR, "error");
+    ASSERT_EQ(3U, received.size());
+    EXPECT_EQ("error", received[0].text);
+    EXPECT_EQ("error", received[1].text);
+    EXPECT_THAT(received[2].text, EndsWith("\"msg\":\"error\"}"));
+}
+
+TEST_F(SinkTest, RemovedSinkIsNotCalled)
+{
+    int first = addJsonSink(MDCLOG_DEBUG);
+    int second = addRecordSink(MDCLOG_INFO);
+
+    EXPECT_NE(first, second);
+    EXPECT_EQ(0, mdclog_sink_remove(first));
+    EXPECT_TRUE(mdclog_level_enabled(MDCLOG_INFO));
+    EXPECT_FALSE(mdclog_level_enabled(MDCLOG_DEBUG));
+    mdclog_write(MDCLOG_INFO, "info");
+    EXPECT_EQ(0, mdclog_sink_remove(second));
+    EXPECT_FALSE(mdclog_level_enabled(MDCLOG_INFO));
+    mdclog_write(MDCLOG_ERR, "error");
+    ASSERT_EQ(1U, received.size());
+    EXPECT_EQ("info", received[0].text);
+    EXPECT_EQ(-1, mdclog_sink_remove(second));
+    EXPECT_EQ(ENOENT, errno);
+}
+
+TEST_F(SinkTest, SinksAreRemovedByCleaning)
+{
+    EXPECT_LT(0, addJsonSink(MDCLOG_DEBUG));
+    mdclog_lib_clean();
+    EXPECT_FALSE(mdclog_level_enabled(MDCLOG_DEBUG));
+    mdclog_write(MDCLOG_ERR, "error");
+    EXPECT_TRUE(received.empty());
+}
+
+TEST_F(SinkTest, EntriesWrittenBySinkAreDiscarded)
+{
+    mdclog_sink_t sink = { MDCLOG_SINK_JSON, MDCLOG_ERR,
+                           [] (void *arg, const char *, size_t)
+                           {
+                               (*static_cast<int*>(arg))++;
+                               mdclog_write(MDCLOG_ERR, "from sink");
+                           },
+                           NULL, NULL };
+    int           calls = 0;
+
+    sink.arg = &calls;
+    EXPECT_CALL(systemMock, write(STDOUT_FILENO, _, _))
+        .WillOnce(Invoke([] (int, const void* buffer, size_t len)
+        {
+            EXPECT_THAT(std::string(static_cast<const char*>(buffer), len), HasSubstr("\"msg\":\"error\""));
+            return len;
+        }));
+    EXPECT_LT(0, mdclog_sink_add(&sink));
+    mdclog_write(MDCLOG_ERR, "error");
+    EXPECT_EQ(1, calls);
+}
+
+TEST_F(SinkTest, InvalidSinksAreNotAccepted)
+{
+    mdclog_sink_t sink = { MDCLOG_SINK_JSON, MDCLOG_ERR, collect_json, NULL, &received };
+
+    EXPECT_EQ(-1, mdclog_sink_add(NULL));
+    EXPECT_EQ(EINVAL, errno);
+    sink.level = (mdclog_severity_t)6;
+    EXPECT_EQ(-1, mdclog_sink_add(&sink));
+    EXPECT_EQ(EINVAL, errno);
+    sink.level = MDCLOG_ERR;
+    sink.format = MDCLOG_SINK_RECORD;
+    EXPECT_EQ(-1, mdclog_sink_add(&sink));
+    EXPECT_EQ(EINVAL, errno);
+    sink.format = (mdclog_sink_format_t)2;
+    EXPECT_EQ(-1, mdclog_sink_add(&sink));
+    EXPECT_EQ(EINVAL, errno);
+    EXPECT_FALSE(mdclog_level_enabled(MDCLOG_WARN));
+}
+
+TEST_F(SinkTest, SinkIsNotCalledAfterRemovingItWhileOthersWrite)
+{
+    std::atomic<int>  calls(0);
+    std::atomic<bool> stop(false);
+    mdclog_sink_t     sink = { MDCLOG_SINK_JSON, MDCLOG_DEBUG,
+                               [] (void *arg, const char *, size_t)
+                               {
+                                   (*static_cast<std::atomic<int>*>(arg))++;
+                               },
+                               NULL, &calls };
+    std::thread       writer([&stop] ()
+    {
+        while (!stop)
+            mdclog_write(MDCLOG_DEBUG, "debug");
+    });
+    int               id = mdclog_sink_add(&sink);
+    int               after;
+
+    EXPECT_LT(0, id);
+    while (calls < 100)
+        std::this_thread::yield();
+    EXPECT_EQ(0, mdclog_sink_remove(id));
+    after = calls;
+    usleep(10000);
+    stop = true;
+    writer.join();
+    EXPECT_EQ(after, calls);
+}
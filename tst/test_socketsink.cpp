@@ -0,0 +1,422 @@
+/*
+ * Tests for the unix domain socket sink
+ *
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ */
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "private/filesink.h"
+#include "private/socketsink.h"
+#include "mdclog/mdclog.h"
+#include "system_mock.hpp"
+
+using namespace testing;
+using namespace mdclogtest;
+
+extern "C" {
+void mdclog_lib_clean(void);
+}
+
+/*
+ * Local stand-in for the log collector
+ */
+class Collector
+{
+public:
+    Collector(const std::string& path, mdclog_socket_type_t type): type(type)
+    {
+        struct sockaddr_un address = {};
+
+        address.sun_family = AF_UNIX;
+        strcpy(address.sun_path, path.c_str());
+        listener = socket(AF_UNIX, type == MDCLOG_SOCKET_SEQPACKET ? SOCK_SEQPACKET : SOCK_STREAM, 0);
+        EXPECT_EQ(0, bind(listener, (struct sockaddr*)&address, sizeof(address)));
+        EXPECT_EQ(0, listen(listener, 4));
+    }
+
+    ~Collector()
+    {
+        if (connection >= 0)
+            close(connection);
+        close(listener);
+    }
+
+    bool accept()
+    {
+        struct pollfd pfd = { listener, POLLIN, 0 };
+
+        if (poll(&pfd, 1, 5000) != 1)
+            return false;
+        connection = ::accept(listener, NULL, NULL);
+        return connection >= 0;
+    }
+
+    void disconnect()
+    {
+        close(connection);
+        connection = -1;
+    }
+
+    /*
+     * Receive data, one message at a time for a seqpacket socket
+     */
+    bool receive(int timeout_ms)
+    {
+        struct pollfd pfd = { connection, POLLIN, 0 };
+        char buffer[256 * 1024];
+        ssize_t n;
+
+        if (poll(&pfd, 1, timeout_ms) != 1)
+            return false;
+        n = recv(connection, buffer, sizeof(buffer), 0);
+        if (n <= 0)
+            return false;
+        data.append(buffer, (size_t)n);
+        messages++;
+        return true;
+    }
+
+    /*
+     * Receive until the given number of frames have arrived
+     */
+    std::vector<std::string> frames(size_t count)
+    {
+        while (parse().size() < count && receive(5000))
+            ;
+        return parse();
+    }
+
+    std::vector<std::string> parse()
+    {
+        std::vector<std::string> result;
+        size_t offset = 0;
+
+        while (offset + SOCKET_FRAME_HEADER_LENGTH <= data.size())
+        {
+            const unsigned char* p = (const unsigned char*)&data[offset];
+            size_t len = (size_t)p[0] << 24 | (size_t)p[1] << 16 | (size_t)p[2] << 8 | p[3];
+
+            if (offset + SOCKET_FRAME_HEADER_LENGTH + len > data.size())
+                break;
+            result.push_back(data.substr(offset + SOCKET_FRAME_HEADER_LENGTH, len));
+            offset += SOCKET_FRAME_HEADER_LENGTH + len;
+        }
+        return result;
+    }
+
+    mdclog_socket_type_t type;
+    int listener = -1;
+    int connection = -1;
+    std::string data;
+    int messages = 0;
+};
+
+class SocketSinkTest: public testing::Test
+{
+public:
+    NiceMock<SystemMock> systemMock;
+    std::string dir;
+    std::string path;
+    struct socket_sink_config config;
+    std::mutex mutex;
+    std::string fallback;
+
+    void SetUp()
+    {
+        char name[] = "/tmp/mdclog_socket_XXXXXX";
+
+        ASSERT_NE(nullptr, mkdtemp(name));
+        dir = name;
+        path = dir + "/collector.sock";
+        config = {};
+        config.type = MDCLOG_SOCKET_SEQPACKET;
+        config.batch_size = MDCLOG_DEFAULT_SOCKET_BATCH_SIZE;
+        config.flush_interval_ms = 10000;
+        config.lines = 1;
+        setSystemMock(&systemMock);
+        ON_CALL(systemMock, write(STDOUT_FILENO, NotNull(), _))
+            .WillByDefault(Invoke([this] (int, const void* buffer, size_t len)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                fallback.append((const char*)buffer, len);
+                return (ssize_t)len;
+            }));
+    }
+
+    void TearDown()
+    {
+        mdclog_internal_socket_sink_set(NULL);
+        mdclog_lib_clean();
+        unlink(path.c_str());
+        rmdir(dir.c_str());
+    }
+
+    void open()
+    {
+        struct socket_sink* sink = mdclog_internal_socket_sink_open(path.c_str(), &config);
+
+        ASSERT_NE(nullptr, sink);
+        mdclog_internal_socket_sink_set(sink);
+    }
+
+    void write(const std::string& data)
+    {
+        EXPECT_EQ((ssize_t)data.size(), mdclog_internal_output_write(data.data(), data.size()));
+    }
+
+    std::string getFallback()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return fallback;
+    }
+
+    bool waitConnected(bool connected)
+    {
+        for (int i = 0; i < 500; i++)
+        {
+            if ((mdclog_internal_socket_sink_connected() != 0) == connected)
+                return true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return false;
+    }
+};
+
+TEST_F(SocketSinkTest, EntriesAreFramedAndSentInOneBatch)
+{
+    Collector collector(path, MDCLOG_SOCKET_SEQPACKET);
+
+    open();
+    ASSERT_TRUE(collector.accept());
+    EXPECT_TRUE(mdclog_internal_socket_sink_connected());
+    for (int i = 0; i < 5; i++)
+        write("entry " + std::to_string(i) + "\n");
+    // the batch is sent when the sink is closed, before the flush interval
+    mdclog_internal_socket_sink_set(NULL);
+    EXPECT_THAT(collector.frames(5), ElementsAre("entry 0", "entry 1", "entry 2", "entry 3", "entry 4"));
+    EXPECT_EQ(1, collector.messages);
+    EXPECT_EQ("", getFallback());
+}
+
+TEST_F(SocketSinkTest, PartialBatchIsSentAfterFlushInterval)
+{
+    Collector collector(path, MDCLOG_SOCKET_SEQPACKET);
+
+    config.flush_interval_ms = 20;
+    open();
+    ASSERT_TRUE(collector.accept());
+    write("alone\n");
+    EXPECT_TRUE(collector.receive(5000));
+    EXPECT_THAT(collector.parse(), ElementsAre("alone"));
+}
+
+TEST_F(SocketSinkTest, FullBatchIsSentAsOneMessage)
+{
+    Collector collector(path, MDCLOG_SOCKET_SEQPACKET);
+    std::string entry(1000, 'x');
+
+    config.batch_size = 4096;
+    open();
+    ASSERT_TRUE(collector.accept());
+    for (int i = 0; i < 20; i++)
+        write(entry + "\n");
+    mdclog_internal_socket_sink_set(NULL);
+    EXPECT_EQ(20U, collector.frames(20).size());
+    EXPECT_GE(collector.messages, 5);
+    EXPECT_LT(collector.messages, 20);
+}
+
+TEST_F(SocketSinkTest, StreamSocketReceivesEveryLineAsFrame)
+{
+    Collector collector(path, MDCLOG_SOCKET_STREAM);
+
+    config.type = MDCLOG_SOCKET_STREAM;
+    open();
+    ASSERT_TRUE(collector.accept());
+    write("a\nbb\n");
+    write("no newline");
+    write("\n");
+    mdclog_internal_socket_sink_set(NULL);
+    EXPECT_THAT(collector.frames(4), ElementsAre("a", "bb", "no newline", ""));
+}
+
+TEST_F(SocketSinkTest, EveryWriteIsFrameWithoutLines)
+{
+    Collector collector(path, MDCLOG_SOCKET_STREAM);
+
+    config.type = MDCLOG_SOCKET_STREAM;
+    config.lines = 0;
+    open();
+    ASSERT_TRUE(collector.accept());
+    write(std::string("bin\nary\0", 8));
+    write("second");
+    mdclog_internal_socket_sink_set(NULL);
+    EXPECT_THAT(collector.frames(2), ElementsAre(std::string("bin\nary\0", 8), "second"));
+}
+
+TEST_F(SocketSinkTest, EntryLongerThanTheQueueIsSent)
+{
+    Collector collector(path, MDCLOG_SOCKET_STREAM);
+    std::string entry(100000, 'y');
+
+    config.type = MDCLOG_SOCKET_STREAM;
+    config.batch_size = 1024;
+    open();
+    ASSERT_TRUE(collector.accept());
+    write("short\n");
+    write(entry + "\n");
+    mdclog_internal_socket_sink_set(NULL);
+    EXPECT_THAT(collector.frames(2), ElementsAre("short", entry));
+}
+
+TEST_F(SocketSinkTest, EntriesAreWrittenToStandardOutWithoutCollector)
+{
+    open();
+    EXPECT_FALSE(mdclog_internal_socket_sink_connected());
+    write("first\n");
+    write("second\n");
+    EXPECT_EQ("first\nsecond\n", getFallback());
+    errno = 0;
+    EXPECT_EQ(-1, mdclog_internal_socket_sink_write("x\n", 2));
+    EXPECT_EQ(ENOTCONN, errno);
+}
+
+TEST_F(SocketSinkTest, SinkConnectsWhenCollectorStartsListening)
+{
+    open();
+    EXPECT_FALSE(mdclog_internal_socket_sink_connected());
+
+    Collector collector(path, MDCLOG_SOCKET_SEQPACKET);
+    unsigned long generation = mdclog_internal_output_generation();
+    ASSERT_TRUE(waitConnected(true));
+    EXPECT_NE(generation, mdclog_internal_output_generation());
+    ASSERT_TRUE(collector.accept());
+    write("connected\n");
+    mdclog_internal_socket_sink_set(NULL);
+    EXPECT_THAT(collector.frames(1), ElementsAre("connected"));
+}
+
+TEST_F(SocketSinkTest, EntriesAreWrittenToStandardOutAfterConnectionBreaks)
+{
+    std::unique_ptr<Collector> collector(new Collector(path, MDCLOG_SOCKET_SEQPACKET));
+
+    config.flush_interval_ms = 0;
+    open();
+    ASSERT_TRUE(collector->accept());
+    collector.reset();
+    unlink(path.c_str());
+    // the sender notices the broken connection when sending
+    write("lost connection\n");
+    ASSERT_TRUE(waitConnected(false));
+    write("while down\n");
+    EXPECT_EQ("lost connection\nwhile down\n", getFallback());
+
+    collector.reset(new Collector(path, MDCLOG_SOCKET_SEQPACKET));
+    ASSERT_TRUE(waitConnected(true));
+    ASSERT_TRUE(collector->accept());
+    write("reconnected\n");
+    EXPECT_THAT(collector->frames(1), ElementsAre("reconnected"));
+}
+
+TEST_F(SocketSinkTest, FramesSentBeforeTheStreamBreaksAreNotWrittenToStandardOut)
+{
+    Collector collector(path, MDCLOG_SOCKET_STREAM);
+    std::vector<std::string> frames;
+    std::string lines;
+    std::string expected;
+    char line[128];
+
+    config.type = MDCLOG_SOCKET_STREAM;
+    config.batch_size = 1024;
+    config.flush_interval_ms = 0;
+    open();
+    ASSERT_TRUE(collector.accept());
+    // more than fits to the socket buffer of a collector that does not read
+    for (int i = 0; i < 10000; i++)
+    {
+        snprintf(line, sizeof(line), "%05d %090d\n", i, 0);
+        lines += line;
+    }
+    write(lines);
+    for (int i = 0; i < 500 && getFallback().find("09999 ") == std::string::npos; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    while (collector.receive(1000))
+        ;
+    frames = collector.parse();
+    ASSERT_FALSE(frames.empty());
+    ASSERT_LT(frames.size(), 10000U);
+    for (size_t i = 0; i < frames.size(); i++)
+        EXPECT_EQ(lines.substr(i * 97, 96), frames[i]);
+    // the frame the collector got partly is written to standard out whole
+    EXPECT_EQ(lines.substr(frames.size() * 97), getFallback());
+}
+
+TEST_F(SocketSinkTest, LogEntriesAreSentToTheSocket)
+{
+    Collector collector(path, MDCLOG_SOCKET_STREAM);
+    mdclog_attr_t* attr;
+
+    ASSERT_EQ(0, mdclog_attr_init(&attr));
+    ASSERT_EQ(0, mdclog_attr_set_ident(attr, "socket"));
+    ASSERT_EQ(0, mdclog_attr_set_socket(attr, path.c_str(), MDCLOG_SOCKET_STREAM));
+    ASSERT_EQ(0, mdclog_attr_set_socket_batching(attr, 0, 0));
+    ASSERT_EQ(0, mdclog_init(attr));
+    mdclog_attr_destroy(attr);
+    ASSERT_TRUE(collector.accept());
+    mdclog_write(MDCLOG_ERR, "sent to the %s", "collector");
+    mdclog_lib_clean();
+    std::vector<std::string> frames = collector.frames(1);
+    ASSERT_EQ(1U, frames.size());
+    EXPECT_THAT(frames[0], StartsWith("{"));
+    EXPECT_THAT(frames[0], EndsWith("\"id\":\"socket\",\"mdc\":{},\"msg\":\"sent to the collector\"}"));
+    EXPECT_EQ("", getFallback());
+}
+
+TEST_F(SocketSinkTest, InvalidSocketAttributesAreNotAccepted)
+{
+    mdclog_attr_t* attr;
+    std::string long_path(sizeof(((struct sockaddr_un*)0)->sun_path), 'p');
+
+    ASSERT_EQ(0, mdclog_attr_init(&attr));
+    EXPECT_EQ(-1, mdclog_attr_set_socket(NULL, "x.sock", MDCLOG_SOCKET_STREAM));
+    EXPECT_EQ(EINVAL, errno);
+    EXPECT_EQ(-1, mdclog_attr_set_socket(attr, "", MDCLOG_SOCKET_STREAM));
+    EXPECT_EQ(-1, mdclog_attr_set_socket(attr, long_path.c_str(), MDCLOG_SOCKET_STREAM));
+    EXPECT_EQ(-1, mdclog_attr_set_socket(attr, "x.sock", static_cast<mdclog_socket_type_t>(2)));
+    EXPECT_EQ(0, mdclog_attr_set_socket(attr, NULL, MDCLOG_SOCKET_STREAM));
+    EXPECT_EQ(-1, mdclog_attr_set_socket_batching(NULL, 0, 0));
+    EXPECT_EQ(-1, mdclog_attr_set_socket_batching(attr, MDCLOG_MAX_SOCKET_BATCH_SIZE + 1, 0));
+    EXPECT_EQ(0, mdclog_attr_set_socket_batching(attr, MDCLOG_MAX_SOCKET_BATCH_SIZE, 100));
+    mdclog_attr_destroy(attr);
+}
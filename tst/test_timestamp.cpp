@@ -0,0 +1,258 @@
+/*
+ * Tests for the clock sources and timestamp rendering
+ *
+ *  Copyright (c) 2019 AT&T Intellectual Property.
+ *  Copyright (c) 2018-2019 Nokia.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This source code is part of the near-RT RIC (RAN Intelligent Controller)
+ *  platform project (RICP).
+ */
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <sys/time.h>
+#include <thread>
+#include <time.h>
+
+#include "private/timestamp.h"
+
+using namespace testing;
+
+static int64_t toMs(const struct timeval& tv)
+{
+    return (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static int64_t nowMs()
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return toMs(tv);
+}
+
+static std::string epochMs(const struct timeval& tv)
+{
+    char buffer[32];
+
+    snprintf(buffer, sizeof(buffer), "%llu", (unsigned long long)toMs(tv));
+    return buffer;
+}
+
+static std::string rfc3339(const struct timeval& tv)
+{
+    char      buffer[64];
+    char      ms[8];
+    struct tm tm;
+
+    gmtime_r(&tv.tv_sec, &tm);
+    strftime(buffer, sizeof(buffer), "\"%Y-%m-%dT%H:%M:%S", &tm);
+    snprintf(ms, sizeof(ms), ".%03dZ\"", (int)(tv.tv_usec / 1000));
+    return std::string(buffer) + ms;
+}
+
+TEST(RenderDecimalTest, DecimalsAreRenderedLikeSnprintf)
+{
+    const uint64_t values[] = { 0, 1, 9, 10, 11, 99, 100, 101, 999, 1000, 12345, 1550667066,
+                                1550667066123ULL, 9999999999999ULL, UINT64_MAX / 10, UINT64_MAX - 1,
+                                UINT64_MAX };
+    char           buffer[DECIMAL_MAX_LENGTH];
+    char           expected[32];
+    size_t         len;
+
+    for (auto value: values)
+    {
+        snprintf(expected, sizeof(expected), "%llu", (unsigned long long)value);
+        len = mdclog_internal_render_decimal(buffer, value);
+        EXPECT_EQ(std::string(expected), std::string(buffer, len));
+    }
+}
+
+TEST(RenderDecimalTest, PowersOfTenAndTheirNeighboursAreRenderedLikeSnprintf)
+{
+    char     buffer[DECIMAL_MAX_LENGTH];
+    char     expected[32];
+    size_t   len;
+    uint64_t power = 1;
+
+    for (int i = 0; i < 19; i++, power *= 10)
+    {
+        for (uint64_t value: { power - 1, power, power + 1 })
+        {
+            snprintf(expected, sizeof(expected), "%llu", (unsigned long long)value);
+            len = mdclog_internal_render_decimal(buffer, value);
+            EXPECT_EQ(std::string(expected), std::string(buffer, len));
+        }
+    }
+}
+
+class RenderTimestampTest: public testing::Test
+{
+public:
+    char                      buffer[64];
+    mdclog_timestamp_format_t format = MDCLOG_TIMESTAMP_EPOCH_MS;
+
+    std::string render(const struct timeval& tv)
+    {
+        size_t len = mdclog_internal_render_timestamp(buffer, sizeof(buffer), &tv, format);
+
+        EXPECT_EQ(strlen(buffer), len);
+        return std::string(buffer, len);
+    }
+};
+
+TEST_F(RenderTimestampTest, EpochMillisecondsAreRenderedAcrossSecondBoundaries)
+{
+    struct timeval tv = { 1550667065, 0 };
+
+    // consecutive calls within a second reuse the cached digits of the second
+    for (int i = 0; i < 3000; i++)
+    {
+        tv.tv_sec = 1550667065 + i / 1000;
+        tv.tv_usec = (i % 1000) * 1000 + 999;
+        EXPECT_EQ(epochMs(tv), render(tv));
+    }
+}
+
+TEST_F(RenderTimestampTest, EpochMillisecondsAreRenderedWhenTheSecondChangesBackAndForth)
+{
+    struct timeval tv1 = { 1550667066, 5000 };
+    struct timeval tv2 = { 999999999, 120000 };
+    struct timeval tv3 = { 10000000000LL, 1000 };
+
+    for (int i = 0; i < 3; i++)
+    {
+        EXPECT_EQ(epochMs(tv1), render(tv1));
+        EXPECT_EQ(epochMs(tv2), render(tv2));
+        EXPECT_EQ(epochMs(tv3), render(tv3));
+    }
+}
+
+TEST_F(RenderTimestampTest, EpochMillisecondsWithinTheFirstSecondHaveNoLeadingZeros)
+{
+    struct timeval tv = { 0, 0 };
+
+    EXPECT_EQ("0", render(tv));
+    tv.tv_usec = 7000;
+    EXPECT_EQ("7", render(tv));
+    tv.tv_usec = 123456;
+    EXPECT_EQ("123", render(tv));
+    tv.tv_sec = 1;
+    EXPECT_EQ("1123", render(tv));
+}
+
+TEST_F(RenderTimestampTest, Rfc3339IsRenderedAcrossSecondBoundaries)
+{
+    struct timeval tv = { 1550667065, 0 };
+
+    format = MDCLOG_TIMESTAMP_RFC3339;
+    for (int i = 0; i < 3000; i += 7)
+    {
+        tv.tv_sec = 1550667065 + i / 1000;
+        tv.tv_usec = (i % 1000) * 1000;
+        EXPECT_EQ(rfc3339(tv), render(tv));
+    }
+}
+
+TEST_F(RenderTimestampTest, Rfc3339IsRenderedInUtc)
+{
+    struct timeval tv = { 1550667066, 123456 };
+
+    format = MDCLOG_TIMESTAMP_RFC3339;
+    EXPECT_EQ("\"2019-02-20T12:51:06.123Z\"", render(tv));
+    tv = { 0, 0 };
+    EXPECT_EQ("\"1970-01-01T00:00:00.000Z\"", render(tv));
+    tv = { 951825599, 999999 };
+    EXPECT_EQ("\"2000-02-29T11:59:59.999Z\"", render(tv));
+}
+
+TEST_F(RenderTimestampTest, TimestampCannotBeRenderedToTooShortBuffer)
+{
+    struct timeval tv = { 1550667066, 123456 };
+
+    EXPECT_EQ(0U, mdclog_internal_render_timestamp(buffer, strlen("1550667066123"), &tv, format));
+    EXPECT_EQ(13U, mdclog_internal_render_timestamp(buffer, strlen("1550667066123") + 1, &tv, format));
+    format = MDCLOG_TIMESTAMP_RFC3339;
+    EXPECT_EQ(0U, mdclog_internal_render_timestamp(buffer, strlen("\"2019-02-20T12:51:06.123Z\""), &tv, format));
+    EXPECT_EQ(26U, mdclog_internal_render_timestamp(buffer, strlen("\"2019-02-20T12:51:06.123Z\"") + 1, &tv, format));
+}
+
+TEST_F(RenderTimestampTest, EveryThreadHasItsOwnCache)
+{
+    struct timeval tv1 = { 1550667066, 1000 };
+    struct timeval tv2 = { 1600000000, 2000 };
+    std::string    other;
+
+    EXPECT_EQ(epochMs(tv1), render(tv1));
+    std::thread thread([&]()
+        {
+            char   buffer[64];
+            size_t len = mdclog_internal_render_timestamp(buffer, sizeof(buffer), &tv2, format);
+
+            other = std::string(buffer, len);
+        });
+    thread.join();
+    EXPECT_EQ(epochMs(tv2), other);
+    tv1.tv_usec = 999000;
+    EXPECT_EQ(epochMs(tv1), render(tv1));
+}
+
+class ClockTest: public TestWithParam<mdclog_clock_t>
+{
+};
+
+TEST_P(ClockTest, ClockIsCloseToTheRealtimeClock)
+{
+    struct timeval tv;
+    int64_t        before, after;
+
+    for (int i = 0; i < 20; i++)
+    {
+        before = nowMs();
+        mdclog_internal_clock_read(GetParam(), &tv);
+        after = nowMs();
+        // the coarse clock may lag by a kernel tick, the time stamp counter by the calibration drift
+        EXPECT_GE(toMs(tv), before - 50);
+        EXPECT_LE(toMs(tv), after + 50);
+        EXPECT_GE(tv.tv_usec, 0);
+        EXPECT_LT(tv.tv_usec, 1000000);
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(Clocks, ClockTest,
+                         Values(MDCLOG_CLOCK_REALTIME, MDCLOG_CLOCK_REALTIME_COARSE, MDCLOG_CLOCK_TSC));
+
+TEST(TscClockTest, TscClockAdvancesAfterCalibration)
+{
+    struct timeval tv1, tv2;
+
+    if (!mdclog_internal_tsc_available())
+        GTEST_SKIP() << "no invariant time stamp counter";
+    // the first calibration is measured over at least 10 milliseconds
+    for (int i = 0; i < 3; i++)
+    {
+        mdclog_internal_clock_read(MDCLOG_CLOCK_TSC, &tv1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    mdclog_internal_clock_read(MDCLOG_CLOCK_TSC, &tv1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    mdclog_internal_clock_read(MDCLOG_CLOCK_TSC, &tv2);
+    EXPECT_GE(toMs(tv2) - toMs(tv1), 90);
+    EXPECT_LE(toMs(tv2) - toMs(tv1), 200);
+}